@@ -0,0 +1,458 @@
+// Converts textures/*.png into the cooked texture format the game embeds, see
+// Platformer/CookedTexture.h. Runs as a pre-build step of the game:
+//
+//     AssetCooker.exe [-lz4] [-bgra] <texture dir> <output dir>
+//
+// Textures with at most 256 colors are stored as 8 bit indices into a
+// palette unless -bgra is given. -lz4 compresses the pixels when that makes
+// them smaller.
+//
+// A texture can have a sprite sheet next to it, name.sprite, listing where
+// its named frames are:
+//
+//     # player.png
+//     frame_width 16
+//     idle 0
+//     run 1 2
+//     fall 3
+//
+// Frames are counted from the left in frame_width texel steps. Frames a sheet
+// does not name use frame 0.
+
+#include <windows.h>
+#include <wincodec.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "../Platformer/CookedTexture.h"
+#include "../Platformer/Lz4.h"
+
+template<class Interface>
+inline void SafeRelease(Interface** ppInterfaceToRelease)
+{
+    if (*ppInterfaceToRelease != NULL)
+    {
+        (*ppInterfaceToRelease)->Release();
+        (*ppInterfaceToRelease) = NULL;
+    }
+}
+
+struct CookedPixels
+{
+    UINT width;
+    UINT height;
+    UINT stride;
+    BYTE* pixels;
+};
+
+HRESULT DecodePng(IWICImagingFactory* pFactory, const wchar_t* path, CookedPixels* pImage)
+{
+    pImage->pixels = NULL;
+
+    IWICBitmapDecoder* pDecoder = NULL;
+    HRESULT hr = pFactory->CreateDecoderFromFilename(path, NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &pDecoder);
+
+    IWICBitmapFrameDecode* pSource = NULL;
+    if (SUCCEEDED(hr))
+    {
+        hr = pDecoder->GetFrame(0, &pSource);
+    }
+
+    IWICFormatConverter* pConverter = NULL;
+    if (SUCCEEDED(hr))
+    {
+        hr = pFactory->CreateFormatConverter(&pConverter);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pConverter->Initialize(
+            pSource,
+            GUID_WICPixelFormat32bppPBGRA,
+            WICBitmapDitherTypeNone,
+            NULL,
+            0.f,
+            WICBitmapPaletteTypeMedianCut);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pConverter->GetSize(&pImage->width, &pImage->height);
+    }
+
+    if (SUCCEEDED(hr) && (pImage->width > 0xFFFF || pImage->height > 0xFFFF))
+    {
+        hr = E_INVALIDARG;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pImage->stride = pImage->width * 4;
+        pImage->pixels = static_cast<BYTE*>(malloc(pImage->stride * pImage->height));
+        if (pImage->pixels == NULL)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pConverter->CopyPixels(NULL, pImage->stride, pImage->stride * pImage->height, pImage->pixels);
+    }
+
+    if (!SUCCEEDED(hr))
+    {
+        free(pImage->pixels);
+        pImage->pixels = NULL;
+    }
+
+    SafeRelease(&pDecoder);
+    SafeRelease(&pSource);
+    SafeRelease(&pConverter);
+
+    return hr;
+}
+
+// Fill the frame table of header from a sprite sheet. A missing sheet is not
+// an error, the texture is then a single frame.
+bool ReadSpriteSheet(const wchar_t* path, CookedTextureHeader* pHeader)
+{
+    pHeader->frameWidth = COOKED_DEFAULT_FRAME_WIDTH;
+    for (unsigned char& frame : pHeader->frames)
+    {
+        frame = 0;
+    }
+
+    FILE* pFile = NULL;
+    if (_wfopen_s(&pFile, path, L"r") != 0 || pFile == NULL)
+    {
+        return true;
+    }
+
+    struct NamedFrames
+    {
+        const char* name;
+        SpriteFrame::Type first;
+        int count;
+    };
+
+    const NamedFrames namedFrames[] =
+    {
+        { "idle", SpriteFrame::IDLE, 1 },
+        { "run", SpriteFrame::RUN_1, 2 },
+        { "fall", SpriteFrame::FALL, 1 },
+        { "cycle", SpriteFrame::CYCLE_1, 3 },
+        { "spent", SpriteFrame::SPENT, 1 },
+    };
+
+    bool result = true;
+    int lineNumber = 0;
+    char line[256];
+    while (result && fgets(line, sizeof(line), pFile))
+    {
+        lineNumber++;
+
+        char* context = NULL;
+        char* key = strtok_s(line, " \t\r\n", &context);
+        if (key == NULL || key[0] == '#')
+        {
+            continue;
+        }
+
+        int values[4];
+        int valueCount = 0;
+        for (char* token = strtok_s(NULL, " \t\r\n", &context);
+            token != NULL && valueCount < 4;
+            token = strtok_s(NULL, " \t\r\n", &context))
+        {
+            values[valueCount++] = atoi(token);
+        }
+
+        if (strcmp(key, "frame_width") == 0 && valueCount == 1 && values[0] > 0 && values[0] <= 0xFFFF)
+        {
+            pHeader->frameWidth = static_cast<unsigned short>(values[0]);
+            continue;
+        }
+
+        result = false;
+        for (const NamedFrames& named : namedFrames)
+        {
+            if (strcmp(key, named.name) != 0 || valueCount != named.count)
+            {
+                continue;
+            }
+
+            result = true;
+            for (int index = 0; index < named.count; index++)
+            {
+                result = result && values[index] >= 0 && values[index] <= 0xFF;
+                pHeader->frames[named.first + index] = static_cast<unsigned char>(values[index]);
+            }
+        }
+
+        if (!result)
+        {
+            fwprintf(stderr, L"%ls(%d): error: bad sprite sheet line\n", path, lineNumber);
+        }
+    }
+
+    fclose(pFile);
+    return result;
+}
+
+// Palette and one index per pixel for image, false when it has too many
+// colors.
+bool IndexImage(const CookedPixels& image, UINT* pPalette, int* pPaletteSize, BYTE* pIndices)
+{
+    int paletteSize = 0;
+    for (UINT y = 0; y < image.height; y++)
+    {
+        const UINT* pRow = reinterpret_cast<const UINT*>(image.pixels + y * image.stride);
+        for (UINT x = 0; x < image.width; x++)
+        {
+            int index = 0;
+            while (index < paletteSize && pPalette[index] != pRow[x])
+            {
+                index++;
+            }
+
+            if (index == paletteSize)
+            {
+                if (paletteSize == COOKED_MAX_PALETTE_SIZE)
+                {
+                    return false;
+                }
+
+                pPalette[paletteSize++] = pRow[x];
+            }
+
+            *pIndices++ = static_cast<BYTE>(index);
+        }
+    }
+
+    *pPaletteSize = paletteSize;
+    return true;
+}
+
+bool WriteCookedTexture(const wchar_t* path, const CookedTextureHeader& header, const UINT* pPalette, const BYTE* pData)
+{
+    FILE* pFile = NULL;
+    if (_wfopen_s(&pFile, path, L"wb") != 0 || pFile == NULL)
+    {
+        return false;
+    }
+
+    bool result = fwrite(&header, sizeof(header), 1, pFile) == 1
+        && fwrite(pPalette, sizeof(UINT), header.paletteSize, pFile) == header.paletteSize
+        && fwrite(pData, 1, header.dataSize, pFile) == header.dataSize;
+
+    return fclose(pFile) == 0 && result;
+}
+
+bool IsNewer(const wchar_t* path, const FILETIME& than)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(path, GetFileExInfoStandard, &attributes))
+    {
+        return false;
+    }
+
+    return CompareFileTime(&attributes.ftLastWriteTime, &than) > 0;
+}
+
+struct CookOptions
+{
+    bool compress;
+    bool indexed;
+};
+
+bool CookTexture(IWICImagingFactory* pFactory, const wchar_t* inputDir, const wchar_t* outputDir, const wchar_t* pngName, const CookOptions& options)
+{
+    wchar_t name[MAX_PATH];
+    wcscpy_s(name, pngName);
+    wchar_t* extension = wcsrchr(name, L'.');
+    if (extension)
+    {
+        *extension = L'\0';
+    }
+
+    wchar_t pngPath[MAX_PATH];
+    wchar_t spritePath[MAX_PATH];
+    wchar_t outputPath[MAX_PATH];
+    swprintf_s(pngPath, L"%ls\\%ls.png", inputDir, name);
+    swprintf_s(spritePath, L"%ls\\%ls.sprite", inputDir, name);
+    swprintf_s(outputPath, L"%ls\\%ls.tex", outputDir, name);
+
+    wchar_t cookerPath[MAX_PATH];
+    GetModuleFileNameW(NULL, cookerPath, MAX_PATH);
+
+    // skip textures that are up to date, the flags are not tracked so
+    // changing them needs a rebuild
+    WIN32_FILE_ATTRIBUTE_DATA outputAttributes;
+    if (GetFileAttributesExW(outputPath, GetFileExInfoStandard, &outputAttributes)
+        && !IsNewer(pngPath, outputAttributes.ftLastWriteTime)
+        && !IsNewer(spritePath, outputAttributes.ftLastWriteTime)
+        && !IsNewer(cookerPath, outputAttributes.ftLastWriteTime))
+    {
+        return true;
+    }
+
+    CookedPixels image;
+    HRESULT hr = DecodePng(pFactory, pngPath, &image);
+    if (!SUCCEEDED(hr))
+    {
+        fwprintf(stderr, L"%ls: error: could not decode (0x%08x)\n", pngPath, static_cast<unsigned int>(hr));
+        return false;
+    }
+
+    CookedTextureHeader header = {};
+    header.magic = COOKED_TEXTURE_MAGIC;
+    header.version = COOKED_TEXTURE_VERSION;
+    header.flags = CookedTextureHeader::NONE;
+    header.width = static_cast<unsigned short>(image.width);
+    header.height = static_cast<unsigned short>(image.height);
+    header.stride = image.stride;
+    header.pixelSize = image.stride * image.height;
+    header.dataSize = header.pixelSize;
+
+    bool result = ReadSpriteSheet(spritePath, &header);
+
+    for (unsigned char frame : header.frames)
+    {
+        if (result && (frame + 1) * header.frameWidth > header.width)
+        {
+            fwprintf(stderr, L"%ls: error: frame %d is outside the texture\n", spritePath, frame);
+            result = false;
+        }
+    }
+
+    const BYTE* pData = image.pixels;
+    UINT palette[COOKED_MAX_PALETTE_SIZE];
+    int paletteSize = 0;
+    BYTE* pIndices = NULL;
+    if (result && options.indexed)
+    {
+        pIndices = static_cast<BYTE*>(malloc(image.width * image.height));
+        if (pIndices && IndexImage(image, palette, &paletteSize, pIndices))
+        {
+            header.flags |= CookedTextureHeader::INDEXED;
+            header.paletteSize = static_cast<unsigned short>(paletteSize);
+            header.stride = image.width;
+            header.pixelSize = image.width * image.height;
+            header.dataSize = header.pixelSize;
+            pData = pIndices;
+        }
+    }
+
+    BYTE* pCompressed = NULL;
+    if (result && options.compress)
+    {
+        pCompressed = static_cast<BYTE*>(malloc(Lz4CompressBound(header.pixelSize)));
+        if (pCompressed)
+        {
+            int compressedSize = Lz4Compress(pData, header.pixelSize, pCompressed);
+
+            // tiny textures can grow, keep those raw
+            if (static_cast<unsigned int>(compressedSize) < header.pixelSize)
+            {
+                header.flags |= CookedTextureHeader::LZ4;
+                header.dataSize = compressedSize;
+                pData = pCompressed;
+            }
+        }
+    }
+
+    if (result)
+    {
+        result = WriteCookedTexture(outputPath, header, palette, pData);
+        if (result)
+        {
+            wprintf(L"%ls: %ux%u, %u -> %u bytes%ls%ls\n",
+                name,
+                image.width,
+                image.height,
+                image.stride * image.height,
+                static_cast<UINT>(header.dataSize + header.paletteSize * sizeof(UINT)),
+                (header.flags & CookedTextureHeader::INDEXED) ? L" indexed" : L"",
+                (header.flags & CookedTextureHeader::LZ4) ? L" lz4" : L"");
+        }
+        else
+        {
+            fwprintf(stderr, L"%ls: error: could not write\n", outputPath);
+        }
+    }
+
+    free(pCompressed);
+    free(pIndices);
+    free(image.pixels);
+
+    return result;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    CookOptions options = { false, true };
+    int argIndex = 1;
+    for (; argIndex < argc && argv[argIndex][0] == L'-'; argIndex++)
+    {
+        if (wcscmp(argv[argIndex], L"-lz4") == 0)
+        {
+            options.compress = true;
+        }
+        else if (wcscmp(argv[argIndex], L"-bgra") == 0)
+        {
+            options.indexed = false;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (argc - argIndex != 2)
+    {
+        fwprintf(stderr, L"usage: AssetCooker [-lz4] [-bgra] <texture dir> <output dir>\n");
+        return 1;
+    }
+
+    const wchar_t* inputDir = argv[argIndex];
+    const wchar_t* outputDir = argv[argIndex + 1];
+    CreateDirectoryW(outputDir, NULL);
+
+    if (!SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED)))
+    {
+        return 1;
+    }
+
+    IWICImagingFactory* pFactory = NULL;
+    HRESULT hr = CoCreateInstance(
+        CLSID_WICImagingFactory2,
+        NULL,
+        CLSCTX_INPROC_SERVER,
+        IID_IWICImagingFactory2,
+        reinterpret_cast<void**>(&pFactory));
+
+    bool result = SUCCEEDED(hr);
+
+    wchar_t pattern[MAX_PATH];
+    swprintf_s(pattern, L"%ls\\*.png", inputDir);
+
+    WIN32_FIND_DATAW findData;
+    HANDLE hFind = result ? FindFirstFileW(pattern, &findData) : INVALID_HANDLE_VALUE;
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            result = CookTexture(pFactory, inputDir, outputDir, findData.cFileName, options) && result;
+        } while (FindNextFileW(hFind, &findData));
+
+        FindClose(hFind);
+    }
+
+    SafeRelease(&pFactory);
+    CoUninitialize();
+
+    return result ? 0 : 1;
+}
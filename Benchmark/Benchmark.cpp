@@ -0,0 +1,1304 @@
+// Microbenchmarks of the simulation kernels. Nothing is drawn, so this runs
+// without a window or a device: on Windows through Benchmark.vcxproj, and on
+// Linux against the headless platform headers in Headless/, from the
+// repository root:
+//
+//   g++ -std=c++17 -O2 -pthread -IBenchmark/Headless -IPlatformer
+//       Benchmark/Benchmark.cpp Benchmark/Scenarios.cpp Benchmark/SimServer.cpp
+//       Benchmark/SaveStates.cpp Benchmark/DeviceLoss.cpp
+//       Benchmark/Headless/HeadlessPlatform.cpp
+//       Platformer/Platformer.cpp Platformer/Levels.cpp Platformer/AssetLoader.cpp
+//       Platformer/LevelStreamer.cpp Platformer/Profiler.cpp -o benchmark
+//
+// Usage: benchmark [-samples <n>] [-filter <text>] [-json <file>|-]
+//        benchmark -scenarios [options], see Scenarios.cpp
+//        benchmark -serve [options], see SimServer.cpp
+//        benchmark -savestate [options], see SaveStates.cpp
+//        benchmark -deviceloss [options], see DeviceLoss.cpp
+//
+// Every kernel runs on synthetic worlds of several sizes. Each sample times
+// enough iterations to last a few milliseconds and the reported ns/op are the
+// mean, standard deviation, min and max over the samples.
+
+#include "Benchmark.h"
+#include <math.h>
+
+#define BENCHMARK_DEFAULT_SAMPLES 20
+#define BENCHMARK_WARMUP_SAMPLES 2
+#define BENCHMARK_MIN_SAMPLE_TIME 0.002
+#define BENCHMARK_MAX_RESULTS 80
+
+// Capacity of the entity world the layout comparisons run on.
+#define BENCHMARK_ENTITIES 10000
+
+struct BenchmarkResult
+{
+    const char* name;
+    int size;
+    int samples;
+    long long iterations;
+    double mean;
+    double stddev;
+    double min;
+    double max;
+};
+
+// Keeps results of the timed loops alive.
+static volatile float s_sink;
+
+// The components of one actor in one object, as the player and the enemies
+// kept them before the entity world.
+class Actor
+{
+public:
+
+    void Initialize(Scalar x, Scalar y, Scalar width, Scalar height, Scalar runSpeed)
+    {
+        transform.x = x;
+        transform.y = y;
+        collider.width = width;
+        collider.height = height;
+        velocity.yVel = 0;
+        velocity.falling = false;
+        velocity.action = Action::NONE;
+        velocity.movement = MovementDirection::NONE;
+        velocity.runSpeed = runSpeed;
+        animation.time = 0.f;
+        sprite.frame = SpriteFrame::IDLE;
+        sprite.flip = false;
+    }
+
+    // A copy of the player's components.
+    void CopyPlayer(const GameState& gameState)
+    {
+        const EntityWorld<NUM_ACTORS>& world = gameState.world;
+        transform = *world.transforms.Get(PLAYER_ENTITY);
+        velocity = *world.velocities.Get(PLAYER_ENTITY);
+        collider = *world.colliders.Get(PLAYER_ENTITY);
+        sprite = *world.sprites.Get(PLAYER_ENTITY);
+        animation = *world.animations.Get(PLAYER_ENTITY);
+    }
+
+    SimRect GetRect() const
+    {
+        return ::GetRect(transform, collider);
+    }
+
+    MovementDirection::Type UpdateMovement(Scalar delta)
+    {
+        return ::UpdateMovement(transform, velocity, delta);
+    }
+
+    void CheckFalling(GameState &gameState)
+    {
+        ::CheckFalling(gameState, transform, velocity, collider);
+    }
+
+    void TickAnim(float delta)
+    {
+        TickActorAnim(sprite, animation, velocity, delta);
+    }
+
+    // Hot: movement and collision.
+    Transform transform;
+    Velocity velocity;
+    Collider collider;
+
+    // Cold: sprite selection.
+    Sprite sprite;
+    Animation animation;
+};
+
+// An enemy as laid out before the entity world: every field in one object,
+// ticked one object at a time. Kept as the baseline for the ECS benchmarks.
+struct ClassEnemy
+{
+    void Initialize(Scalar x, Scalar y)
+    {
+        actor.Initialize(x, y, ENEMY_WIDTH, ENEMY_HEIGHT, 45);
+        actor.velocity.action = Action::MOVE_LEFT;
+        active = true;
+        isDead = false;
+        type = Enemy::CAT;
+        textureId = 0;
+        palette = Palette::BASE;
+    }
+
+    void TickSimulation(GameState& gameState, CollisionPipeline& collision, float delta)
+    {
+        MovementDirection::Type movement = actor.UpdateMovement(static_cast<Scalar>(delta));
+        actor.velocity.movement = movement;
+
+        // the pipeline on one body at a time
+        CollisionBody body = { &actor.transform, &actor.velocity, &actor.collider, true };
+        collision.Clear();
+        collision.Gather(gameState, body);
+        collision.Resolve();
+        collision.DispatchLevelEvents(gameState);
+
+        Scalar verticalAdjustment = 0;
+        Scalar horizontalAdjustment = 0;
+        const EntityWorld<NUM_ACTORS>& world = gameState.world;
+        SimRect playerRect = GetRect(*world.transforms.Get(PLAYER_ENTITY), *world.colliders.Get(PLAYER_ENTITY));
+        if (Intersect(actor.GetRect(), playerRect, movement, verticalAdjustment, horizontalAdjustment))
+        {
+            isDead = isDead || (horizontalAdjustment == 0 && verticalAdjustment >= 0);
+        }
+
+        actor.TickAnim(delta);
+        actor.CheckFalling(gameState);
+
+        if (actor.transform.y > SCREEN_HEIGHT)
+        {
+            isDead = true;
+        }
+    }
+
+    Actor actor;
+    bool active;
+    bool isDead;
+    Enemy::Type type;
+    unsigned char textureId;
+    Palette::Type palette;
+};
+
+typedef EntityWorld<BENCHMARK_ENTITIES> BenchmarkWorld;
+// in floats, the largest ActorPairs lane is longer than fixed point reaches
+typedef SweepAndPrune<BENCHMARK_ENTITIES, D2D1_RECT_F> BenchmarkBroadphase;
+
+class SimBenchmark
+{
+public:
+    SimBenchmark(int samples, const char* filter) :
+        m_samples(samples),
+        m_filter(filter),
+        m_resultCount(0),
+        m_results(),
+        m_pPlatformer(new Platformer()),
+        m_pWorld(new BenchmarkWorld()),
+        m_pBroadphase(new BenchmarkBroadphase()),
+        m_pParticles(new ParticleSystem(SCREEN_WIDTH, SCREEN_HEIGHT))
+    {
+    }
+
+    ~SimBenchmark()
+    {
+        delete m_pParticles;
+        delete m_pBroadphase;
+        delete m_pWorld;
+        delete m_pPlatformer;
+    }
+
+    SimBenchmark(const SimBenchmark&) = delete;
+    SimBenchmark& operator=(const SimBenchmark&) = delete;
+
+    void Run()
+    {
+        static const int worldSizes[] = { 5, 10, NUM_GEO };
+        static const int streamSizes[] = { 1000, 16000, 131072 };
+        static const int entityCounts[] = { 100, 1000, BENCHMARK_ENTITIES };
+        static const int particleCounts[] = { 1000, 10000, 100000 };
+
+        for (int size : worldSizes)
+        {
+            BenchIntersect(size);
+        }
+
+        for (int size : worldSizes)
+        {
+            BenchResolveGeoCollisions(size);
+        }
+
+        for (int size : worldSizes)
+        {
+            BenchCheckFalling(size);
+        }
+
+        for (int size : worldSizes)
+        {
+            BenchLevelQueries(size);
+        }
+
+        BenchUpdateMovement();
+        BenchScalarKernels<float, D2D1_RECT_F>("UpdateMovement/float", "Intersect/float");
+        BenchScalarKernels<Fixed, FixedRect>("UpdateMovement/fixed", "Intersect/fixed");
+
+        for (int size : worldSizes)
+        {
+            BenchGeoTickAnim(size);
+        }
+
+        for (int size : worldSizes)
+        {
+            BenchAllocateGeo(size);
+        }
+
+        for (int size : streamSizes)
+        {
+            BenchLoadLevelEntities(size);
+        }
+
+        for (int size : entityCounts)
+        {
+            BenchEnemyTick(size);
+        }
+
+        for (int size : entityCounts)
+        {
+            BenchEnemyMove(size);
+        }
+
+        for (int size : entityCounts)
+        {
+            BenchEnemySwarm(size);
+        }
+
+        for (int size : entityCounts)
+        {
+            BenchBlockAnim(size);
+        }
+
+        for (int size : entityCounts)
+        {
+            BenchActorPairs(size);
+        }
+
+        for (int size : particleCounts)
+        {
+            BenchParticles(size);
+        }
+    }
+
+    void PrintResults() const
+    {
+        printf("%-28s %6s %12s %10s %10s %10s\n", "benchmark", "size", "ns/op", "stddev", "min", "max");
+        for (int index = 0; index < m_resultCount; index++)
+        {
+            const BenchmarkResult& result = m_results[index];
+            printf("%-28s %6d %12.2f %10.2f %10.2f %10.2f\n",
+                result.name,
+                result.size,
+                result.mean,
+                result.stddev,
+                result.min,
+                result.max);
+        }
+
+        StateLayoutStats layout = GetLayout();
+        printf("\nlayout: geo %d bytes, actor %d bytes, enemy %d bytes, game state %u bytes\n",
+            layout.geoBytes,
+            layout.actorBytes,
+            layout.enemyBytes,
+            static_cast<unsigned int>(sizeof(GameState)));
+        printf("layout: full world touches %d geo lines, %d enemy lines, %d player lines per tick\n",
+            layout.geoLines,
+            layout.enemyLines,
+            layout.playerLines);
+    }
+
+    bool WriteJson(FILE* pFile) const
+    {
+        fprintf(pFile, "{\n  \"benchmarks\": [\n");
+        for (int index = 0; index < m_resultCount; index++)
+        {
+            const BenchmarkResult& result = m_results[index];
+            fprintf(pFile, "    {\"name\": \"%s\", \"size\": %d, \"samples\": %d, \"iterations\": %lld, "
+                "\"ns_per_op\": %.3f, \"stddev_ns\": %.3f, \"variance_ns2\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f}%s\n",
+                result.name,
+                result.size,
+                result.samples,
+                result.iterations,
+                result.mean,
+                result.stddev,
+                result.stddev * result.stddev,
+                result.min,
+                result.max,
+                index + 1 < m_resultCount ? "," : "");
+        }
+
+        StateLayoutStats layout = GetLayout();
+        fprintf(pFile, "  ],\n  \"layout\": {\"geo_bytes\": %d, \"actor_bytes\": %d, \"enemy_bytes\": %d, "
+            "\"game_state_bytes\": %u, \"geo_lines\": %d, \"enemy_lines\": %d, \"player_lines\": %d}\n}\n",
+            layout.geoBytes,
+            layout.actorBytes,
+            layout.enemyBytes,
+            static_cast<unsigned int>(sizeof(GameState)),
+            layout.geoLines,
+            layout.enemyLines,
+            layout.playerLines);
+
+        return ferror(pFile) == 0;
+    }
+
+private:
+    GameState& State()
+    {
+        return m_pPlatformer->m_gameState;
+    }
+
+    // Empty world with the player standing at the left of the screen.
+    void ClearWorld()
+    {
+        GameState& gameState = State();
+        gameState.spatial.Clear();
+        m_pPlatformer->DeallocateAllGeo();
+        m_pPlatformer->DeallocateAllEnemies();
+        gameState.tilemap.Clear();
+        gameState.player.Reset(gameState);
+        gameState.cameraScroll = 0;
+        gameState.level = LevelCursor();
+    }
+
+    // A floor along the bottom and blocks of every type scattered over one
+    // screen, geoCount in all.
+    void BuildWorld(int geoCount)
+    {
+        ClearWorld();
+
+        Random random(static_cast<unsigned int>(geoCount));
+        m_pPlatformer->AllocateGeo(0, SCREEN_HEIGHT - 10, SCREEN_WIDTH, SCREEN_HEIGHT, 0, Geo::BLOCK_NONE);
+        for (int index = 1; index < geoCount; index++)
+        {
+            Scalar left = static_cast<Scalar>(random.Range(0.f, SCREEN_WIDTH - 10.f));
+            Scalar top = static_cast<Scalar>(random.Range(20.f, SCREEN_HEIGHT - 30.f));
+            int type = static_cast<int>(random.Next() % Geo::BLOCK_TYPE_COUNT);
+            m_pPlatformer->AllocateGeo(left, top, left + 10, top + 10, 0, type);
+        }
+    }
+
+    bool Selected(const char* name) const
+    {
+        return m_filter == NULL || strstr(name, m_filter) != NULL;
+    }
+
+    // Time body(), which performs opsPerCall operations, and record ns/op.
+    template<class Body>
+    void Measure(const char* name, int size, int opsPerCall, Body body)
+    {
+        if (m_resultCount >= BENCHMARK_MAX_RESULTS)
+        {
+            return;
+        }
+
+        // grow the iteration count until a sample is long enough to time
+        long long iterations = 1;
+        for (;;)
+        {
+            double start = GetSeconds();
+            for (long long iteration = 0; iteration < iterations; iteration++)
+            {
+                body();
+            }
+
+            if (GetSeconds() - start >= BENCHMARK_MIN_SAMPLE_TIME)
+            {
+                break;
+            }
+
+            iterations *= 2;
+        }
+
+        std::vector<double> nsPerOp;
+        for (int sample = 0; sample < BENCHMARK_WARMUP_SAMPLES + m_samples; sample++)
+        {
+            double start = GetSeconds();
+            for (long long iteration = 0; iteration < iterations; iteration++)
+            {
+                body();
+            }
+
+            double elapsed = GetSeconds() - start;
+            if (sample >= BENCHMARK_WARMUP_SAMPLES)
+            {
+                nsPerOp.push_back(elapsed * 1e9 / static_cast<double>(iterations * opsPerCall));
+            }
+        }
+
+        BenchmarkResult& result = m_results[m_resultCount++];
+        result.name = name;
+        result.size = size;
+        result.samples = m_samples;
+        result.iterations = iterations * opsPerCall;
+        result.mean = 0.0;
+        result.min = nsPerOp[0];
+        result.max = nsPerOp[0];
+        for (double value : nsPerOp)
+        {
+            result.mean += value;
+            result.min = value < result.min ? value : result.min;
+            result.max = value > result.max ? value : result.max;
+        }
+        result.mean /= static_cast<double>(nsPerOp.size());
+
+        double variance = 0.0;
+        for (double value : nsPerOp)
+        {
+            variance += (value - result.mean) * (value - result.mean);
+        }
+        result.stddev = nsPerOp.size() > 1 ? sqrt(variance / static_cast<double>(nsPerOp.size() - 1)) : 0.0;
+
+        fprintf(stderr, "%s/%d: %.2f ns/op\n", name, size, result.mean);
+    }
+
+    // Actor rect against every geo of the world, as the collision loops do.
+    void BenchIntersect(int size)
+    {
+        if (!Selected("Intersect"))
+        {
+            return;
+        }
+
+        BuildWorld(size);
+        const GameState& gameState = State();
+
+        Random random(7);
+        std::vector<SimRect> actorRects;
+        for (int index = 0; index < 256; index++)
+        {
+            Scalar x = static_cast<Scalar>(random.Range(0.f, SCREEN_WIDTH - PLAYER_WIDTH));
+            Scalar y = static_cast<Scalar>(random.Range(0.f, SCREEN_HEIGHT - PLAYER_HEIGHT));
+            actorRects.push_back(MakeSimRect(x, y, x + PLAYER_WIDTH, y + PLAYER_HEIGHT));
+        }
+
+        size_t next = 0;
+        MovementDirection::Type movement = static_cast<MovementDirection::Type>(MovementDirection::DOWN | MovementDirection::RIGHT);
+        Measure("Intersect", size, NUM_GEO, [&]
+        {
+            const SimRect& actorRect = actorRects[next++ % actorRects.size()];
+            Scalar adjustment = 0;
+            for (const Geo& geo : gameState.geo)
+            {
+                Scalar verticalAdjustment = 0;
+                Scalar horizontalAdjustment = 0;
+                if (Intersect(actorRect, geo.GetRect(), movement, verticalAdjustment, horizontalAdjustment))
+                {
+                    adjustment += verticalAdjustment + horizontalAdjustment;
+                }
+            }
+            s_sink = ToFloat(adjustment);
+        });
+    }
+
+    // Player dropped onto the world at spots spread over the screen.
+    void BenchResolveGeoCollisions(int size)
+    {
+        if (!Selected("CollisionPipeline::Resolve"))
+        {
+            return;
+        }
+
+        BuildWorld(size);
+        GameState& gameState = State();
+
+        Random random(11);
+        std::vector<Actor> starts;
+        for (int index = 0; index < 256; index++)
+        {
+            Actor actor;
+            actor.CopyPlayer(gameState);
+            actor.transform.x = static_cast<Scalar>(random.Range(0.f, SCREEN_WIDTH - PLAYER_WIDTH));
+            actor.transform.y = static_cast<Scalar>(random.Range(0.f, SCREEN_HEIGHT - PLAYER_HEIGHT));
+            starts.push_back(actor);
+        }
+
+        size_t next = 0;
+        MovementDirection::Type movement = static_cast<MovementDirection::Type>(MovementDirection::DOWN | MovementDirection::RIGHT);
+        CollisionPipeline collision;
+        Measure("CollisionPipeline::Resolve", size, 1, [&]
+        {
+            Actor actor = starts[next++ % starts.size()];
+            actor.velocity.movement = movement;
+            CollisionBody body = { &actor.transform, &actor.velocity, &actor.collider, false };
+            collision.Clear();
+            collision.Gather(gameState, body);
+            collision.Resolve();
+            collision.DispatchLevelEvents(gameState);
+            s_sink = ToFloat(actor.transform.y);
+        });
+    }
+
+    void BenchCheckFalling(int size)
+    {
+        if (!Selected("Actor::CheckFalling"))
+        {
+            return;
+        }
+
+        BuildWorld(size);
+        GameState& gameState = State();
+
+        Random random(13);
+        std::vector<Actor> actors;
+        for (int index = 0; index < 256; index++)
+        {
+            Actor actor;
+            actor.CopyPlayer(gameState);
+            actor.transform.x = static_cast<Scalar>(random.Range(0.f, SCREEN_WIDTH - PLAYER_WIDTH));
+            actor.transform.y = static_cast<Scalar>(random.Range(0.f, SCREEN_HEIGHT - PLAYER_HEIGHT));
+            actors.push_back(actor);
+        }
+
+        size_t next = 0;
+        Measure("Actor::CheckFalling", size, 1, [&]
+        {
+            Actor& actor = actors[next++ % actors.size()];
+            actor.velocity.falling = false;
+            actor.CheckFalling(gameState);
+            s_sink = actor.velocity.falling ? 1.f : 0.f;
+        });
+    }
+
+    // A tick's worth of overlap, raycast and ground probe queries spread over
+    // the screen, answered by one QueryLevel call and one call per query.
+    void BenchLevelQueries(int size)
+    {
+        bool batchedSelected = Selected("QueryLevel/batched");
+        bool singleSelected = Selected("QueryLevel/single");
+        if (!batchedSelected && !singleSelected)
+        {
+            return;
+        }
+
+        BuildWorld(size);
+        GameState& gameState = State();
+
+        Random random(17);
+        std::vector<LevelQuery> queries;
+        for (int index = 0; index < 256; index++)
+        {
+            Scalar x = static_cast<Scalar>(random.Range(0.f, SCREEN_WIDTH - PLAYER_WIDTH));
+            Scalar y = static_cast<Scalar>(random.Range(0.f, SCREEN_HEIGHT - PLAYER_HEIGHT));
+            SimRect rect = MakeSimRect(x, y, x + PLAYER_WIDTH, y + PLAYER_HEIGHT);
+            switch (index % 3)
+            {
+            case 0:
+                queries.push_back(OverlapQuery(rect));
+                break;
+            case 1:
+                queries.push_back(RaycastQuery(MakeSimPoint(x, y), MakeSimPoint(x + 30, y + 30)));
+                break;
+            default:
+                queries.push_back(GroundProbeQuery(rect, FALL_PROBE_DISTANCE));
+                break;
+            }
+        }
+
+        std::vector<LevelQueryResult> results(queries.size());
+        int count = static_cast<int>(queries.size());
+        if (batchedSelected)
+        {
+            Measure("QueryLevel/batched", size, count, [&]
+            {
+                QueryLevel(gameState, queries.data(), results.data(), count);
+                s_sink = ToFloat(results[0].distance);
+            });
+        }
+
+        if (singleSelected)
+        {
+            Measure("QueryLevel/single", size, count, [&]
+            {
+                for (int index = 0; index < count; index++)
+                {
+                    QueryLevel(gameState, &queries[index], &results[index], 1);
+                }
+                s_sink = ToFloat(results[0].distance);
+            });
+        }
+    }
+
+    // Independent of the world, restarts from a running jump every call.
+    void BenchUpdateMovement()
+    {
+        if (!Selected("Actor::UpdateMovement"))
+        {
+            return;
+        }
+
+        ClearWorld();
+        Actor start;
+        start.CopyPlayer(State());
+        start.velocity.action = static_cast<Action::Type>(Action::MOVE_RIGHT | Action::JUMP);
+        start.velocity.falling = true;
+        start.velocity.yVel = -200;
+        Scalar step = static_cast<Scalar>(1.f / 60.f);
+
+        Measure("Actor::UpdateMovement", 1, 1, [&]
+        {
+            Actor actor = start;
+            MovementDirection::Type movement = actor.UpdateMovement(step);
+            s_sink = ToFloat(actor.transform.x + actor.transform.y) + static_cast<float>(movement);
+        });
+    }
+
+    // The movement and overlap kernels in both number types, whichever one
+    // the build simulates in, for the cost of USE_FIXED_POINT_PHYSICS.
+    template<class T, class Rect>
+    void BenchScalarKernels(const char* movementName, const char* intersectName)
+    {
+        Random random(19);
+        if (Selected(movementName))
+        {
+            TransformT<T> startTransform = { static_cast<T>(20.f), static_cast<T>(100.f) };
+            VelocityT<T> startVelocity = {};
+            startVelocity.runSpeed = static_cast<T>(45.f);
+            startVelocity.action = static_cast<Action::Type>(Action::MOVE_RIGHT | Action::JUMP);
+            startVelocity.falling = true;
+            startVelocity.yVel = static_cast<T>(-200.f);
+            T step = static_cast<T>(1.f / 60.f);
+
+            Measure(movementName, 1, 1, [&]
+            {
+                TransformT<T> transform = startTransform;
+                VelocityT<T> velocity = startVelocity;
+                MovementDirection::Type movement = UpdateMovement(transform, velocity, step);
+                s_sink = ToFloat(transform.x + transform.y) + static_cast<float>(movement);
+            });
+        }
+
+        if (Selected(intersectName))
+        {
+            std::vector<Rect> actorRects;
+            std::vector<Rect> blockRects;
+            for (int index = 0; index < 256; index++)
+            {
+                float x = random.Range(0.f, SCREEN_WIDTH - PLAYER_WIDTH);
+                float y = random.Range(0.f, SCREEN_HEIGHT - PLAYER_HEIGHT);
+                Rect rect = { static_cast<T>(x), static_cast<T>(y), static_cast<T>(x + PLAYER_WIDTH), static_cast<T>(y + PLAYER_HEIGHT) };
+                actorRects.push_back(rect);
+            }
+
+            for (int index = 0; index < NUM_GEO; index++)
+            {
+                float left = random.Range(0.f, SCREEN_WIDTH - 10.f);
+                float top = random.Range(20.f, SCREEN_HEIGHT - 30.f);
+                Rect rect = { static_cast<T>(left), static_cast<T>(top), static_cast<T>(left + 10.f), static_cast<T>(top + 10.f) };
+                blockRects.push_back(rect);
+            }
+
+            size_t next = 0;
+            MovementDirection::Type movement = static_cast<MovementDirection::Type>(MovementDirection::DOWN | MovementDirection::RIGHT);
+            Measure(intersectName, NUM_GEO, NUM_GEO, [&]
+            {
+                const Rect& actorRect = actorRects[next++ % actorRects.size()];
+                T adjustment = 0;
+                for (const Rect& blockRect : blockRects)
+                {
+                    T verticalAdjustment = 0;
+                    T horizontalAdjustment = 0;
+                    if (Intersect(actorRect, blockRect, movement, verticalAdjustment, horizontalAdjustment))
+                    {
+                        adjustment += verticalAdjustment + horizontalAdjustment;
+                    }
+                }
+                s_sink = ToFloat(adjustment);
+            });
+        }
+    }
+
+    // Every geo ticked once per call, coin blocks cycle and some are bumped.
+    void BenchGeoTickAnim(int size)
+    {
+        if (!Selected("Geo::TickAnim"))
+        {
+            return;
+        }
+
+        BuildWorld(size);
+        GameState& gameState = State();
+
+        int tick = 0;
+        Measure("Geo::TickAnim", size, NUM_GEO, [&]
+        {
+            if (++tick % 64 == 0)
+            {
+                for (Geo& geo : gameState.geo)
+                {
+                    if (geo.active && geo.type == Geo::BLOCK_COIN)
+                    {
+                        geo.gameplayState = Geo::HAS_COIN;
+                        geo.Bump();
+                    }
+                }
+            }
+
+            for (Geo& geo : gameState.geo)
+            {
+                geo.TickAnim(1.f / 60.f);
+            }
+            s_sink = gameState.geo[0].animTime;
+        });
+    }
+
+    // Fill the pool up to size and release it again.
+    void BenchAllocateGeo(int size)
+    {
+        if (!Selected("AllocateGeo/DeallocateGeo"))
+        {
+            return;
+        }
+
+        ClearWorld();
+        Platformer& platformer = *m_pPlatformer;
+        int indices[NUM_GEO];
+
+        Measure("AllocateGeo/DeallocateGeo", size, size, [&]
+        {
+            for (int index = 0; index < size; index++)
+            {
+                Scalar left = index * 10;
+                indices[index] = platformer.AllocateGeo(left, 100, left + 10, 110, 0, Geo::BLOCK_NONE);
+            }
+
+            for (int index = 0; index < size; index++)
+            {
+                if (indices[index] >= 0)
+                {
+                    platformer.DeallocateGeo(indices[index]);
+                }
+            }
+        });
+    }
+
+    // Scroll the camera over a generated level, loading what comes into
+    // view and unloading what leaves it like TickSimulation does. The larger
+    // levels overrun the pools, records that find no slot are dropped.
+    void BenchLoadLevelEntities(int recordCount)
+    {
+        if (!Selected("LoadLevelEntities"))
+        {
+            return;
+        }
+
+        std::vector<short> stream = BuildLevelStream(recordCount);
+        Platformer& platformer = *m_pPlatformer;
+        GameState& gameState = State();
+
+        Measure("LoadLevelEntities", recordCount, recordCount, [&]
+        {
+            ClearWorld();
+            gameState.level.next = stream.data();
+
+            for (int scroll = 0; scroll < BENCHMARK_LEVEL_WIDTH; scroll += SCREEN_WIDTH / 4)
+            {
+                gameState.cameraScroll = scroll;
+                platformer.LoadLevelEntities();
+
+                for (int index = 0; index < NUM_GEO; index++)
+                {
+                    if (gameState.geo[index].active && gameState.geo[index].right < gameState.cameraScroll)
+                    {
+                        platformer.DeallocateGeo(index);
+                    }
+                }
+
+                EntityWorld<NUM_ACTORS>& world = gameState.world;
+                for (int dense = world.brains.Count() - 1; dense >= 0; dense--)
+                {
+                    int entity = world.brains.EntityAt(dense);
+                    if (world.transforms.Get(entity)->x < gameState.cameraScroll)
+                    {
+                        platformer.DeallocateEnemy(entity);
+                    }
+                }
+            }
+        });
+    }
+
+    // A screen walled in on both sides, so walking enemies turn around
+    // forever instead of leaving, with the player out of their way.
+    void BuildArena()
+    {
+        BuildWorld(NUM_GEO - 2);
+        m_pPlatformer->AllocateGeo(-10, 0, 0, SCREEN_HEIGHT, 0, Geo::BLOCK_NONE);
+        m_pPlatformer->AllocateGeo(SCREEN_WIDTH, 0, SCREEN_WIDTH + 10, SCREEN_HEIGHT, 0, Geo::BLOCK_NONE);
+        State().world.transforms.Get(PLAYER_ENTITY)->y = -1000;
+    }
+
+    // count enemies spread over the arena, as objects and as entities.
+    void SpawnEnemies(int count, std::vector<ClassEnemy>& enemies)
+    {
+        Random random(static_cast<unsigned int>(count));
+        enemies.resize(count);
+        m_pWorld->Clear();
+        for (ClassEnemy& enemy : enemies)
+        {
+            Scalar x = static_cast<Scalar>(random.Range(0.f, SCREEN_WIDTH - ENEMY_WIDTH));
+            Scalar y = static_cast<Scalar>(random.Range(0.f, SCREEN_HEIGHT - 30.f));
+            enemy.Initialize(x, y);
+            m_pWorld->CreateEnemy(x, y, Enemy::CAT, 0, Palette::BASE);
+        }
+    }
+
+    // The whole enemy tick, class layout against the entity systems. Both
+    // run the same movement and collision code.
+    void BenchEnemyTick(int count)
+    {
+        bool classSelected = Selected("EnemyTick/class");
+        bool ecsSelected = Selected("EnemyTick/ecs");
+        if (!classSelected && !ecsSelected)
+        {
+            return;
+        }
+
+        BuildArena();
+        GameState& gameState = State();
+        std::vector<ClassEnemy> enemies;
+        SpawnEnemies(count, enemies);
+        CollisionPipeline collision;
+        Scalar step = static_cast<Scalar>(1.f / 60.f);
+
+        if (classSelected)
+        {
+            Measure("EnemyTick/class", count, count, [&]
+            {
+                for (ClassEnemy& enemy : enemies)
+                {
+                    enemy.TickSimulation(gameState, collision, 1.f / 60.f);
+                }
+                s_sink = ToFloat(enemies[0].actor.transform.x);
+            });
+        }
+
+        if (ecsSelected)
+        {
+            BenchmarkWorld& world = *m_pWorld;
+            Measure("EnemyTick/ecs", count, count, [&]
+            {
+                MovementSystem(world, step);
+                collision.CollideWithLevel(gameState, world);
+                TickEntitySystems(world, gameState, 1.f / 60.f);
+                s_sink = ToFloat(world.transforms.At(0).x);
+            });
+        }
+    }
+
+    // Movement and animation only, where the class layout drags every field
+    // through the cache and the systems read just what they need.
+    void BenchEnemyMove(int count)
+    {
+        bool classSelected = Selected("EnemyMove/class");
+        bool ecsSelected = Selected("EnemyMove/ecs");
+        if (!classSelected && !ecsSelected)
+        {
+            return;
+        }
+
+        std::vector<ClassEnemy> enemies;
+        SpawnEnemies(count, enemies);
+
+        // keep them on the ground so nothing drifts away over the samples
+        for (ClassEnemy& enemy : enemies)
+        {
+            enemy.actor.velocity.action = static_cast<Action::Type>(Action::MOVE_LEFT | Action::MOVE_RIGHT);
+        }
+
+        BenchmarkWorld& world = *m_pWorld;
+        for (int dense = 0; dense < world.velocities.Count(); dense++)
+        {
+            world.velocities.At(dense).action = static_cast<Action::Type>(Action::MOVE_LEFT | Action::MOVE_RIGHT);
+        }
+
+        Scalar step = static_cast<Scalar>(1.f / 60.f);
+        if (classSelected)
+        {
+            Measure("EnemyMove/class", count, count, [&]
+            {
+                for (ClassEnemy& enemy : enemies)
+                {
+                    enemy.actor.UpdateMovement(step);
+                    enemy.actor.TickAnim(1.f / 60.f);
+                }
+                s_sink = enemies[0].actor.animation.time;
+            });
+        }
+
+        if (ecsSelected)
+        {
+            Measure("EnemyMove/ecs", count, count, [&]
+            {
+                MovementSystem(world, step);
+                ActorAnimationSystem(world, 1.f / 60.f);
+                s_sink = world.animations.At(0).time;
+            });
+        }
+    }
+
+    // Movement and animation of a swarm mixing four archetypes, the stock cat
+    // among them. The systems run one type at a time, cats through their
+    // compile-time specialization; the baseline walks the enemies in spawn
+    // order and reads each one's archetype, as before they were grouped.
+    void BenchEnemySwarm(int count)
+    {
+        bool groupedSelected = Selected("EnemySwarm/grouped");
+        bool mixedSelected = Selected("EnemySwarm/mixed");
+        if (!groupedSelected && !mixedSelected)
+        {
+            return;
+        }
+
+        BenchmarkWorld& world = *m_pWorld;
+        world.Clear();
+        world.ResetArchetypes();
+
+        EnemyArchetype runner = StockEnemyArchetype(Enemy::CAT);
+        runner.runSpeed = 70;
+        runner.stompable = false;
+        world.DefineArchetype(2, runner);
+
+        EnemyArchetype floater = StockEnemyArchetype(Enemy::CAT);
+        floater.gravityScale = static_cast<Scalar>(0.5f);
+        floater.runFrame1 = SpriteFrame::CYCLE_1;
+        floater.runFrame2 = SpriteFrame::CYCLE_2;
+        world.DefineArchetype(3, floater);
+
+        EnemyArchetype patroller = StockEnemyArchetype(Enemy::CAT);
+        patroller.runSpeed = 30;
+        patroller.turnsAtLedges = true;
+        world.DefineArchetype(4, patroller);
+
+        static const Enemy::Type types[] = { Enemy::CAT, static_cast<Enemy::Type>(2), static_cast<Enemy::Type>(3), static_cast<Enemy::Type>(4) };
+        Random random(static_cast<unsigned int>(count));
+        for (int index = 0; index < count; index++)
+        {
+            Scalar x = static_cast<Scalar>(random.Range(0.f, SCREEN_WIDTH - ENEMY_WIDTH));
+            Scalar y = static_cast<Scalar>(random.Range(0.f, SCREEN_HEIGHT - 30.f));
+            int entity = world.CreateEnemy(x, y, types[random.Next() % 4], 0, Palette::BASE);
+
+            Velocity& velocity = *world.velocities.Get(entity);
+            velocity.action = (random.Next() & 1) ? Action::MOVE_LEFT : Action::MOVE_RIGHT;
+            velocity.falling = random.Next() % 3 == 0;
+        }
+
+        Scalar step = static_cast<Scalar>(1.f / 60.f);
+
+        // still in spawn order, so it goes first
+        if (mixedSelected)
+        {
+            Measure("EnemySwarm/mixed", count, count, [&]
+            {
+                for (int dense = 0; dense < world.velocities.Count(); dense++)
+                {
+                    int entity = world.velocities.EntityAt(dense);
+                    const EnemyArchetype& archetype = world.archetypes[world.brains.At(dense).type];
+                    Velocity& velocity = world.velocities.At(dense);
+                    Transform& transform = *world.transforms.Get(entity);
+
+                    Action::Type action = velocity.action;
+                    int movement = MovementDirection::NONE;
+                    if ((action & Action::MOVE_LEFT) && !(action & Action::MOVE_RIGHT))
+                    {
+                        transform.x -= velocity.runSpeed * step;
+                        movement |= MovementDirection::LEFT;
+                    }
+                    else if ((action & Action::MOVE_RIGHT) && !(action & Action::MOVE_LEFT))
+                    {
+                        transform.x += velocity.runSpeed * step;
+                        movement |= MovementDirection::RIGHT;
+                    }
+
+                    if (velocity.falling)
+                    {
+                        velocity.yVel += gravity * archetype.gravityScale * step;
+                    }
+
+                    if (velocity.yVel != 0)
+                    {
+                        movement |= velocity.yVel > 0 ? MovementDirection::DOWN : MovementDirection::UP;
+                    }
+
+                    transform.y += velocity.yVel * step;
+                    velocity.movement = static_cast<MovementDirection::Type>(movement);
+                    TickActorAnim(*world.sprites.Get(entity), *world.animations.Get(entity), velocity, 1.f / 60.f, archetype);
+                }
+                s_sink = world.animations.At(0).time;
+            });
+        }
+
+        if (groupedSelected)
+        {
+            Measure("EnemySwarm/grouped", count, count, [&]
+            {
+                MovementSystem(world, step);
+                ActorAnimationSystem(world, 1.f / 60.f);
+                s_sink = world.animations.At(0).time;
+            });
+        }
+    }
+
+    // Block animation over an array of Geo against block entities.
+    void BenchBlockAnim(int count)
+    {
+        bool classSelected = Selected("BlockAnim/class");
+        bool ecsSelected = Selected("BlockAnim/ecs");
+        if (!classSelected && !ecsSelected)
+        {
+            return;
+        }
+
+        Random random(static_cast<unsigned int>(count));
+        std::vector<Geo> blocks(count);
+        BenchmarkWorld& world = *m_pWorld;
+        world.Clear();
+        for (int index = 0; index < count; index++)
+        {
+            Scalar left = index % 1000 * 10;
+            Scalar top = index / 1000 * 10;
+            int type = static_cast<int>(random.Next() % Geo::BLOCK_TYPE_COUNT);
+            blocks[index].Initialize(left, top, left + 10, top + 10, 0, type);
+            world.CreateBlock(left, top, left + 10, top + 10, 0, type);
+        }
+
+        if (classSelected)
+        {
+            Measure("BlockAnim/class", count, count, [&]
+            {
+                for (Geo& geo : blocks)
+                {
+                    geo.TickAnim(1.f / 60.f);
+                }
+                s_sink = blocks[0].animTime;
+            });
+        }
+
+        if (ecsSelected)
+        {
+            Measure("BlockAnim/ecs", count, count, [&]
+            {
+                BlockAnimationSystem(world, 1.f / 60.f);
+                s_sink = world.animations.At(0).time;
+            });
+        }
+    }
+
+    // Candidate pairs among count actors walking back and forth, twenty to a
+    // screen, with SweepAndPrune keeping them sorted tick to tick and with the
+    // all-pairs loop it replaces.
+    void BenchActorPairs(int count)
+    {
+        bool sweepSelected = Selected("ActorPairs/sweep");
+        bool naiveSelected = Selected("ActorPairs/naive");
+        if (!sweepSelected && !naiveSelected)
+        {
+            return;
+        }
+
+        Random random(static_cast<unsigned int>(count));
+        float width = static_cast<float>(count) * (SCREEN_WIDTH / 20.f);
+        std::vector<D2D1_RECT_F> rects(count);
+        std::vector<float> speeds(count);
+        for (int index = 0; index < count; index++)
+        {
+            float x = random.Range(0.f, width - ENEMY_WIDTH);
+            float y = random.Range(0.f, SCREEN_HEIGHT - ENEMY_HEIGHT);
+            rects[index] = D2D1::RectF(x, y, x + ENEMY_WIDTH, y + ENEMY_HEIGHT);
+            speeds[index] = (random.Next() & 1) ? 45.f / 60.f : -45.f / 60.f;
+        }
+
+        auto step = [&]
+        {
+            for (int index = 0; index < count; index++)
+            {
+                D2D1_RECT_F& rect = rects[index];
+                if ((rect.left < 0.f && speeds[index] < 0.f) || (rect.right > width && speeds[index] > 0.f))
+                {
+                    speeds[index] = -speeds[index];
+                }
+
+                rect.left += speeds[index];
+                rect.right += speeds[index];
+            }
+        };
+
+        if (sweepSelected)
+        {
+            BenchmarkBroadphase& broadphase = *m_pBroadphase;
+            broadphase.Clear();
+            Measure("ActorPairs/sweep", count, count, [&]
+            {
+                step();
+                for (int index = 0; index < count; index++)
+                {
+                    broadphase.Update(index, rects[index]);
+                }
+
+                broadphase.Sort();
+                int pairs = 0;
+                broadphase.ForEachPair([&](int, int) { pairs++; });
+                s_sink = static_cast<float>(pairs);
+            });
+        }
+
+        // quadratic, too slow to sample at the largest size
+        if (naiveSelected && count < BENCHMARK_ENTITIES)
+        {
+            Measure("ActorPairs/naive", count, count, [&]
+            {
+                step();
+                int pairs = 0;
+                for (int first = 0; first < count; first++)
+                {
+                    for (int second = first + 1; second < count; second++)
+                    {
+                        const D2D1_RECT_F& a = rects[first];
+                        const D2D1_RECT_F& b = rects[second];
+                        if (a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom)
+                        {
+                            pairs++;
+                        }
+                    }
+                }
+
+                s_sink = static_cast<float>(pairs);
+            });
+        }
+    }
+
+    // Steady state of count live particles: every tick updates the pool and
+    // tops it back up with debris bursts, as a screen full of broken blocks
+    // would. The pool has to stay under PARTICLE_BUDGET_SECONDS per update at
+    // the largest size, about 10 ns per particle.
+    void BenchParticles(int count)
+    {
+        bool updateSelected = Selected("Particles/update");
+        bool rasterizeSelected = Selected("Particles/rasterize");
+        if (!updateSelected && !rasterizeSelected)
+        {
+            return;
+        }
+
+        ParticleSystem& particles = *m_pParticles;
+        particles.Clear();
+        particles.stats = ParticleStats();
+
+        ParticleBurst burst = { ParticleKind::DEBRIS, D2D1::RectF(0.f, 20.f, SCREEN_WIDTH, SCREEN_HEIGHT - 20.f) };
+        auto fill = [&]
+        {
+            while (particles.Count() < count && particles.Count() < particles.Cap())
+            {
+                particles.Emit(burst);
+            }
+        };
+
+        fill();
+
+        if (updateSelected)
+        {
+            Measure("Particles/update", count, count, [&]
+            {
+                particles.Update(1.f / 60.f, SCREEN_HEIGHT);
+                fill();
+            });
+
+            // the cap cuts the pool when updates run long, so the larger
+            // sizes would quietly measure fewer particles
+            if (particles.stats.overBudget > 0)
+            {
+                fprintf(stderr, "Particles/update %d: over budget %d times, cap %d\n", count, particles.stats.overBudget, particles.Cap());
+            }
+        }
+
+        if (rasterizeSelected)
+        {
+            fill();
+            Measure("Particles/rasterize", count, count, [&]
+            {
+                s_sink = static_cast<float>(particles.Rasterize(0.f)[0]);
+            });
+        }
+    }
+
+    // Layout of a full world, as reported by the game on its first frame.
+    StateLayoutStats GetLayout() const
+    {
+        const_cast<SimBenchmark*>(this)->BuildWorld(NUM_GEO);
+        return GetStateLayoutStats(m_pPlatformer->m_gameState);
+    }
+
+    int m_samples;
+    const char* m_filter;
+    int m_resultCount;
+    BenchmarkResult m_results[BENCHMARK_MAX_RESULTS];
+    Platformer* m_pPlatformer;
+    BenchmarkWorld* m_pWorld;
+    BenchmarkBroadphase* m_pBroadphase;
+    ParticleSystem* m_pParticles;
+};
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-scenarios") == 0)
+    {
+        return RunScenarios(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-serve") == 0)
+    {
+        return RunSimServer(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-savestate") == 0)
+    {
+        return RunSaveStates(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-deviceloss") == 0)
+    {
+        return RunDeviceLoss(argc - 1, argv + 1);
+    }
+
+    int samples = BENCHMARK_DEFAULT_SAMPLES;
+    const char* filter = NULL;
+    const char* jsonPath = NULL;
+
+    for (int index = 1; index < argc; index++)
+    {
+        if (strcmp(argv[index], "-samples") == 0 && index + 1 < argc)
+        {
+            samples = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-filter") == 0 && index + 1 < argc)
+        {
+            filter = argv[++index];
+        }
+        else if (strcmp(argv[index], "-json") == 0 && index + 1 < argc)
+        {
+            jsonPath = argv[++index];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-samples <n>] [-filter <text>] [-json <file>|-]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (samples < 2)
+    {
+        samples = 2;
+    }
+
+    SimBenchmark benchmark(samples, filter);
+    benchmark.Run();
+
+    if (jsonPath == NULL)
+    {
+        benchmark.PrintResults();
+        return 0;
+    }
+
+    FILE* pFile = stdout;
+    if (strcmp(jsonPath, "-") != 0 && fopen_s(&pFile, jsonPath, "w") != 0)
+    {
+        fprintf(stderr, "could not open %s\n", jsonPath);
+        return 1;
+    }
+
+    bool written = benchmark.WriteJson(pFile);
+    if (pFile != stdout)
+    {
+        fclose(pFile);
+        benchmark.PrintResults();
+    }
+
+    return written ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "LevelGenerator.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Length of the generated levels, the tilemap ends past it.
+#define BENCHMARK_LEVEL_WIDTH 10000
+
+inline double GetSeconds()
+{
+    static LARGE_INTEGER frequency = {};
+    if (frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return static_cast<double>(now.QuadPart) / static_cast<double>(frequency.QuadPart);
+}
+
+// Generated level stream. Exits when the generator makes a stream the game
+// would reject, nothing measured on it would mean anything.
+inline std::vector<short> BuildLevelStream(const LevelGenParams& params)
+{
+    std::vector<short> stream;
+    GenerateLevel(params, stream);
+
+    size_t errorOffset = 0;
+    LevelError::Type error = ValidateLevelStream(stream.data(), stream.size(), errorOffset);
+    if (error != LevelError::NONE)
+    {
+        fprintf(stderr, "generated level is invalid: error %d at short %u\n", error, static_cast<unsigned int>(errorOffset));
+        exit(1);
+    }
+
+    return stream;
+}
+
+// Default level over BENCHMARK_LEVEL_WIDTH with about entityCount geo and
+// enemies, seeded by the count.
+inline std::vector<short> BuildLevelStream(int entityCount)
+{
+    LevelGenParams params = DefaultLevelGenParams(static_cast<unsigned int>(entityCount));
+    params.length = BENCHMARK_LEVEL_WIDTH;
+    SetLevelGenEntityCount(params, entityCount);
+    return BuildLevelStream(params);
+}
+
+inline void HashBytes(unsigned long long& hash, const void* pData, size_t size)
+{
+    const unsigned char* pBytes = static_cast<const unsigned char*>(pData);
+    for (size_t index = 0; index < size; index++)
+    {
+        hash = (hash ^ pBytes[index]) * 1099511628211ull;
+    }
+}
+
+// FNV-1a over the player, the camera and every live enemy and geo. Equal
+// hashes mean two games played out the same.
+inline unsigned long long HashGameState(const GameState& gameState)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    const EntityWorld<NUM_ACTORS>& world = gameState.world;
+    HashBytes(hash, world.transforms.Get(PLAYER_ENTITY), sizeof(Transform));
+    HashBytes(hash, &world.velocities.Get(PLAYER_ENTITY)->yVel, sizeof(Scalar));
+    HashBytes(hash, &gameState.cameraScroll, sizeof(Scalar));
+
+    for (int dense = 0; dense < world.transforms.Count(); dense++)
+    {
+        if (world.transforms.EntityAt(dense) != PLAYER_ENTITY)
+        {
+            HashBytes(hash, &world.transforms.At(dense), sizeof(Transform));
+        }
+    }
+
+    for (const Geo& geo : gameState.geo)
+    {
+        if (geo.active)
+        {
+            SimRect rect = geo.GetRect();
+            HashBytes(hash, &rect, sizeof(rect));
+            HashBytes(hash, &geo.gameplayState, sizeof(geo.gameplayState));
+        }
+    }
+
+    return hash;
+}
+
+// Run the scenarios, see Scenarios.cpp. Returns the process exit code.
+int RunScenarios(int argc, char** argv);
+
+// Serve the sim to viewers, see SimServer.cpp. Returns the process exit code.
+int RunSimServer(int argc, char** argv);
+
+// Save and load the game every tick, see SaveStates.cpp. Returns the process
+// exit code.
+int RunSaveStates(int argc, char** argv);
+
+// Lose the device over and over and check the level textures come back, see
+// DeviceLoss.cpp. Returns the process exit code.
+int RunDeviceLoss(int argc, char** argv);
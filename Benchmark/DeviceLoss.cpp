@@ -0,0 +1,253 @@
+// Device loss recovery of the level textures, see Platformer/TextureCache.h.
+// Binds every texture slot, draws them with a spread of palettes, then loses
+// the device over and over: each time everything the lost device made has to
+// be released, and Restore on the new device has to rebuild exactly the
+// (slot, palette) pairs in use, so that drawing afterwards creates nothing.
+//
+// Usage: benchmark -deviceloss [-rounds <n>]
+//
+// The device is HeadlessDeviceTarget from Headless/d2d1.h, so this only runs
+// in the headless build; the recovery times are of expanding the pixels and
+// the bookkeeping, without an upload to a GPU.
+//
+// Exit code 1 when a pair is not restored, one is restored that was not in
+// use, or a resource of a lost device is still alive.
+
+#include "Benchmark.h"
+
+#define DEVICE_LOSS_DEFAULT_ROUNDS 100
+
+// Pixels of every test texture, about the size of the game's.
+#define DEVICE_LOSS_TEXTURE_SIZE 64
+
+#ifdef HEADLESS_D2D1
+
+static const UINT s_deviceLossPalette[] = { 0x00000000, 0xFF0000FF, 0xFF00FF00, 0xFFFF0000 };
+
+class DeviceLossCheck
+{
+public:
+    DeviceLossCheck() :
+        m_pLoader(new AssetLoader()),
+        m_pCache(new TextureCache<NUM_TEXTURES>()),
+        m_pTarget(new HeadlessDeviceTarget()),
+        m_used(),
+        m_usedCount(0)
+    {
+        // half the textures BGRA, half indexed, as the cooker leaves them
+        for (int asset = 0; asset < NUM_IMAGE_ASSETS; asset++)
+        {
+            DecodedImage image = {};
+            bool indexed = (asset & 1) != 0;
+            image.width = DEVICE_LOSS_TEXTURE_SIZE;
+            image.height = DEVICE_LOSS_TEXTURE_SIZE;
+            image.stride = DEVICE_LOSS_TEXTURE_SIZE * (indexed ? 1 : sizeof(UINT));
+            image.pixels = static_cast<BYTE*>(malloc(image.stride * image.height));
+            image.ownsPixels = true;
+            if (indexed)
+            {
+                image.palette = s_deviceLossPalette;
+                image.paletteSize = sizeof(s_deviceLossPalette) / sizeof(s_deviceLossPalette[0]);
+            }
+
+            for (UINT index = 0; index < image.stride * image.height; index++)
+            {
+                image.pixels[index] = static_cast<BYTE>(indexed ? index % image.paletteSize : index);
+            }
+
+            m_pLoader->Store(TEXTURE_OFFSET + 1 + asset, image);
+        }
+    }
+
+    ~DeviceLossCheck()
+    {
+        delete m_pCache;
+        delete m_pTarget;
+        delete m_pLoader;
+    }
+
+    DeviceLossCheck(const DeviceLossCheck&) = delete;
+    DeviceLossCheck& operator=(const DeviceLossCheck&) = delete;
+
+    // Bind and draw every slot. The last slot is rebound after it was drawn,
+    // what it drew before must not come back.
+    bool Draw()
+    {
+        for (int slot = 0; slot < NUM_TEXTURES; slot++)
+        {
+            m_pCache->Bind(slot, TEXTURE_OFFSET + 1 + slot % NUM_IMAGE_ASSETS);
+            for (int palette = 0; palette < Palette::COUNT; palette++)
+            {
+                if (palette == Palette::BASE || (slot + palette) % 3 == 0)
+                {
+                    if (!Use(slot, static_cast<Palette::Type>(palette)))
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        int last = NUM_TEXTURES - 1;
+        m_pCache->Bind(last, TEXTURE_OFFSET + 1 + (last + 1) % NUM_IMAGE_ASSETS);
+        for (int palette = 0; palette < Palette::COUNT; palette++)
+        {
+            if (m_used[last][palette])
+            {
+                m_used[last][palette] = false;
+                m_usedCount--;
+            }
+        }
+
+        return Use(last, Palette::BASE);
+    }
+
+    // Lose the device and restore on a new one. Returns the seconds Restore
+    // took, or a negative number when the check failed.
+    double LoseDevice()
+    {
+        m_pTarget->Lose();
+        m_pCache->OnDeviceLost();
+        if (m_pTarget->live != 0)
+        {
+            fprintf(stderr, "%d bitmaps and brushes of the lost device are still alive\n", m_pTarget->live);
+            return -1.0;
+        }
+
+        delete m_pTarget;
+        m_pTarget = new HeadlessDeviceTarget();
+
+        double start = GetSeconds();
+        int restored = m_pCache->Restore(m_pTarget, *m_pLoader);
+        double end = GetSeconds();
+
+        const TextureCacheStats& stats = m_pCache->stats;
+        if (restored != m_usedCount || stats.usedBitmaps != m_usedCount)
+        {
+            fprintf(stderr, "%d of %d pairs restored, %d expected\n", restored, stats.usedBitmaps, m_usedCount);
+            return -1.0;
+        }
+
+        // a bitmap and a brush for every pair in use, and nothing else
+        if (m_pTarget->created != 2 * m_usedCount)
+        {
+            fprintf(stderr, "restore made %d resources for %d pairs\n", m_pTarget->created, m_usedCount);
+            return -1.0;
+        }
+
+        int created = m_pTarget->created;
+        for (int slot = 0; slot < NUM_TEXTURES; slot++)
+        {
+            for (int palette = 0; palette < Palette::COUNT; palette++)
+            {
+                if (m_used[slot][palette]
+                    && !m_pTarget->Owns(m_pCache->GetBrush(m_pTarget, *m_pLoader, slot, static_cast<Palette::Type>(palette))))
+                {
+                    fprintf(stderr, "slot %d palette %d is not on the new device\n", slot, palette);
+                    return -1.0;
+                }
+            }
+        }
+
+        if (m_pTarget->created != created)
+        {
+            fprintf(stderr, "drawing after the restore made %d more resources\n", m_pTarget->created - created);
+            return -1.0;
+        }
+
+        return end - start;
+    }
+
+    int GetUsedCount() const
+    {
+        return m_usedCount;
+    }
+
+private:
+    bool Use(int slot, Palette::Type palette)
+    {
+        if (!m_pTarget->Owns(m_pCache->GetBrush(m_pTarget, *m_pLoader, slot, palette)))
+        {
+            fprintf(stderr, "slot %d palette %d did not draw\n", slot, palette);
+            return false;
+        }
+
+        if (!m_used[slot][palette])
+        {
+            m_used[slot][palette] = true;
+            m_usedCount++;
+        }
+
+        return true;
+    }
+
+    AssetLoader* m_pLoader;
+    TextureCache<NUM_TEXTURES>* m_pCache;
+    HeadlessDeviceTarget* m_pTarget;
+
+    // pairs drawn since their slot was last bound
+    bool m_used[NUM_TEXTURES][Palette::COUNT];
+    int m_usedCount;
+};
+
+int RunDeviceLoss(int argc, char** argv)
+{
+    int rounds = DEVICE_LOSS_DEFAULT_ROUNDS;
+    for (int index = 1; index < argc; index++)
+    {
+        if (strcmp(argv[index], "-rounds") == 0 && index + 1 < argc)
+        {
+            rounds = atoi(argv[++index]);
+        }
+        else
+        {
+            fprintf(stderr, "usage: benchmark -deviceloss [-rounds <n>]\n");
+            return 1;
+        }
+    }
+
+    if (rounds < 1)
+    {
+        rounds = 1;
+    }
+
+    DeviceLossCheck* pCheck = new DeviceLossCheck();
+    bool failed = !pCheck->Draw();
+    double total = 0.0;
+    double worst = 0.0;
+    for (int round = 0; round < rounds && !failed; round++)
+    {
+        double seconds = pCheck->LoseDevice();
+        if (seconds < 0.0)
+        {
+            fprintf(stderr, "device loss %d failed\n", round + 1);
+            failed = true;
+            break;
+        }
+
+        total += seconds;
+        worst = seconds > worst ? seconds : worst;
+    }
+
+    if (!failed)
+    {
+        printf("%d device losses, all %d texture pairs in use restored each time, recovery mean %.3f ms, worst %.3f ms\n",
+            rounds,
+            pCheck->GetUsedCount(),
+            total / rounds * 1e3,
+            worst * 1e3);
+    }
+
+    delete pCheck;
+    return failed ? 1 : 0;
+}
+
+#else
+
+int RunDeviceLoss(int, char**)
+{
+    fprintf(stderr, "-deviceloss needs the stand-in device of the headless build, see Headless/d2d1.h\n");
+    return 1;
+}
+
+#endif
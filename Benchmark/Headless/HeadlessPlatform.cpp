@@ -0,0 +1,5 @@
+#include <windows.h>
+
+// Stands in for the image base the linker provides on Windows.
+EXTERN_C IMAGE_DOS_HEADER __ImageBase;
+IMAGE_DOS_HEADER __ImageBase = {};
@@ -0,0 +1,240 @@
+#pragma once
+#include <windows.h>
+
+// Direct2D types the game headers use. There is no device: the factory and
+// the geometries the sim makes exist, every render target and device resource
+// fails to create and drawing does nothing. HeadlessDeviceTarget at the end
+// stands in for one where a check needs device resources.
+
+#define HEADLESS_D2D1 1
+
+struct D2D_RECT_F { float left, top, right, bottom; };
+struct D2D_RECT_U { UINT32 left, top, right, bottom; };
+struct D2D_SIZE_F { float width, height; };
+struct D2D_SIZE_U { UINT32 width, height; };
+struct D2D_POINT_2F { float x, y; };
+struct D2D_POINT_2U { UINT32 x, y; };
+struct D2D_MATRIX_3X2_F { float _11, _12, _21, _22, _31, _32; };
+struct D2D1_COLOR_F { float r, g, b, a; };
+
+typedef D2D_RECT_F D2D1_RECT_F;
+typedef D2D_RECT_U D2D1_RECT_U;
+typedef D2D_SIZE_F D2D1_SIZE_F;
+typedef D2D_SIZE_U D2D1_SIZE_U;
+typedef D2D_POINT_2F D2D1_POINT_2F;
+typedef D2D_POINT_2U D2D1_POINT_2U;
+typedef D2D_MATRIX_3X2_F D2D1_MATRIX_3X2_F;
+
+enum D2D1_FACTORY_TYPE { D2D1_FACTORY_TYPE_SINGLE_THREADED, D2D1_FACTORY_TYPE_MULTI_THREADED };
+enum D2D1_EXTEND_MODE { D2D1_EXTEND_MODE_CLAMP, D2D1_EXTEND_MODE_WRAP, D2D1_EXTEND_MODE_MIRROR };
+enum D2D1_PRESENT_OPTIONS { D2D1_PRESENT_OPTIONS_NONE, D2D1_PRESENT_OPTIONS_RETAIN_CONTENTS, D2D1_PRESENT_OPTIONS_IMMEDIATELY };
+enum D2D1_ALPHA_MODE { D2D1_ALPHA_MODE_UNKNOWN, D2D1_ALPHA_MODE_PREMULTIPLIED, D2D1_ALPHA_MODE_STRAIGHT, D2D1_ALPHA_MODE_IGNORE };
+enum D2D1_BITMAP_INTERPOLATION_MODE { D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, D2D1_BITMAP_INTERPOLATION_MODE_LINEAR };
+enum D2D1_ANTIALIAS_MODE { D2D1_ANTIALIAS_MODE_PER_PRIMITIVE, D2D1_ANTIALIAS_MODE_ALIASED };
+enum D2D1_RENDER_TARGET_TYPE { D2D1_RENDER_TARGET_TYPE_DEFAULT, D2D1_RENDER_TARGET_TYPE_SOFTWARE, D2D1_RENDER_TARGET_TYPE_HARDWARE };
+enum DXGI_FORMAT { DXGI_FORMAT_UNKNOWN = 0, DXGI_FORMAT_A8_UNORM = 65, DXGI_FORMAT_B8G8R8A8_UNORM = 87 };
+
+struct D2D1_PIXEL_FORMAT { DXGI_FORMAT format; D2D1_ALPHA_MODE alphaMode; };
+struct D2D1_BITMAP_PROPERTIES { D2D1_PIXEL_FORMAT pixelFormat; float dpiX, dpiY; };
+struct D2D1_RENDER_TARGET_PROPERTIES { D2D1_RENDER_TARGET_TYPE type; D2D1_PIXEL_FORMAT pixelFormat; float dpiX, dpiY; };
+struct D2D1_HWND_RENDER_TARGET_PROPERTIES { HWND hwnd; D2D1_SIZE_U pixelSize; D2D1_PRESENT_OPTIONS presentOptions; };
+
+#define D2DERR_WRONG_STATE ((HRESULT)0x88990001L)
+#define D2DERR_RECREATE_TARGET ((HRESULT)0x8899000CL)
+
+struct IDWriteTextFormat;
+
+struct ID2D1Resource : IUnknown {};
+
+struct ID2D1Image : ID2D1Resource {};
+
+struct ID2D1Bitmap : ID2D1Image
+{
+    D2D1_SIZE_F GetSize() { return D2D1_SIZE_F(); }
+    D2D1_SIZE_U GetPixelSize() { return D2D1_SIZE_U(); }
+    HRESULT CopyFromMemory(const D2D1_RECT_U*, const void*, UINT32) { return E_NOTIMPL; }
+};
+
+struct ID2D1Brush : ID2D1Resource
+{
+    void SetTransform(const D2D1_MATRIX_3X2_F&) {}
+    void SetOpacity(float) {}
+};
+
+struct ID2D1SolidColorBrush : ID2D1Brush {};
+
+struct ID2D1BitmapBrush : ID2D1Brush
+{
+    void SetExtendModeX(D2D1_EXTEND_MODE) {}
+    void SetExtendModeY(D2D1_EXTEND_MODE) {}
+    void SetInterpolationMode(D2D1_BITMAP_INTERPOLATION_MODE) {}
+};
+
+struct ID2D1Geometry : ID2D1Resource {};
+
+struct ID2D1RectangleGeometry : ID2D1Geometry {};
+
+struct ID2D1BitmapRenderTarget;
+
+struct ID2D1RenderTarget : ID2D1Resource
+{
+    HRESULT CreateSolidColorBrush(const D2D1_COLOR_F&, ID2D1SolidColorBrush** ppBrush) { *ppBrush = NULL; return E_NOTIMPL; }
+    virtual HRESULT CreateBitmapBrush(ID2D1Bitmap*, ID2D1BitmapBrush** ppBrush) { *ppBrush = NULL; return E_NOTIMPL; }
+    virtual HRESULT CreateBitmap(D2D1_SIZE_U, const void*, UINT32, const D2D1_BITMAP_PROPERTIES&, ID2D1Bitmap** ppBitmap) { *ppBitmap = NULL; return E_NOTIMPL; }
+    HRESULT CreateCompatibleRenderTarget(D2D1_SIZE_F, ID2D1BitmapRenderTarget** ppTarget) { *ppTarget = NULL; return E_NOTIMPL; }
+    HRESULT CreateCompatibleRenderTarget(D2D1_SIZE_F, D2D1_SIZE_U, ID2D1BitmapRenderTarget** ppTarget) { *ppTarget = NULL; return E_NOTIMPL; }
+    void BeginDraw() {}
+    HRESULT EndDraw() { return S_OK; }
+    void SetTransform(const D2D1_MATRIX_3X2_F&) {}
+    void GetTransform(D2D1_MATRIX_3X2_F* pTransform) { *pTransform = D2D1_MATRIX_3X2_F(); }
+    void Clear(const D2D1_COLOR_F&) {}
+    D2D1_SIZE_F GetSize() { return D2D1_SIZE_F(); }
+    D2D1_SIZE_U GetPixelSize() { return D2D1_SIZE_U(); }
+    void DrawLine(D2D1_POINT_2F, D2D1_POINT_2F, ID2D1Brush*, float = 1.f) {}
+    void DrawRectangle(const D2D1_RECT_F&, ID2D1Brush*, float = 1.f) {}
+    void FillRectangle(const D2D1_RECT_F&, ID2D1Brush*) {}
+    void FillGeometry(ID2D1Geometry*, ID2D1Brush*) {}
+    void DrawBitmap(ID2D1Bitmap*, const D2D1_RECT_F&, float = 1.f, D2D1_BITMAP_INTERPOLATION_MODE = D2D1_BITMAP_INTERPOLATION_MODE_LINEAR, const D2D1_RECT_F* = NULL) {}
+    void DrawTextW(const WCHAR*, UINT32, IDWriteTextFormat*, const D2D1_RECT_F&, ID2D1Brush*) {}
+    void PushAxisAlignedClip(const D2D1_RECT_F&, D2D1_ANTIALIAS_MODE) {}
+    void PopAxisAlignedClip() {}
+    void SetAntialiasMode(D2D1_ANTIALIAS_MODE) {}
+};
+
+struct ID2D1BitmapRenderTarget : ID2D1RenderTarget
+{
+    HRESULT GetBitmap(ID2D1Bitmap** ppBitmap) { *ppBitmap = NULL; return E_NOTIMPL; }
+};
+
+struct ID2D1HwndRenderTarget : ID2D1RenderTarget
+{
+    HRESULT Resize(const D2D1_SIZE_U&) { return E_NOTIMPL; }
+};
+
+// Geometries hold nothing, so every one is the same shared object.
+struct ID2D1Factory : IUnknown
+{
+    HRESULT CreateHwndRenderTarget(const D2D1_RENDER_TARGET_PROPERTIES&, const D2D1_HWND_RENDER_TARGET_PROPERTIES&, ID2D1HwndRenderTarget** ppTarget) { *ppTarget = NULL; return E_NOTIMPL; }
+
+    HRESULT CreateRectangleGeometry(const D2D1_RECT_F&, ID2D1RectangleGeometry** ppGeometry)
+    {
+        static ID2D1RectangleGeometry s_geometry;
+        *ppGeometry = &s_geometry;
+        return S_OK;
+    }
+};
+
+// One factory for the process, Release leaves it alive like every stub.
+inline HRESULT D2D1CreateFactory(D2D1_FACTORY_TYPE, ID2D1Factory** ppFactory)
+{
+    static ID2D1Factory s_factory;
+    *ppFactory = &s_factory;
+    return S_OK;
+}
+
+// Render target that makes real bitmaps and brushes, counted on the target
+// that made them, so a check can tell which device a resource belongs to and
+// that none outlive it. After Lose every create fails as on a lost device.
+struct HeadlessDeviceTarget : ID2D1RenderTarget
+{
+    struct Bitmap : ID2D1Bitmap
+    {
+        HeadlessDeviceTarget* pTarget;
+        ULONG refs;
+
+        ULONG AddRef() override { return ++refs; }
+
+        ULONG Release() override
+        {
+            ULONG remaining = --refs;
+            if (remaining == 0)
+            {
+                pTarget->live--;
+                delete this;
+            }
+
+            return remaining;
+        }
+    };
+
+    struct BitmapBrush : ID2D1BitmapBrush
+    {
+        HeadlessDeviceTarget* pTarget;
+        ID2D1Bitmap* pBitmap;
+        ULONG refs;
+
+        ULONG AddRef() override { return ++refs; }
+
+        ULONG Release() override
+        {
+            ULONG remaining = --refs;
+            if (remaining == 0)
+            {
+                pBitmap->Release();
+                pTarget->live--;
+                delete this;
+            }
+
+            return remaining;
+        }
+    };
+
+    HeadlessDeviceTarget() :
+        created(0),
+        live(0),
+        lost(false)
+    {
+    }
+
+    HRESULT CreateBitmap(D2D1_SIZE_U, const void*, UINT32, const D2D1_BITMAP_PROPERTIES&, ID2D1Bitmap** ppBitmap) override
+    {
+        *ppBitmap = NULL;
+        if (lost)
+        {
+            return D2DERR_RECREATE_TARGET;
+        }
+
+        Bitmap* pBitmap = new Bitmap();
+        pBitmap->pTarget = this;
+        pBitmap->refs = 1;
+        created++;
+        live++;
+        *ppBitmap = pBitmap;
+        return S_OK;
+    }
+
+    HRESULT CreateBitmapBrush(ID2D1Bitmap* pBitmap, ID2D1BitmapBrush** ppBrush) override
+    {
+        *ppBrush = NULL;
+        if (lost)
+        {
+            return D2DERR_RECREATE_TARGET;
+        }
+
+        BitmapBrush* pBrush = new BitmapBrush();
+        pBrush->pTarget = this;
+        pBrush->pBitmap = pBitmap;
+        pBrush->refs = 1;
+        pBitmap->AddRef();
+        created++;
+        live++;
+        *ppBrush = pBrush;
+        return S_OK;
+    }
+
+    // Whether a resource was made here, and not by another target.
+    bool Owns(ID2D1BitmapBrush* pBrush) const
+    {
+        return pBrush && static_cast<BitmapBrush*>(pBrush)->pTarget == this;
+    }
+
+    void Lose()
+    {
+        lost = true;
+    }
+
+    // bitmaps and brushes made, and how many are still alive
+    int created;
+    int live;
+    bool lost;
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <d2d1.h>
+
+namespace D2D1
+{
+    struct ColorF : D2D1_COLOR_F
+    {
+        enum Enum
+        {
+            Black = 0x000000,
+            CornflowerBlue = 0x6495ED,
+            LightSlateGray = 0x778899,
+            MediumPurple = 0x9370DB,
+            White = 0xFFFFFF,
+        };
+
+        ColorF(UINT32 rgb, float alpha = 1.f)
+        {
+            r = static_cast<float>((rgb >> 16) & 0xFF) / 255.f;
+            g = static_cast<float>((rgb >> 8) & 0xFF) / 255.f;
+            b = static_cast<float>(rgb & 0xFF) / 255.f;
+            a = alpha;
+        }
+
+        ColorF(float red, float green, float blue, float alpha = 1.f)
+        {
+            r = red;
+            g = green;
+            b = blue;
+            a = alpha;
+        }
+    };
+
+    struct Matrix3x2F : D2D1_MATRIX_3X2_F
+    {
+        Matrix3x2F()
+        {
+            *this = Identity();
+        }
+
+        Matrix3x2F(float m11, float m12, float m21, float m22, float m31, float m32)
+        {
+            _11 = m11;
+            _12 = m12;
+            _21 = m21;
+            _22 = m22;
+            _31 = m31;
+            _32 = m32;
+        }
+
+        static Matrix3x2F Identity()
+        {
+            return Matrix3x2F(1.f, 0.f, 0.f, 1.f, 0.f, 0.f);
+        }
+
+        static Matrix3x2F Translation(D2D1_SIZE_F size)
+        {
+            return Matrix3x2F(1.f, 0.f, 0.f, 1.f, size.width, size.height);
+        }
+
+        static Matrix3x2F Translation(float x, float y)
+        {
+            return Matrix3x2F(1.f, 0.f, 0.f, 1.f, x, y);
+        }
+
+        static Matrix3x2F Scale(D2D1_SIZE_F size, D2D1_POINT_2F center = D2D1_POINT_2F())
+        {
+            return Matrix3x2F(size.width, 0.f, 0.f, size.height,
+                center.x - size.width * center.x, center.y - size.height * center.y);
+        }
+    };
+
+    inline D2D1_RECT_F RectF(float left = 0.f, float top = 0.f, float right = 0.f, float bottom = 0.f) { return D2D1_RECT_F{ left, top, right, bottom }; }
+    inline D2D1_RECT_U RectU(UINT32 left = 0, UINT32 top = 0, UINT32 right = 0, UINT32 bottom = 0) { return D2D1_RECT_U{ left, top, right, bottom }; }
+    inline D2D1_SIZE_F SizeF(float width = 0.f, float height = 0.f) { return D2D1_SIZE_F{ width, height }; }
+    inline D2D1_SIZE_U SizeU(UINT32 width = 0, UINT32 height = 0) { return D2D1_SIZE_U{ width, height }; }
+    inline D2D1_POINT_2F Point2F(float x = 0.f, float y = 0.f) { return D2D1_POINT_2F{ x, y }; }
+    inline D2D1_POINT_2U Point2U(UINT32 x = 0, UINT32 y = 0) { return D2D1_POINT_2U{ x, y }; }
+
+    inline D2D1_PIXEL_FORMAT PixelFormat(DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN, D2D1_ALPHA_MODE alphaMode = D2D1_ALPHA_MODE_UNKNOWN)
+    {
+        return D2D1_PIXEL_FORMAT{ format, alphaMode };
+    }
+
+    inline D2D1_BITMAP_PROPERTIES BitmapProperties(const D2D1_PIXEL_FORMAT& pixelFormat = D2D1_PIXEL_FORMAT(), float dpiX = 96.f, float dpiY = 96.f)
+    {
+        return D2D1_BITMAP_PROPERTIES{ pixelFormat, dpiX, dpiY };
+    }
+
+    inline D2D1_RENDER_TARGET_PROPERTIES RenderTargetProperties(D2D1_RENDER_TARGET_TYPE type = D2D1_RENDER_TARGET_TYPE_DEFAULT)
+    {
+        D2D1_RENDER_TARGET_PROPERTIES properties = D2D1_RENDER_TARGET_PROPERTIES();
+        properties.type = type;
+        return properties;
+    }
+
+    inline D2D1_HWND_RENDER_TARGET_PROPERTIES HwndRenderTargetProperties(HWND hwnd, D2D1_SIZE_U pixelSize = D2D1_SIZE_U(), D2D1_PRESENT_OPTIONS presentOptions = D2D1_PRESENT_OPTIONS_NONE)
+    {
+        return D2D1_HWND_RENDER_TARGET_PROPERTIES{ hwnd, pixelSize, presentOptions };
+    }
+}
+
+inline D2D1::Matrix3x2F operator*(const D2D1_MATRIX_3X2_F& left, const D2D1_MATRIX_3X2_F& right)
+{
+    return D2D1::Matrix3x2F(
+        left._11 * right._11 + left._12 * right._21,
+        left._11 * right._12 + left._12 * right._22,
+        left._21 * right._11 + left._22 * right._21,
+        left._21 * right._12 + left._22 * right._22,
+        left._31 * right._11 + left._32 * right._21 + right._31,
+        left._31 * right._12 + left._32 * right._22 + right._32);
+}
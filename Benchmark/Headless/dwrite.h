@@ -0,0 +1,28 @@
+#pragma once
+#include <windows.h>
+
+enum DWRITE_FACTORY_TYPE { DWRITE_FACTORY_TYPE_SHARED };
+enum DWRITE_FONT_WEIGHT { DWRITE_FONT_WEIGHT_NORMAL = 400 };
+enum DWRITE_FONT_STYLE { DWRITE_FONT_STYLE_NORMAL };
+enum DWRITE_FONT_STRETCH { DWRITE_FONT_STRETCH_NORMAL = 5 };
+enum DWRITE_TEXT_ALIGNMENT { DWRITE_TEXT_ALIGNMENT_LEADING, DWRITE_TEXT_ALIGNMENT_TRAILING, DWRITE_TEXT_ALIGNMENT_CENTER };
+enum DWRITE_PARAGRAPH_ALIGNMENT { DWRITE_PARAGRAPH_ALIGNMENT_NEAR, DWRITE_PARAGRAPH_ALIGNMENT_FAR, DWRITE_PARAGRAPH_ALIGNMENT_CENTER };
+
+struct IDWriteFontCollection;
+
+struct IDWriteTextFormat : IUnknown
+{
+    HRESULT SetTextAlignment(DWRITE_TEXT_ALIGNMENT) { return E_NOTIMPL; }
+    HRESULT SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT) { return E_NOTIMPL; }
+};
+
+struct IDWriteFactory : IUnknown
+{
+    HRESULT CreateTextFormat(const WCHAR*, IDWriteFontCollection*, DWRITE_FONT_WEIGHT, DWRITE_FONT_STYLE, DWRITE_FONT_STRETCH, float, const WCHAR*, IDWriteTextFormat** ppFormat) { *ppFormat = NULL; return E_NOTIMPL; }
+};
+
+inline HRESULT DWriteCreateFactory(DWRITE_FACTORY_TYPE, REFIID, IUnknown** ppFactory)
+{
+    *ppFactory = NULL;
+    return E_NOTIMPL;
+}
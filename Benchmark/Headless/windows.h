@@ -0,0 +1,249 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+// Just enough of the Win32 API for the game headers to build without a
+// display. Windows, messages and resources don't exist, so the game runs on
+// its embedded levels, see Benchmark.cpp.
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define WINAPI
+#define CALLBACK
+#define STDMETHODCALLTYPE
+#define EXTERN_C extern "C"
+#define UNREFERENCED_PARAMETER(p) (void)(p)
+
+typedef int HRESULT;
+typedef int BOOL;
+typedef int INT;
+typedef long LONG;
+typedef long long LONGLONG;
+typedef unsigned long ULONG;
+typedef unsigned long DWORD;
+typedef unsigned int UINT;
+typedef unsigned int UINT32;
+typedef uint64_t UINT64;
+typedef unsigned short WORD;
+typedef unsigned char BYTE;
+typedef float FLOAT;
+typedef size_t SIZE_T;
+typedef intptr_t LONG_PTR;
+typedef uintptr_t ULONG_PTR;
+typedef uintptr_t WPARAM;
+typedef intptr_t LPARAM;
+typedef intptr_t LRESULT;
+typedef void* LPVOID;
+typedef char* LPSTR;
+typedef wchar_t WCHAR;
+typedef wchar_t* LPWSTR;
+typedef const wchar_t* LPCWSTR;
+
+typedef struct HWND__* HWND;
+typedef struct HINSTANCE__* HINSTANCE;
+typedef HINSTANCE HMODULE;
+typedef struct HRSRC__* HRSRC;
+typedef struct HCURSOR__* HCURSOR;
+typedef void* HGLOBAL;
+typedef void* HANDLE;
+
+struct GUID
+{
+    unsigned long data;
+};
+typedef GUID IID;
+typedef const GUID& REFIID;
+#define __uuidof(x) GUID()
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_POINTER ((HRESULT)0x80004003L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define TRUE 1
+#define FALSE 0
+
+typedef union
+{
+    struct
+    {
+        DWORD LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* pCount)
+{
+    pCount->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return TRUE;
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* pFrequency)
+{
+    pFrequency->QuadPart = 1000000000;
+    return TRUE;
+}
+
+inline DWORD GetCurrentThreadId()
+{
+    return static_cast<DWORD>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+}
+
+inline void OutputDebugStringA(const char* text)
+{
+    fputs(text, stderr);
+}
+
+inline void OutputDebugStringW(const wchar_t* text)
+{
+    fputws(text, stderr);
+}
+
+inline int fopen_s(FILE** ppFile, const char* name, const char* mode)
+{
+    *ppFile = fopen(name, mode);
+    return *ppFile ? 0 : 1;
+}
+
+// Heap and COM
+
+#define HeapEnableTerminationOnCorruption 1
+
+inline BOOL HeapSetInformation(HANDLE, int, void*, SIZE_T) { return TRUE; }
+inline HRESULT CoInitialize(void*) { return S_OK; }
+inline void CoUninitialize() {}
+
+struct IUnknown
+{
+    virtual ~IUnknown() {}
+    virtual HRESULT QueryInterface(REFIID, void**) { return E_NOTIMPL; }
+    virtual ULONG AddRef() { return 1; }
+    virtual ULONG Release() { return 0; }
+};
+
+// Resources, none are linked in
+
+typedef struct
+{
+    WORD e_magic;
+} IMAGE_DOS_HEADER;
+
+#define MAKEINTRESOURCE(i) ((LPCWSTR)((ULONG_PTR)((WORD)(i))))
+
+inline HRSRC FindResource(HMODULE, LPCWSTR, LPCWSTR) { return NULL; }
+inline HGLOBAL LoadResource(HMODULE, HRSRC) { return NULL; }
+inline void* LockResource(HGLOBAL) { return NULL; }
+inline DWORD SizeofResource(HMODULE, HRSRC) { return 0; }
+
+// Windows and messages, there are none
+
+struct POINT
+{
+    LONG x;
+    LONG y;
+};
+
+struct RECT
+{
+    LONG left;
+    LONG top;
+    LONG right;
+    LONG bottom;
+};
+
+struct MSG
+{
+    HWND hwnd;
+    UINT message;
+    WPARAM wParam;
+    LPARAM lParam;
+    DWORD time;
+    POINT pt;
+};
+
+typedef LRESULT (*WNDPROC)(HWND, UINT, WPARAM, LPARAM);
+
+typedef struct
+{
+    UINT cbSize;
+    UINT style;
+    WNDPROC lpfnWndProc;
+    int cbClsExtra;
+    int cbWndExtra;
+    HINSTANCE hInstance;
+    void* hIcon;
+    HCURSOR hCursor;
+    void* hbrBackground;
+    LPCWSTR lpszMenuName;
+    LPCWSTR lpszClassName;
+    void* hIconSm;
+} WNDCLASSEX;
+
+typedef struct
+{
+    void* lpCreateParams;
+} CREATESTRUCT, *LPCREATESTRUCT;
+
+#define PM_REMOVE 1
+#define WM_CREATE 0x1
+#define WM_DESTROY 0x2
+#define WM_SIZE 0x5
+#define WM_PAINT 0xF
+#define WM_QUIT 0x12
+#define WM_DISPLAYCHANGE 0x7E
+#define WM_KEYDOWN 0x100
+#define WM_KEYUP 0x101
+#define KF_REPEAT 0x4000
+#define VK_SPACE 0x20
+#define VK_F5 0x74
+#define VK_F6 0x75
+#define VK_F8 0x77
+#define VK_F9 0x78
+#define VK_LSHIFT 0xA0
+#define GWLP_USERDATA (-21)
+#define CS_HREDRAW 0x2
+#define CS_VREDRAW 0x1
+#define WS_OVERLAPPEDWINDOW 0
+#define CW_USEDEFAULT 0
+#define SWP_NOMOVE 0x2
+#define SW_SHOWNORMAL 1
+#define IDI_APPLICATION ((LPCWSTR)32512)
+#define IDC_ARROW ((LPCWSTR)32512)
+
+#define HIWORD(l) ((WORD)((((ULONG_PTR)(l)) >> 16) & 0xffff))
+#define LOWORD(l) ((WORD)(((ULONG_PTR)(l)) & 0xffff))
+
+inline BOOL PeekMessage(MSG*, HWND, UINT, UINT, UINT) { return FALSE; }
+inline BOOL TranslateMessage(const MSG*) { return FALSE; }
+inline LRESULT DispatchMessage(const MSG*) { return 0; }
+inline void PostQuitMessage(int) {}
+inline LRESULT DefWindowProc(HWND, UINT, WPARAM, LPARAM) { return 0; }
+inline LONG_PTR SetWindowLongPtrW(HWND, int, LONG_PTR) { return 0; }
+inline LONG_PTR GetWindowLongPtrW(HWND, int) { return 0; }
+inline BOOL InvalidateRect(HWND, const RECT*, BOOL) { return TRUE; }
+inline BOOL ValidateRect(HWND, const RECT*) { return TRUE; }
+inline WORD RegisterClassEx(const WNDCLASSEX*) { return 0; }
+inline HCURSOR LoadCursor(HINSTANCE, LPCWSTR) { return NULL; }
+inline HWND CreateWindow(LPCWSTR, LPCWSTR, DWORD, int, int, int, int, HWND, void*, HINSTANCE, void*) { return NULL; }
+inline UINT GetDpiForWindow(HWND) { return 96; }
+// The game passes NULL for the position it does not move; deduced, that is
+// an integer here and not a null pointer converted to int, which g++ warns on.
+template<class X, class Y>
+inline BOOL SetWindowPos(HWND, HWND, X, Y, int, int, UINT) { return FALSE; }
+inline BOOL ShowWindow(HWND, int) { return FALSE; }
+inline BOOL UpdateWindow(HWND) { return FALSE; }
+inline BOOL GetClientRect(HWND, RECT* pRect) { *pRect = RECT(); return FALSE; }
@@ -0,0 +1,65 @@
+#pragma once
+#include <windows.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The part of Winsock the sim stream uses, over BSD sockets, so benchmark
+// -serve runs the same code on Linux.
+
+typedef int SOCKET;
+typedef unsigned long u_long;
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define WSAEWOULDBLOCK EWOULDBLOCK
+#define MAKEWORD(low, high) ((WORD)(((BYTE)(low)) | (((WORD)((BYTE)(high))) << 8)))
+
+struct WSADATA
+{
+    WORD wVersion;
+};
+
+// Writes to a closed socket fail with EPIPE instead of ending the process,
+// as they do on Windows.
+inline int WSAStartup(WORD version, WSADATA* pData)
+{
+    signal(SIGPIPE, SIG_IGN);
+    pData->wVersion = version;
+    return 0;
+}
+
+inline int WSACleanup()
+{
+    return 0;
+}
+
+inline int WSAGetLastError()
+{
+    return errno == EAGAIN ? WSAEWOULDBLOCK : errno;
+}
+
+inline int closesocket(SOCKET socket)
+{
+    return close(socket);
+}
+
+inline int ioctlsocket(SOCKET socket, long command, u_long* pArgument)
+{
+    if (command != FIONBIO)
+    {
+        return SOCKET_ERROR;
+    }
+
+    int flags = fcntl(socket, F_GETFL, 0);
+    flags = *pArgument ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(socket, F_SETFL, flags);
+}
@@ -0,0 +1,410 @@
+// Save state throughput, see Platformer/SaveState.h. Plays a level with
+// scripted input and saves the game after every tick: the whole state every
+// -keyframe ticks, and in between a delta against the last whole one, as
+// replays keep them. Every state is loaded straight into a second game, and
+// saving that game again has to give back the same bytes.
+//
+// Usage: benchmark -savestate [-seconds <s>] [-keyframe <ticks>] [-filter <text>]
+//
+// Bytes are per saved state, times are per save and per load, and MB/s is
+// the saved bytes over those times. A load includes rebuilding what is not
+// saved, the spatial index and the level textures. At the end both games
+// play on from the last state loaded, and they have to stay in step.
+//
+// Last, states cut short are loaded into the replica, which has to turn
+// them down and be left exactly as it was.
+//
+// Exit code 1 when any state fails to round trip, the games drift apart or a
+// damaged state changes the game it was loaded into.
+
+#include "Benchmark.h"
+#include <algorithm>
+
+#define SAVE_BENCHMARK_DELTA (1.f / 60.f)
+#define SAVE_BENCHMARK_DEFAULT_SECONDS 60
+#define SAVE_BENCHMARK_DEFAULT_KEYFRAME 60
+
+// Room for the largest state, a tilemap full of distinct tiles included.
+#define SAVE_BENCHMARK_BUFFER (256 * 1024)
+
+// Ticks both games play on from the last state loaded.
+#define SAVE_BENCHMARK_REPLAY_TICKS 600
+
+// Damaged states are the whole one cut at every 1/n of its length.
+#define SAVE_BENCHMARK_DAMAGE_CUTS 8
+
+// Generated level, as in the geo_stream scenario.
+#define SAVE_BENCHMARK_STREAM_GEO_DENSITY 20.f
+#define SAVE_BENCHMARK_STREAM_ENEMY_DENSITY 1.f
+
+struct SaveLevel
+{
+    enum Type
+    {
+        SPEEDRUN,
+        GEO_STREAM,
+        COUNT,
+    };
+};
+
+struct SaveLevelDesc
+{
+    const char* name;
+
+    // the player runs right and jumps every period ticks
+    int period;
+    int jumpDown;
+    int jumpUp;
+};
+
+static const SaveLevelDesc s_saveLevels[SaveLevel::COUNT] =
+{
+    { "speedrun", 40, 1, 13 },
+    { "geo_stream", 30, 5, 20 },
+};
+
+struct SaveStateOptions
+{
+    int seconds;
+    int keyframe;
+    const char* filter;
+};
+
+// Totals for the whole or the delta states of one level.
+struct SaveKindResult
+{
+    int states;
+    size_t bytes;
+    size_t maxBytes;
+    double saveSeconds;
+    double loadSeconds;
+};
+
+struct SaveLevelResult
+{
+    SaveKindResult full;
+    SaveKindResult delta;
+
+    // states that did not save, load or come back the same
+    int failures;
+    bool replayMatched;
+    bool damagedRejected;
+};
+
+class SaveStateBenchmark
+{
+public:
+    explicit SaveStateBenchmark(const SaveStateOptions& options) :
+        m_options(options),
+        m_pGame(new Platformer()),
+        m_pReplica(new Platformer()),
+        m_pKeyframe(new GameState()),
+        m_pReplicaKeyframe(new GameState()),
+        m_streamLevel(),
+        m_buffer(SAVE_BENCHMARK_BUFFER),
+        m_check(SAVE_BENCHMARK_BUFFER)
+    {
+        LevelGenParams params = DefaultLevelGenParams(1);
+        params.length = BENCHMARK_LEVEL_WIDTH;
+        params.geoDensity = SAVE_BENCHMARK_STREAM_GEO_DENSITY;
+        params.enemyDensity = SAVE_BENCHMARK_STREAM_ENEMY_DENSITY;
+        m_streamLevel = BuildLevelStream(params);
+    }
+
+    ~SaveStateBenchmark()
+    {
+        delete m_pReplicaKeyframe;
+        delete m_pKeyframe;
+        delete m_pReplica;
+        delete m_pGame;
+    }
+
+    SaveStateBenchmark(const SaveStateBenchmark&) = delete;
+    SaveStateBenchmark& operator=(const SaveStateBenchmark&) = delete;
+
+    bool Selected(SaveLevel::Type level) const
+    {
+        return m_options.filter == NULL || strstr(s_saveLevels[level].name, m_options.filter) != NULL;
+    }
+
+    SaveLevelResult Run(SaveLevel::Type level)
+    {
+        SaveLevelResult result = {};
+        short* pStream = GetStream(level);
+        Start(*m_pGame, level);
+        m_pReplica->ResetGame();
+
+        const unsigned int ticks = static_cast<unsigned int>(m_options.seconds * 60);
+        unsigned int keyframeId = 0;
+        for (unsigned int tick = 1; tick <= ticks; tick++)
+        {
+            ApplyScript(*m_pGame, level, tick);
+            m_pGame->StepSimulation(SAVE_BENCHMARK_DELTA);
+
+            // a reset starts a new level, deltas against the old one would
+            // be as large as whole states
+            if (m_pGame->m_gameState.needsReset)
+            {
+                Start(*m_pGame, level);
+                keyframeId = 0;
+            }
+
+            bool whole = keyframeId == 0 || (tick - keyframeId) % m_options.keyframe == 0;
+            if (whole)
+            {
+                keyframeId = tick;
+            }
+
+            const GameState* pKeyframe = whole ? NULL : m_pKeyframe;
+            const GameState* pReplicaKeyframe = whole ? NULL : m_pReplicaKeyframe;
+            SaveKindResult& kind = whole ? result.full : result.delta;
+
+            double start = GetSeconds();
+            BitWriter out(m_buffer.data(), m_buffer.size());
+            bool saved = m_pGame->SaveState(out, pKeyframe, keyframeId, pStream) && out.Finish();
+            double middle = GetSeconds();
+            BitReader in(m_buffer.data(), out.GetByteCount());
+            bool loaded = saved && m_pReplica->LoadState(in, pReplicaKeyframe, keyframeId, pStream);
+            double end = GetSeconds();
+
+            kind.states++;
+            kind.bytes += out.GetByteCount();
+            kind.maxBytes = std::max(kind.maxBytes, out.GetByteCount());
+            kind.saveSeconds += middle - start;
+            kind.loadSeconds += end - middle;
+
+            if (whole)
+            {
+                *m_pKeyframe = m_pGame->m_gameState;
+                *m_pReplicaKeyframe = m_pReplica->m_gameState;
+            }
+
+            if (!loaded || !SameBytes(out.GetByteCount(), pReplicaKeyframe, keyframeId, pStream))
+            {
+                result.failures++;
+
+                // carry on from a state the replica does have
+                keyframeId = 0;
+            }
+        }
+
+        result.replayMatched = Replay(level, ticks);
+        result.damagedRejected = RejectDamaged(pStream);
+        return result;
+    }
+
+private:
+    short* GetStream(SaveLevel::Type level)
+    {
+        return level == SaveLevel::GEO_STREAM ? m_streamLevel.data() : NULL;
+    }
+
+    // Fresh game on the level, as the scenarios start it.
+    void Start(Platformer& platformer, SaveLevel::Type level)
+    {
+        platformer.ResetGame();
+        if (level == SaveLevel::GEO_STREAM)
+        {
+            GameState& gameState = platformer.m_gameState;
+            gameState.spatial.Clear();
+            platformer.DeallocateAllGeo();
+            platformer.DeallocateAllEnemies();
+            gameState.tilemap.Clear();
+            gameState.level = LevelCursor();
+            gameState.level.next = m_streamLevel.data();
+            platformer.LoadLevelEntities();
+        }
+    }
+
+    static void ApplyScript(Platformer& platformer, SaveLevel::Type level, unsigned int tick)
+    {
+        const SaveLevelDesc& desc = s_saveLevels[level];
+        int phase = static_cast<int>(tick % desc.period);
+        Input::Type& input = platformer.m_gameState.input;
+        if (phase == 0)
+        {
+            input = Input::RIGHT_DOWN;
+        }
+        else if (phase == desc.jumpDown)
+        {
+            input = Input::JUMP_DOWN;
+        }
+        else if (phase == desc.jumpUp)
+        {
+            input = Input::JUMP_UP;
+        }
+    }
+
+    // The replica saved against its own keyframe has to match the bytes the
+    // game wrote.
+    bool SameBytes(size_t size, const GameState* pReplicaKeyframe, unsigned int keyframeId, short* pStream)
+    {
+        BitWriter check(m_check.data(), m_check.size());
+        return m_pReplica->SaveState(check, pReplicaKeyframe, keyframeId, pStream)
+            && check.Finish()
+            && check.GetByteCount() == size
+            && memcmp(m_check.data(), m_buffer.data(), size) == 0;
+    }
+
+    // Loads of the replica's own whole state cut short at several points
+    // have to fail and leave it saving the same bytes as before.
+    bool RejectDamaged(short* pStream)
+    {
+        BitWriter out(m_buffer.data(), m_buffer.size());
+        if (!m_pReplica->SaveState(out, NULL, 0, pStream) || !out.Finish())
+        {
+            return false;
+        }
+
+        size_t size = out.GetByteCount();
+        unsigned long long hash = HashGameState(m_pReplica->m_gameState);
+        for (int cut = 1; cut < SAVE_BENCHMARK_DAMAGE_CUTS; cut++)
+        {
+            BitReader in(m_buffer.data(), size * cut / SAVE_BENCHMARK_DAMAGE_CUTS);
+            if (m_pReplica->LoadState(in, NULL, 0, pStream)
+                || HashGameState(m_pReplica->m_gameState) != hash
+                || !SameBytes(size, NULL, 0, pStream))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Both games play on with the same input from the last state loaded.
+    bool Replay(SaveLevel::Type level, unsigned int firstTick)
+    {
+        for (unsigned int tick = firstTick + 1; tick <= firstTick + SAVE_BENCHMARK_REPLAY_TICKS; tick++)
+        {
+            for (Platformer* pPlatformer : { m_pGame, m_pReplica })
+            {
+                ApplyScript(*pPlatformer, level, tick);
+                pPlatformer->StepSimulation(SAVE_BENCHMARK_DELTA);
+                if (pPlatformer->m_gameState.needsReset)
+                {
+                    Start(*pPlatformer, level);
+                }
+            }
+
+            if (HashGameState(m_pGame->m_gameState) != HashGameState(m_pReplica->m_gameState))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    SaveStateOptions m_options;
+    Platformer* m_pGame;
+
+    // loads every state the game saves
+    Platformer* m_pReplica;
+
+    // last whole state of each game, what the deltas are against
+    GameState* m_pKeyframe;
+    GameState* m_pReplicaKeyframe;
+
+    std::vector<short> m_streamLevel;
+    std::vector<unsigned char> m_buffer;
+    std::vector<unsigned char> m_check;
+};
+
+static void PrintKind(const char* level, const char* kind, const SaveKindResult& result)
+{
+    if (result.states == 0)
+    {
+        return;
+    }
+
+    double mb = result.bytes / 1e6;
+    printf("%-10s %-6s %8d %10.1f %8u %10.2f %10.2f %10.1f %10.1f\n",
+        level,
+        kind,
+        result.states,
+        static_cast<double>(result.bytes) / result.states,
+        static_cast<unsigned int>(result.maxBytes),
+        result.saveSeconds / result.states * 1e6,
+        result.loadSeconds / result.states * 1e6,
+        result.saveSeconds > 0.0 ? mb / result.saveSeconds : 0.0,
+        result.loadSeconds > 0.0 ? mb / result.loadSeconds : 0.0);
+}
+
+int RunSaveStates(int argc, char** argv)
+{
+    SaveStateOptions options = {};
+    options.seconds = SAVE_BENCHMARK_DEFAULT_SECONDS;
+    options.keyframe = SAVE_BENCHMARK_DEFAULT_KEYFRAME;
+
+    for (int index = 1; index < argc; index++)
+    {
+        if (strcmp(argv[index], "-seconds") == 0 && index + 1 < argc)
+        {
+            options.seconds = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-keyframe") == 0 && index + 1 < argc)
+        {
+            options.keyframe = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-filter") == 0 && index + 1 < argc)
+        {
+            options.filter = argv[++index];
+        }
+        else
+        {
+            fprintf(stderr, "usage: benchmark -savestate [-seconds <s>] [-keyframe <ticks>] [-filter <text>]\n");
+            return 1;
+        }
+    }
+
+    if (options.seconds < 1)
+    {
+        options.seconds = 1;
+    }
+
+    if (options.keyframe < 1)
+    {
+        options.keyframe = 1;
+    }
+
+    SaveStateBenchmark* pBenchmark = new SaveStateBenchmark(options);
+    printf("GameState %u bytes in memory, keyframe every %d ticks\n",
+        static_cast<unsigned int>(sizeof(GameState)), options.keyframe);
+    printf("%-10s %-6s %8s %10s %8s %10s %10s %10s %10s\n",
+        "level", "kind", "states", "B/state", "max B", "save us", "load us", "save MB/s", "load MB/s");
+
+    bool failed = false;
+    for (int level = 0; level < SaveLevel::COUNT; level++)
+    {
+        SaveLevel::Type type = static_cast<SaveLevel::Type>(level);
+        if (!pBenchmark->Selected(type))
+        {
+            continue;
+        }
+
+        SaveLevelResult result = pBenchmark->Run(type);
+        PrintKind(s_saveLevels[level].name, "full", result.full);
+        PrintKind(s_saveLevels[level].name, "delta", result.delta);
+        if (result.failures > 0)
+        {
+            fprintf(stderr, "%s: %d states did not round trip\n", s_saveLevels[level].name, result.failures);
+            failed = true;
+        }
+
+        if (!result.replayMatched)
+        {
+            fprintf(stderr, "%s: the loaded game drifted from the original\n", s_saveLevels[level].name);
+            failed = true;
+        }
+
+        if (!result.damagedRejected)
+        {
+            fprintf(stderr, "%s: a damaged state changed the game it was loaded into\n", s_saveLevels[level].name);
+            failed = true;
+        }
+    }
+
+    delete pBenchmark;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,641 @@
+// Whole-game scenarios run tick by tick with scripted input, as a regression
+// gate for the simulation. Each scenario plays a fixed number of ticks at a
+// fixed delta, several times over, and reports throughput and tick times.
+//
+// A tick takes well under a microsecond, shorter than a timer read is
+// precise, so throughput comes from timing whole runs and taking the best
+// of them. The tick time columns come from one extra run that times every
+// tick on its own, for the shape of the distribution and the spikes; the
+// gate never looks at them.
+//
+// Usage: benchmark -scenarios [-runs <n>] [-seconds <s>] [-filter <text>]
+//                  [-baseline <file>] [-tolerance <fraction>]
+//                  [-update-baseline] [-json <file>|-]
+//
+// With -baseline the run fails, exit code 1, when a scenario's best ticks
+// per second drops more than the tolerance below its baseline. Baselines are
+// only comparable on the machine and build they were recorded with, so
+// refresh them with -update-baseline when either changes.
+//
+// The state column hashes the world at the end of the observed run. It
+// depends only on the simulation, not on timing, so two builds that print the
+// same hash played the scenarios out identically; with USE_FIXED_POINT_PHYSICS it
+// should match across compilers and optimization levels.
+//
+// The redraw column is the mean share of the screen the renderer would have
+// redrawn per tick, as told by its damage tracker after every tick. Any tick
+// that scrolls redraws all of it.
+
+#include "Benchmark.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#define SCENARIO_DELTA (1.f / 60.f)
+#define SCENARIO_DEFAULT_RUNS 15
+#define SCENARIO_DEFAULT_SECONDS 3600
+#define SCENARIO_DEFAULT_TOLERANCE 0.25
+#define SCENARIO_MAX_SCRIPT 8
+
+// Window pixels per level unit the redraw share is measured at, 800x600.
+#define SCENARIO_PIXELS_PER_UNIT 4.f
+
+// Geo and enemies per screen of the geo_stream level. That is as much geo
+// as the whole NUM_GEO pool holds, so the pool stays full, geo streams in and
+// out as the camera moves and records that find no slot are dropped.
+#define SCENARIO_STREAM_GEO_DENSITY 20.f
+#define SCENARIO_STREAM_ENEMY_DENSITY 1.f
+
+// Heap allocations of the whole process, the sim should make none per tick.
+static std::atomic<long long> s_allocations(0);
+
+void* operator new(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+struct Scenario
+{
+    enum Type
+    {
+        SPEEDRUN,
+        ENEMY_SWARM,
+        GEO_STREAM,
+        GEO_STREAM_WORKER,
+        IDLE,
+        COUNT,
+    };
+};
+
+// Input written on a tick of a repeating period.
+struct ScriptedInput
+{
+    int tick;
+    Input::Type input;
+};
+
+struct ScenarioDesc
+{
+    const char* name;
+    int period;
+    int scriptLength;
+    ScriptedInput script[SCENARIO_MAX_SCRIPT];
+};
+
+// Every scenario but idle runs right and jumps on a loop so the camera keeps
+// scrolling and entities keep loading. The speedrun jump clears level 1's cat
+// and the player runs off the far end, one reset per pass through the level.
+// geo_stream_worker plays the geo_stream level through the level streamer's
+// worker instead of loading it on the sim thread, as resource levels load;
+// what spawns when does not depend on the worker, so both print the same
+// state hash. Idle leaves the player standing on the first screen while the enemies walk
+// and the blocks animate.
+static const ScenarioDesc s_scenarios[Scenario::COUNT] =
+{
+    { "speedrun", 40, 3, { { 0, Input::RIGHT_DOWN }, { 1, Input::JUMP_DOWN }, { 13, Input::JUMP_UP } } },
+    { "enemy_swarm", 90, 3, { { 0, Input::RIGHT_DOWN }, { 30, Input::JUMP_DOWN }, { 45, Input::JUMP_UP } } },
+    { "geo_stream", 30, 3, { { 0, Input::RIGHT_DOWN }, { 5, Input::JUMP_DOWN }, { 20, Input::JUMP_UP } } },
+    { "geo_stream_worker", 30, 3, { { 0, Input::RIGHT_DOWN }, { 5, Input::JUMP_DOWN }, { 20, Input::JUMP_UP } } },
+    { "idle", 1, 0, {} },
+};
+
+struct ScenarioResult
+{
+    const char* name;
+    int runs;
+    int ticks;
+
+    // whole runs, the best one is what the gate compares
+    double ticksPerSecond;
+    double medianTicksPerSecond;
+
+    // every tick of the observed run
+    double meanMicroseconds;
+    double p50Microseconds;
+    double p99Microseconds;
+    double maxMicroseconds;
+    int peakGeo;
+    int peakEnemies;
+    int resets;
+    long long allocations;
+    unsigned long long stateHash;
+
+    // mean share of the screen redrawn per tick
+    double redrawFraction;
+
+    // from the baseline file, zero when the scenario has none
+    double baselineTicksPerSecond;
+    bool regressed;
+};
+
+struct ScenarioOptions
+{
+    int runs;
+    int seconds;
+    const char* filter;
+    const char* baselinePath;
+    double tolerance;
+    bool updateBaseline;
+    const char* jsonPath;
+};
+
+class ScenarioRunner
+{
+public:
+    explicit ScenarioRunner(const ScenarioOptions& options) :
+        m_options(options),
+        m_pPlatformer(new Platformer()),
+        m_streamLevel(),
+        m_spawnCount(0)
+    {
+        LevelGenParams params = DefaultLevelGenParams(1);
+        params.length = BENCHMARK_LEVEL_WIDTH;
+        params.geoDensity = SCENARIO_STREAM_GEO_DENSITY;
+        params.enemyDensity = SCENARIO_STREAM_ENEMY_DENSITY;
+        m_streamLevel = BuildLevelStream(params);
+    }
+
+    ~ScenarioRunner()
+    {
+        delete m_pPlatformer;
+    }
+
+    ScenarioRunner(const ScenarioRunner&) = delete;
+    ScenarioRunner& operator=(const ScenarioRunner&) = delete;
+
+    bool Selected(Scenario::Type scenario) const
+    {
+        return m_options.filter == NULL || strstr(s_scenarios[scenario].name, m_options.filter) != NULL;
+    }
+
+    // Results of count scenarios. The timed runs take turns, run 1 of every
+    // scenario, then run 2 and so on, so a stretch where the machine is busy
+    // slows one run of each instead of every run of one.
+    void Run(const Scenario::Type* scenarios, int count, ScenarioResult* results)
+    {
+        int ticks = m_options.seconds * 60;
+        std::vector<std::vector<double>> runRates(count);
+        for (int index = 0; index < count; index++)
+        {
+            ScenarioResult& result = results[index];
+            result = ScenarioResult();
+            result.name = s_scenarios[scenarios[index]].name;
+            result.runs = m_options.runs;
+            result.ticks = ticks;
+
+            long long allocationsBefore = s_allocations.load(std::memory_order_relaxed);
+            Observe(scenarios[index], result);
+            result.allocations = s_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+        }
+
+        for (int run = 0; run < m_options.runs; run++)
+        {
+            for (int index = 0; index < count; index++)
+            {
+                long long allocationsBefore = s_allocations.load(std::memory_order_relaxed);
+                double runTime = TimeRun(scenarios[index], ticks);
+                results[index].allocations += s_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+                runRates[index].push_back(runTime > 0.0 ? ticks / runTime : 0.0);
+            }
+        }
+
+        for (int index = 0; index < count; index++)
+        {
+            std::vector<double>& rates = runRates[index];
+            std::sort(rates.begin(), rates.end());
+            results[index].ticksPerSecond = rates.back();
+            results[index].medianTicksPerSecond = rates[rates.size() / 2];
+        }
+    }
+
+private:
+    GameState& State()
+    {
+        return m_pPlatformer->m_gameState;
+    }
+
+    // One run timing every tick, which also gathers everything but the
+    // throughput: tick times, peaks, resets, redraw and the end state.
+    void Observe(Scenario::Type scenario, ScenarioResult& result)
+    {
+        const ScenarioDesc& desc = s_scenarios[scenario];
+        std::vector<double> tickTimes;
+        tickTimes.reserve(result.ticks);
+        DamageStats& damageStats = m_pPlatformer->m_damage.stats;
+        damageStats = DamageStats();
+
+        Start(scenario);
+        for (int tick = 0; tick < result.ticks; tick++)
+        {
+            ApplyScript(desc, tick);
+
+            double start = GetSeconds();
+            m_pPlatformer->StepSimulation(SCENARIO_DELTA);
+            tickTimes.push_back(GetSeconds() - start);
+
+            // outside the timed region, like the game's own reset
+            if (State().needsReset)
+            {
+                Start(scenario);
+                result.resets++;
+            }
+
+            if (scenario == Scenario::ENEMY_SWARM)
+            {
+                FillEnemies();
+            }
+
+            m_pPlatformer->TrackDamage(SCENARIO_PIXELS_PER_UNIT, SCENARIO_PIXELS_PER_UNIT);
+
+            StateLayoutStats stats = GetStateLayoutStats(State());
+            result.peakGeo = std::max(result.peakGeo, stats.liveGeo);
+            result.peakEnemies = std::max(result.peakEnemies, stats.liveEnemies);
+        }
+
+        result.stateHash = HashGameState(State());
+        result.redrawFraction = damageStats.frames > 0 ? damageStats.totalFraction / damageStats.frames : 0.0;
+
+        double total = 0.0;
+        for (double time : tickTimes)
+        {
+            total += time;
+        }
+
+        std::sort(tickTimes.begin(), tickTimes.end());
+        result.meanMicroseconds = total / tickTimes.size() * 1e6;
+        result.p50Microseconds = tickTimes[tickTimes.size() / 2] * 1e6;
+        result.p99Microseconds = tickTimes[tickTimes.size() * 99 / 100] * 1e6;
+        result.maxMicroseconds = tickTimes.back() * 1e6;
+    }
+
+    // Seconds for ticks ticks. Resets and the swarm's refills are part of
+    // the run, they come at the same ticks every time.
+    double TimeRun(Scenario::Type scenario, int ticks)
+    {
+        const ScenarioDesc& desc = s_scenarios[scenario];
+        Start(scenario);
+
+        double start = GetSeconds();
+        for (int tick = 0; tick < ticks; tick++)
+        {
+            ApplyScript(desc, tick);
+            m_pPlatformer->StepSimulation(SCENARIO_DELTA);
+            if (State().needsReset)
+            {
+                Start(scenario);
+            }
+
+            if (scenario == Scenario::ENEMY_SWARM)
+            {
+                FillEnemies();
+            }
+        }
+
+        return GetSeconds() - start;
+    }
+
+    // Fresh game, then whatever the scenario changes about the world.
+    void Start(Scenario::Type scenario)
+    {
+        Platformer& platformer = *m_pPlatformer;
+        platformer.ResetGame();
+
+        if (scenario == Scenario::GEO_STREAM || scenario == Scenario::GEO_STREAM_WORKER)
+        {
+            GameState& gameState = State();
+            gameState.spatial.Clear();
+            platformer.DeallocateAllGeo();
+            platformer.DeallocateAllEnemies();
+            gameState.tilemap.Clear();
+            gameState.level = LevelCursor();
+            gameState.level.next = m_streamLevel.data();
+            if (scenario == Scenario::GEO_STREAM_WORKER)
+            {
+                platformer.StartLevelStream();
+            }
+            else
+            {
+                platformer.LoadLevelEntities();
+            }
+        }
+        else if (scenario == Scenario::ENEMY_SWARM)
+        {
+            FillEnemies();
+        }
+    }
+
+    void ApplyScript(const ScenarioDesc& desc, int tick)
+    {
+        int phase = tick % desc.period;
+        for (int index = 0; index < desc.scriptLength; index++)
+        {
+            if (desc.script[index].tick == phase)
+            {
+                State().input = desc.script[index].input;
+            }
+        }
+    }
+
+    // Keep the enemy pool full, new cats walk in from the right edge in
+    // every palette.
+    void FillEnemies()
+    {
+        GameState& gameState = State();
+        Scalar x = gameState.cameraScroll + SCREEN_WIDTH - ENEMY_WIDTH;
+        for (int count = gameState.world.brains.Count(); count < NUM_ENTITIES; count++)
+        {
+            m_spawnCount++;
+            m_pPlatformer->AllocateEnemy(x, 120, Enemy::CAT, 1, static_cast<Palette::Type>(m_spawnCount % Palette::COUNT));
+        }
+    }
+
+    ScenarioOptions m_options;
+    Platformer* m_pPlatformer;
+    std::vector<short> m_streamLevel;
+    unsigned int m_spawnCount;
+};
+
+// Baseline lines are "<name> <best run ticks per second> <p99 us>", '#' starts a comment.
+static void ReadBaseline(const char* path, ScenarioResult* results, int resultCount)
+{
+    FILE* pFile = NULL;
+    if (fopen_s(&pFile, path, "r") != 0 || pFile == NULL)
+    {
+        fprintf(stderr, "no baseline at %s\n", path);
+        return;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), pFile))
+    {
+        char name[64];
+        double ticksPerSecond = 0.0;
+        double p99 = 0.0;
+        if (line[0] == '#' || sscanf(line, "%63s %lf %lf", name, &ticksPerSecond, &p99) < 2)
+        {
+            continue;
+        }
+
+        for (int index = 0; index < resultCount; index++)
+        {
+            if (strcmp(results[index].name, name) == 0)
+            {
+                results[index].baselineTicksPerSecond = ticksPerSecond;
+            }
+        }
+    }
+
+    fclose(pFile);
+}
+
+static bool WriteBaseline(const char* path, const ScenarioResult* results, int resultCount)
+{
+    FILE* pFile = NULL;
+    if (fopen_s(&pFile, path, "w") != 0 || pFile == NULL)
+    {
+        fprintf(stderr, "could not open %s\n", path);
+        return false;
+    }
+
+    fprintf(pFile, "# benchmark -scenarios baseline: <name> <best run ticks per second> <p99 us>\n");
+    fprintf(pFile, "# Machine and build specific, refresh with -update-baseline.\n");
+    for (int index = 0; index < resultCount; index++)
+    {
+        fprintf(pFile, "%s %.0f %.2f\n", results[index].name, results[index].ticksPerSecond, results[index].p99Microseconds);
+    }
+
+    bool written = ferror(pFile) == 0;
+    fclose(pFile);
+    return written;
+}
+
+static void PrintResults(const ScenarioResult* results, int resultCount)
+{
+    printf("%-12s %10s %9s %9s %9s %9s %5s %7s %6s %7s %16s %7s %9s\n",
+        "scenario", "ticks/s", "mean us", "p50 us", "p99 us", "max us", "geo", "enemies", "resets", "allocs", "state", "redraw", "baseline");
+    for (int index = 0; index < resultCount; index++)
+    {
+        const ScenarioResult& result = results[index];
+        printf("%-12s %10.0f %9.2f %9.2f %9.2f %9.2f %5d %7d %6d %7lld %016llx %6.1f%%",
+            result.name,
+            result.ticksPerSecond,
+            result.meanMicroseconds,
+            result.p50Microseconds,
+            result.p99Microseconds,
+            result.maxMicroseconds,
+            result.peakGeo,
+            result.peakEnemies,
+            result.resets,
+            result.allocations,
+            result.stateHash,
+            result.redrawFraction * 100.0);
+
+        if (result.baselineTicksPerSecond > 0.0)
+        {
+            printf(" %+8.1f%%%s",
+                (result.ticksPerSecond / result.baselineTicksPerSecond - 1.0) * 100.0,
+                result.regressed ? " REGRESSED" : "");
+        }
+
+        printf("\n");
+    }
+}
+
+static bool WriteJson(FILE* pFile, const ScenarioResult* results, int resultCount)
+{
+    fprintf(pFile, "{\n  \"scenarios\": [\n");
+    for (int index = 0; index < resultCount; index++)
+    {
+        const ScenarioResult& result = results[index];
+        fprintf(pFile, "    {\"name\": \"%s\", \"runs\": %d, \"ticks\": %d, \"ticks_per_sec\": %.1f, \"median_ticks_per_sec\": %.1f, "
+            "\"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, "
+            "\"peak_geo\": %d, \"peak_enemies\": %d, \"resets\": %d, \"allocations\": %lld, \"state_hash\": \"%016llx\", \"redraw_fraction\": %.4f, "
+            "\"baseline_ticks_per_sec\": %.1f, \"regressed\": %s}%s\n",
+            result.name,
+            result.runs,
+            result.ticks,
+            result.ticksPerSecond,
+            result.medianTicksPerSecond,
+            result.meanMicroseconds,
+            result.p50Microseconds,
+            result.p99Microseconds,
+            result.maxMicroseconds,
+            result.peakGeo,
+            result.peakEnemies,
+            result.resets,
+            result.allocations,
+            result.stateHash,
+            result.redrawFraction,
+            result.baselineTicksPerSecond,
+            result.regressed ? "true" : "false",
+            index + 1 < resultCount ? "," : "");
+    }
+
+    fprintf(pFile, "  ]\n}\n");
+    return ferror(pFile) == 0;
+}
+
+int RunScenarios(int argc, char** argv)
+{
+    ScenarioOptions options = {};
+    options.runs = SCENARIO_DEFAULT_RUNS;
+    options.seconds = SCENARIO_DEFAULT_SECONDS;
+    options.tolerance = SCENARIO_DEFAULT_TOLERANCE;
+
+    for (int index = 1; index < argc; index++)
+    {
+        if (strcmp(argv[index], "-runs") == 0 && index + 1 < argc)
+        {
+            options.runs = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-seconds") == 0 && index + 1 < argc)
+        {
+            options.seconds = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-filter") == 0 && index + 1 < argc)
+        {
+            options.filter = argv[++index];
+        }
+        else if (strcmp(argv[index], "-baseline") == 0 && index + 1 < argc)
+        {
+            options.baselinePath = argv[++index];
+        }
+        else if (strcmp(argv[index], "-tolerance") == 0 && index + 1 < argc)
+        {
+            options.tolerance = atof(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-update-baseline") == 0)
+        {
+            options.updateBaseline = true;
+        }
+        else if (strcmp(argv[index], "-json") == 0 && index + 1 < argc)
+        {
+            options.jsonPath = argv[++index];
+        }
+        else
+        {
+            fprintf(stderr, "usage: benchmark -scenarios [-runs <n>] [-seconds <s>] [-filter <text>] "
+                "[-baseline <file>] [-tolerance <fraction>] [-update-baseline] [-json <file>|-]\n");
+            return 1;
+        }
+    }
+
+    if (options.runs < 1)
+    {
+        options.runs = 1;
+    }
+
+    if (options.seconds < 1)
+    {
+        options.seconds = 1;
+    }
+
+    if (options.updateBaseline && options.baselinePath == NULL)
+    {
+        fprintf(stderr, "-update-baseline needs -baseline <file>\n");
+        return 1;
+    }
+
+    ScenarioRunner runner(options);
+    Scenario::Type selected[Scenario::COUNT];
+    int resultCount = 0;
+    for (int scenario = 0; scenario < Scenario::COUNT; scenario++)
+    {
+        if (runner.Selected(static_cast<Scenario::Type>(scenario)))
+        {
+            selected[resultCount++] = static_cast<Scenario::Type>(scenario);
+        }
+    }
+
+    ScenarioResult results[Scenario::COUNT];
+    runner.Run(selected, resultCount, results);
+
+    bool regressed = false;
+    if (options.updateBaseline)
+    {
+        if (!WriteBaseline(options.baselinePath, results, resultCount))
+        {
+            return 1;
+        }
+    }
+    else if (options.baselinePath)
+    {
+        ReadBaseline(options.baselinePath, results, resultCount);
+        for (int index = 0; index < resultCount; index++)
+        {
+            ScenarioResult& result = results[index];
+            result.regressed = result.baselineTicksPerSecond > 0.0
+                && result.ticksPerSecond < result.baselineTicksPerSecond * (1.0 - options.tolerance);
+            regressed = regressed || result.regressed;
+        }
+    }
+
+    PrintResults(results, resultCount);
+
+    if (options.jsonPath)
+    {
+        FILE* pFile = stdout;
+        if (strcmp(options.jsonPath, "-") != 0 && fopen_s(&pFile, options.jsonPath, "w") != 0)
+        {
+            fprintf(stderr, "could not open %s\n", options.jsonPath);
+            return 1;
+        }
+
+        bool written = WriteJson(pFile, results, resultCount);
+        if (pFile != stdout)
+        {
+            fclose(pFile);
+        }
+
+        if (!written)
+        {
+            return 1;
+        }
+    }
+
+    return regressed ? 1 : 0;
+}
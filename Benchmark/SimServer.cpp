@@ -0,0 +1,309 @@
+// Headless sim server. Runs the game at a fixed tick rate with scripted input
+// and streams every tick to viewers on this machine, see
+// Platformer/SimStream.h:
+//
+// Usage: benchmark -serve [-port <n>] [-rate <ticks per second>]
+//                  [-seconds <s>] [-idle] [-local]
+//        Platformer.exe -connect [port]
+//
+// The player runs right and jumps like the speedrun scenario, or stands on
+// the first screen with -idle. -seconds 0 serves until the process is
+// stopped.
+//
+// With -local a viewer in this process connects over the same socket and
+// decodes every tick, and at the end the bytes per tick it received and the
+// latency from capture to decode are printed next to what publishing cost
+// the server.
+
+#include "Benchmark.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#define SIM_SERVER_DEFAULT_RATE 60
+#define SIM_SERVER_DEFAULT_LOCAL_SECONDS 10
+
+// Input script period of the running player, as in the speedrun scenario.
+#define SIM_SERVER_SCRIPT_PERIOD 40
+
+// How long the local viewer waits for a tick before checking for the end.
+#define SIM_SERVER_VIEWER_WAIT_MS 100
+
+// Seconds between status lines when serving without a local viewer.
+#define SIM_SERVER_STATUS_SECONDS 5
+
+struct SimServerOptions
+{
+    unsigned short port;
+    int rate;
+    int seconds;
+    bool idle;
+    bool local;
+};
+
+// What the local viewer saw, one entry per decoded tick.
+struct LocalViewerResult
+{
+    bool connected;
+    SimStreamStats stats;
+    std::vector<float> latencies;
+    std::vector<int> bytes;
+};
+
+static void RunLocalViewer(unsigned short port, const std::atomic<bool>& stop, LocalViewerResult& result)
+{
+    SimStreamClient* pClient = new SimStreamClient();
+    result.connected = pClient->Connect(port);
+
+    while (result.connected && pClient->IsConnected() && !stop.load())
+    {
+        if (pClient->Receive(SIM_SERVER_VIEWER_WAIT_MS))
+        {
+            result.latencies.push_back(pClient->stats.lastLatency);
+            result.bytes.push_back(pClient->stats.lastBytes);
+        }
+    }
+
+    result.stats = pClient->stats;
+    delete pClient;
+}
+
+class SimServer
+{
+public:
+    explicit SimServer(const SimServerOptions& options) :
+        m_options(options),
+        m_pPlatformer(new Platformer()),
+        m_pServer(new SimStreamServer())
+    {
+    }
+
+    ~SimServer()
+    {
+        delete m_pServer;
+        delete m_pPlatformer;
+    }
+
+    SimServer(const SimServer&) = delete;
+    SimServer& operator=(const SimServer&) = delete;
+
+    int Run()
+    {
+        if (!m_pServer->Listen(m_options.port))
+        {
+            fprintf(stderr, "could not listen on port %u\n", m_options.port);
+            return 1;
+        }
+
+        printf("serving on 127.0.0.1:%u at %d ticks/s, snapshot %u bytes\n",
+            m_options.port, m_options.rate, static_cast<unsigned int>(sizeof(SimSnapshot)));
+
+        std::atomic<bool> stop(false);
+        LocalViewerResult viewerResult = {};
+        std::thread viewer;
+        if (m_options.local)
+        {
+            viewer = std::thread(RunLocalViewer, m_options.port, std::cref(stop), std::ref(viewerResult));
+        }
+
+        Platformer& platformer = *m_pPlatformer;
+        platformer.ResetGame();
+
+        const unsigned int ticks = static_cast<unsigned int>(m_options.seconds * m_options.rate);
+        const float delta = 1.f / m_options.rate;
+        std::vector<double> publishTimes;
+        publishTimes.reserve(ticks);
+
+        double start = GetSeconds();
+        double nextStatus = start + SIM_SERVER_STATUS_SECONDS;
+        for (unsigned int tick = 1; ticks == 0 || tick <= ticks; tick++)
+        {
+            ApplyScript(tick);
+            platformer.StepSimulation(delta);
+            if (platformer.m_gameState.needsReset)
+            {
+                platformer.ResetGame();
+            }
+
+            // latency is measured from here, capture and encode included
+            LARGE_INTEGER captureTime;
+            QueryPerformanceCounter(&captureTime);
+            double publishStart = GetSeconds();
+            platformer.CaptureSnapshot(m_snapshot, tick);
+            m_pServer->Publish(m_snapshot, captureTime.QuadPart);
+            double now = GetSeconds();
+            if (ticks != 0)
+            {
+                publishTimes.push_back(now - publishStart);
+            }
+
+            if (!m_options.local && now >= nextStatus)
+            {
+                const SimStreamStats& stats = m_pServer->stats;
+                printf("tick %u viewers %d bytes/snapshot %.1f\n",
+                    tick, m_pServer->GetViewerCount(), stats.snapshots > 0 ? static_cast<double>(stats.bytes) / stats.snapshots : 0.0);
+                fflush(stdout);
+                nextStatus += SIM_SERVER_STATUS_SECONDS;
+            }
+
+            double next = start + static_cast<double>(tick) / m_options.rate;
+            if (next > now)
+            {
+                std::this_thread::sleep_for(std::chrono::duration<double>(next - now));
+            }
+        }
+
+        stop.store(true);
+        if (viewer.joinable())
+        {
+            viewer.join();
+        }
+
+        PrintResults(publishTimes, viewerResult);
+        return m_options.local && (!viewerResult.connected || viewerResult.stats.snapshots == 0) ? 1 : 0;
+    }
+
+private:
+    void ApplyScript(unsigned int tick)
+    {
+        if (m_options.idle)
+        {
+            return;
+        }
+
+        Input::Type& input = m_pPlatformer->m_gameState.input;
+        switch (tick % SIM_SERVER_SCRIPT_PERIOD)
+        {
+        case 0:
+            input = Input::RIGHT_DOWN;
+            break;
+        case 1:
+            input = Input::JUMP_DOWN;
+            break;
+        case 13:
+            input = Input::JUMP_UP;
+            break;
+        default:
+            break;
+        }
+    }
+
+    template<class Value>
+    static Value Percentile(std::vector<Value>& values, int percent)
+    {
+        std::sort(values.begin(), values.end());
+        return values[values.size() * percent / 100];
+    }
+
+    void PrintResults(std::vector<double>& publishTimes, LocalViewerResult& viewerResult)
+    {
+        const SimStreamStats& stats = m_pServer->stats;
+        double total = 0.0;
+        for (double time : publishTimes)
+        {
+            total += time;
+        }
+
+        printf("%-8s %8s %8s %10s %10s %10s\n", "server", "ticks", "sent", "full", "publish us", "p99 us");
+        printf("%-8s %8u %8d %10d %10.2f %10.2f\n",
+            "",
+            static_cast<unsigned int>(publishTimes.size()),
+            stats.snapshots,
+            stats.fullSnapshots,
+            publishTimes.empty() ? 0.0 : total / publishTimes.size() * 1e6,
+            publishTimes.empty() ? 0.0 : Percentile(publishTimes, 99) * 1e6);
+
+        if (!m_options.local)
+        {
+            return;
+        }
+
+        if (!viewerResult.connected || viewerResult.latencies.empty())
+        {
+            fprintf(stderr, "the local viewer received nothing\n");
+            return;
+        }
+
+        const SimStreamStats& viewerStats = viewerResult.stats;
+        double meanBytes = static_cast<double>(viewerStats.bytes) / viewerStats.snapshots;
+        double meanLatency = 0.0;
+        for (float latency : viewerResult.latencies)
+        {
+            meanLatency += latency;
+        }
+
+        meanLatency /= viewerResult.latencies.size();
+
+        int p99Bytes = Percentile(viewerResult.bytes, 99);
+        float p99Latency = Percentile(viewerResult.latencies, 99);
+
+        printf("%-8s %8s %8s %10s %10s %10s %10s %10s %10s\n",
+            "viewer", "ticks", "B/tick", "p99 B", "max B", "raw ratio", "mean us", "p99 us", "max us");
+        printf("%-8s %8d %8.1f %10d %10d %9.1fx %10.1f %10.1f %10.1f\n",
+            "",
+            viewerStats.snapshots,
+            meanBytes,
+            p99Bytes,
+            viewerResult.bytes.back(),
+            sizeof(SimSnapshot) / meanBytes,
+            meanLatency * 1e6,
+            p99Latency * 1e6,
+            viewerResult.latencies.back() * 1e6);
+    }
+
+    SimServerOptions m_options;
+    Platformer* m_pPlatformer;
+    SimStreamServer* m_pServer;
+    SimSnapshot m_snapshot;
+};
+
+int RunSimServer(int argc, char** argv)
+{
+    SimServerOptions options = {};
+    options.port = SIM_STREAM_DEFAULT_PORT;
+    options.rate = SIM_SERVER_DEFAULT_RATE;
+    options.seconds = -1;
+
+    for (int index = 1; index < argc; index++)
+    {
+        if (strcmp(argv[index], "-port") == 0 && index + 1 < argc)
+        {
+            options.port = static_cast<unsigned short>(atoi(argv[++index]));
+        }
+        else if (strcmp(argv[index], "-rate") == 0 && index + 1 < argc)
+        {
+            options.rate = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-seconds") == 0 && index + 1 < argc)
+        {
+            options.seconds = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-idle") == 0)
+        {
+            options.idle = true;
+        }
+        else if (strcmp(argv[index], "-local") == 0)
+        {
+            options.local = true;
+        }
+        else
+        {
+            fprintf(stderr, "usage: benchmark -serve [-port <n>] [-rate <ticks per second>] [-seconds <s>] [-idle] [-local]\n");
+            return 1;
+        }
+    }
+
+    if (options.rate < 1)
+    {
+        options.rate = 1;
+    }
+
+    // a local run has to end to report, a plain server runs until stopped
+    if (options.seconds < 0 || (options.local && options.seconds == 0))
+    {
+        options.seconds = options.local ? SIM_SERVER_DEFAULT_LOCAL_SECONDS : 0;
+    }
+
+    SimServer server(options);
+    return server.Run();
+}
@@ -0,0 +1,184 @@
+#include "Platformer.h"
+#include "AssetLoader.h"
+
+AssetLoader::AssetLoader() :
+    m_workerCount(0),
+    m_stop(false),
+    m_queue(),
+    m_queueHead(0),
+    m_queueCount(0),
+    m_states(),
+    m_images()
+{
+}
+
+AssetLoader::~AssetLoader()
+{
+    Stop();
+
+    for (DecodedImage& image : m_images)
+    {
+        FreeDecodedImage(&image);
+    }
+}
+
+void AssetLoader::Start()
+{
+    if (m_workerCount > 0)
+    {
+        return;
+    }
+
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    int workerCount = hardwareThreads > 1 ? static_cast<int>(hardwareThreads) - 1 : 1;
+    if (workerCount > NUM_ASSET_WORKERS)
+    {
+        workerCount = NUM_ASSET_WORKERS;
+    }
+
+    m_stop = false;
+    for (int index = 0; index < workerCount; index++)
+    {
+        m_workers[index] = std::thread(&AssetLoader::Run, this);
+    }
+
+    m_workerCount = workerCount;
+}
+
+void AssetLoader::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_queued.notify_all();
+    for (int index = 0; index < m_workerCount; index++)
+    {
+        m_workers[index].join();
+    }
+
+    m_workerCount = 0;
+}
+
+void AssetLoader::Queue(int resourceId)
+{
+    int index = AssetIndex(resourceId);
+    if (index < 0)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_states[index] != State::NONE)
+        {
+            return;
+        }
+
+        m_states[index] = State::QUEUED;
+        m_queue[(m_queueHead + m_queueCount) % NUM_IMAGE_ASSETS] = index;
+        m_queueCount++;
+    }
+
+    m_queued.notify_one();
+}
+
+const DecodedImage* AssetLoader::Acquire(int resourceId)
+{
+    int index = AssetIndex(resourceId);
+    if (index < 0)
+    {
+        return NULL;
+    }
+
+    Queue(resourceId);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_workerCount == 0 && m_states[index] == State::QUEUED)
+    {
+        // no pool, load inline
+        m_states[index] = State::DECODING;
+        lock.unlock();
+
+        DecodedImage image;
+        HRESULT hr = LoadCookedTexture(resourceId, &image);
+
+        lock.lock();
+        m_images[index] = image;
+        m_states[index] = SUCCEEDED(hr) ? State::READY : State::FAILED;
+    }
+
+    m_loaded.wait(lock, [&] { return m_states[index] == State::READY || m_states[index] == State::FAILED; });
+
+    return m_states[index] == State::READY ? &m_images[index] : NULL;
+}
+
+const DecodedImage* AssetLoader::Peek(int resourceId)
+{
+    int index = AssetIndex(resourceId);
+    if (index < 0)
+    {
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_states[index] == State::READY ? &m_images[index] : NULL;
+}
+
+void AssetLoader::Store(int resourceId, DecodedImage& image)
+{
+    int index = AssetIndex(resourceId);
+    if (index < 0)
+    {
+        FreeDecodedImage(&image);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_states[index] == State::NONE || m_states[index] == State::FAILED)
+        {
+            m_images[index] = image;
+            m_states[index] = image.pixels ? State::READY : State::FAILED;
+            image = DecodedImage();
+        }
+    }
+
+    // already queued or loaded here, the copy is not needed
+    FreeDecodedImage(&image);
+    m_loaded.notify_all();
+}
+
+void AssetLoader::Run()
+{
+    PROFILE_THREAD("asset loader");
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_queued.wait(lock, [&] { return m_stop || m_queueCount > 0; });
+        if (m_stop)
+        {
+            break;
+        }
+
+        int index = m_queue[m_queueHead];
+        m_queueHead = (m_queueHead + 1) % NUM_IMAGE_ASSETS;
+        m_queueCount--;
+        m_states[index] = State::DECODING;
+        lock.unlock();
+
+        DecodedImage image;
+        HRESULT hr;
+        {
+            PROFILE_ZONE("load texture");
+            hr = LoadCookedTexture(TEXTURE_OFFSET + 1 + index, &image);
+        }
+
+        lock.lock();
+        m_images[index] = image;
+        m_states[index] = SUCCEEDED(hr) ? State::READY : State::FAILED;
+        m_loaded.notify_all();
+    }
+}
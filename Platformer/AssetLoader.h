@@ -0,0 +1,73 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "resource.h"
+#include "Image.h"
+
+#define NUM_ASSET_WORKERS 4
+#define NUM_IMAGE_ASSETS (TEXTURE_LAST - TEXTURE_OFFSET)
+
+// Loads cooked textures on a small thread pool and keeps their pixels around,
+// so device bitmaps can be created from them on first use. Only compressed
+// textures cost anything to load.
+class AssetLoader
+{
+public:
+    struct State
+    {
+        enum Type
+        {
+            NONE,
+            QUEUED,
+            DECODING,
+            READY,
+            FAILED,
+        };
+    };
+
+    AssetLoader();
+    ~AssetLoader();
+
+    void Start();
+
+    void Stop();
+
+    // Queue a load, does nothing if the image was already queued.
+    void Queue(int resourceId);
+
+    // Pixels of an image resource, waiting for its load if needed. Returns
+    // NULL if the image can not be loaded.
+    const DecodedImage* Acquire(int resourceId);
+
+    // Pixels of an image resource if it is already loaded, never waits.
+    const DecodedImage* Peek(int resourceId);
+
+    // Adopt pixels loaded elsewhere, e.g. by the level streamer.
+    void Store(int resourceId, DecodedImage& image);
+
+private:
+    static int AssetIndex(int resourceId)
+    {
+        int index = resourceId - TEXTURE_OFFSET - 1;
+        return index >= 0 && index < NUM_IMAGE_ASSETS ? index : -1;
+    }
+
+    void Run();
+
+    std::mutex m_mutex;
+    std::condition_variable m_queued;
+    std::condition_variable m_loaded;
+    std::thread m_workers[NUM_ASSET_WORKERS];
+    int m_workerCount;
+    bool m_stop;
+
+    // FIFO of asset indices waiting for a worker
+    int m_queue[NUM_IMAGE_ASSETS];
+    int m_queueHead;
+    int m_queueCount;
+
+    State::Type m_states[NUM_IMAGE_ASSETS];
+    DecodedImage m_images[NUM_IMAGE_ASSETS];
+};
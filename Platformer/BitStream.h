@@ -0,0 +1,256 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// Bit-level writing and reading for the save state format, see SaveState.h.
+// Values are packed least significant bit first with no padding between
+// them. A stream either fills a block of memory the caller owns, or goes
+// through a small buffer to a file, so a state is written to and read from
+// disk as it is produced and consumed, never held whole.
+
+// Bytes buffered between file reads and writes.
+#define BIT_STREAM_BUFFER 4096
+
+class BitWriter
+{
+public:
+    // Into pBuffer, failing once capacity bytes are used.
+    BitWriter(unsigned char* pBuffer, size_t capacity) :
+        m_pFile(NULL),
+        m_pBuffer(pBuffer),
+        m_capacity(capacity),
+        m_size(0),
+        m_flushed(0),
+        m_bits(0),
+        m_bitCount(0),
+        m_failed(false)
+    {
+    }
+
+    // To an open file, flushed whenever the buffer fills.
+    explicit BitWriter(FILE* pFile) :
+        m_pFile(pFile),
+        m_pBuffer(m_fileBuffer),
+        m_capacity(BIT_STREAM_BUFFER),
+        m_size(0),
+        m_flushed(0),
+        m_bits(0),
+        m_bitCount(0),
+        m_failed(pFile == NULL)
+    {
+    }
+
+    BitWriter(const BitWriter&) = delete;
+    BitWriter& operator=(const BitWriter&) = delete;
+
+    // The low count bits of value, count up to 32.
+    void Write(uint32_t value, int count)
+    {
+        if (count < 32)
+        {
+            value &= (1u << count) - 1;
+        }
+
+        m_bits |= static_cast<uint64_t>(value) << m_bitCount;
+        m_bitCount += count;
+        if (m_bitCount >= 32)
+        {
+            PutBytes(4);
+        }
+    }
+
+    // Pad the last byte with zeros and write out whatever is buffered. False
+    // when anything could not be written.
+    bool Finish()
+    {
+        PutBytes((m_bitCount + 7) / 8);
+        m_bitCount = 0;
+        m_bits = 0;
+        Flush();
+        return !m_failed;
+    }
+
+    bool Failed() const
+    {
+        return m_failed;
+    }
+
+    // Bits written so far, padding of Finish included.
+    size_t GetBitCount() const
+    {
+        return (m_flushed + m_size) * 8 + m_bitCount;
+    }
+
+    size_t GetByteCount() const
+    {
+        return (GetBitCount() + 7) / 8;
+    }
+
+private:
+    // Bytes that do not fit are dropped, the stream is failed from there.
+    void PutBytes(int count)
+    {
+        for (int index = 0; index < count; index++)
+        {
+            if (m_size == m_capacity)
+            {
+                Flush();
+            }
+
+            if (m_size < m_capacity)
+            {
+                m_pBuffer[m_size++] = static_cast<unsigned char>(m_bits);
+            }
+            else
+            {
+                m_failed = true;
+            }
+
+            m_bits >>= 8;
+        }
+
+        m_bitCount = m_bitCount > count * 8 ? m_bitCount - count * 8 : 0;
+    }
+
+    void Flush()
+    {
+        if (m_pFile == NULL || m_size == 0)
+        {
+            return;
+        }
+
+        if (fwrite(m_pBuffer, 1, m_size, m_pFile) != m_size)
+        {
+            m_failed = true;
+        }
+
+        m_flushed += m_size;
+        m_size = 0;
+    }
+
+    FILE* m_pFile;
+    unsigned char* m_pBuffer;
+    size_t m_capacity;
+    size_t m_size;
+
+    // bytes already handed to the file
+    size_t m_flushed;
+
+    // pending bits, the oldest lowest
+    uint64_t m_bits;
+    int m_bitCount;
+    bool m_failed;
+
+    unsigned char m_fileBuffer[BIT_STREAM_BUFFER];
+};
+
+class BitReader
+{
+public:
+    // From size bytes at pData.
+    BitReader(const unsigned char* pData, size_t size) :
+        m_pFile(NULL),
+        m_pData(pData),
+        m_size(size),
+        m_offset(0),
+        m_consumed(0),
+        m_bits(0),
+        m_bitCount(0),
+        m_failed(false)
+    {
+    }
+
+    // From an open file, read a buffer at a time.
+    explicit BitReader(FILE* pFile) :
+        m_pFile(pFile),
+        m_pData(m_fileBuffer),
+        m_size(0),
+        m_offset(0),
+        m_consumed(0),
+        m_bits(0),
+        m_bitCount(0),
+        m_failed(pFile == NULL)
+    {
+    }
+
+    BitReader(const BitReader&) = delete;
+    BitReader& operator=(const BitReader&) = delete;
+
+    // count bits, up to 32. Past the end of the data the stream fails and
+    // reads zeros.
+    uint32_t Read(int count)
+    {
+        if (m_bitCount < count)
+        {
+            Refill();
+            if (m_bitCount < count)
+            {
+                m_failed = true;
+                m_bits = 0;
+                m_bitCount = count;
+            }
+        }
+
+        uint32_t value = static_cast<uint32_t>(m_bits);
+        if (count < 32)
+        {
+            value &= (1u << count) - 1;
+        }
+
+        m_bits >>= count;
+        m_bitCount -= count;
+        return value;
+    }
+
+    bool Failed() const
+    {
+        return m_failed;
+    }
+
+    // Whole bytes taken from the data so far.
+    size_t GetByteCount() const
+    {
+        return m_consumed + m_offset - m_bitCount / 8;
+    }
+
+private:
+    void Refill()
+    {
+        while (m_bitCount <= 56)
+        {
+            if (m_offset == m_size)
+            {
+                if (m_pFile == NULL || m_failed)
+                {
+                    return;
+                }
+
+                m_consumed += m_size;
+                m_size = fread(m_fileBuffer, 1, BIT_STREAM_BUFFER, m_pFile);
+                m_offset = 0;
+                if (m_size == 0)
+                {
+                    return;
+                }
+            }
+
+            m_bits |= static_cast<uint64_t>(m_pData[m_offset++]) << m_bitCount;
+            m_bitCount += 8;
+        }
+    }
+
+    FILE* m_pFile;
+    const unsigned char* m_pData;
+    size_t m_size;
+    size_t m_offset;
+
+    // bytes of the file before the buffer
+    size_t m_consumed;
+
+    uint64_t m_bits;
+    int m_bitCount;
+    bool m_failed;
+
+    unsigned char m_fileBuffer[BIT_STREAM_BUFFER];
+};
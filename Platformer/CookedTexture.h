@@ -0,0 +1,64 @@
+#pragma once
+
+// Cooked textures are written by the AssetCooker project from textures/*.png
+// and embedded as "Texture" resources. The pixels are premultiplied BGRA, or
+// 8 bit indices into a premultiplied BGRA palette for textures with few
+// enough colors, so the game never decodes anything.
+//
+// Layout: header, paletteSize palette entries, dataSize bytes of pixels.
+
+#define COOKED_TEXTURE_MAGIC 0x58544B43 // "CKTX"
+#define COOKED_TEXTURE_VERSION 2
+
+#define COOKED_MAX_PALETTE_SIZE 256
+
+// Frame width of textures cooked without a sprite sheet, one tile.
+#define COOKED_DEFAULT_FRAME_WIDTH 16
+
+// Named frames of a sprite sheet. The sim only picks one of these, the sheet
+// of the texture decides where in the image it is.
+struct SpriteFrame
+{
+    enum Type : unsigned char
+    {
+        IDLE,
+        RUN_1,
+        RUN_2,
+        FALL,
+        CYCLE_1,
+        CYCLE_2,
+        CYCLE_3,
+        SPENT,
+        COUNT,
+    };
+};
+
+struct CookedTextureHeader
+{
+    enum Flags
+    {
+        NONE    = 0x0,
+        LZ4     = 0x1,
+        INDEXED = 0x2,
+    };
+
+    unsigned int magic;
+    unsigned short version;
+    unsigned short flags;
+    unsigned short width;
+    unsigned short height;
+    unsigned int stride;
+
+    // size of the pixels once decompressed, and as stored
+    unsigned int pixelSize;
+    unsigned int dataSize;
+
+    // texels per frame, frames are laid out left to right
+    unsigned short frameWidth;
+    unsigned char frames[SpriteFrame::COUNT];
+
+    // palette entries of INDEXED textures
+    unsigned short paletteSize;
+};
+
+static_assert(sizeof(CookedTextureHeader) % 4 == 0, "pixels following the header must stay aligned");
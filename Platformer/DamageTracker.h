@@ -0,0 +1,268 @@
+#pragma once
+#include <math.h>
+
+#include <d2d1.h>
+
+// Damage tracking for partial redraws of a view that did not move. Each
+// frame every drawable reports its rect and a word for how it looks (sprite
+// frame, flip, texture) under a slot of its own. A slot that appeared, went
+// away, moved or changed look damages the rect it covered last frame and the
+// one it covers now, and the renderer redraws only the damaged rects over
+// the frame it kept. A new view, a new target or anything else that could
+// change pixels no slot knows about asks for a full redraw with Invalidate.
+// Slots are small integer handles chosen by the caller.
+
+// Damage rects per frame. Overlapping or touching ones are merged, and past
+// this many the two whose union grows the least are.
+#define NUM_DAMAGE_RECTS 8
+
+// Pixels added around every damaged rect, for antialiased edges and filtered
+// sprites reaching into their neighbours.
+#define DAMAGE_MARGIN_PIXELS 1
+
+struct DamageStats
+{
+    int frames;
+    int fullFrames;
+
+    // share of the view redrawn by the last frame and summed over all frames
+    float lastFraction;
+    double totalFraction;
+};
+
+template<int SlotCount>
+class DamageTracker
+{
+public:
+    DamageTracker() :
+        stats(),
+        m_view(),
+        m_pixelsPerUnitX(1.f),
+        m_pixelsPerUnitY(1.f),
+        m_frame(FIRST_FRAME),
+        m_full(true),
+        m_count(0)
+    {
+        for (Slot& slot : m_slots)
+        {
+            slot.frame = 0;
+        }
+    }
+
+    // Redraw the whole view next frame.
+    void Invalidate()
+    {
+        m_full = true;
+    }
+
+    // Start a frame. view is the visible area in the units rects are
+    // reported in, pixelsPerUnit how many target pixels a unit covers, so
+    // damage can be grown to whole pixels.
+    void BeginFrame(const D2D1_RECT_F& view, float pixelsPerUnitX, float pixelsPerUnitY)
+    {
+        // a new view is redrawn whole, and so is an empty target, there are
+        // no pixels to snap damage to
+        if (view.left != m_view.left
+            || view.top != m_view.top
+            || view.right != m_view.right
+            || view.bottom != m_view.bottom
+            || pixelsPerUnitX != m_pixelsPerUnitX
+            || pixelsPerUnitY != m_pixelsPerUnitY
+            || pixelsPerUnitX <= 0.f
+            || pixelsPerUnitY <= 0.f)
+        {
+            m_full = true;
+        }
+
+        m_view = view;
+        m_pixelsPerUnitX = pixelsPerUnitX;
+        m_pixelsPerUnitY = pixelsPerUnitY;
+        m_frame++;
+        m_count = 0;
+    }
+
+    void Report(int slot, const D2D1_RECT_F& rect, unsigned int look)
+    {
+        if (slot < 0 || slot >= SlotCount)
+        {
+            return;
+        }
+
+        Slot& entry = m_slots[slot];
+        if (entry.frame != m_frame - 1)
+        {
+            AddDamage(rect);
+        }
+        else if (entry.look != look
+            || entry.rect.left != rect.left
+            || entry.rect.top != rect.top
+            || entry.rect.right != rect.right
+            || entry.rect.bottom != rect.bottom)
+        {
+            AddDamage(entry.rect);
+            AddDamage(rect);
+        }
+
+        entry.rect = rect;
+        entry.look = look;
+        entry.frame = m_frame;
+    }
+
+    // Close the frame: slots reported last frame but not this one damage
+    // where they were. Returns true when the whole view has to be redrawn,
+    // otherwise the damage is in GetRects.
+    bool EndFrame()
+    {
+        for (const Slot& slot : m_slots)
+        {
+            if (slot.frame == m_frame - 1)
+            {
+                AddDamage(slot.rect);
+            }
+        }
+
+        bool full = m_full;
+        if (full)
+        {
+            m_rects[0] = m_view;
+            m_count = 1;
+            m_full = false;
+        }
+
+        float area = 0.f;
+        for (int index = 0; index < m_count; index++)
+        {
+            area += Area(m_rects[index]);
+        }
+
+        float viewArea = Area(m_view);
+        stats.frames++;
+        stats.fullFrames += full ? 1 : 0;
+        stats.lastFraction = viewArea > 0.f ? area / viewArea : 1.f;
+        stats.totalFraction += stats.lastFraction;
+        return full;
+    }
+
+    // Disjoint rects to redraw this frame, on whole pixels.
+    const D2D1_RECT_F* GetRects() const
+    {
+        return m_rects;
+    }
+
+    int GetRectCount() const
+    {
+        return m_count;
+    }
+
+    DamageStats stats;
+
+private:
+    struct Slot
+    {
+        D2D1_RECT_F rect;
+        unsigned int look;
+
+        // last frame the slot was reported in
+        unsigned int frame;
+    };
+
+    // Slots start at frame 0, which is never the frame before the first.
+    static const unsigned int FIRST_FRAME = 2;
+
+    static float Area(const D2D1_RECT_F& rect)
+    {
+        return (rect.right - rect.left) * (rect.bottom - rect.top);
+    }
+
+    // Touching counts, their union covers nothing more.
+    static bool Touches(const D2D1_RECT_F& a, const D2D1_RECT_F& b)
+    {
+        return a.left <= b.right && b.left <= a.right && a.top <= b.bottom && b.top <= a.bottom;
+    }
+
+    static D2D1_RECT_F Union(const D2D1_RECT_F& a, const D2D1_RECT_F& b)
+    {
+        return D2D1::RectF(
+            a.left < b.left ? a.left : b.left,
+            a.top < b.top ? a.top : b.top,
+            a.right > b.right ? a.right : b.right,
+            a.bottom > b.bottom ? a.bottom : b.bottom);
+    }
+
+    // Grow rect to the pixels it touches plus the margin, inside the view.
+    // False when nothing of it is visible.
+    bool SnapToPixels(D2D1_RECT_F& rect) const
+    {
+        float left = floorf((rect.left - m_view.left) * m_pixelsPerUnitX) - DAMAGE_MARGIN_PIXELS;
+        float top = floorf((rect.top - m_view.top) * m_pixelsPerUnitY) - DAMAGE_MARGIN_PIXELS;
+        float right = ceilf((rect.right - m_view.left) * m_pixelsPerUnitX) + DAMAGE_MARGIN_PIXELS;
+        float bottom = ceilf((rect.bottom - m_view.top) * m_pixelsPerUnitY) + DAMAGE_MARGIN_PIXELS;
+
+        rect.left = m_view.left + left / m_pixelsPerUnitX;
+        rect.top = m_view.top + top / m_pixelsPerUnitY;
+        rect.right = m_view.left + right / m_pixelsPerUnitX;
+        rect.bottom = m_view.top + bottom / m_pixelsPerUnitY;
+
+        rect.left = rect.left > m_view.left ? rect.left : m_view.left;
+        rect.top = rect.top > m_view.top ? rect.top : m_view.top;
+        rect.right = rect.right < m_view.right ? rect.right : m_view.right;
+        rect.bottom = rect.bottom < m_view.bottom ? rect.bottom : m_view.bottom;
+        return rect.left < rect.right && rect.top < rect.bottom;
+    }
+
+    void AddDamage(D2D1_RECT_F rect)
+    {
+        if (m_full || !SnapToPixels(rect))
+        {
+            return;
+        }
+
+        // fold in whatever it touches, and when the list is full whatever
+        // grows the least, until it stands alone
+        for (;;)
+        {
+            int merge = -1;
+            for (int index = 0; index < m_count; index++)
+            {
+                if (Touches(m_rects[index], rect))
+                {
+                    merge = index;
+                    break;
+                }
+            }
+
+            if (merge < 0 && m_count < NUM_DAMAGE_RECTS)
+            {
+                break;
+            }
+
+            if (merge < 0)
+            {
+                float bestGrowth = 0.f;
+                for (int index = 0; index < m_count; index++)
+                {
+                    float growth = Area(Union(m_rects[index], rect)) - Area(m_rects[index]) - Area(rect);
+                    if (merge < 0 || growth < bestGrowth)
+                    {
+                        merge = index;
+                        bestGrowth = growth;
+                    }
+                }
+            }
+
+            rect = Union(rect, m_rects[merge]);
+            m_rects[merge] = m_rects[--m_count];
+        }
+
+        m_rects[m_count++] = rect;
+    }
+
+    D2D1_RECT_F m_view;
+    float m_pixelsPerUnitX;
+    float m_pixelsPerUnitY;
+    unsigned int m_frame;
+    bool m_full;
+    D2D1_RECT_F m_rects[NUM_DAMAGE_RECTS];
+    int m_count;
+    Slot m_slots[SlotCount];
+};
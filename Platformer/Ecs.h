@@ -0,0 +1,307 @@
+#pragma once
+
+// Minimal entity-component storage. An entity is an index shared by every
+// component pool plus a generation that tells a stale id from the entity that
+// reused its index. Each pool keeps its components packed in a dense array,
+// so systems walk only the components they read, in order, with no holes.
+
+typedef unsigned int EntityId;
+
+#define ENTITY_INDEX_BITS 16
+#define ENTITY_INDEX_MASK ((1u << ENTITY_INDEX_BITS) - 1)
+#define INVALID_ENTITY 0xFFFFFFFFu
+
+inline int EntityIndex(EntityId id)
+{
+    return static_cast<int>(id & ENTITY_INDEX_MASK);
+}
+
+inline EntityId MakeEntityId(int index, unsigned int generation)
+{
+    return (generation << ENTITY_INDEX_BITS) | static_cast<unsigned int>(index);
+}
+
+// Dense array of T keyed by entity index. Removal moves the last component
+// into the hole, so pools whose entities were added and removed together keep
+// the same order and systems reading several of them stay sequential.
+template<class T, int Capacity>
+class ComponentPool
+{
+public:
+    static_assert(Capacity <= static_cast<int>(ENTITY_INDEX_MASK), "entity indices do not fit");
+
+    ComponentPool() :
+        m_count(0)
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        for (int index = 0; index < Capacity; index++)
+        {
+            m_sparse[index] = -1;
+        }
+
+        m_count = 0;
+    }
+
+    // Component of a new entity, value-initialized. The entity must not have
+    // one already.
+    T& Add(int entity)
+    {
+        int dense = m_count++;
+        m_sparse[entity] = dense;
+        m_entities[dense] = entity;
+        m_components[dense] = T();
+        return m_components[dense];
+    }
+
+    void Remove(int entity)
+    {
+        int dense = m_sparse[entity];
+        if (dense < 0)
+        {
+            return;
+        }
+
+        int last = --m_count;
+        if (dense != last)
+        {
+            m_components[dense] = m_components[last];
+            m_entities[dense] = m_entities[last];
+            m_sparse[m_entities[dense]] = dense;
+        }
+
+        m_sparse[entity] = -1;
+    }
+
+    bool Has(int entity) const
+    {
+        return m_sparse[entity] >= 0;
+    }
+
+    // NULL when the entity has no such component.
+    T* Get(int entity)
+    {
+        int dense = m_sparse[entity];
+        return dense >= 0 ? &m_components[dense] : NULL;
+    }
+
+    const T* Get(int entity) const
+    {
+        int dense = m_sparse[entity];
+        return dense >= 0 ? &m_components[dense] : NULL;
+    }
+
+    int Count() const
+    {
+        return m_count;
+    }
+
+    // Dense access, for systems.
+    T& At(int dense)
+    {
+        return m_components[dense];
+    }
+
+    const T& At(int dense) const
+    {
+        return m_components[dense];
+    }
+
+    int EntityAt(int dense) const
+    {
+        return m_entities[dense];
+    }
+
+    const T* Data() const
+    {
+        return m_components;
+    }
+
+    // Stable insertion sort of the dense components by key(component,
+    // entity), close to a single pass when they are nearly in order.
+    template<class Key>
+    void SortBy(Key key)
+    {
+        for (int dense = 1; dense < m_count; dense++)
+        {
+            T component = m_components[dense];
+            int entity = m_entities[dense];
+            auto value = key(component, entity);
+            int target = dense;
+            while (target > 0 && value < key(m_components[target - 1], m_entities[target - 1]))
+            {
+                m_components[target] = m_components[target - 1];
+                m_entities[target] = m_entities[target - 1];
+                m_sparse[m_entities[target]] = target;
+                target--;
+            }
+
+            if (target != dense)
+            {
+                m_components[target] = component;
+                m_entities[target] = entity;
+                m_sparse[entity] = target;
+            }
+        }
+    }
+
+private:
+    int m_count;
+    int m_sparse[Capacity];
+    int m_entities[Capacity];
+    T m_components[Capacity];
+};
+
+// Entity ids with a free list of indices.
+template<int Capacity>
+class EntityPool
+{
+public:
+    static_assert(Capacity <= static_cast<int>(ENTITY_INDEX_MASK), "entity indices do not fit");
+
+    EntityPool()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        for (int index = 0; index < Capacity; index++)
+        {
+            m_alive[index] = false;
+            m_generations[index] = 0;
+            m_free[index] = Capacity - 1 - index;
+        }
+
+        m_freeCount = Capacity;
+    }
+
+    // INVALID_ENTITY when the pool is full.
+    EntityId Create()
+    {
+        if (m_freeCount == 0)
+        {
+            return INVALID_ENTITY;
+        }
+
+        int index = m_free[--m_freeCount];
+        m_alive[index] = true;
+        return MakeEntityId(index, m_generations[index]);
+    }
+
+    // Take a given index, for an entity kept at a fixed one. The rest of the
+    // free list keeps its order, so Create hands out the same indices as
+    // before. INVALID_ENTITY when the index is taken.
+    EntityId CreateAt(int index)
+    {
+        if (index < 0 || index >= Capacity || m_alive[index])
+        {
+            return INVALID_ENTITY;
+        }
+
+        int slot = 0;
+        while (m_free[slot] != index)
+        {
+            slot++;
+        }
+
+        m_freeCount--;
+        for (; slot < m_freeCount; slot++)
+        {
+            m_free[slot] = m_free[slot + 1];
+        }
+
+        m_alive[index] = true;
+        return MakeEntityId(index, m_generations[index]);
+    }
+
+    void Destroy(int index)
+    {
+        if (!m_alive[index])
+        {
+            return;
+        }
+
+        m_alive[index] = false;
+        m_generations[index]++;
+        m_free[m_freeCount++] = index;
+    }
+
+    bool IsAlive(EntityId id) const
+    {
+        int index = EntityIndex(id);
+        return id != INVALID_ENTITY
+            && m_alive[index]
+            && m_generations[index] == (id >> ENTITY_INDEX_BITS);
+    }
+
+    bool IsAliveIndex(int index) const
+    {
+        return m_alive[index];
+    }
+
+    EntityId GetId(int index) const
+    {
+        return MakeEntityId(index, m_generations[index]);
+    }
+
+    int Count() const
+    {
+        return Capacity - m_freeCount;
+    }
+
+    // The saved parts of the pool, see SaveState.h: the generation of every
+    // index and the free list, the next index Create hands out last.
+    unsigned int GetGeneration(int index) const
+    {
+        return m_generations[index];
+    }
+
+    int FreeAt(int slot) const
+    {
+        return m_free[slot];
+    }
+
+    // Rebuild from generations and a free list in that order. Indices not on
+    // the list are alive. False, leaving the pool empty, when the list holds
+    // an index twice or out of range.
+    bool Restore(const unsigned short* generations, const int* free, int freeCount)
+    {
+        Clear();
+        if (freeCount < 0 || freeCount > Capacity)
+        {
+            return false;
+        }
+
+        for (int index = 0; index < Capacity; index++)
+        {
+            m_alive[index] = true;
+            m_generations[index] = generations[index];
+        }
+
+        for (int slot = 0; slot < freeCount; slot++)
+        {
+            int index = free[slot];
+            if (index < 0 || index >= Capacity || !m_alive[index])
+            {
+                Clear();
+                return false;
+            }
+
+            m_alive[index] = false;
+            m_free[slot] = index;
+        }
+
+        m_freeCount = freeCount;
+        return true;
+    }
+
+private:
+    bool m_alive[Capacity];
+    unsigned short m_generations[Capacity];
+    int m_free[Capacity];
+    int m_freeCount;
+};
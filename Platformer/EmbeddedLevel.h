@@ -0,0 +1,295 @@
+#pragma once
+#include "Platformer.h"
+
+// Compile-time level building. A level written as a constexpr stream of
+// shorts, in the same layout as the LEVEL resources, is validated, has its
+// textures and archetypes hoisted and its records sorted by left, and gets a
+// chunk table, all during compilation. VALIDATE_EMBEDDED_LEVEL turns any problem into a build
+// error.
+
+struct LevelError
+{
+    enum Type
+    {
+        NONE,
+        MISSING_END,
+        TRUNCATED_RECORD,
+        UNKNOWN_RECORD,
+        EMPTY_RECT,
+        OUT_OF_BOUNDS,
+        BAD_TEXTURE_SLOT,
+        BAD_TEXTURE_RESOURCE,
+        TEXTURE_REDEFINED,
+        UNDEFINED_TEXTURE,
+        BAD_BLOCK_TYPE,
+        BAD_ENEMY_TYPE,
+        BAD_PALETTE,
+        BAD_ARCHETYPE,
+        ARCHETYPE_REDEFINED,
+    };
+};
+
+template<int N>
+struct CompiledLevel
+{
+    constexpr EmbeddedLevel View() const
+    {
+        return EmbeddedLevel{ textures, textureCount, archetypes, archetypeCount, records, recordCount, chunkFirstRecord, chunkCount };
+    }
+
+    LevelRecord textures[NUM_TEXTURES];
+    int textureCount;
+
+    LevelRecord archetypes[NUM_ENEMY_ARCHETYPES];
+    int archetypeCount;
+
+    // every record but END is at least three shorts long
+    LevelRecord records[N / 3 + 1];
+    int recordCount;
+
+    short chunkFirstRecord[NUM_LEVEL_CHUNKS];
+    int chunkCount;
+
+    LevelError::Type error;
+
+    // offset in shorts of the offending record
+    int errorOffset;
+};
+
+constexpr LevelError::Type ValidateLevelRecord(const LevelRecord& record)
+{
+    switch (record.type)
+    {
+    case LevelEntity::TEXTURE:
+        if (record.textureId < 0 || record.textureId >= NUM_TEXTURES)
+        {
+            return LevelError::BAD_TEXTURE_SLOT;
+        }
+
+        if (record.kind <= TEXTURE_OFFSET || record.kind > TEXTURE_LAST)
+        {
+            return LevelError::BAD_TEXTURE_RESOURCE;
+        }
+
+        return LevelError::NONE;
+
+    case LevelEntity::GEO:
+    case LevelEntity::TILES:
+        if (record.right <= record.left || record.bottom <= record.top)
+        {
+            return LevelError::EMPTY_RECT;
+        }
+
+        if (record.kind < 0 || record.kind >= Geo::BLOCK_TYPE_COUNT)
+        {
+            return LevelError::BAD_BLOCK_TYPE;
+        }
+
+        if (record.type == LevelEntity::TILES
+            && record.right > NUM_TILE_CHUNKS * TILE_CHUNK_PIXEL_WIDTH)
+        {
+            return LevelError::OUT_OF_BOUNDS;
+        }
+        break;
+
+    case LevelEntity::ARCHETYPE:
+        if (record.kind < 0 || record.kind >= NUM_ENEMY_ARCHETYPES)
+        {
+            return LevelError::BAD_ENEMY_TYPE;
+        }
+
+        if (record.archetype.runSpeed < 0
+            || record.archetype.width <= 0 || record.archetype.width > ENEMY_MAX_SIZE
+            || record.archetype.height <= 0 || record.archetype.height > ENEMY_MAX_SIZE
+            || record.archetype.gravityPercent < 0
+            || (record.archetype.flags & ~(ENEMY_TURNS_AT_LEDGES | ENEMY_STOMPABLE)) != 0
+            || !IsSpriteFrame(record.archetype.idleFrame)
+            || !IsSpriteFrame(record.archetype.runFrame1)
+            || !IsSpriteFrame(record.archetype.runFrame2)
+            || !IsSpriteFrame(record.archetype.fallFrame))
+        {
+            return LevelError::BAD_ARCHETYPE;
+        }
+
+        return LevelError::NONE;
+
+    case LevelEntity::ENEMY:
+        // whether the type has an archetype depends on the records before
+        if ((record.kind & ((1 << ENEMY_PALETTE_SHIFT) - 1)) >= NUM_ENEMY_ARCHETYPES)
+        {
+            return LevelError::BAD_ENEMY_TYPE;
+        }
+
+        if ((record.kind >> ENEMY_PALETTE_SHIFT) >= Palette::COUNT)
+        {
+            return LevelError::BAD_PALETTE;
+        }
+        break;
+
+    default:
+        return LevelError::UNKNOWN_RECORD;
+    }
+
+    if (record.left < 0.f)
+    {
+        return LevelError::OUT_OF_BOUNDS;
+    }
+
+    if (record.textureId < 0 || record.textureId >= NUM_TEXTURES)
+    {
+        return LevelError::BAD_TEXTURE_SLOT;
+    }
+
+    return LevelError::NONE;
+}
+
+template<int N>
+constexpr CompiledLevel<N> CompileLevel(const short (&data)[N])
+{
+    CompiledLevel<N> level = {};
+    bool textureDefined[NUM_TEXTURES] = {};
+    bool archetypeSet[NUM_ENEMY_ARCHETYPES] = {};
+
+    const short* next = data;
+    const short* end = data + N;
+    while (true)
+    {
+        level.errorOffset = static_cast<int>(next - data);
+        if (next >= end)
+        {
+            level.error = LevelError::MISSING_END;
+            return level;
+        }
+
+        if (*next == LevelEntity::END)
+        {
+            break;
+        }
+
+        int size = LevelRecordSize(*next);
+        if (size == 0)
+        {
+            level.error = LevelError::UNKNOWN_RECORD;
+            return level;
+        }
+
+        if (size > end - next)
+        {
+            level.error = LevelError::TRUNCATED_RECORD;
+            return level;
+        }
+
+        LevelRecord record = {};
+        ReadLevelRecord(next, record);
+
+        level.error = ValidateLevelRecord(record);
+        if (level.error != LevelError::NONE)
+        {
+            return level;
+        }
+
+        if (record.type == LevelEntity::TEXTURE)
+        {
+            // all textures are loaded up front, so a slot can only be set once
+            if (textureDefined[record.textureId])
+            {
+                level.error = LevelError::TEXTURE_REDEFINED;
+                return level;
+            }
+
+            textureDefined[record.textureId] = true;
+            level.textures[level.textureCount++] = record;
+        }
+        else if (record.type == LevelEntity::ARCHETYPE)
+        {
+            // archetypes are set up front too
+            if (archetypeSet[record.kind])
+            {
+                level.error = LevelError::ARCHETYPE_REDEFINED;
+                return level;
+            }
+
+            archetypeSet[record.kind] = true;
+            level.archetypes[level.archetypeCount++] = record;
+        }
+        else
+        {
+            level.records[level.recordCount++] = record;
+        }
+    }
+
+    for (int index = 0; index < level.recordCount; index++)
+    {
+        if (!textureDefined[level.records[index].textureId])
+        {
+            level.error = LevelError::UNDEFINED_TEXTURE;
+            level.errorOffset = -1;
+            return level;
+        }
+
+        if (level.records[index].type == LevelEntity::ENEMY)
+        {
+            int type = level.records[index].kind & ((1 << ENEMY_PALETTE_SHIFT) - 1);
+            if (!archetypeSet[type] && !IsStockEnemyType(type))
+            {
+                level.error = LevelError::BAD_ENEMY_TYPE;
+                level.errorOffset = -1;
+                return level;
+            }
+        }
+    }
+
+    // Stable insertion sort by left. Authored levels are almost sorted
+    // already, which keeps this close to linear and well inside the
+    // compiler's constexpr step limit.
+    for (int index = 1; index < level.recordCount; index++)
+    {
+        LevelRecord record = level.records[index];
+        int insert = index;
+        while (insert > 0 && level.records[insert - 1].left > record.left)
+        {
+            level.records[insert] = level.records[insert - 1];
+            insert--;
+        }
+
+        level.records[insert] = record;
+    }
+
+    if (level.recordCount > 0)
+    {
+        float lastLeft = level.records[level.recordCount - 1].left;
+        level.chunkCount = static_cast<int>(lastLeft) / LEVEL_CHUNK_WIDTH + 1;
+    }
+
+    int first = 0;
+    for (int chunk = 0; chunk < level.chunkCount; chunk++)
+    {
+        float chunkLeft = static_cast<float>(chunk * LEVEL_CHUNK_WIDTH);
+        while (first < level.recordCount && level.records[first].left < chunkLeft)
+        {
+            first++;
+        }
+
+        level.chunkFirstRecord[chunk] = static_cast<short>(first);
+    }
+
+    level.errorOffset = -1;
+    return level;
+}
+
+#define VALIDATE_EMBEDDED_LEVEL(level) \
+    static_assert((level).error != LevelError::MISSING_END, #level ": stream has no END record"); \
+    static_assert((level).error != LevelError::TRUNCATED_RECORD, #level ": last record is cut short"); \
+    static_assert((level).error != LevelError::UNKNOWN_RECORD, #level ": unknown record type"); \
+    static_assert((level).error != LevelError::EMPTY_RECT, #level ": geo or tiles with no area"); \
+    static_assert((level).error != LevelError::OUT_OF_BOUNDS, #level ": record outside the level"); \
+    static_assert((level).error != LevelError::BAD_TEXTURE_SLOT, #level ": texture slot out of range"); \
+    static_assert((level).error != LevelError::BAD_TEXTURE_RESOURCE, #level ": texture resource does not exist"); \
+    static_assert((level).error != LevelError::TEXTURE_REDEFINED, #level ": texture slot set twice"); \
+    static_assert((level).error != LevelError::UNDEFINED_TEXTURE, #level ": record uses a texture slot that is never set"); \
+    static_assert((level).error != LevelError::BAD_BLOCK_TYPE, #level ": unknown block type"); \
+    static_assert((level).error != LevelError::BAD_ENEMY_TYPE, #level ": enemy type with no archetype"); \
+    static_assert((level).error != LevelError::BAD_PALETTE, #level ": unknown enemy palette"); \
+    static_assert((level).error != LevelError::BAD_ARCHETYPE, #level ": archetype out of range"); \
+    static_assert((level).error != LevelError::ARCHETYPE_REDEFINED, #level ": archetype set twice"); \
+    static_assert((level).error == LevelError::NONE, #level ": invalid level")
@@ -0,0 +1,234 @@
+#pragma once
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <type_traits>
+
+#include <d2d1.h>
+
+// Number type of the simulation. Floats round differently depending on the
+// compiler, the optimization level and the FPU mode (x87 or SSE, contracted
+// multiply-adds), so the same inputs can play out differently on two builds.
+// With fixed point every operation is integer math and a replay or a
+// lockstep peer gets bit-identical results on any build.
+#ifndef USE_FIXED_POINT_PHYSICS
+#define USE_FIXED_POINT_PHYSICS 0
+#endif
+
+// 16.16: steps of 1/65536 and a range of about +-32767 units, more than the
+// longest level, see LEVEL_GEN_MAX_LENGTH.
+#define FIXED_FRACTION_BITS 16
+#define FIXED_ONE (1 << FIXED_FRACTION_BITS)
+
+class Fixed
+{
+public:
+    // Uninitialized like a float, so components holding it stay trivial.
+    Fixed() = default;
+
+    // Whole units convert implicitly, they are exact. Integers only, so a
+    // float never sneaks in truncated through an int conversion.
+    template<class Integer, class = typename std::enable_if<std::is_integral<Integer>::value>::type>
+    constexpr Fixed(Integer value) :
+        m_raw(static_cast<int32_t>(value) * FIXED_ONE)
+    {
+    }
+
+    // Nearest value. Only meant for constants and level data; converting a
+    // float computed at run time would bring its rounding back in.
+    constexpr explicit Fixed(float value) :
+        m_raw(static_cast<int32_t>(static_cast<double>(value) * FIXED_ONE + (value < 0.f ? -0.5 : 0.5)))
+    {
+    }
+
+    static constexpr Fixed FromRaw(int32_t raw)
+    {
+        Fixed value = Fixed();
+        value.m_raw = raw;
+        return value;
+    }
+
+    constexpr int32_t Raw() const
+    {
+        return m_raw;
+    }
+
+    // Exact for up to 24 significant bits, rounded to nearest past that.
+    // For drawing and streaming hints only: where floats are kept wider than
+    // declared (FLT_EVAL_METHOD 2, x87) arithmetic on the result can round
+    // differently from build to build, so the game never decides anything on
+    // it. Compare Fixed values, or whole units from FloorDiv and CeilDiv.
+    float ToFloat() const
+    {
+        return static_cast<float>(m_raw) * (1.f / FIXED_ONE);
+    }
+
+    constexpr Fixed operator-() const
+    {
+        return FromRaw(-m_raw);
+    }
+
+    friend constexpr Fixed operator+(Fixed a, Fixed b)
+    {
+        return FromRaw(a.m_raw + b.m_raw);
+    }
+
+    friend constexpr Fixed operator-(Fixed a, Fixed b)
+    {
+        return FromRaw(a.m_raw - b.m_raw);
+    }
+
+    // Products and quotients round towards negative infinity.
+    friend constexpr Fixed operator*(Fixed a, Fixed b)
+    {
+        return FromRaw(static_cast<int32_t>((static_cast<int64_t>(a.m_raw) * b.m_raw) >> FIXED_FRACTION_BITS));
+    }
+
+    friend constexpr Fixed operator/(Fixed a, Fixed b)
+    {
+        return FromRaw(static_cast<int32_t>(FloorDivide(static_cast<int64_t>(a.m_raw) * FIXED_ONE, b.m_raw)));
+    }
+
+    Fixed& operator+=(Fixed other)
+    {
+        m_raw += other.m_raw;
+        return *this;
+    }
+
+    Fixed& operator-=(Fixed other)
+    {
+        m_raw -= other.m_raw;
+        return *this;
+    }
+
+    Fixed& operator*=(Fixed other)
+    {
+        return *this = *this * other;
+    }
+
+    Fixed& operator/=(Fixed other)
+    {
+        return *this = *this / other;
+    }
+
+    friend constexpr bool operator==(Fixed a, Fixed b) { return a.m_raw == b.m_raw; }
+    friend constexpr bool operator!=(Fixed a, Fixed b) { return a.m_raw != b.m_raw; }
+    friend constexpr bool operator<(Fixed a, Fixed b) { return a.m_raw < b.m_raw; }
+    friend constexpr bool operator<=(Fixed a, Fixed b) { return a.m_raw <= b.m_raw; }
+    friend constexpr bool operator>(Fixed a, Fixed b) { return a.m_raw > b.m_raw; }
+    friend constexpr bool operator>=(Fixed a, Fixed b) { return a.m_raw >= b.m_raw; }
+
+    static constexpr int64_t FloorDivide(int64_t numerator, int64_t denominator)
+    {
+        return numerator / denominator - ((numerator % denominator != 0) && ((numerator < 0) != (denominator < 0)) ? 1 : 0);
+    }
+
+private:
+    int32_t m_raw;
+};
+
+#define FIXED_MAX Fixed::FromRaw(INT32_MAX)
+
+struct FixedRect
+{
+    Fixed left;
+    Fixed top;
+    Fixed right;
+    Fixed bottom;
+};
+
+struct FixedPoint
+{
+    Fixed x;
+    Fixed y;
+};
+
+// The helpers below take either number type, so code templated on it or
+// written against Scalar reads the same for both.
+
+inline float ToFloat(float value)
+{
+    return value;
+}
+
+inline float ToFloat(Fixed value)
+{
+    return value.ToFloat();
+}
+
+inline float Abs(float value)
+{
+    return fabsf(value);
+}
+
+inline Fixed Abs(Fixed value)
+{
+    return value < 0 ? -value : value;
+}
+
+template<class T>
+inline T Min(T a, T b)
+{
+    return b < a ? b : a;
+}
+
+template<class T>
+inline T Max(T a, T b)
+{
+    return a < b ? b : a;
+}
+
+// floor(value / divisor) and ceil(value / divisor), for grid cells.
+inline int FloorDiv(float value, int divisor)
+{
+    return static_cast<int>(floorf(value / divisor));
+}
+
+inline int FloorDiv(Fixed value, int divisor)
+{
+    return static_cast<int>(Fixed::FloorDivide(value.Raw(), static_cast<int64_t>(divisor) * FIXED_ONE));
+}
+
+inline int CeilDiv(float value, int divisor)
+{
+    return static_cast<int>(ceilf(value / divisor));
+}
+
+inline int CeilDiv(Fixed value, int divisor)
+{
+    return -FloorDiv(-value, divisor);
+}
+
+inline D2D1_RECT_F ToRectF(const D2D1_RECT_F& rect)
+{
+    return rect;
+}
+
+inline D2D1_RECT_F ToRectF(const FixedRect& rect)
+{
+    return D2D1::RectF(rect.left.ToFloat(), rect.top.ToFloat(), rect.right.ToFloat(), rect.bottom.ToFloat());
+}
+
+#if USE_FIXED_POINT_PHYSICS
+typedef Fixed Scalar;
+typedef FixedRect SimRect;
+typedef FixedPoint SimPoint;
+#define SCALAR_MAX FIXED_MAX
+#else
+typedef float Scalar;
+typedef D2D1_RECT_F SimRect;
+typedef D2D1_POINT_2F SimPoint;
+#define SCALAR_MAX FLT_MAX
+#endif
+
+inline SimRect MakeSimRect(Scalar left, Scalar top, Scalar right, Scalar bottom)
+{
+    SimRect rect = { left, top, right, bottom };
+    return rect;
+}
+
+inline SimPoint MakeSimPoint(Scalar x, Scalar y)
+{
+    SimPoint point = { x, y };
+    return point;
+}
@@ -0,0 +1,228 @@
+#pragma once
+#include <windows.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <new>
+
+#define FRAME_ARENA_SIZE (64 * 1024)
+
+// Frames whose allocations are alive at once. Data allocated in one frame is
+// still valid during the next, so a consumer thread can read a frame while
+// the sim builds the one after it.
+#define NUM_FRAME_ARENAS 2
+
+struct FrameArenaStats
+{
+    // bytes handed out this frame, and the most any single frame used
+    size_t used;
+    size_t highWater;
+
+    // usage of the last completed frame
+    size_t lastFrameUsed;
+
+    // allocations that did not fit and went to the heap instead
+    int overflows;
+    int lastFrameOverflows;
+};
+
+// Linear allocator for data that only lives for a frame. Everything is
+// released at once by BeginFrame. Allocating is only safe from the thread
+// that calls BeginFrame.
+class FrameArena
+{
+public:
+    FrameArena() :
+        stats(),
+        m_current(0),
+        m_buffers(),
+        m_offsets(),
+        m_overflowBlocks(),
+        m_frameOverflows(0)
+    {
+        // a missing buffer only means every allocation overflows
+        for (int index = 0; index < NUM_FRAME_ARENAS; index++)
+        {
+            m_buffers[index] = static_cast<char*>(malloc(FRAME_ARENA_SIZE));
+        }
+    }
+
+    ~FrameArena()
+    {
+        for (int index = 0; index < NUM_FRAME_ARENAS; index++)
+        {
+            FreeOverflowBlocks(index);
+            free(m_buffers[index]);
+        }
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Switch to the buffer of the frame before last and drop what it held.
+    void BeginFrame()
+    {
+        stats.lastFrameUsed = m_offsets[m_current];
+        stats.lastFrameOverflows = m_frameOverflows;
+
+        m_current = (m_current + 1) % NUM_FRAME_ARENAS;
+        m_offsets[m_current] = 0;
+        m_frameOverflows = 0;
+        FreeOverflowBlocks(m_current);
+
+        stats.used = 0;
+    }
+
+    // Never fails while the heap does not. Allocations that do not fit fall
+    // back to the heap, are counted, and are released with the frame.
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        uintptr_t base = reinterpret_cast<uintptr_t>(m_buffers[m_current]);
+        size_t offset = ((base + m_offsets[m_current] + alignment - 1) & ~(alignment - 1)) - base;
+        if (base != 0 && offset + size <= FRAME_ARENA_SIZE)
+        {
+            m_offsets[m_current] = offset + size;
+            Track(offset + size);
+            return m_buffers[m_current] + offset;
+        }
+
+        return AllocateOverflow(size, alignment);
+    }
+
+    FrameArenaStats stats;
+
+private:
+    struct OverflowBlock
+    {
+        OverflowBlock* next;
+    };
+
+    void Track(size_t used)
+    {
+        stats.used = used;
+        if (used > stats.highWater)
+        {
+            stats.highWater = used;
+        }
+    }
+
+    void* AllocateOverflow(size_t size, size_t alignment)
+    {
+        if (m_frameOverflows == 0)
+        {
+            OutputDebugStringA("FrameArena: out of space, falling back to the heap\n");
+        }
+
+        m_frameOverflows++;
+        stats.overflows++;
+
+        // room for the list link, then padding up to the alignment
+        OverflowBlock* pBlock = static_cast<OverflowBlock*>(malloc(sizeof(OverflowBlock) + alignment - 1 + size));
+        if (pBlock == NULL)
+        {
+            return NULL;
+        }
+
+        pBlock->next = m_overflowBlocks[m_current];
+        m_overflowBlocks[m_current] = pBlock;
+
+        uintptr_t data = reinterpret_cast<uintptr_t>(pBlock + 1);
+        return reinterpret_cast<void*>((data + alignment - 1) & ~(alignment - 1));
+    }
+
+    void FreeOverflowBlocks(int index)
+    {
+        while (m_overflowBlocks[index])
+        {
+            OverflowBlock* pNext = m_overflowBlocks[index]->next;
+            free(m_overflowBlocks[index]);
+            m_overflowBlocks[index] = pNext;
+        }
+    }
+
+    int m_current;
+    char* m_buffers[NUM_FRAME_ARENAS];
+    size_t m_offsets[NUM_FRAME_ARENAS];
+    OverflowBlock* m_overflowBlocks[NUM_FRAME_ARENAS];
+    int m_frameOverflows;
+};
+
+// std allocator over a FrameArena, for containers that only live for a frame.
+// Deallocation is a no-op, the memory goes away with the frame.
+template<class T>
+class FrameAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit FrameAllocator(FrameArena& arena) : m_pArena(&arena)
+    {
+    }
+
+    template<class U>
+    FrameAllocator(const FrameAllocator<U>& other) : m_pArena(other.GetArena())
+    {
+    }
+
+    // Throws like any allocator when even the heap fallback fails.
+    T* allocate(size_t count)
+    {
+        T* p = static_cast<T*>(m_pArena->Allocate(count * sizeof(T), alignof(T)));
+        if (p == NULL)
+        {
+            throw std::bad_alloc();
+        }
+
+        return p;
+    }
+
+    void deallocate(T*, size_t)
+    {
+    }
+
+    FrameArena* GetArena() const
+    {
+        return m_pArena;
+    }
+
+    template<class U>
+    bool operator==(const FrameAllocator<U>& other) const
+    {
+        return m_pArena == other.GetArena();
+    }
+
+    template<class U>
+    bool operator!=(const FrameAllocator<U>& other) const
+    {
+        return m_pArena != other.GetArena();
+    }
+
+private:
+    FrameArena* m_pArena;
+};
+
+typedef std::basic_string<wchar_t, std::char_traits<wchar_t>, FrameAllocator<wchar_t>> FrameWString;
+
+// Append the decimal digits of value, formatted on the stack so the only
+// memory used is the string's own, from the frame.
+inline void AppendInt(FrameWString& string, long long value)
+{
+    wchar_t digits[24];
+    wchar_t* pEnd = digits + sizeof(digits) / sizeof(digits[0]);
+    wchar_t* pDigit = pEnd;
+    unsigned long long magnitude = value < 0 ? 0ull - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value);
+    do
+    {
+        *--pDigit = static_cast<wchar_t>(L'0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0)
+    {
+        *--pDigit = L'-';
+    }
+
+    string.append(pDigit, pEnd);
+}
@@ -0,0 +1,238 @@
+#pragma once
+#include <windows.h>
+#include <stdlib.h>
+
+#include "CookedTexture.h"
+#include "Lz4.h"
+
+// Pixels of a cooked "Texture" resource. Either premultiplied BGRA, ready to
+// be copied into a device bitmap, or one byte per pixel indexing palette.
+struct DecodedImage
+{
+    UINT width;
+    UINT height;
+    UINT stride;
+    BYTE* pixels;
+
+    // false when pixels point straight into the resource section
+    bool ownsPixels;
+
+    // premultiplied BGRA entries in the resource section, NULL for BGRA
+    // images
+    const UINT* palette;
+    UINT paletteSize;
+};
+
+inline void FreeDecodedImage(DecodedImage* pImage)
+{
+    if (pImage->ownsPixels)
+    {
+        free(pImage->pixels);
+    }
+
+    pImage->pixels = NULL;
+    pImage->ownsPixels = false;
+    pImage->palette = NULL;
+    pImage->paletteSize = 0;
+    pImage->width = 0;
+    pImage->height = 0;
+    pImage->stride = 0;
+}
+
+// Header of a cooked "Texture" resource, NULL when the resource is missing or
+// was cooked for another version of the format. The pixel data follows it.
+inline const CookedTextureHeader* FindCookedTexture(int resourceId)
+{
+    HRSRC hRes = FindResource(
+        HINST_THISCOMPONENT,
+        MAKEINTRESOURCE(resourceId),
+        L"Texture");
+    if (hRes == NULL)
+    {
+        return NULL;
+    }
+
+    HGLOBAL hResLoad = LoadResource(HINST_THISCOMPONENT, hRes);
+    if (hResLoad == NULL)
+    {
+        return NULL;
+    }
+
+    const CookedTextureHeader* pHeader = static_cast<const CookedTextureHeader*>(LockResource(hResLoad));
+    DWORD resourceSize = SizeofResource(HINST_THISCOMPONENT, hRes);
+    if (pHeader == NULL
+        || resourceSize < sizeof(CookedTextureHeader)
+        || pHeader->magic != COOKED_TEXTURE_MAGIC
+        || pHeader->version != COOKED_TEXTURE_VERSION
+        || pHeader->paletteSize > COOKED_MAX_PALETTE_SIZE
+        || pHeader->paletteSize * sizeof(UINT) + pHeader->dataSize > resourceSize - sizeof(CookedTextureHeader)
+        || pHeader->pixelSize != pHeader->stride * pHeader->height)
+    {
+        return NULL;
+    }
+
+    return pHeader;
+}
+
+// Load a cooked texture. Resources are mapped with the executable, so
+// uncompressed pixels are used in place and compressed ones are inflated into
+// memory owned by the image. Safe to call from any thread.
+inline HRESULT LoadCookedTexture(int resourceId, DecodedImage* pImage)
+{
+    *pImage = DecodedImage();
+
+    const CookedTextureHeader* pHeader = FindCookedTexture(resourceId);
+    if (pHeader == NULL)
+    {
+        return E_FAIL;
+    }
+
+    const UINT* pPalette = reinterpret_cast<const UINT*>(pHeader + 1);
+    const BYTE* pData = reinterpret_cast<const BYTE*>(pPalette + pHeader->paletteSize);
+    if (pHeader->flags & CookedTextureHeader::LZ4)
+    {
+        BYTE* pixels = static_cast<BYTE*>(malloc(pHeader->pixelSize));
+        if (pixels == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        if (!Lz4Decompress(pData, pHeader->dataSize, pixels, pHeader->pixelSize))
+        {
+            free(pixels);
+            return E_FAIL;
+        }
+
+        pImage->pixels = pixels;
+        pImage->ownsPixels = true;
+    }
+    else
+    {
+        if (pHeader->dataSize != pHeader->pixelSize)
+        {
+            return E_FAIL;
+        }
+
+        pImage->pixels = const_cast<BYTE*>(pData);
+        pImage->ownsPixels = false;
+    }
+
+    if (pHeader->flags & CookedTextureHeader::INDEXED)
+    {
+        pImage->palette = pPalette;
+        pImage->paletteSize = pHeader->paletteSize;
+    }
+
+    pImage->width = pHeader->width;
+    pImage->height = pHeader->height;
+    pImage->stride = pHeader->stride;
+
+    return S_OK;
+}
+
+// Where the named frames of a texture are, in texels.
+struct SpriteSheet
+{
+    int GetFrameLeft(int frame) const
+    {
+        return frame >= 0 && frame < SpriteFrame::COUNT
+            ? frames[frame] * frameWidth
+            : 0;
+    }
+
+    int frameWidth;
+    unsigned char frames[SpriteFrame::COUNT];
+};
+
+// Sprite sheet of a cooked texture. Textures without one are a single frame.
+inline void ReadSpriteSheet(int resourceId, SpriteSheet* pSheet)
+{
+    *pSheet = SpriteSheet();
+    pSheet->frameWidth = COOKED_DEFAULT_FRAME_WIDTH;
+
+    const CookedTextureHeader* pHeader = FindCookedTexture(resourceId);
+    if (pHeader == NULL)
+    {
+        return;
+    }
+
+    pSheet->frameWidth = pHeader->frameWidth;
+    for (int index = 0; index < SpriteFrame::COUNT; index++)
+    {
+        pSheet->frames[index] = pHeader->frames[index];
+    }
+}
+
+// Recolors applied to a texture when it is drawn. Indexed textures only swap
+// their palette, so a variant costs no texture memory on the CPU side.
+struct Palette
+{
+    enum Type : unsigned char
+    {
+        BASE,
+        SWAP_RED_BLUE,
+        SWAP_RED_GREEN,
+        GRAY,
+        COUNT,
+    };
+};
+
+// Apply a palette to one premultiplied BGRA color. Premultiplied colors stay
+// valid since no channel grows past the largest one.
+inline UINT SwapColor(UINT color, Palette::Type palette)
+{
+    UINT alpha = color & 0xFF000000;
+    UINT red = (color >> 16) & 0xFF;
+    UINT green = (color >> 8) & 0xFF;
+    UINT blue = color & 0xFF;
+
+    switch (palette)
+    {
+    case Palette::SWAP_RED_BLUE:
+        return alpha | (blue << 16) | (green << 8) | red;
+    case Palette::SWAP_RED_GREEN:
+        return alpha | (green << 16) | (red << 8) | blue;
+    case Palette::GRAY:
+        {
+            UINT luma = (red * 77 + green * 150 + blue * 29) >> 8;
+            return alpha | (luma << 16) | (luma << 8) | luma;
+        }
+    case Palette::BASE:
+    default:
+        return color;
+    }
+}
+
+// Blit an image to width * height premultiplied BGRA pixels, looking indexed
+// pixels up in the image's palette after applying palette to it.
+inline void ExpandImage(const DecodedImage& image, Palette::Type palette, UINT* pDest)
+{
+    if (image.palette)
+    {
+        UINT colors[COOKED_MAX_PALETTE_SIZE] = {};
+        for (UINT index = 0; index < image.paletteSize; index++)
+        {
+            colors[index] = SwapColor(image.palette[index], palette);
+        }
+
+        for (UINT y = 0; y < image.height; y++)
+        {
+            const BYTE* pRow = image.pixels + y * image.stride;
+            for (UINT x = 0; x < image.width; x++)
+            {
+                *pDest++ = colors[pRow[x]];
+            }
+        }
+
+        return;
+    }
+
+    for (UINT y = 0; y < image.height; y++)
+    {
+        const UINT* pRow = reinterpret_cast<const UINT*>(image.pixels + y * image.stride);
+        for (UINT x = 0; x < image.width; x++)
+        {
+            *pDest++ = SwapColor(pRow[x], palette);
+        }
+    }
+}
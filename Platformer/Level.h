@@ -0,0 +1,212 @@
+#pragma once
+#include <float.h>
+
+struct LevelEntity
+{
+    enum Type
+    {
+        END = 0x0,
+        GEO = 0x1,
+        ENEMY = 0x2,
+        TEXTURE = 0x3,
+        TILES = 0x4,
+        ARCHETYPE = 0x5,
+    };
+};
+
+// Width of the chunks embedded levels index their records by.
+#define LEVEL_CHUNK_WIDTH 160
+#define NUM_LEVEL_CHUNKS (32768 / LEVEL_CHUNK_WIDTH + 1)
+
+// Enemy archetype set by an ARCHETYPE record, laid out as
+// 5, type, runSpeed, width, height, gravity percent, flags, idle frame,
+// run frame 1, run frame 2, fall frame
+// with flags from ENEMY_TURNS_AT_LEDGES and ENEMY_STOMPABLE.
+struct LevelArchetype
+{
+    short runSpeed;
+    short width;
+    short height;
+    short gravityPercent;
+    short flags;
+    short idleFrame;
+    short runFrame1;
+    short runFrame2;
+    short fallFrame;
+};
+
+// One record of a level stream, see the LEVEL resources in Platformer.rc for
+// the layouts.
+struct LevelRecord
+{
+    LevelEntity::Type type;
+    float left;
+    float top;
+    float right;
+    float bottom;
+
+    // level texture slot
+    int textureId;
+
+    // block type for GEO and TILES, enemy type for ENEMY and ARCHETYPE,
+    // resource id for TEXTURE
+    int kind;
+
+    // ARCHETYPE only
+    LevelArchetype archetype;
+};
+
+// Number of shorts in a record of the given type, 0 for unknown types.
+constexpr int LevelRecordSize(short type)
+{
+    switch (type)
+    {
+    case LevelEntity::END:
+        return 1;
+    case LevelEntity::GEO:
+    case LevelEntity::TILES:
+        return 7;
+    case LevelEntity::ENEMY:
+        return 5;
+    case LevelEntity::TEXTURE:
+        return 3;
+    case LevelEntity::ARCHETYPE:
+        return 11;
+    default:
+        return 0;
+    }
+}
+
+// Left edge of the record at next. Textures and archetypes are due as soon as
+// they are reached, the end of the stream never is.
+constexpr float PeekLevelRecordLeft(const short* next)
+{
+    switch (*next)
+    {
+    case LevelEntity::GEO:
+    case LevelEntity::ENEMY:
+    case LevelEntity::TILES:
+        return static_cast<float>(*(next + 1));
+    case LevelEntity::TEXTURE:
+    case LevelEntity::ARCHETYPE:
+        return -FLT_MAX;
+    case LevelEntity::END:
+    default:
+        return FLT_MAX;
+    }
+}
+
+// Read the record at next and advance past it. Must not be called at the end
+// of the stream.
+constexpr void ReadLevelRecord(const short*& next, LevelRecord& record)
+{
+    record.type = static_cast<LevelEntity::Type>(*next++);
+    record.left = 0.f;
+    record.top = 0.f;
+    record.right = 0.f;
+    record.bottom = 0.f;
+    record.textureId = 0;
+    record.kind = 0;
+    record.archetype = LevelArchetype();
+
+    switch (record.type)
+    {
+    case LevelEntity::GEO:
+    case LevelEntity::TILES:
+        record.left = static_cast<float>(*next++);
+        record.top = static_cast<float>(*next++);
+        record.right = record.left + static_cast<float>(*next++);
+        record.bottom = record.top + static_cast<float>(*next++);
+        record.textureId = static_cast<int>(*next++);
+        record.kind = static_cast<int>(*next++);
+        break;
+    case LevelEntity::ENEMY:
+        record.left = static_cast<float>(*next++);
+        record.top = static_cast<float>(*next++);
+        record.right = record.left;
+        record.bottom = record.top;
+        record.kind = static_cast<int>(*next++);
+        record.textureId = static_cast<int>(*next++);
+        break;
+    case LevelEntity::TEXTURE:
+        record.left = -FLT_MAX;
+        record.textureId = static_cast<int>(*next++);
+        record.kind = static_cast<int>(*next++);
+        break;
+    case LevelEntity::ARCHETYPE:
+        record.left = -FLT_MAX;
+        record.kind = static_cast<int>(*next++);
+        record.archetype.runSpeed = *next++;
+        record.archetype.width = *next++;
+        record.archetype.height = *next++;
+        record.archetype.gravityPercent = *next++;
+        record.archetype.flags = *next++;
+        record.archetype.idleFrame = *next++;
+        record.archetype.runFrame1 = *next++;
+        record.archetype.runFrame2 = *next++;
+        record.archetype.fallFrame = *next++;
+        break;
+    default:
+        break;
+    }
+}
+
+inline void ReadLevelRecord(short*& next, LevelRecord& record)
+{
+    const short* cursor = next;
+    ReadLevelRecord(cursor, record);
+    next += cursor - next;
+}
+
+// A level compiled into the executable, see EmbeddedLevel.h. Textures and
+// archetypes are hoisted out of the stream and the remaining records are
+// sorted by left.
+struct EmbeddedLevel
+{
+    // First record at or after x, found through the chunk table.
+    int FirstRecordAt(float x) const
+    {
+        if (x < 0.f)
+        {
+            return 0;
+        }
+
+        int chunk = static_cast<int>(x) / LEVEL_CHUNK_WIDTH;
+
+        if (chunk >= chunkCount)
+        {
+            return recordCount;
+        }
+
+        int index = chunkFirstRecord[chunk];
+        while (index < recordCount && records[index].left < x)
+        {
+            index++;
+        }
+
+        return index;
+    }
+
+    const LevelRecord* textures;
+    int textureCount;
+    const LevelRecord* archetypes;
+    int archetypeCount;
+    const LevelRecord* records;
+    int recordCount;
+
+    // index of the first record in each LEVEL_CHUNK_WIDTH wide chunk
+    const short* chunkFirstRecord;
+    int chunkCount;
+};
+
+// Embedded level for levelId, or NULL when it only exists as a resource.
+const EmbeddedLevel* FindEmbeddedLevel(int levelId);
+
+struct LevelCursor
+{
+    short* next;
+
+    // set instead of next when playing an embedded level
+    const EmbeddedLevel* embedded;
+    int nextRecord;
+};
@@ -0,0 +1,286 @@
+#pragma once
+#include "EmbeddedLevel.h"
+#include <vector>
+
+// Procedural levels for stress and scaling runs. A seed and a set of knobs
+// always give the same stream, in the layout of the LEVEL resources and
+// sorted by left, so the streamer and LoadLevelEntities walk it like any
+// other level.
+
+// Positions are stored as shorts, generated levels end before this.
+#define LEVEL_GEN_MAX_LENGTH 32000
+
+#define LEVEL_GEN_BLOCK_SIZE 10
+#define LEVEL_GEN_GROUND_TOP (SCREEN_HEIGHT - 20)
+
+// The ground is laid in pieces this wide, as tiles while the tilemap reaches
+// and as plain geo past its end.
+#define LEVEL_GEN_GROUND_WIDTH LEVEL_CHUNK_WIDTH
+
+// Platforms sit around this height, give or take heightVariance.
+#define LEVEL_GEN_PLATFORM_TOP 80
+
+// Small deterministic generator so every run sees the same worlds.
+class Random
+{
+public:
+    explicit Random(unsigned int seed) : m_state(seed)
+    {
+    }
+
+    unsigned int Next()
+    {
+        m_state = m_state * 1664525u + 1013904223u;
+        return m_state >> 8;
+    }
+
+    float Range(float low, float high)
+    {
+        return low + (high - low) * static_cast<float>(Next() & 0xFFFF) / 65535.f;
+    }
+
+private:
+    unsigned int m_state;
+};
+
+struct LevelGenParams
+{
+    unsigned int seed;
+
+    // in units, clamped to LEVEL_GEN_MAX_LENGTH
+    int length;
+
+    // average geo blocks and enemies per SCREEN_WIDTH of level
+    float geoDensity;
+    float enemyDensity;
+
+    // relative odds of each Geo::BlockType
+    int blockWeights[Geo::BLOCK_TYPE_COUNT];
+
+    // texture slots the level sets, cycling through the texture resources
+    int textureCount;
+
+    // how far platforms stray from LEVEL_GEN_PLATFORM_TOP
+    int heightVariance;
+};
+
+// A screen or so of platforms and a cat per screen, like the authored levels.
+inline LevelGenParams DefaultLevelGenParams(unsigned int seed)
+{
+    LevelGenParams params = {};
+    params.seed = seed;
+    params.length = 10000;
+    params.geoDensity = 6.f;
+    params.enemyDensity = 1.f;
+    params.blockWeights[Geo::BLOCK_NONE] = 2;
+    params.blockWeights[Geo::BLOCK_BREAKABLE] = 1;
+    params.blockWeights[Geo::BLOCK_COIN] = 1;
+    params.textureCount = TEXTURE_LAST - TEXTURE_OFFSET;
+    params.heightVariance = 30;
+    return params;
+}
+
+// Densities that give about entityCount geo and enemies over the level, in
+// the same proportion as params already has.
+inline void SetLevelGenEntityCount(LevelGenParams& params, int entityCount)
+{
+    int length = params.length < LEVEL_GEN_MAX_LENGTH ? params.length : LEVEL_GEN_MAX_LENGTH;
+    float screens = static_cast<float>(length) / SCREEN_WIDTH;
+    float total = params.geoDensity + params.enemyDensity;
+    if (screens <= 0.f || total <= 0.f)
+    {
+        return;
+    }
+
+    float scale = static_cast<float>(entityCount) / (screens * total);
+    params.geoDensity *= scale;
+    params.enemyDensity *= scale;
+}
+
+// Distance to the next entity for an average of density per screen. Gaps are
+// uniform in [0, 2 * mean], so entities clump and spread out like in play.
+inline float NextLevelGenGap(Random& random, float density)
+{
+    return density > 0.f ? random.Range(0.f, 2.f * SCREEN_WIDTH / density) : FLT_MAX;
+}
+
+// Append the level described by params to stream, END included. Returns the
+// number of geo, enemy and tile records written.
+inline int GenerateLevel(const LevelGenParams& params, std::vector<short>& stream)
+{
+    Random random(params.seed);
+
+    int textureCount = params.textureCount < 1 ? 1
+        : params.textureCount > NUM_TEXTURES ? NUM_TEXTURES
+        : params.textureCount;
+    int resourceCount = TEXTURE_LAST - TEXTURE_OFFSET;
+    for (int slot = 0; slot < textureCount; slot++)
+    {
+        stream.insert(stream.end(), { LevelEntity::TEXTURE, static_cast<short>(slot), static_cast<short>(TEXTURE_OFFSET + 1 + slot % resourceCount) });
+    }
+
+    // the ground and the cats use the slots their resources land in
+    int groundSlot = (TEXTURE_GROUND - TEXTURE_OFFSET - 1) % textureCount;
+    int catSlot = TEXTURE_CAT - TEXTURE_OFFSET - 1 < textureCount ? TEXTURE_CAT - TEXTURE_OFFSET - 1 : 0;
+
+    int weightTotal = 0;
+    for (int weight : params.blockWeights)
+    {
+        weightTotal += weight > 0 ? weight : 0;
+    }
+
+    float length = static_cast<float>(params.length < LEVEL_GEN_MAX_LENGTH ? params.length : LEVEL_GEN_MAX_LENGTH);
+    float tilemapEnd = static_cast<float>(NUM_TILE_CHUNKS * TILE_CHUNK_PIXEL_WIDTH);
+    int lowestTop = LEVEL_GEN_GROUND_TOP - PLAYER_HEIGHT - LEVEL_GEN_BLOCK_SIZE;
+
+    int recordCount = 0;
+    float nextGround = 0.f;
+    float nextGeo = NextLevelGenGap(random, params.geoDensity);
+    float nextEnemy = NextLevelGenGap(random, params.enemyDensity);
+    for (;;)
+    {
+        // emit whichever comes first to keep the stream sorted by left
+        float left = nextGround < nextGeo ? nextGround : nextGeo;
+        left = nextEnemy < left ? nextEnemy : left;
+        if (left >= length)
+        {
+            break;
+        }
+
+        short x = static_cast<short>(left);
+        if (left == nextGround)
+        {
+            float right = left + LEVEL_GEN_GROUND_WIDTH;
+            if (left < tilemapEnd)
+            {
+                right = right < tilemapEnd ? right : tilemapEnd;
+                stream.insert(stream.end(), { LevelEntity::TILES, x, LEVEL_GEN_GROUND_TOP, static_cast<short>(right - left),
+                    SCREEN_HEIGHT - LEVEL_GEN_GROUND_TOP, static_cast<short>(groundSlot), Geo::BLOCK_NONE });
+            }
+            else
+            {
+                stream.insert(stream.end(), { LevelEntity::GEO, x, LEVEL_GEN_GROUND_TOP, LEVEL_GEN_GROUND_WIDTH,
+                    SCREEN_HEIGHT - LEVEL_GEN_GROUND_TOP, static_cast<short>(groundSlot), Geo::BLOCK_NONE });
+            }
+
+            nextGround = right;
+        }
+        else if (left == nextGeo)
+        {
+            int top = LEVEL_GEN_PLATFORM_TOP;
+            if (params.heightVariance > 0)
+            {
+                top += static_cast<int>(random.Next() % (2 * params.heightVariance + 1)) - params.heightVariance;
+            }
+
+            top = top < 0 ? 0 : top > lowestTop ? lowestTop : top;
+
+            int type = Geo::BLOCK_NONE;
+            if (weightTotal > 0)
+            {
+                int pick = static_cast<int>(random.Next() % weightTotal);
+                for (type = 0; type < Geo::BLOCK_TYPE_COUNT - 1; type++)
+                {
+                    pick -= params.blockWeights[type] > 0 ? params.blockWeights[type] : 0;
+                    if (pick < 0)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            short texture = static_cast<short>(random.Next() % textureCount);
+            stream.insert(stream.end(), { LevelEntity::GEO, x, static_cast<short>(top), LEVEL_GEN_BLOCK_SIZE,
+                LEVEL_GEN_BLOCK_SIZE, texture, static_cast<short>(type) });
+            nextGeo += NextLevelGenGap(random, params.geoDensity);
+        }
+        else
+        {
+            short kind = static_cast<short>(Enemy::CAT | (random.Next() % Palette::COUNT) << ENEMY_PALETTE_SHIFT);
+            stream.insert(stream.end(), { LevelEntity::ENEMY, x, LEVEL_GEN_GROUND_TOP - ENEMY_HEIGHT, kind, static_cast<short>(catSlot) });
+            nextEnemy += NextLevelGenGap(random, params.enemyDensity);
+        }
+
+        recordCount++;
+    }
+
+    stream.push_back(LevelEntity::END);
+    return recordCount;
+}
+
+// Check a stream built at run time the way CompileLevel checks embedded
+// ones. errorOffset is the offset in shorts of the offending record.
+inline LevelError::Type ValidateLevelStream(const short* data, size_t size, size_t& errorOffset)
+{
+    bool textureDefined[NUM_TEXTURES] = {};
+    bool archetypeSet[NUM_ENEMY_ARCHETYPES] = {};
+
+    const short* next = data;
+    const short* end = data + size;
+    for (;;)
+    {
+        errorOffset = static_cast<size_t>(next - data);
+        if (next >= end)
+        {
+            return LevelError::MISSING_END;
+        }
+
+        if (*next == LevelEntity::END)
+        {
+            return LevelError::NONE;
+        }
+
+        int recordSize = LevelRecordSize(*next);
+        if (recordSize == 0)
+        {
+            return LevelError::UNKNOWN_RECORD;
+        }
+
+        if (recordSize > end - next)
+        {
+            return LevelError::TRUNCATED_RECORD;
+        }
+
+        LevelRecord record = {};
+        ReadLevelRecord(next, record);
+
+        LevelError::Type error = ValidateLevelRecord(record);
+        if (error != LevelError::NONE)
+        {
+            return error;
+        }
+
+        if (record.type == LevelEntity::TEXTURE)
+        {
+            if (textureDefined[record.textureId])
+            {
+                return LevelError::TEXTURE_REDEFINED;
+            }
+
+            textureDefined[record.textureId] = true;
+        }
+        else if (record.type == LevelEntity::ARCHETYPE)
+        {
+            if (archetypeSet[record.kind])
+            {
+                return LevelError::ARCHETYPE_REDEFINED;
+            }
+
+            archetypeSet[record.kind] = true;
+        }
+        else if (!textureDefined[record.textureId])
+        {
+            // streamed levels load textures as they reach them
+            return LevelError::UNDEFINED_TEXTURE;
+        }
+        else if (record.type == LevelEntity::ENEMY)
+        {
+            // and archetypes the same way
+            int type = record.kind & ((1 << ENEMY_PALETTE_SHIFT) - 1);
+            if (!archetypeSet[type] && !IsStockEnemyType(type))
+            {
+                return LevelError::BAD_ENEMY_TYPE;
+            }
+        }
+    }
+}
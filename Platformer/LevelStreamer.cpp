@@ -0,0 +1,148 @@
+#include "Platformer.h"
+#include "LevelStreamer.h"
+
+LevelStreamer::LevelStreamer() :
+    stats(),
+    m_batches(),
+    m_front(-1),
+    m_running(false),
+    m_stop(false),
+    m_cameraScroll(0.f),
+    m_producedUpTo(-FLT_MAX),
+    m_viewWidth(0.f),
+    m_next(NULL)
+{
+}
+
+LevelStreamer::~LevelStreamer()
+{
+    Stop();
+}
+
+bool LevelStreamer::Start(short* level, float cameraScroll, float viewWidth)
+{
+    Stop();
+
+    m_ready.Reset();
+    m_free.Reset();
+    for (int index = 0; index < NUM_STREAM_BATCHES; index++)
+    {
+        m_free.Push(index);
+    }
+
+    m_front = -1;
+    m_next = level;
+    m_viewWidth = viewWidth;
+    m_cameraScroll.store(cameraScroll, std::memory_order_relaxed);
+    m_producedUpTo.store(-FLT_MAX, std::memory_order_relaxed);
+    m_stop.store(false, std::memory_order_relaxed);
+    stats = StreamStats();
+
+    m_thread = std::thread(&LevelStreamer::Run, this);
+    m_running = true;
+
+    return true;
+}
+
+void LevelStreamer::Stop()
+{
+    if (!m_running)
+    {
+        return;
+    }
+
+    m_stop.store(true, std::memory_order_relaxed);
+    m_thread.join();
+    m_running = false;
+
+    // textures loaded for records that were never committed
+    if (m_front >= 0)
+    {
+        ReleaseBatch(m_batches[m_front]);
+        m_front = -1;
+    }
+
+    int batchIndex;
+    while (m_ready.Pop(batchIndex))
+    {
+        ReleaseBatch(m_batches[batchIndex]);
+    }
+}
+
+StreamBatch* LevelStreamer::Front()
+{
+    if (m_front < 0 && !m_ready.Pop(m_front))
+    {
+        m_front = -1;
+        return NULL;
+    }
+
+    return &m_batches[m_front];
+}
+
+void LevelStreamer::PopFront()
+{
+    if (m_front < 0)
+    {
+        return;
+    }
+
+    m_free.Push(m_front);
+    m_front = -1;
+}
+
+void LevelStreamer::ReleaseBatch(StreamBatch& batch)
+{
+    for (int index = batch.next; index < batch.count; index++)
+    {
+        FreeDecodedImage(&batch.records[index].image);
+    }
+
+    batch.count = 0;
+    batch.next = 0;
+}
+
+void LevelStreamer::Run()
+{
+    PROFILE_THREAD("level streamer");
+
+    while (!m_stop.load(std::memory_order_relaxed))
+    {
+        float peekLeft = PeekLevelRecordLeft(m_next);
+        if (peekLeft == FLT_MAX)
+        {
+            // end of the level
+            m_producedUpTo.store(FLT_MAX, std::memory_order_release);
+            break;
+        }
+
+        float limit = m_cameraScroll.load(std::memory_order_relaxed) + m_viewWidth + STREAM_LOOKAHEAD;
+        int batchIndex;
+        if (peekLeft > limit || !m_free.Pop(batchIndex))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        PROFILE_ZONE("stream batch");
+        StreamBatch& batch = m_batches[batchIndex];
+        batch.count = 0;
+        batch.next = 0;
+        while (batch.count < STREAM_BATCH_SIZE && PeekLevelRecordLeft(m_next) <= limit)
+        {
+            StreamedRecord& streamed = batch.records[batch.count++];
+            ReadLevelRecord(m_next, streamed.record);
+            streamed.end = m_next;
+            streamed.image = DecodedImage();
+
+            if (streamed.record.type == LevelEntity::TEXTURE)
+            {
+                LoadCookedTexture(streamed.record.kind, &streamed.image);
+            }
+        }
+
+        // there are as many slots in the ready queue as there are batches
+        m_ready.Push(batchIndex);
+        m_producedUpTo.store(PeekLevelRecordLeft(m_next), std::memory_order_release);
+    }
+}
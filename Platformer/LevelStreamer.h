@@ -0,0 +1,151 @@
+#pragma once
+#include <atomic>
+#include <thread>
+
+#include "Level.h"
+#include "Image.h"
+
+#define NUM_STREAM_BATCHES 8
+#define STREAM_BATCH_SIZE 32
+
+// How far past the right edge of the view the streamer works ahead.
+#define STREAM_LOOKAHEAD 400
+
+// Lock-free single producer, single consumer ring. Capacity must be a power
+// of two.
+template<class T, unsigned int Capacity>
+class SpscQueue
+{
+public:
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    SpscQueue() : m_head(0), m_tail(0)
+    {
+    }
+
+    // Only safe while neither side is running.
+    void Reset()
+    {
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    bool Push(const T& item)
+    {
+        unsigned int tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+
+        m_items[tail & (Capacity - 1)] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item)
+    {
+        unsigned int head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        item = m_items[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::atomic<unsigned int> m_head;
+    std::atomic<unsigned int> m_tail;
+    T m_items[Capacity];
+};
+
+struct StreamedRecord
+{
+    LevelRecord record;
+
+    // level cursor just past this record
+    short* end;
+
+    // loaded on the worker for TEXTURE records
+    DecodedImage image;
+};
+
+struct StreamBatch
+{
+    StreamedRecord records[STREAM_BATCH_SIZE];
+    int count;
+
+    // next record the sim has not committed yet
+    int next;
+};
+
+struct StreamStats
+{
+    int stalls;
+    float stallTime;
+    float lastCommitTime;
+    float worstCommitTime;
+};
+
+// Parses level records and loads their textures on a worker thread, ahead
+// of the camera. Batches are handed to the sim through a lock-free queue and
+// returned through another one once committed.
+class LevelStreamer
+{
+public:
+    LevelStreamer();
+    ~LevelStreamer();
+
+    bool Start(short* level, float cameraScroll, float viewWidth);
+
+    void Stop();
+
+    bool IsRunning() const
+    {
+        return m_running;
+    }
+
+    void SetCameraScroll(float cameraScroll)
+    {
+        m_cameraScroll.store(cameraScroll, std::memory_order_relaxed);
+    }
+
+    // Left edge of the first record that has not been queued yet. Everything
+    // before it is either queued or committed. Read this before Front() to
+    // know whether an empty queue means the sim has to wait.
+    float GetProducedUpTo() const
+    {
+        return m_producedUpTo.load(std::memory_order_acquire);
+    }
+
+    // Consumer side: the batch being committed, NULL when nothing is queued.
+    StreamBatch* Front();
+
+    // Consumer side: hand the front batch back to the worker.
+    void PopFront();
+
+    StreamStats stats;
+
+private:
+    void Run();
+
+    void ReleaseBatch(StreamBatch& batch);
+
+    StreamBatch m_batches[NUM_STREAM_BATCHES];
+    SpscQueue<int, NUM_STREAM_BATCHES> m_ready;
+    SpscQueue<int, NUM_STREAM_BATCHES> m_free;
+    int m_front;
+
+    std::thread m_thread;
+    bool m_running;
+    std::atomic<bool> m_stop;
+    std::atomic<float> m_cameraScroll;
+    std::atomic<float> m_producedUpTo;
+    float m_viewWidth;
+
+    // worker's cursor
+    short* m_next;
+};
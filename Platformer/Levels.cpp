@@ -0,0 +1,56 @@
+#include "Platformer.h"
+#include "EmbeddedLevel.h"
+
+// Levels compiled into the executable. They mirror the LEVEL resources in
+// Platformer.rc, which are still used when USE_EMBEDDED_LEVELS is off. The
+// palette test level is left out on purpose, it always plays from its
+// resource so the level streamer runs in every build.
+
+static constexpr short level1Data[] =
+{
+    LevelEntity::TEXTURE,   0, TEXTURE_PLAYER,
+    LevelEntity::TEXTURE,   1, TEXTURE_BRICK,
+    LevelEntity::TEXTURE,   2, TEXTURE_QUESTION,
+    LevelEntity::TEXTURE,   3, TEXTURE_GROUND,
+    LevelEntity::TEXTURE,   4, TEXTURE_CAT,
+    LevelEntity::ARCHETYPE, Enemy::CAT, 45, ENEMY_WIDTH, ENEMY_HEIGHT, 100, ENEMY_STOMPABLE,
+        SpriteFrame::IDLE, SpriteFrame::RUN_1, SpriteFrame::RUN_2, SpriteFrame::FALL,
+    LevelEntity::TILES,     0,    130,   1000,     30,      3, BLOCK_TYPE_NONE,
+    LevelEntity::GEO,      50,     90,     10,     10,      2, BLOCK_TYPE_COIN,
+    LevelEntity::GEO,     100,     90,     10,     10,      1, BLOCK_TYPE_BREAKABLE,
+    LevelEntity::GEO,     110,     90,     10,     10,      2, BLOCK_TYPE_COIN,
+    LevelEntity::GEO,     120,     90,     10,     10,      1, BLOCK_TYPE_BREAKABLE,
+    LevelEntity::GEO,     120,     50,     10,     10,      2, BLOCK_TYPE_COIN,
+    LevelEntity::GEO,     130,     90,     10,     10,      2, BLOCK_TYPE_COIN,
+    LevelEntity::GEO,     140,     90,     10,     10,      1, BLOCK_TYPE_BREAKABLE,
+    LevelEntity::ENEMY,   150,    120, Enemy::CAT,              4,
+    LevelEntity::GEO,     300,     90,     10,     10,      1, BLOCK_TYPE_BREAKABLE,
+    LevelEntity::END,
+};
+
+static constexpr auto level1 = CompileLevel(level1Data);
+VALIDATE_EMBEDDED_LEVEL(level1);
+
+struct EmbeddedLevelEntry
+{
+    int levelId;
+    EmbeddedLevel level;
+};
+
+static constexpr EmbeddedLevelEntry embeddedLevels[] =
+{
+    { FIRST_LEVEL_ID, level1.View() },
+};
+
+const EmbeddedLevel* FindEmbeddedLevel(int levelId)
+{
+    for (const EmbeddedLevelEntry& entry : embeddedLevels)
+    {
+        if (entry.levelId == levelId)
+        {
+            return &entry.level;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,198 @@
+#pragma once
+#include <string.h>
+
+// LZ4 block format, see https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+// Only what the cooked textures need: a greedy compressor for the asset
+// cooker and a bounds checked decompressor for the game.
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_SAFE_DISTANCE 12
+#define LZ4_HASH_BITS 12
+#define LZ4_MAX_OFFSET 65535
+
+// Worst case size of compressing size bytes.
+inline int Lz4CompressBound(int size)
+{
+    return size + size / 255 + 16;
+}
+
+inline unsigned char* Lz4WriteLength(unsigned char* out, int length)
+{
+    while (length >= 255)
+    {
+        *out++ = 255;
+        length -= 255;
+    }
+
+    *out++ = static_cast<unsigned char>(length);
+    return out;
+}
+
+inline unsigned char* Lz4WriteSequence(unsigned char* out, const unsigned char* literals, int literalLength, int offset, int matchLength)
+{
+    unsigned char* token = out++;
+    *token = static_cast<unsigned char>((literalLength >= 15 ? 15 : literalLength) << 4);
+    if (literalLength >= 15)
+    {
+        out = Lz4WriteLength(out, literalLength - 15);
+    }
+
+    memcpy(out, literals, literalLength);
+    out += literalLength;
+
+    if (matchLength == 0)
+    {
+        // last sequence, literals only
+        return out;
+    }
+
+    *out++ = static_cast<unsigned char>(offset & 0xFF);
+    *out++ = static_cast<unsigned char>(offset >> 8);
+
+    matchLength -= LZ4_MIN_MATCH;
+    *token |= static_cast<unsigned char>(matchLength >= 15 ? 15 : matchLength);
+    if (matchLength >= 15)
+    {
+        out = Lz4WriteLength(out, matchLength - 15);
+    }
+
+    return out;
+}
+
+// Compress size bytes of source into dest, which must hold
+// Lz4CompressBound(size) bytes. Returns the compressed size.
+inline int Lz4Compress(const unsigned char* source, int size, unsigned char* dest)
+{
+    int table[1 << LZ4_HASH_BITS];
+    for (int& entry : table)
+    {
+        entry = -1;
+    }
+
+    unsigned char* out = dest;
+    int anchor = 0;
+    int position = 0;
+    int matchLimit = size - LZ4_MATCH_SAFE_DISTANCE;
+
+    while (position < matchLimit)
+    {
+        unsigned int sequence;
+        memcpy(&sequence, source + position, sizeof(sequence));
+        unsigned int hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+
+        int candidate = table[hash];
+        table[hash] = position;
+
+        if (candidate < 0
+            || position - candidate > LZ4_MAX_OFFSET
+            || memcmp(source + candidate, source + position, LZ4_MIN_MATCH) != 0)
+        {
+            position++;
+            continue;
+        }
+
+        int matchLength = LZ4_MIN_MATCH;
+        while (position + matchLength < size - LZ4_LAST_LITERALS
+            && source[candidate + matchLength] == source[position + matchLength])
+        {
+            matchLength++;
+        }
+
+        out = Lz4WriteSequence(out, source + anchor, position - anchor, position - candidate, matchLength);
+        position += matchLength;
+        anchor = position;
+    }
+
+    out = Lz4WriteSequence(out, source + anchor, size - anchor, 0, 0);
+    return static_cast<int>(out - dest);
+}
+
+// Decompress a block into exactly destSize bytes. Returns false on malformed
+// input rather than reading or writing out of bounds.
+inline bool Lz4Decompress(const unsigned char* source, int sourceSize, unsigned char* dest, int destSize)
+{
+    const unsigned char* in = source;
+    const unsigned char* inEnd = source + sourceSize;
+    unsigned char* out = dest;
+    unsigned char* outEnd = dest + destSize;
+
+    while (in < inEnd)
+    {
+        unsigned char token = *in++;
+
+        int literalLength = token >> 4;
+        if (literalLength == 15)
+        {
+            unsigned char extra;
+            do
+            {
+                if (in >= inEnd)
+                {
+                    return false;
+                }
+
+                extra = *in++;
+                literalLength += extra;
+            } while (extra == 255);
+        }
+
+        if (literalLength > inEnd - in || literalLength > outEnd - out)
+        {
+            return false;
+        }
+
+        memcpy(out, in, literalLength);
+        in += literalLength;
+        out += literalLength;
+
+        if (in == inEnd)
+        {
+            // the last sequence has no match
+            break;
+        }
+
+        if (inEnd - in < 2)
+        {
+            return false;
+        }
+
+        int offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > out - dest)
+        {
+            return false;
+        }
+
+        int matchLength = (token & 0xF) + LZ4_MIN_MATCH;
+        if ((token & 0xF) == 15)
+        {
+            unsigned char extra;
+            do
+            {
+                if (in >= inEnd)
+                {
+                    return false;
+                }
+
+                extra = *in++;
+                matchLength += extra;
+            } while (extra == 255);
+        }
+
+        if (matchLength > outEnd - out)
+        {
+            return false;
+        }
+
+        // matches may overlap their own output, copy forward byte by byte
+        const unsigned char* match = out - offset;
+        for (int index = 0; index < matchLength; index++)
+        {
+            out[index] = match[index];
+        }
+        out += matchLength;
+    }
+
+    return out == outEnd;
+}
@@ -0,0 +1,446 @@
+#pragma once
+#include <windows.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+
+#include <d2d1.h>
+
+// Define as 0 to build the scalar update on x86 too.
+#ifndef USE_SSE2_PARTICLES
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define USE_SSE2_PARTICLES 1
+#else
+#define USE_SSE2_PARTICLES 0
+#endif
+#endif
+
+#if USE_SSE2_PARTICLES
+#include <emmintrin.h>
+#endif
+
+// Cosmetic particles: debris from broken blocks, coins popping out of
+// question blocks and dust from stomps. They never feed back into the sim, so
+// the pool is free to drop them when a frame runs short.
+
+// Particles the pool holds, a multiple of the SIMD width.
+#define NUM_PARTICLES (128 * 1024)
+#define PARTICLE_LANES 4
+static_assert(NUM_PARTICLES % PARTICLE_LANES == 0, "particle arrays end mid vector");
+
+// Time one Update may take. Past it the live cap drops to what would have
+// fit, and grows back while updates stay under half the budget.
+#define PARTICLE_BUDGET_SECONDS 0.001
+#define PARTICLE_MIN_CAP 1024
+
+// Bursts the sim can ask for in one tick, see ParticleBurstQueue.
+#define NUM_PARTICLE_BURSTS 16
+
+struct ParticleKind
+{
+    enum Type : unsigned char
+    {
+        DEBRIS,
+        COIN,
+        DUST,
+        COUNT,
+    };
+};
+
+// How a burst of one kind is spawned. Velocities are in units per second,
+// x in [-speedX, speedX] and y in [minSpeedY, maxSpeedY].
+struct ParticleEmitter
+{
+    int count;
+    float speedX;
+    float minSpeedY;
+    float maxSpeedY;
+    float gravity;
+    float minLife;
+    float maxLife;
+
+    // premultiplied BGRA
+    UINT color;
+};
+
+inline const ParticleEmitter& GetParticleEmitter(ParticleKind::Type kind)
+{
+    static const ParticleEmitter emitters[ParticleKind::COUNT] =
+    {
+        // debris flies up and out, then falls off the screen
+        { 24, 60.f, -180.f, -80.f, 550.f, 0.6f, 1.2f, 0xFF8B4513 },
+        // coins hop straight up out of the block
+        { 12, 20.f, -200.f, -140.f, 550.f, 0.4f, 0.6f, 0xFFFFC800 },
+        // dust drifts up and fades quickly
+        { 16, 40.f, -30.f, -5.f, -20.f, 0.3f, 0.5f, 0x80505050 },
+    };
+
+    return emitters[kind];
+}
+
+// A burst over a rect of the level.
+struct ParticleBurst
+{
+    ParticleKind::Type kind;
+    D2D1_RECT_F rect;
+};
+
+// Bursts asked for by the sim during a tick, drained by the particle system
+// afterwards. The sim only ever writes here; bursts past NUM_PARTICLE_BURSTS
+// are dropped.
+struct ParticleBurstQueue
+{
+    void Push(ParticleKind::Type kind, const D2D1_RECT_F& rect)
+    {
+        if (count < NUM_PARTICLE_BURSTS)
+        {
+            bursts[count].kind = kind;
+            bursts[count].rect = rect;
+            count++;
+        }
+    }
+
+    ParticleBurst bursts[NUM_PARTICLE_BURSTS];
+    int count;
+};
+
+struct ParticleStats
+{
+    int live;
+    int cap;
+
+    // particles spawned, and those that were not or were cut for the cap
+    int emitted;
+    int dropped;
+
+    // updates that went past PARTICLE_BUDGET_SECONDS
+    int overBudget;
+    double updateTime;
+};
+
+// Pool of particles kept as one array per field, live ones packed at the
+// front, so Update streams through them a vector at a time. Dead particles are
+// replaced by the last live one. Everything is drawn by rasterizing into one
+// layer of layerWidth x layerHeight pixels that the renderer blits in a
+// single call.
+class ParticleSystem
+{
+public:
+    ParticleSystem(int layerWidth, int layerHeight) :
+        stats(),
+        m_layerWidth(layerWidth),
+        m_layerHeight(layerHeight),
+        m_count(0),
+        m_cap(0),
+        m_random(1),
+        m_pBlock(NULL),
+        m_x(NULL),
+        m_y(NULL),
+        m_vx(NULL),
+        m_vy(NULL),
+        m_gravity(NULL),
+        m_life(NULL),
+        m_kinds(NULL),
+        m_deadMasks(NULL),
+        m_pLayer(NULL)
+    {
+        QueryPerformanceFrequency(&m_frequency);
+
+        // one block for every array, each starting on a 16 byte boundary;
+        // without it the pool simply stays empty
+        size_t floatBytes = NUM_PARTICLES * sizeof(float);
+        size_t layerBytes = static_cast<size_t>(layerWidth) * layerHeight * sizeof(UINT);
+        size_t size = 6 * floatBytes + NUM_PARTICLES + NUM_PARTICLES / PARTICLE_LANES + layerBytes + 16;
+        m_pBlock = static_cast<char*>(malloc(size));
+        if (m_pBlock == NULL)
+        {
+            return;
+        }
+
+        // zeroed so the lanes past the last live particle never hold
+        // denormals or NaNs
+        memset(m_pBlock, 0, size);
+        char* pNext = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(m_pBlock) + 15) & ~static_cast<uintptr_t>(15));
+        float** fields[] = { &m_x, &m_y, &m_vx, &m_vy, &m_gravity, &m_life };
+        for (float** field : fields)
+        {
+            *field = reinterpret_cast<float*>(pNext);
+            pNext += floatBytes;
+        }
+
+        m_pLayer = reinterpret_cast<UINT*>(pNext);
+        pNext += layerBytes;
+        m_kinds = reinterpret_cast<unsigned char*>(pNext);
+        pNext += NUM_PARTICLES;
+        m_deadMasks = reinterpret_cast<unsigned char*>(pNext);
+
+        m_cap = NUM_PARTICLES;
+    }
+
+    ~ParticleSystem()
+    {
+        free(m_pBlock);
+    }
+
+    ParticleSystem(const ParticleSystem&) = delete;
+    ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+    void Clear()
+    {
+        m_count = 0;
+    }
+
+    // Spawn a burst at random points of its rect. What does not fit under
+    // the cap is dropped.
+    void Emit(const ParticleBurst& burst)
+    {
+        const ParticleEmitter& emitter = GetParticleEmitter(burst.kind);
+        int count = emitter.count;
+        if (count > m_cap - m_count)
+        {
+            int fit = m_cap > m_count ? m_cap - m_count : 0;
+            stats.dropped += count - fit;
+            count = fit;
+        }
+
+        for (int spawned = 0; spawned < count; spawned++)
+        {
+            int index = m_count++;
+            m_x[index] = Range(burst.rect.left, burst.rect.right);
+            m_y[index] = Range(burst.rect.top, burst.rect.bottom);
+            m_vx[index] = Range(-emitter.speedX, emitter.speedX);
+            m_vy[index] = Range(emitter.minSpeedY, emitter.maxSpeedY);
+            m_gravity[index] = emitter.gravity;
+            m_life[index] = Range(emitter.minLife, emitter.maxLife);
+            m_kinds[index] = burst.kind;
+        }
+
+        stats.emitted += count;
+        stats.live = m_count;
+    }
+
+    void Emit(const ParticleBurstQueue& queue)
+    {
+        for (int index = 0; index < queue.count; index++)
+        {
+            Emit(queue.bursts[index]);
+        }
+    }
+
+    // Move every particle by delta and drop the ones that ran out of life or
+    // fell below killBelow, then adjust the cap to the time it took.
+    void Update(float delta, float killBelow)
+    {
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+
+        int groups = (m_count + PARTICLE_LANES - 1) / PARTICLE_LANES;
+        Integrate(groups, delta, killBelow);
+
+        // replace each dead particle with the last live one, walking back so
+        // the one moved in was already updated and is known to be alive
+        for (int group = groups - 1; group >= 0; group--)
+        {
+            int deadMask = m_deadMasks[group];
+            if (deadMask == 0)
+            {
+                continue;
+            }
+
+            for (int lane = PARTICLE_LANES - 1; lane >= 0; lane--)
+            {
+                int index = group * PARTICLE_LANES + lane;
+                if ((deadMask & (1 << lane)) && index < m_count)
+                {
+                    Move(--m_count, index);
+                }
+            }
+        }
+
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&end);
+        ApplyBudget(static_cast<double>(end.QuadPart - start.QuadPart) / static_cast<double>(m_frequency.QuadPart));
+    }
+
+    // Draw every particle as one pixel of the layer, whose left edge is at
+    // originX in the level. Returns the layer, premultiplied BGRA rows of
+    // layerWidth pixels.
+    const UINT* Rasterize(float originX)
+    {
+        if (m_pLayer == NULL)
+        {
+            return NULL;
+        }
+
+        memset(m_pLayer, 0, static_cast<size_t>(m_layerWidth) * m_layerHeight * sizeof(UINT));
+
+        UINT colors[ParticleKind::COUNT];
+        for (int kind = 0; kind < ParticleKind::COUNT; kind++)
+        {
+            colors[kind] = GetParticleEmitter(static_cast<ParticleKind::Type>(kind)).color;
+        }
+
+        float width = static_cast<float>(m_layerWidth);
+        float height = static_cast<float>(m_layerHeight);
+        for (int index = 0; index < m_count; index++)
+        {
+            float x = m_x[index] - originX;
+            float y = m_y[index];
+            if (x < 0.f || x >= width || y < 0.f || y >= height)
+            {
+                continue;
+            }
+
+            m_pLayer[static_cast<int>(y) * m_layerWidth + static_cast<int>(x)] = colors[m_kinds[index]];
+        }
+
+        return m_pLayer;
+    }
+
+    // Level rect covering every live particle and the pixel it is drawn on.
+    // False when there are none.
+    bool GetBounds(D2D1_RECT_F& bounds) const
+    {
+        if (m_count == 0)
+        {
+            return false;
+        }
+
+        bounds = D2D1::RectF(m_x[0], m_y[0], m_x[0], m_y[0]);
+        for (int index = 1; index < m_count; index++)
+        {
+            bounds.left = m_x[index] < bounds.left ? m_x[index] : bounds.left;
+            bounds.top = m_y[index] < bounds.top ? m_y[index] : bounds.top;
+            bounds.right = m_x[index] > bounds.right ? m_x[index] : bounds.right;
+            bounds.bottom = m_y[index] > bounds.bottom ? m_y[index] : bounds.bottom;
+        }
+
+        bounds.left = floorf(bounds.left);
+        bounds.top = floorf(bounds.top);
+        bounds.right = floorf(bounds.right) + 1.f;
+        bounds.bottom = floorf(bounds.bottom) + 1.f;
+        return true;
+    }
+
+    int Count() const
+    {
+        return m_count;
+    }
+
+    int Cap() const
+    {
+        return m_cap;
+    }
+
+    ParticleStats stats;
+
+private:
+    // Step groups vectors of particles and flag the dead lanes of each.
+    // Lanes past the last live particle are stepped too, they hold stale
+    // values that nothing reads.
+    void Integrate(int groups, float delta, float killBelow)
+    {
+#if USE_SSE2_PARTICLES
+        __m128 dt = _mm_set1_ps(delta);
+        __m128 zero = _mm_setzero_ps();
+        __m128 bottom = _mm_set1_ps(killBelow);
+        for (int group = 0; group < groups; group++)
+        {
+            int index = group * PARTICLE_LANES;
+            __m128 vy = _mm_add_ps(_mm_load_ps(m_vy + index), _mm_mul_ps(_mm_load_ps(m_gravity + index), dt));
+            __m128 x = _mm_add_ps(_mm_load_ps(m_x + index), _mm_mul_ps(_mm_load_ps(m_vx + index), dt));
+            __m128 y = _mm_add_ps(_mm_load_ps(m_y + index), _mm_mul_ps(vy, dt));
+            __m128 life = _mm_sub_ps(_mm_load_ps(m_life + index), dt);
+            _mm_store_ps(m_vy + index, vy);
+            _mm_store_ps(m_x + index, x);
+            _mm_store_ps(m_y + index, y);
+            _mm_store_ps(m_life + index, life);
+
+            __m128 dead = _mm_or_ps(_mm_cmple_ps(life, zero), _mm_cmpgt_ps(y, bottom));
+            m_deadMasks[group] = static_cast<unsigned char>(_mm_movemask_ps(dead));
+        }
+#else
+        for (int group = 0; group < groups; group++)
+        {
+            int deadMask = 0;
+            for (int lane = 0; lane < PARTICLE_LANES; lane++)
+            {
+                int index = group * PARTICLE_LANES + lane;
+                m_vy[index] += m_gravity[index] * delta;
+                m_x[index] += m_vx[index] * delta;
+                m_y[index] += m_vy[index] * delta;
+                m_life[index] -= delta;
+                deadMask |= (m_life[index] <= 0.f || m_y[index] > killBelow) ? 1 << lane : 0;
+            }
+
+            m_deadMasks[group] = static_cast<unsigned char>(deadMask);
+        }
+#endif
+    }
+
+    void Move(int from, int to)
+    {
+        m_x[to] = m_x[from];
+        m_y[to] = m_y[from];
+        m_vx[to] = m_vx[from];
+        m_vy[to] = m_vy[from];
+        m_gravity[to] = m_gravity[from];
+        m_life[to] = m_life[from];
+        m_kinds[to] = m_kinds[from];
+    }
+
+    // Over budget, cap the pool at what would have fit with some margin and
+    // cut the excess right away; particles are short-lived, so nobody misses
+    // the ones cut. Well under budget with a busy pool, let the cap grow back.
+    void ApplyBudget(double elapsed)
+    {
+        stats.updateTime = elapsed;
+        if (elapsed > PARTICLE_BUDGET_SECONDS && m_count > PARTICLE_MIN_CAP)
+        {
+            stats.overBudget++;
+            int cap = static_cast<int>(m_count * (PARTICLE_BUDGET_SECONDS / elapsed) * 0.9);
+            m_cap = cap > PARTICLE_MIN_CAP ? cap : PARTICLE_MIN_CAP;
+            if (m_count > m_cap)
+            {
+                stats.dropped += m_count - m_cap;
+                m_count = m_cap;
+            }
+        }
+        else if (elapsed < PARTICLE_BUDGET_SECONDS / 2 && m_count > m_cap / 2 && m_cap < NUM_PARTICLES)
+        {
+            int cap = m_cap + m_cap / 8;
+            m_cap = cap < NUM_PARTICLES ? cap : NUM_PARTICLES;
+        }
+
+        stats.live = m_count;
+        stats.cap = m_cap;
+    }
+
+    float Range(float low, float high)
+    {
+        m_random = m_random * 1664525u + 1013904223u;
+        return low + (high - low) * static_cast<float>((m_random >> 8) & 0xFFFF) / 65535.f;
+    }
+
+    int m_layerWidth;
+    int m_layerHeight;
+    int m_count;
+    int m_cap;
+    unsigned int m_random;
+    LARGE_INTEGER m_frequency;
+
+    char* m_pBlock;
+    float* m_x;
+    float* m_y;
+    float* m_vx;
+    float* m_vy;
+    float* m_gravity;
+    float* m_life;
+    unsigned char* m_kinds;
+
+    // bit per lane of each vector, set for particles that died this update
+    unsigned char* m_deadMasks;
+
+    UINT* m_pLayer;
+};
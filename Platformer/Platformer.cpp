@@ -1,20 +1,69 @@
 #include "Platformer.h"
+#include "SaveState.h"
 #include "resource.h"
 #include <string>
+#include <algorithm>
 
 int WINAPI WinMain(
     _In_ HINSTANCE /* hInstance */,
     _In_opt_ HINSTANCE /* hPrevInstance */,
-    _In_ LPSTR /* lpCmdLine */,
+    _In_ LPSTR lpCmdLine,
     _In_ int /* nCmdShow */)
 {
     HeapSetInformation(NULL, HeapEnableTerminationOnCorruption, NULL, 0);
 
+#if USE_PROFILER
+    // -trace [frames] captures the first frames, F9 captures later ones
+    PROFILE_THREAD("main");
+    const char* pTrace = strstr(lpCmdLine, "-trace");
+    if (pTrace)
+    {
+        Profiler::SetCaptureFrames(atoi(pTrace + strlen("-trace")));
+        Profiler::BeginCapture();
+    }
+#endif
+
     if (SUCCEEDED(CoInitialize(NULL)))
     {
         {
             Platformer platformer;
 
+            // -software draws with the CPU rasterizer, where redrawing only
+            // the damaged parts of the frame matters most
+            platformer.SetSoftwareRendering(strstr(lpCmdLine, "-software") != NULL);
+
+            // -level <id> starts on another level, PALETTE_TEST_LEVEL_ID say
+            const char* pLevel = strstr(lpCmdLine, "-level");
+            if (pLevel)
+            {
+                int levelId = atoi(pLevel + strlen("-level"));
+                if (levelId > 0)
+                {
+                    platformer.SetStartLevel(levelId);
+                }
+            }
+
+            // -device-loss [frames] loses the device over and over, to test
+            // the recovery
+            const char* pDeviceLoss = strstr(lpCmdLine, "-device-loss");
+            if (pDeviceLoss)
+            {
+                int frames = atoi(pDeviceLoss + strlen("-device-loss"));
+                platformer.SetDeviceLossInterval(frames > 0 ? frames : DEFAULT_DEVICE_LOSS_INTERVAL);
+            }
+
+            // -connect [port] draws what benchmark -serve streams instead of
+            // playing
+            const char* pConnect = strstr(lpCmdLine, "-connect");
+            if (pConnect)
+            {
+                int port = atoi(pConnect + strlen("-connect"));
+                if (!platformer.ConnectViewer(port > 0 ? static_cast<unsigned short>(port) : SIM_STREAM_DEFAULT_PORT))
+                {
+                    OutputDebugStringA("no sim server to connect to, playing instead\n");
+                }
+            }
+
             if (SUCCEEDED(platformer.Initialize()))
             {
                 platformer.RunMessageLoop();
@@ -23,6 +72,10 @@ int WINAPI WinMain(
         CoUninitialize();
     }
 
+#if USE_PROFILER
+    Profiler::Shutdown();
+#endif
+
     return 0;
 }
 
@@ -31,12 +84,25 @@ Platformer::Platformer() :
     m_hwnd(NULL),
     m_lastFrameTime(),
     m_performanceFrequency(),
+    m_stepAccumulator(0.f),
+    m_inputQueue(),
+    m_inputHead(0),
+    m_inputCount(0),
+    m_startLevelId(FIRST_LEVEL_ID),
     m_gameState(),
-    // WIC
-    m_pIWICFactory(NULL),
+    m_collision(),
     // Base
     m_pDirect2dFactory(NULL),
     m_pRenderTarget(NULL),
+    m_softwareRendering(false),
+    m_deviceStats(),
+    m_deviceLost(false),
+    m_forceDeviceLoss(false),
+    m_deviceLossInterval(0),
+    m_framesSinceDeviceLoss(0),
+    // Damage
+    m_pFrameTarget(NULL),
+    m_damage(),
     // Text
     m_pWriteFactory(NULL),
     m_pDebugTextFormat(NULL),
@@ -46,18 +112,56 @@ Platformer::Platformer() :
     m_pLightSlateGrayBrush(NULL),
     m_pCornflowerBlueBrush(NULL),
     m_pInnerSquareBrush(NULL),
-    m_pTextureBrushes(),
-    m_pTextureBitmaps()
+    m_textures(),
+    m_spriteSheets(),
+    // Assets
+    m_assetLoader(),
+    m_startupTimeline(),
+    // Frame
+    m_frameArena(),
+    // Tilemap
+    m_pChunkTargets(),
+    m_chunkCacheX(),
+    m_chunkCacheVersion(),
+    // Culling
+    m_renderStats(),
+    // Streaming
+    m_levelStreamer(),
+    // Particles
+    m_particles(SCREEN_WIDTH, SCREEN_HEIGHT),
+    m_pParticleBitmap(NULL),
+    // Viewer
+    m_pViewerLink(NULL)
 {
     QueryPerformanceCounter(&m_lastFrameTime);
     QueryPerformanceFrequency(&m_performanceFrequency);
+
+    // Enemies need the factory for their shapes as soon as a level loads,
+    // which a game that never calls Initialize, in the benchmark say, does
+    // too. A failure is reported by Initialize, which tries again.
+    D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &m_pDirect2dFactory);
+
+    for (int index = 0; index < NUM_CHUNK_CACHES; index++)
+    {
+        m_chunkCacheX[index] = -1;
+    }
 }
 
 Platformer::~Platformer()
 {
+    // Streaming
+    m_levelStreamer.Stop();
+
+    // Assets
+    m_assetLoader.Stop();
+
+    // Viewer
+    delete m_pViewerLink;
+
     // Base
     SafeRelease(&m_pDirect2dFactory);
     SafeRelease(&m_pRenderTarget);
+    SafeRelease(&m_pFrameTarget);
 
     // Text
     SafeRelease(&m_pWriteFactory);
@@ -69,11 +173,27 @@ Platformer::~Platformer()
     SafeRelease(&m_pInnerSquareBrush);
 }
 
+bool Platformer::ConnectViewer(unsigned short port)
+{
+    SimStreamClient* pLink = new SimStreamClient();
+    if (!pLink->Connect(port))
+    {
+        delete pLink;
+        return false;
+    }
+
+    m_pViewerLink = pLink;
+    return true;
+}
+
 void Platformer::RunMessageLoop()
 {
     CreateDeviceResources();
+    m_startupTimeline.Mark("device resources");
 
     ResetGame();
+    m_startupTimeline.Mark("level loaded");
+
     while (TickGame())
     {
         
@@ -90,15 +210,8 @@ HRESULT Platformer::CreateDeviceIndependentResources()
 {
     HRESULT hr = S_OK;
 
-    hr = CoCreateInstance(
-        CLSID_WICImagingFactory2,
-        NULL,
-        CLSCTX_INPROC_SERVER,
-        IID_IWICImagingFactory2,
-        reinterpret_cast<void**>(&m_pIWICFactory));
-
-    // Base
-    if (SUCCEEDED(hr))
+    // Base, usually made by the constructor already
+    if (!m_pDirect2dFactory)
     {
         hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &m_pDirect2dFactory);
     }
@@ -142,6 +255,9 @@ HRESULT Platformer::CreateDeviceResources()
 {
     HRESULT hr = S_OK;
 
+    LARGE_INTEGER startTime;
+    QueryPerformanceCounter(&startTime);
+
     if (!m_pRenderTarget)
     {
         RECT rc;
@@ -153,7 +269,7 @@ HRESULT Platformer::CreateDeviceResources()
 
         // Create a Direct2D render target;
         hr = m_pDirect2dFactory->CreateHwndRenderTarget(
-            D2D1::RenderTargetProperties(),
+            D2D1::RenderTargetProperties(m_softwareRendering ? D2D1_RENDER_TARGET_TYPE_SOFTWARE : D2D1_RENDER_TARGET_TYPE_DEFAULT),
             D2D1::HwndRenderTargetProperties(m_hwnd, size, D2D1_PRESENT_OPTIONS_IMMEDIATELY),
             &m_pRenderTarget);
 
@@ -180,21 +296,59 @@ HRESULT Platformer::CreateDeviceResources()
         }
     }
 
-    for (int index = 0; index < NUM_TEXTURES; index++)
+    if (SUCCEEDED(hr) && !m_pFrameTarget)
     {
-        if (!SUCCEEDED(hr) || !m_pRenderTarget)
-        {
-            break;
-        }
+        // same size and resolution as the window, drawing it back is a copy
+        hr = m_pRenderTarget->CreateCompatibleRenderTarget(
+            m_pRenderTarget->GetSize(),
+            m_pRenderTarget->GetPixelSize(),
+            &m_pFrameTarget);
+        m_damage.Invalidate();
+    }
+
+    if (SUCCEEDED(hr) && !m_pParticleBitmap)
+    {
+        // particles are simply not drawn without it
+        m_pRenderTarget->CreateBitmap(
+            D2D1::SizeU(SCREEN_WIDTH, SCREEN_HEIGHT),
+            NULL,
+            0,
+            D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)),
+            &m_pParticleBitmap);
+    }
+
+    // texture bitmaps and brushes are created on first use, see
+    // GetTextureBrush, except after a device loss: then everything that was
+    // in use comes back now from the pixels the asset loader kept, along
+    // with the tile chunks on screen
+    if (SUCCEEDED(hr) && m_deviceLost)
+    {
+        m_deviceLost = false;
+        m_textures.Restore(m_pRenderTarget, m_assetLoader);
 
-        if (m_pTextureBitmaps[index] == NULL)
+        D2D1_MATRIX_3X2_F textureScale = D2D1::Matrix3x2F::Scale(D2D1::SizeF(1.f / TEXELS_PER_UNIT, 1.f / TEXELS_PER_UNIT));
+        int firstChunk = static_cast<int>(ToFloat(m_gameState.cameraScroll)) / TILE_CHUNK_PIXEL_WIDTH;
+        int lastChunk = (static_cast<int>(ToFloat(m_gameState.cameraScroll)) + SCREEN_WIDTH) / TILE_CHUNK_PIXEL_WIDTH;
+        for (int chunkX = firstChunk; chunkX <= lastChunk && chunkX < NUM_TILE_CHUNKS; chunkX++)
         {
-            continue;
+            RenderTileChunk(chunkX, chunkX % NUM_CHUNK_CACHES, textureScale);
         }
 
-        m_pRenderTarget->CreateBitmapBrush(m_pTextureBitmaps[index], &m_pTextureBrushes[index]);
-        m_pTextureBrushes[index]->SetExtendModeX(D2D1_EXTEND_MODE_WRAP);
-        m_pTextureBrushes[index]->SetExtendModeY(D2D1_EXTEND_MODE_WRAP);
+        LARGE_INTEGER endTime;
+        QueryPerformanceCounter(&endTime);
+
+        float recoveryTime = (float)(endTime.QuadPart - startTime.QuadPart)
+            / (float)(m_performanceFrequency.QuadPart);
+        m_deviceStats.lastRecoveryTime = recoveryTime;
+        m_deviceStats.worstRecoveryTime = std::max(m_deviceStats.worstRecoveryTime, recoveryTime);
+
+        char line[128];
+        snprintf(line, sizeof(line), "device loss %d: %d of %d textures restored in %.2f ms\n",
+            m_deviceStats.losses,
+            m_textures.stats.restoredBitmaps,
+            m_textures.stats.usedBitmaps,
+            recoveryTime * 1000.f);
+        OutputDebugStringA(line);
     }
 
     return hr;
@@ -203,13 +357,25 @@ HRESULT Platformer::CreateDeviceResources()
 void Platformer::DiscardDeviceResources()
 {
     SafeRelease(&m_pRenderTarget);
+    SafeRelease(&m_pFrameTarget);
     SafeRelease(&m_pLightSlateGrayBrush);
     SafeRelease(&m_pCornflowerBlueBrush);
     SafeRelease(&m_pInnerSquareBrush);
-    for (int index = 0; index < NUM_TEXTURES; index++)
+
+    // the bitmaps go too, a brush made from one of the old device would not
+    // draw
+    m_textures.OnDeviceLost();
+
+    for (int index = 0; index < NUM_CHUNK_CACHES; index++)
     {
-        SafeRelease(&m_pTextureBrushes[index]);
+        SafeRelease(&m_pChunkTargets[index]);
+        m_chunkCacheX[index] = -1;
     }
+    SafeRelease(&m_pParticleBitmap);
+
+    m_deviceStats.losses++;
+    m_deviceLost = true;
+    m_framesSinceDeviceLoss = 0;
 }
 
 void Platformer::ResetGame()
@@ -219,8 +385,13 @@ void Platformer::ResetGame()
     // input
     m_gameState.input = Input::NONE;
 
+    // spatial index and broadphase, emptied before the geo and enemies are
+    // released
+    m_gameState.spatial.Clear();
+    m_gameState.actors.Clear();
+
     // player
-    m_gameState.player.Reset();
+    m_gameState.player.Reset(m_gameState);
 
     // geo
     DeallocateAllGeo();
@@ -228,15 +399,22 @@ void Platformer::ResetGame()
     // enemies
     DeallocateAllEnemies();
 
+    // tiles
+    m_gameState.tilemap.Clear();
+
     // camera
     m_gameState.cameraScroll = 0;
+    m_damage.Invalidate();
 
     // level
-    m_gameState.levelId = 1;
+    m_gameState.levelId = m_startLevelId;
     LoadLevel();
 
     // anim
     m_gameState.anim.active = false;
+    // particles
+    m_gameState.bursts.count = 0;
+    m_particles.Clear();
 }
 
 float Platformer::GetTimeDelta()
@@ -253,6 +431,8 @@ float Platformer::GetTimeDelta()
 
 bool Platformer::PumpMessages()
 {
+    PROFILE_ZONE("PumpMessages");
+
     MSG msg;
     if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
     {
@@ -269,119 +449,345 @@ bool Platformer::PumpMessages()
 }
 
 
-bool Intersect(
-    const D2D_RECT_F& rect1,
-    const D2D_RECT_F& rect2,
-    const MovementDirection::Type& movement,
-    float& verticalAdjustment,
-    float& horizontalAdjustment)
+void Platformer::TickSimulation(float delta)
 {
-    if (rect1.right <= rect2.left
-        || rect1.left >= rect2.right
-        || rect1.bottom <= rect2.top
-        || rect1.top >= rect2.bottom)
+    PROFILE_ZONE("TickSimulation");
+
+    EntityWorld<NUM_ACTORS>& world = m_gameState.world;
+
+    // movement runs in the sim number type, everything else stays in float
+    Scalar step = static_cast<Scalar>(delta);
+
+    // move everything
     {
-        return false;
+        PROFILE_ZONE("move");
+        m_gameState.player.BeginTick(m_gameState, step, delta);
+
+        // enemies killed since the last tick go before they move again,
+        // walking back so removal only moves entities already visited
+        for (int dense = world.brains.Count() - 1; dense >= 0; dense--)
+        {
+            if (world.brains.At(dense).isDead)
+            {
+                DeallocateEnemy(world.brains.EntityAt(dense));
+            }
+        }
+
+        MovementSystem(world, step);
     }
 
-    bool hasVertical = false;
-    bool hasHorizontal = false;
+    // push out of the level, then stomps and kills
+    {
+        PROFILE_ZONE("collision");
+        m_collision.Run(m_gameState, world, m_gameState.actors);
+    }
 
-    if (movement & MovementDirection::DOWN)
+    // sim player
     {
-        verticalAdjustment = rect2.top - rect1.bottom;
-        hasVertical = true;
+        PROFILE_ZONE("player");
+        m_gameState.player.EndTick(m_gameState);
     }
-    else if (movement & MovementDirection::UP)
+
+    // sim entities
     {
-        verticalAdjustment = rect2.bottom - rect1.top;
-        hasVertical = true;
+        PROFILE_ZONE("entities");
+        TickEntitySystems(world, m_gameState, delta);
+
+        // still grouped, enemies come first
+        for (int dense = 0; dense < world.brains.Count(); dense++)
+        {
+            m_gameState.spatial.Update(EntityHandle(world.brains.EntityAt(dense)), ToSpatialRect(GetRect(world.transforms.At(dense), world.colliders.At(dense))));
+        }
     }
 
-    if (movement & MovementDirection::LEFT)
+    // tick animations
     {
-        horizontalAdjustment = rect2.right - rect1.left;
-        hasHorizontal = true;
+        PROFILE_ZONE("geo anim");
+        for (Geo& geo : m_gameState.geo)
+        {
+            geo.TickAnim(delta);
+        }
+
+        m_gameState.tilemap.TickAnim(delta);
     }
-    else if (movement & MovementDirection::RIGHT)
+
+    // update camera boundary
     {
-        horizontalAdjustment = rect2.left - rect1.right;
-        hasHorizontal = true;
+        PROFILE_ZONE("camera");
+        const static int cameraScrollOffset = SCREEN_WIDTH / 3 * 2;
+        Transform& player = *world.transforms.Get(PLAYER_ENTITY);
+        if (player.x > m_gameState.cameraScroll + Scalar(cameraScrollOffset))
+        {
+            m_gameState.cameraScroll = player.x - Scalar(cameraScrollOffset);
+        }
+
+        if (player.x < m_gameState.cameraScroll)
+        {
+            player.x = m_gameState.cameraScroll;
+        }
     }
 
-    if (hasVertical && hasHorizontal)
+    // split merged colliders whose blocks changed, and remove broken blocks
     {
-        if (std::abs(horizontalAdjustment) > std::abs(verticalAdjustment))
+        PROFILE_ZONE("split colliders");
+        for (int geoIndex = 0; geoIndex < NUM_GEO; geoIndex++)
         {
-            horizontalAdjustment = 0;
+            Geo& geo = m_gameState.geo[geoIndex];
+            if (!geo.active || !geo.changed)
+            {
+                continue;
+            }
+
+            geo.changed = false;
+            if (!geo.collides)
+            {
+                SplitGeoCollider(geo.colliderIndex);
+            }
+
+            if (geo.gameplayState == Geo::BROKEN)
+            {
+                DeallocateGeo(geoIndex);
+            }
         }
-        else
+    }
+
+    // particles asked for this tick, then move them all
+    {
+        PROFILE_ZONE("particles");
+        m_particles.Emit(m_gameState.bursts);
+        m_gameState.bursts.count = 0;
+        m_particles.Update(delta, SCREEN_HEIGHT);
+    }
+
+    // unload geo
+    {
+        PROFILE_ZONE("unload");
+        for (int geoIndex = 0; geoIndex < NUM_GEO; geoIndex++)
         {
-            verticalAdjustment = 0;
+            Geo& geo = m_gameState.geo[geoIndex];
+            if (geo.active && geo.right < m_gameState.cameraScroll)
+            {
+                DeallocateGeo(geoIndex);
+            }
         }
     }
 
-    return true;
+    // load new entities
+    PROFILE_ZONE("load entities");
+    if (m_gameState.level.embedded)
+    {
+        LoadEmbeddedEntities();
+    }
+    else if (m_levelStreamer.IsRunning())
+    {
+        CommitStreamedEntities();
+    }
+    else
+    {
+        LoadLevelEntities();
+    }
 }
 
-void Platformer::TickSimulation(float delta)
+void Platformer::StepSimulation(float delta)
 {
-    // sim player
-    m_gameState.player.TickSimulation(m_gameState, delta);
+    m_gameState.player.HandleInput(m_gameState);
 
-    // sim enemies
-    for (int index = 0; index < NUM_ENEMIES; index++)
+    if (m_gameState.anim.active)
     {
-        Enemy& enemy = m_gameState.enemies[index];
-        if (!enemy.active)
-        {
-            continue;
-        }
+        m_gameState.anim.Tick(m_gameState, delta);
+    }
+    else
+    {
+        TickSimulation(delta);
+    }
+}
 
-        if (enemy.isDead)
-        {
-            DeallocateEnemy(index);
-            continue;
-        }
+bool Platformer::SaveState(BitWriter& out, const GameState* pKeyframe, unsigned int keyframeId, short* pLevelStream)
+{
+    if (pLevelStream == NULL && !m_gameState.level.embedded)
+    {
+        pLevelStream = FindLevelResource(m_gameState.levelId);
+    }
+
+    return WriteGameState(out, m_gameState, pLevelStream, pKeyframe, keyframeId);
+}
 
-        enemy.TickSimulation(m_gameState, delta);
+bool Platformer::LoadState(BitReader& in, const GameState* pKeyframe, unsigned int keyframeId, short* pLevelStream)
+{
+    SaveStateHeader header;
+    if (!ReadSaveStateHeader(in, header))
+    {
+        return false;
     }
 
-    // tick animations
-    for (Geo& geo : m_gameState.geo)
+    if ((header.flags & SaveStateFlags::DELTA) && (pKeyframe == NULL || header.keyframeId != keyframeId))
     {
-        geo.TickAnim(delta);
+        return false;
     }
 
-    // update camera boundary
-    const static int cameraScrollOffset = SCREEN_WIDTH / 3 * 2;
-    Actor& playerActor = m_gameState.player.actor;
-    if (playerActor.x > m_gameState.cameraScroll + cameraScrollOffset)
+    bool levelResource = pLevelStream == NULL;
+    if (levelResource)
     {
-        m_gameState.cameraScroll = m_gameState.player.actor.x - cameraScrollOffset;
+        pLevelStream = FindLevelResource(header.levelId);
     }
 
-    if (playerActor.x < m_gameState.cameraScroll)
+    // decoded next to the running game, which is only touched once the
+    // state has read and checked out whole
+    GameState* pLoaded = new GameState(m_gameState);
+    if (!ReadGameState(in, header, *pLoaded, pLevelStream, pKeyframe, keyframeId)
+        || !IsLoadedLevelCursor(pLoaded->level, pLevelStream))
     {
-        playerActor.x = m_gameState.cameraScroll;
+        delete pLoaded;
+        return false;
     }
 
-    // unload geo
-    for (int geoIndex = 0; geoIndex < NUM_GEO; geoIndex++)
+    // the streamer has read ahead of the old cursor, and the enemy shapes
+    // belong to the old entities
+    m_levelStreamer.Stop();
+    for (ID2D1RectangleGeometry*& pRect : m_pEnemyRects)
+    {
+        SafeRelease(&pRect);
+    }
+
+    m_gameState = *pLoaded;
+    delete pLoaded;
+    BindLoadedLevelTextures(pLevelStream);
+
+    EntityWorld<NUM_ACTORS>& world = m_gameState.world;
+    for (int dense = 0; dense < world.brains.Count(); dense++)
+    {
+        int entity = world.brains.EntityAt(dense);
+        const Collider& collider = *world.colliders.Get(entity);
+        m_pDirect2dFactory->CreateRectangleGeometry(
+            D2D1::RectF(0, 0, ToFloat(collider.width), ToFloat(collider.height)),
+            &(m_pEnemyRects[entity]));
+    }
+
+    // everything up to the view is loaded, the streamer picks up after it
+    if (levelResource && !m_gameState.level.embedded && m_gameState.level.next)
+    {
+        m_levelStreamer.Start(m_gameState.level.next, ToFloat(m_gameState.cameraScroll), SCREEN_WIDTH);
+    }
+
+    m_particles.Clear();
+    m_damage.Invalidate();
+    return true;
+}
+
+bool Platformer::QuickSave()
+{
+    FILE* pFile = NULL;
+    if (fopen_s(&pFile, QUICKSAVE_PATH, "wb") != 0 || pFile == NULL)
+    {
+        return false;
+    }
+
+    BitWriter writer(pFile);
+    bool saved = SaveState(writer) && writer.Finish();
+    fclose(pFile);
+    return saved;
+}
+
+bool Platformer::QuickLoad()
+{
+    FILE* pFile = NULL;
+    if (fopen_s(&pFile, QUICKSAVE_PATH, "rb") != 0 || pFile == NULL)
+    {
+        return false;
+    }
+
+    BitReader reader(pFile);
+    bool loaded = LoadState(reader);
+    fclose(pFile);
+    return loaded;
+}
+
+// Commit the streamed records that came into view. Only waits on the worker
+// when it has not yet produced everything up to the right edge of the view.
+void Platformer::CommitStreamedEntities()
+{
+    LARGE_INTEGER startTime;
+    QueryPerformanceCounter(&startTime);
+    LARGE_INTEGER stallTime = {};
+
+    StreamStats& stats = m_levelStreamer.stats;
+    int loadRight = GetLoadRight();
+    m_levelStreamer.SetCameraScroll(ToFloat(m_gameState.cameraScroll));
+
+    bool stalled = false;
+    bool done = false;
+    while (!done)
     {
-        Geo& geo = m_gameState.geo[geoIndex];
-        if (geo.active && geo.right < m_gameState.cameraScroll)
+        float producedUpTo = m_levelStreamer.GetProducedUpTo();
+        StreamBatch* pBatch = m_levelStreamer.Front();
+        if (!pBatch)
+        {
+            if (producedUpTo > loadRight)
+            {
+                break;
+            }
+
+            LARGE_INTEGER stallStart;
+            LARGE_INTEGER stallEnd;
+            QueryPerformanceCounter(&stallStart);
+            std::this_thread::yield();
+            QueryPerformanceCounter(&stallEnd);
+            stallTime.QuadPart += stallEnd.QuadPart - stallStart.QuadPart;
+            stalled = true;
+            continue;
+        }
+
+        while (pBatch->next < pBatch->count)
+        {
+            StreamedRecord& streamed = pBatch->records[pBatch->next];
+            if (streamed.record.left > loadRight)
+            {
+                done = true;
+                break;
+            }
+
+            if (streamed.record.type == LevelEntity::TEXTURE)
+            {
+                UploadLevelTexture(streamed.record.textureId, streamed.record.kind, streamed.image);
+            }
+            else
+            {
+                SpawnLevelRecord(streamed.record);
+            }
+
+            m_gameState.level.next = streamed.end;
+            pBatch->next++;
+        }
+
+        if (!done)
         {
-            DeallocateGeo(geoIndex);
+            m_levelStreamer.PopFront();
         }
     }
 
-    // load new entities
-    LoadLevelEntities();
+    LARGE_INTEGER endTime;
+    QueryPerformanceCounter(&endTime);
+
+    float frequency = static_cast<float>(m_performanceFrequency.QuadPart);
+    if (stalled)
+    {
+        stats.stalls++;
+        stats.stallTime += static_cast<float>(stallTime.QuadPart) / frequency;
+    }
+
+    stats.lastCommitTime = static_cast<float>(endTime.QuadPart - startTime.QuadPart - stallTime.QuadPart) / frequency;
+    if (stats.lastCommitTime > stats.worstCommitTime)
+    {
+        stats.worstCommitTime = stats.lastCommitTime;
+    }
 }
 
 bool Platformer::TickGame()
 {
+    m_frameArena.BeginFrame();
+    PROFILE_FRAME();
+    PROFILE_ZONE("TickGame");
+
     LARGE_INTEGER startTime;
     QueryPerformanceCounter(&startTime);
 
@@ -390,18 +796,46 @@ bool Platformer::TickGame()
         return false;
     }
 
-    m_gameState.player.HandleInput(m_gameState.input);
-
     float delta = GetTimeDelta();
     m_gameState.frameRate = 1.f / delta;
-    
-    if (m_gameState.anim.active)
+
+    if (m_pViewerLink)
     {
-        m_gameState.anim.Tick(m_gameState, delta);
+        // the server steps the game, draw the newest tick it sent
+        bool received = false;
+        while (m_pViewerLink->Receive(0))
+        {
+            received = true;
+        }
+
+        if (received)
+        {
+            ApplySnapshotTextures();
+        }
     }
     else
     {
-        TickSimulation(delta);
+#if USE_FIXED_POINT_PHYSICS
+        m_stepAccumulator += delta;
+        int steps = 0;
+        while (m_stepAccumulator >= FIXED_SIM_STEP && steps < FIXED_SIM_MAX_STEPS)
+        {
+            TakeQueuedInput();
+            StepSimulation(FIXED_SIM_STEP);
+            m_stepAccumulator -= FIXED_SIM_STEP;
+            steps++;
+        }
+
+        if (steps == FIXED_SIM_MAX_STEPS)
+        {
+            // if still behind, drop the whole steps left rather than spiral,
+            // keeping the fraction so the next step is not early
+            m_stepAccumulator = fmodf(m_stepAccumulator, FIXED_SIM_STEP);
+        }
+#else
+        TakeQueuedInput();
+        StepSimulation(delta);
+#endif
     }
 
     LARGE_INTEGER endTime;
@@ -410,118 +844,862 @@ bool Platformer::TickGame()
     m_gameState.simTime = (float)(endTime.QuadPart - startTime.QuadPart)
         / (float)(m_performanceFrequency.QuadPart);
 
-    RenderGame();
+    HRESULT hr = RenderGame();
+
+    if (SUCCEEDED(hr) && !m_startupTimeline.IsReported())
+    {
+        m_startupTimeline.Mark("first frame");
+        m_startupTimeline.Report();
+        ReportTextureMemory();
+        ReportStateLayout();
+    }
 
     return true;
 }
 
 HRESULT Platformer::RenderGame()
 {
+    PROFILE_ZONE("RenderGame");
+
     HRESULT hr = S_OK;
 
     hr = CreateDeviceResources();
 
     if (SUCCEEDED(hr))
     {
-        m_pRenderTarget->BeginDraw();
-        m_pRenderTarget->SetTransform(D2D1::Matrix3x2F::Identity());
-        m_pRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::White));
-
         D2D1_SIZE_F rtSize = m_pRenderTarget->GetSize();
+        D2D1_SIZE_U pixelSize = m_pRenderTarget->GetPixelSize();
+
+        float scroll = m_pViewerLink
+            ? m_pViewerLink->GetSnapshot().cameraScroll
+            : ToFloat(m_gameState.cameraScroll);
+
+        D2D1_MATRIX_3X2_F screenScaleTransform = D2D1::Matrix3x2F::Scale(
+            D2D1::SizeF(rtSize.width / SCREEN_WIDTH, rtSize.height / SCREEN_HEIGHT));
+        D2D1_MATRIX_3X2_F screenScrollTransform = D2D1::Matrix3x2F::Translation(
+            D2D1::SizeF(-scroll, 0)
+        );
+
+        D2D1_MATRIX_3X2_F screenTransform = screenScrollTransform * screenScaleTransform;
+
+        D2D1_MATRIX_3X2_F textureScale = D2D1::Matrix3x2F::Scale(D2D1::SizeF(1.f / TEXELS_PER_UNIT, 1.f / TEXELS_PER_UNIT));
+
+        m_pFrameTarget->BeginDraw();
+        m_pFrameTarget->SetTransform(screenTransform);
+
+        if (m_pViewerLink)
+        {
+            // a streamed tick is drawn whole, nothing here knows what changed
+            m_pFrameTarget->Clear(D2D1::ColorF(D2D1::ColorF::White));
+            RenderSnapshot(m_pFrameTarget, textureScale);
+        }
+        else
+        {
+            TrackDamage(
+                static_cast<float>(pixelSize.width) / SCREEN_WIDTH,
+                static_cast<float>(pixelSize.height) / SCREEN_HEIGHT);
+
+            // particles are rasterized once, every damaged rect draws its part
+            if (m_particles.Count() > 0)
+            {
+                PROFILE_ZONE("particles");
+                const UINT* pParticlePixels = m_particles.Rasterize(floorf(scroll));
+                if (m_pParticleBitmap && pParticlePixels)
+                {
+                    m_pParticleBitmap->CopyFromMemory(NULL, pParticlePixels, SCREEN_WIDTH * sizeof(UINT));
+                }
+            }
+
+            // redraw the damaged parts of the kept frame, each clipped to its
+            // pixels so the rest stays as it was
+            const D2D1_RECT_F* pDamageRects = m_damage.GetRects();
+            for (int index = 0; index < m_damage.GetRectCount(); index++)
+            {
+                m_pFrameTarget->PushAxisAlignedClip(pDamageRects[index], D2D1_ANTIALIAS_MODE_ALIASED);
+                m_pFrameTarget->Clear(D2D1::ColorF(D2D1::ColorF::White));
+                RenderScene(m_pFrameTarget, pDamageRects[index], textureScale);
+                m_pFrameTarget->PopAxisAlignedClip();
+            }
+        }
+
+        hr = m_pFrameTarget->EndDraw();
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_pRenderTarget->BeginDraw();
+        m_pRenderTarget->SetTransform(D2D1::Matrix3x2F::Identity());
+
+        D2D1_SIZE_F rtSize = m_pRenderTarget->GetSize();
+        ID2D1Bitmap* pFrame = NULL;
+        if (SUCCEEDED(m_pFrameTarget->GetBitmap(&pFrame)))
+        {
+            m_pRenderTarget->DrawBitmap(
+                pFrame,
+                D2D1::RectF(0.f, 0.f, rtSize.width, rtSize.height),
+                1.f,
+                D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+            SafeRelease(&pFrame);
+        }
+
+        static int frame = 1;
+        FrameAllocator<wchar_t> frameAllocator(m_frameArena);
+        FrameWString frameString(frameAllocator);
+        AppendInt(frameString, (int)(m_gameState.frameRate));
+        m_pRenderTarget->DrawTextW(
+            frameString.c_str(),
+            static_cast<UINT32>(frameString.length()),
+            m_pDebugTextFormat,
+            D2D1::RectF(0, 0, 200, 20),
+            m_pLightSlateGrayBrush);
+
+        int blocks, colliders, draws;
+        CountGeo(blocks, colliders, draws);
+        FrameWString geoString(L"geo ", frameAllocator);
+        AppendInt(geoString, blocks);
+        geoString += L" col ";
+        AppendInt(geoString, colliders);
+        geoString += L" draw ";
+        AppendInt(geoString, draws);
+        geoString += L" vis ";
+        AppendInt(geoString, m_renderStats.visibleGeo + m_renderStats.visibleEnemies);
+        geoString += L"/";
+        AppendInt(geoString, m_renderStats.totalGeo + m_renderStats.totalEnemies);
+        m_pRenderTarget->DrawTextW(
+            geoString.c_str(),
+            static_cast<UINT32>(geoString.length()),
+            m_pDebugTextFormat,
+            D2D1::RectF(0, 20, 400, 40),
+            m_pLightSlateGrayBrush);
+
+        const StreamStats& streamStats = m_levelStreamer.stats;
+        FrameWString streamString(L"stalls ", frameAllocator);
+        AppendInt(streamString, streamStats.stalls);
+        streamString += L" commit max ";
+        AppendInt(streamString, static_cast<int>(streamStats.worstCommitTime * 1000000.f));
+        streamString += L"us ttff ";
+        AppendInt(streamString, static_cast<int>(m_startupTimeline.GetTotal() * 1000.f));
+        streamString += L"ms";
+        m_pRenderTarget->DrawTextW(
+            streamString.c_str(),
+            static_cast<UINT32>(streamString.length()),
+            m_pDebugTextFormat,
+            D2D1::RectF(0, 40, 400, 60),
+            m_pLightSlateGrayBrush);
+
+        TextureMemoryStats textureStats = GetTextureMemoryStats();
+        FrameWString textureString(L"tex cpu ", frameAllocator);
+        AppendInt(textureString, textureStats.storedBytes / 1024);
+        textureString += L"KB (32bpp ";
+        AppendInt(textureString, textureStats.expandedBytes / 1024);
+        textureString += L"KB) gpu 32bpp ";
+        AppendInt(textureString, textureStats.deviceBytes / 1024);
+        textureString += L"KB in ";
+        AppendInt(textureString, textureStats.deviceBitmaps);
+        textureString += L" bitmaps";
+        m_pRenderTarget->DrawTextW(
+            textureString.c_str(),
+            static_cast<UINT32>(textureString.length()),
+            m_pDebugTextFormat,
+            D2D1::RectF(0, 60, 400, 80),
+            m_pLightSlateGrayBrush);
+
+        const FrameArenaStats& arenaStats = m_frameArena.stats;
+        FrameWString arenaString(L"arena ", frameAllocator);
+        AppendInt(arenaString, arenaStats.lastFrameUsed / 1024);
+        arenaString += L"KB peak ";
+        AppendInt(arenaString, arenaStats.highWater / 1024);
+        arenaString += L"KB ovf ";
+        AppendInt(arenaString, arenaStats.overflows);
+        m_pRenderTarget->DrawTextW(
+            arenaString.c_str(),
+            static_cast<UINT32>(arenaString.length()),
+            m_pDebugTextFormat,
+            D2D1::RectF(0, 80, 400, 100),
+            m_pLightSlateGrayBrush);
+
+        const DamageStats& damageStats = m_damage.stats;
+        FrameWString damageString(L"redraw ", frameAllocator);
+        AppendInt(damageString, static_cast<int>(damageStats.lastFraction * 100.f));
+        damageString += L"% avg ";
+        // no frames tracked yet, for one in the level viewer
+        AppendInt(damageString, damageStats.frames > 0 ? static_cast<int>(damageStats.totalFraction * 100.0 / damageStats.frames) : 0);
+        damageString += L"% full ";
+        AppendInt(damageString, damageStats.fullFrames);
+        m_pRenderTarget->DrawTextW(
+            damageString.c_str(),
+            static_cast<UINT32>(damageString.length()),
+            m_pDebugTextFormat,
+            D2D1::RectF(0, 100, 400, 120),
+            m_pLightSlateGrayBrush);
+
+        const DeviceStats& deviceStats = m_deviceStats;
+        FrameWString deviceString(L"lost ", frameAllocator);
+        AppendInt(deviceString, deviceStats.losses);
+        deviceString += L" recover ";
+        AppendInt(deviceString, static_cast<int>(deviceStats.lastRecoveryTime * 1000000.f));
+        deviceString += L"us max ";
+        AppendInt(deviceString, static_cast<int>(deviceStats.worstRecoveryTime * 1000000.f));
+        deviceString += L"us";
+        m_pRenderTarget->DrawTextW(
+            deviceString.c_str(),
+            static_cast<UINT32>(deviceString.length()),
+            m_pDebugTextFormat,
+            D2D1::RectF(0, 120, 400, 140),
+            m_pLightSlateGrayBrush);
+
+        if (m_pViewerLink)
+        {
+            const SimStreamStats& streamStats = m_pViewerLink->stats;
+            FrameWString viewerString(m_pViewerLink->IsConnected() ? L"stream " : L"stream closed ", frameAllocator);
+            AppendInt(viewerString, streamStats.lastBytes);
+            viewerString += L"B avg ";
+            AppendInt(viewerString, static_cast<int>(streamStats.bytes / (streamStats.snapshots > 0 ? streamStats.snapshots : 1)));
+            viewerString += L"B lat ";
+            AppendInt(viewerString, static_cast<int>(streamStats.lastLatency * 1000000.f));
+            viewerString += L"us max ";
+            AppendInt(viewerString, static_cast<int>(streamStats.worstLatency * 1000000.f));
+            viewerString += L"us";
+            m_pRenderTarget->DrawTextW(
+                viewerString.c_str(),
+                static_cast<UINT32>(viewerString.length()),
+                m_pDebugTextFormat,
+                D2D1::RectF(0, 140, 400, 160),
+                m_pLightSlateGrayBrush);
+        }
+
+        PROFILE_ZONE("EndDraw");
+        hr = m_pRenderTarget->EndDraw();
+
+        // a forced loss takes the same way back as a real one
+        m_framesSinceDeviceLoss++;
+        if (SUCCEEDED(hr)
+            && (m_forceDeviceLoss
+                || (m_deviceLossInterval > 0 && m_framesSinceDeviceLoss >= m_deviceLossInterval)))
+        {
+            m_forceDeviceLoss = false;
+            m_deviceStats.forcedLosses++;
+            hr = D2DERR_RECREATE_TARGET;
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        // the kept frame may be missing what was damaged
+        m_damage.Invalidate();
+    }
+
+    if (hr == D2DERR_RECREATE_TARGET)
+    {
+        hr = S_OK;
+        DiscardDeviceResources();
+    }
+
+    return hr;
+}
+
+void Platformer::TrackDamage(float pixelsPerUnitX, float pixelsPerUnitY)
+{
+    PROFILE_ZONE("TrackDamage");
+
+    float scroll = ToFloat(m_gameState.cameraScroll);
+    m_damage.BeginFrame(D2D1::RectF(scroll, 0.f, scroll + SCREEN_WIDTH, SCREEN_HEIGHT), pixelsPerUnitX, pixelsPerUnitY);
+
+    // chunks change as a whole when their cache is rebuilt, live tiles on
+    // their own
+    const Tilemap& tilemap = m_gameState.tilemap;
+    int firstChunk = static_cast<int>(scroll) / TILE_CHUNK_PIXEL_WIDTH;
+    for (int slot = 0; slot < DAMAGE_VIEW_CHUNKS; slot++)
+    {
+        int chunkX = firstChunk + slot;
+        if (chunkX >= 0 && chunkX < NUM_TILE_CHUNKS)
+        {
+            float chunkLeft = static_cast<float>(chunkX * TILE_CHUNK_PIXEL_WIDTH);
+            m_damage.Report(
+                DAMAGE_SLOT_CHUNKS + slot,
+                D2D1::RectF(chunkLeft, 0.f, chunkLeft + TILE_CHUNK_PIXEL_WIDTH, TILE_CHUNK_PIXEL_HEIGHT),
+                static_cast<unsigned int>(tilemap.chunks[chunkX].version));
+        }
+    }
+
+    int firstColumn = static_cast<int>(scroll) / TILE_SIZE;
+    for (int column = 0; column < DAMAGE_VIEW_TILE_COLUMNS; column++)
+    {
+        int tileX = firstColumn + column;
+        for (int y = 0; y < TILE_CHUNK_HEIGHT; y++)
+        {
+            const Tile* pTile = tilemap.GetTile(tileX, y);
+            if (!pTile || !pTile->IsLive())
+            {
+                continue;
+            }
+
+            unsigned char frame = (pTile->flags & Tile::ANIMATED)
+                ? tilemap.GetQuestionFrame()
+                : pTile->frame;
+            float animYOffset = tilemap.GetBumpOffset(tileX, y);
+            D2D1_RECT_F tileRect = Tilemap::GetTileRectF(tileX, y);
+            tileRect.top += animYOffset;
+            tileRect.bottom += animYOffset;
+            m_damage.Report(
+                DAMAGE_SLOT_TILES + column * TILE_CHUNK_HEIGHT + y,
+                tileRect,
+                frame | (pTile->textureId << 8));
+        }
+    }
+
+    for (int index = 0; index < NUM_GEO; index++)
+    {
+        const Geo& geo = m_gameState.geo[index];
+        if (geo.active && geo.visible)
+        {
+            m_damage.Report(index, geo.GetRenderRectF(), geo.spriteFrame | (geo.textureId << 8));
+        }
+    }
+
+    const EntityWorld<NUM_ACTORS>& world = m_gameState.world;
+    for (int entity = 0; entity < NUM_ACTORS; entity++)
+    {
+        if (!world.ids.IsAliveIndex(entity) || world.blocks.Has(entity))
+        {
+            continue;
+        }
+
+        const Sprite& sprite = *world.sprites.Get(entity);
+        m_damage.Report(
+            DAMAGE_SLOT_ENTITIES + entity,
+            GetRectF(*world.transforms.Get(entity), *world.colliders.Get(entity)),
+            sprite.frame | (sprite.flip << 8) | (sprite.palette << 9) | (sprite.textureId << 16));
+    }
+
+    // particles move every frame they are alive
+    D2D1_RECT_F particleBounds;
+    if (m_particles.GetBounds(particleBounds))
+    {
+        m_damage.Report(DAMAGE_SLOT_PARTICLES, particleBounds, static_cast<unsigned int>(m_damage.stats.frames));
+    }
+
+    m_damage.EndFrame();
+
+    // what a full redraw would cull to, for the debug overlay
+    D2D1_RECT_F viewRect = D2D1::RectF(
+        scroll - CULL_MARGIN,
+        -CULL_MARGIN,
+        scroll + SCREEN_WIDTH + CULL_MARGIN,
+        SCREEN_HEIGHT + CULL_MARGIN);
+    int visibleHandles[NUM_SPATIAL_ENTITIES];
+    int visibleCount = m_gameState.spatial.Query(ToSpatialRect(viewRect), visibleHandles, NUM_SPATIAL_ENTITIES);
+
+    m_renderStats = RenderStats();
+    for (const Geo& geo : m_gameState.geo)
+    {
+        m_renderStats.totalGeo += (geo.active && geo.visible) ? 1 : 0;
+    }
+
+    m_renderStats.totalEnemies = world.brains.Count();
+
+    for (int visibleIndex = 0; visibleIndex < visibleCount; visibleIndex++)
+    {
+        int handle = visibleHandles[visibleIndex];
+        if (handle < EntityHandle(0))
+        {
+            const Geo& geo = m_gameState.geo[handle];
+            m_renderStats.visibleGeo += (geo.active && geo.visible) ? 1 : 0;
+            continue;
+        }
+
+        int entity = handle - EntityHandle(0);
+        m_renderStats.visibleEnemies += (world.ids.IsAliveIndex(entity) && world.brains.Has(entity)) ? 1 : 0;
+    }
+}
+
+void Platformer::RenderGrid(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& rect, float scroll)
+{
+    int gridStartX = ((int)scroll) / 10 * 10;
+    for (int x = 0; x < SCREEN_WIDTH + 10; x += 10)
+    {
+        float lineX = static_cast<FLOAT>(gridStartX + x);
+        if (lineX < rect.left - 1.f || lineX > rect.right + 1.f)
+        {
+            continue;
+        }
+
+        pTarget->DrawLine(
+            D2D1::Point2F(lineX, 0.f),
+            D2D1::Point2F(lineX, SCREEN_HEIGHT),
+            m_pLightSlateGrayBrush,
+            0.5f);
+    }
+
+    for (int y = 0; y < SCREEN_HEIGHT; y += 10)
+    {
+        float lineY = static_cast<FLOAT>(y);
+        if (lineY < rect.top - 1.f || lineY > rect.bottom + 1.f)
+        {
+            continue;
+        }
+
+        pTarget->DrawLine(
+            D2D1::Point2F(static_cast<FLOAT>(gridStartX + 0), lineY),
+            D2D1::Point2F(static_cast<FLOAT>(gridStartX + SCREEN_WIDTH + 10), lineY),
+            m_pLightSlateGrayBrush,
+            0.5f);
+    }
+}
+
+void Platformer::RenderScene(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& rect, const D2D1_MATRIX_3X2_F& textureScale)
+{
+    // Draw a grid background.
+    RenderGrid(pTarget, rect, ToFloat(m_gameState.cameraScroll));
+
+    RenderTilemap(pTarget, rect, textureScale);
+
+    // only draw what the spatial index says is under rect; handles come back
+    // sorted, so geo is still drawn before entities
+    D2D1_RECT_F queryRect = D2D1::RectF(
+        rect.left - CULL_MARGIN,
+        rect.top - CULL_MARGIN,
+        rect.right + CULL_MARGIN,
+        rect.bottom + CULL_MARGIN);
+    int visibleHandles[NUM_SPATIAL_ENTITIES];
+    int visibleCount = m_gameState.spatial.Query(ToSpatialRect(queryRect), visibleHandles, NUM_SPATIAL_ENTITIES);
+
+    const EntityWorld<NUM_ACTORS>& world = m_gameState.world;
+    for (int visibleIndex = 0; visibleIndex < visibleCount; visibleIndex++)
+    {
+        int handle = visibleHandles[visibleIndex];
+        if (handle < EntityHandle(0))
+        {
+            const Geo& geo = m_gameState.geo[handle];
+            if (geo.active && geo.visible)
+            {
+                ID2D1BitmapBrush* pBrush = GetTextureBrush(geo.textureId);
+                if (pBrush)
+                {
+                    D2D1_RECT_F geoRect = geo.GetRenderRectF();
+                    pBrush->SetTransform(textureScale * D2D1::Matrix3x2F::Translation(D2D1::SizeF(geoRect.left - GetSpriteOffset(geo.textureId, geo.spriteFrame, false), geoRect.top)));
+                    pTarget->FillRectangle(geoRect, pBrush);
+                }
+            }
+
+            continue;
+        }
+
+        int entity = handle - EntityHandle(0);
+        if (!world.ids.IsAliveIndex(entity) || !world.brains.Has(entity))
+        {
+            continue;
+        }
+
+        const Sprite& sprite = *world.sprites.Get(entity);
+        ID2D1BitmapBrush* pBrush = GetTextureBrush(sprite.textureId, sprite.palette);
+        if (pBrush)
+        {
+            D2D1_RECT_F enemyRect = GetRectF(*world.transforms.Get(entity), *world.colliders.Get(entity));
+            D2D1_MATRIX_3X2_F flip = sprite.flip
+                ? D2D1::Matrix3x2F::Scale(D2D1::SizeF(-1.f, 1.f))
+                : D2D1::Matrix3x2F::Identity();
+            D2D1_MATRIX_3X2_F translation = D2D1::Matrix3x2F::Translation(D2D1::SizeF(enemyRect.left - GetSpriteOffset(sprite.textureId, sprite.frame, sprite.flip), enemyRect.top));
+            pBrush->SetTransform(textureScale * flip * translation);
+            pTarget->FillRectangle(enemyRect, pBrush);
+        }
+    }
+
+    // draw player
+    ID2D1BitmapBrush* pPlayerBrush = GetTextureBrush(0);
+    if (pPlayerBrush)
+    {
+        const Sprite& sprite = *world.sprites.Get(PLAYER_ENTITY);
+        D2D1_RECT_F playerRect = GetRectF(*world.transforms.Get(PLAYER_ENTITY), *world.colliders.Get(PLAYER_ENTITY));
+        D2D1_MATRIX_3X2_F flip = sprite.flip
+            ? D2D1::Matrix3x2F::Scale(D2D1::SizeF(-1.f, 1.f))
+            : D2D1::Matrix3x2F::Identity();
+        D2D1_MATRIX_3X2_F translation = D2D1::Matrix3x2F::Translation(D2D1::SizeF(playerRect.left - GetSpriteOffset(0, sprite.frame, sprite.flip), playerRect.top));
+        pPlayerBrush->SetTransform(textureScale * flip * translation);
+        pTarget->FillRectangle(playerRect, pPlayerBrush);
+    }
+
+    // draw particles over everything, as one bitmap rasterized by RenderGame;
+    // whole units, so particles sit on the same pixels as the level
+    if (m_particles.Count() > 0 && m_pParticleBitmap)
+    {
+        float particleLeft = floorf(ToFloat(m_gameState.cameraScroll));
+        pTarget->DrawBitmap(
+            m_pParticleBitmap,
+            D2D1::RectF(particleLeft, 0.f, particleLeft + SCREEN_WIDTH, SCREEN_HEIGHT),
+            1.f,
+            D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+    }
+}
+
+static void SetSnapshotSprite(SnapshotSprite& sprite, const D2D1_RECT_F& rect, int textureId, int frame, Palette::Type palette, bool flip)
+{
+    sprite.left = rect.left;
+    sprite.top = rect.top;
+    sprite.right = rect.right;
+    sprite.bottom = rect.bottom;
+    sprite.textureId = static_cast<unsigned char>(textureId);
+    sprite.frame = static_cast<unsigned char>(frame);
+    sprite.palette = static_cast<unsigned char>(palette);
+    sprite.flags = SnapshotSprite::VISIBLE | (flip ? SnapshotSprite::FLIP : 0);
+}
+
+void Platformer::CaptureSnapshot(SimSnapshot& snapshot, unsigned int tick)
+{
+    // snapshots are compared byte by byte, padding included
+    memset(&snapshot, 0, sizeof(snapshot));
+
+    float scroll = ToFloat(m_gameState.cameraScroll);
+    snapshot.tick = tick;
+    snapshot.cameraScroll = scroll;
+
+    for (int slot = 0; slot < NUM_TEXTURES; slot++)
+    {
+        snapshot.textures[slot] = static_cast<unsigned short>(m_textures.GetResource(slot));
+    }
+
+    for (int index = 0; index < NUM_GEO; index++)
+    {
+        const Geo& geo = m_gameState.geo[index];
+        if (geo.active && geo.visible)
+        {
+            SetSnapshotSprite(snapshot.sprites[index], geo.GetRenderRectF(), geo.textureId, geo.spriteFrame, Palette::BASE, false);
+        }
+    }
+
+    const EntityWorld<NUM_ACTORS>& world = m_gameState.world;
+    for (int entity = 0; entity < NUM_ACTORS; entity++)
+    {
+        if (world.ids.IsAliveIndex(entity) && !world.blocks.Has(entity))
+        {
+            const Sprite& sprite = *world.sprites.Get(entity);
+            SetSnapshotSprite(
+                snapshot.sprites[SNAPSHOT_SPRITE_ENTITIES + entity],
+                GetRectF(*world.transforms.Get(entity), *world.colliders.Get(entity)),
+                sprite.textureId,
+                sprite.frame,
+                sprite.palette,
+                sprite.flip);
+        }
+    }
+
+    const Tilemap& tilemap = m_gameState.tilemap;
+    snapshot.firstChunk = static_cast<int>(scroll) / TILE_CHUNK_PIXEL_WIDTH;
+    for (int slot = 0; slot < SNAPSHOT_CHUNKS; slot++)
+    {
+        int chunkX = snapshot.firstChunk + slot;
+        for (int y = 0; y < TILE_CHUNK_HEIGHT; y++)
+        {
+            for (int x = 0; x < TILE_CHUNK_WIDTH; x++)
+            {
+                SnapshotTile& tileOut = snapshot.tiles[slot][y][x];
+                tileOut.textureId = TILE_NO_TEXTURE;
+                if (chunkX < 0 || chunkX >= NUM_TILE_CHUNKS)
+                {
+                    continue;
+                }
+
+                const Tile& tile = tilemap.chunks[chunkX].tiles[y][x];
+                if (tile.IsEmpty())
+                {
+                    continue;
+                }
+
+                tileOut.textureId = tile.textureId;
+                tileOut.frame = (tile.flags & Tile::ANIMATED)
+                    ? tilemap.GetQuestionFrame()
+                    : tile.frame;
+                if (tile.flags & Tile::BUMPING)
+                {
+                    float bump = tilemap.GetBumpOffset(chunkX * TILE_CHUNK_WIDTH + x, y);
+                    tileOut.bump = static_cast<signed char>(lrintf(bump * SNAPSHOT_BUMP_SCALE));
+                }
+            }
+        }
+    }
+}
+
+void Platformer::ApplySnapshotTextures()
+{
+    const SimSnapshot& snapshot = m_pViewerLink->GetSnapshot();
+    for (int slot = 0; slot < NUM_TEXTURES; slot++)
+    {
+        int resource = snapshot.textures[slot];
+        if (resource == m_textures.GetResource(slot))
+        {
+            continue;
+        }
+
+        if (resource == 0)
+        {
+            m_textures.Bind(slot, 0);
+        }
+        else
+        {
+            LoadLevelTexture(slot, resource);
+        }
+    }
+}
+
+void Platformer::RenderSnapshot(ID2D1RenderTarget* pTarget, const D2D1_MATRIX_3X2_F& textureScale)
+{
+    const SimSnapshot& snapshot = m_pViewerLink->GetSnapshot();
+    D2D1_RECT_F screenRect = D2D1::RectF(snapshot.cameraScroll, 0.f, snapshot.cameraScroll + SCREEN_WIDTH, SCREEN_HEIGHT);
+    RenderGrid(pTarget, screenRect, snapshot.cameraScroll);
+
+    // there are no chunk caches here, every tile is drawn on its own
+    for (int slot = 0; slot < SNAPSHOT_CHUNKS; slot++)
+    {
+        int firstTileX = (snapshot.firstChunk + slot) * TILE_CHUNK_WIDTH;
+        for (int y = 0; y < TILE_CHUNK_HEIGHT; y++)
+        {
+            for (int x = 0; x < TILE_CHUNK_WIDTH; x++)
+            {
+                const SnapshotTile& tile = snapshot.tiles[slot][y][x];
+                ID2D1BitmapBrush* pBrush = tile.textureId != TILE_NO_TEXTURE ? GetTextureBrush(tile.textureId) : NULL;
+                if (!pBrush)
+                {
+                    continue;
+                }
+
+                D2D1_RECT_F tileRect = Tilemap::GetTileRectF(firstTileX + x, y);
+                tileRect.top += tile.bump / SNAPSHOT_BUMP_SCALE;
+                tileRect.bottom += tile.bump / SNAPSHOT_BUMP_SCALE;
+                if (tileRect.right < screenRect.left || tileRect.left > screenRect.right)
+                {
+                    continue;
+                }
+
+                pBrush->SetTransform(textureScale * D2D1::Matrix3x2F::Translation(D2D1::SizeF(tileRect.left - GetSpriteOffset(tile.textureId, tile.frame, false), tileRect.top)));
+                pTarget->FillRectangle(tileRect, pBrush);
+            }
+        }
+    }
+
+    for (const SnapshotSprite& sprite : snapshot.sprites)
+    {
+        if (!(sprite.flags & SnapshotSprite::VISIBLE))
+        {
+            continue;
+        }
+
+        ID2D1BitmapBrush* pBrush = GetTextureBrush(sprite.textureId, static_cast<Palette::Type>(sprite.palette));
+        if (!pBrush)
+        {
+            continue;
+        }
+
+        bool flip = (sprite.flags & SnapshotSprite::FLIP) != 0;
+        D2D1_RECT_F spriteRect = D2D1::RectF(sprite.left, sprite.top, sprite.right, sprite.bottom);
+        D2D1_MATRIX_3X2_F flipTransform = flip
+            ? D2D1::Matrix3x2F::Scale(D2D1::SizeF(-1.f, 1.f))
+            : D2D1::Matrix3x2F::Identity();
+        D2D1_MATRIX_3X2_F translation = D2D1::Matrix3x2F::Translation(D2D1::SizeF(spriteRect.left - GetSpriteOffset(sprite.textureId, sprite.frame, flip), spriteRect.top));
+        pBrush->SetTransform(textureScale * flipTransform * translation);
+        pTarget->FillRectangle(spriteRect, pBrush);
+    }
+}
+
+TextureMemoryStats Platformer::GetTextureMemoryStats()
+{
+    TextureMemoryStats stats = {};
+
+    for (int resourceId = TEXTURE_OFFSET + 1; resourceId <= TEXTURE_LAST; resourceId++)
+    {
+        const DecodedImage* pImage = m_assetLoader.Peek(resourceId);
+        if (pImage)
+        {
+            stats.storedBytes += pImage->stride * pImage->height + pImage->paletteSize * sizeof(UINT);
+            stats.expandedBytes += pImage->width * pImage->height * sizeof(UINT);
+        }
+    }
+
+    stats.deviceBytes = m_textures.GetDeviceBytes(&stats.deviceBitmaps);
+
+    return stats;
+}
+
+void Platformer::ReportTextureMemory()
+{
+    char line[160];
+    for (int resourceId = TEXTURE_OFFSET + 1; resourceId <= TEXTURE_LAST; resourceId++)
+    {
+        const DecodedImage* pImage = m_assetLoader.Peek(resourceId);
+        if (!pImage)
+        {
+            continue;
+        }
+
+        snprintf(line, sizeof(line), "texture %d: %ux%u %s, %u bytes (32bpp %u bytes)\n",
+            resourceId,
+            pImage->width,
+            pImage->height,
+            pImage->palette ? "indexed" : "bgra",
+            static_cast<UINT>(pImage->stride * pImage->height + pImage->paletteSize * sizeof(UINT)),
+            static_cast<UINT>(pImage->width * pImage->height * sizeof(UINT)));
+        OutputDebugStringA(line);
+    }
+
+    TextureMemoryStats stats = GetTextureMemoryStats();
+    snprintf(line, sizeof(line), "texture memory: cpu %d bytes (32bpp %d bytes), device %d bytes at 32bpp in %d bitmaps, one per slot and palette\n",
+        stats.storedBytes,
+        stats.expandedBytes,
+        stats.deviceBytes,
+        stats.deviceBitmaps);
+    OutputDebugStringA(line);
+}
+
+void Platformer::ReportStateLayout()
+{
+    StateLayoutStats stats = GetStateLayoutStats(m_gameState);
+
+    char line[160];
+    snprintf(line, sizeof(line), "layout: geo %d bytes, actor %d bytes, enemy %d bytes, game state %u bytes\n",
+        stats.geoBytes,
+        stats.actorBytes,
+        stats.enemyBytes,
+        static_cast<UINT>(sizeof(GameState)));
+    OutputDebugStringA(line);
+
+    snprintf(line, sizeof(line), "layout: %d geo in %d lines, %d enemies in %d lines, player %d lines per tick\n",
+        stats.liveGeo,
+        stats.geoLines,
+        stats.liveEnemies,
+        stats.enemyLines,
+        stats.playerLines);
+    OutputDebugStringA(line);
+}
+
+HRESULT Platformer::RenderTileChunk(int chunkX, int cacheIndex, const D2D1_MATRIX_3X2_F& textureScale)
+{
+    HRESULT hr = S_OK;
+
+    if (!m_pChunkTargets[cacheIndex])
+    {
+        hr = m_pRenderTarget->CreateCompatibleRenderTarget(
+            D2D1::SizeF(TILE_CHUNK_PIXEL_WIDTH, TILE_CHUNK_PIXEL_HEIGHT),
+            D2D1::SizeU(TILE_CHUNK_PIXEL_WIDTH * CHUNK_CACHE_SCALE, TILE_CHUNK_PIXEL_HEIGHT * CHUNK_CACHE_SCALE),
+            &m_pChunkTargets[cacheIndex]);
+    }
+
+    if (!SUCCEEDED(hr))
+    {
+        return hr;
+    }
+
+    const TileChunk& chunk = m_gameState.tilemap.chunks[chunkX];
+    ID2D1BitmapRenderTarget* pTarget = m_pChunkTargets[cacheIndex];
+
+    pTarget->BeginDraw();
+    pTarget->SetTransform(D2D1::Matrix3x2F::Identity());
+    pTarget->Clear(D2D1::ColorF(0.f, 0.f, 0.f, 0.f));
+
+    for (int y = 0; y < TILE_CHUNK_HEIGHT; y++)
+    {
+        for (int x = 0; x < TILE_CHUNK_WIDTH; x++)
+        {
+            const Tile& tile = chunk.tiles[y][x];
+            if (tile.IsEmpty() || tile.IsLive())
+            {
+                continue;
+            }
+
+            ID2D1BitmapBrush* pBrush = GetTextureBrush(tile.textureId);
+            if (!pBrush)
+            {
+                continue;
+            }
+
+            D2D1_RECT_F tileRect = Tilemap::GetTileRectF(x, y);
+            pBrush->SetTransform(textureScale * D2D1::Matrix3x2F::Translation(D2D1::SizeF(tileRect.left - GetSpriteOffset(tile.textureId, tile.frame, false), tileRect.top)));
+            pTarget->FillRectangle(tileRect, pBrush);
+        }
+    }
 
-        D2D1_MATRIX_3X2_F screenScaleTransform = D2D1::Matrix3x2F::Scale(
-            D2D1::SizeF(rtSize.width / SCREEN_WIDTH, rtSize.height / SCREEN_HEIGHT));
-        D2D1_MATRIX_3X2_F screenScaleTransformInverse = D2D1::Matrix3x2F::Scale(
-            D2D1::SizeF(SCREEN_WIDTH / rtSize.width, SCREEN_HEIGHT / rtSize.height));
-        D2D1_MATRIX_3X2_F screenScrollTransform = D2D1::Matrix3x2F::Translation(
-            D2D1::SizeF(-m_gameState.cameraScroll, 0)
-        );
+    hr = pTarget->EndDraw();
 
-        D2D1_MATRIX_3X2_F screenTransform = screenScrollTransform * screenScaleTransform;
+    if (SUCCEEDED(hr))
+    {
+        m_chunkCacheX[cacheIndex] = chunkX;
+        m_chunkCacheVersion[cacheIndex] = chunk.version;
+    }
 
-        m_pRenderTarget->SetTransform(screenTransform);
+    return hr;
+}
 
-        // Draw a grid background.
-        int width = static_cast<int>(rtSize.width);
-        int height = static_cast<int>(rtSize.height);
-        int gridStartX = ((int)m_gameState.cameraScroll) / 10 * 10;
-        for (int x = 0; x < SCREEN_WIDTH + 10; x += 10)
-        {
-            m_pRenderTarget->DrawLine(
-                D2D1::Point2F(static_cast<FLOAT>(gridStartX + x), 0.f),
-                D2D1::Point2F(static_cast<FLOAT>(gridStartX + x), SCREEN_HEIGHT),
-                m_pLightSlateGrayBrush,
-                0.5f);
-        }
+void Platformer::RenderTilemap(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& rect, const D2D1_MATRIX_3X2_F& textureScale)
+{
+    const Tilemap& tilemap = m_gameState.tilemap;
+    int firstChunk = static_cast<int>(floorf(rect.left)) / TILE_CHUNK_PIXEL_WIDTH;
+    int lastChunk = static_cast<int>(ceilf(rect.right)) / TILE_CHUNK_PIXEL_WIDTH;
 
-        for (int y = 0; y < SCREEN_HEIGHT; y += 10)
+    for (int chunkX = firstChunk; chunkX <= lastChunk; chunkX++)
+    {
+        if (chunkX < 0 || chunkX >= NUM_TILE_CHUNKS)
         {
-            m_pRenderTarget->DrawLine(
-                D2D1::Point2F(static_cast<FLOAT>(gridStartX + 0), static_cast<FLOAT>(y)),
-                D2D1::Point2F(static_cast<FLOAT>(gridStartX + SCREEN_WIDTH + 10), static_cast<FLOAT>(y)),
-                m_pLightSlateGrayBrush,
-                0.5f);
+            continue;
         }
 
-        D2D1_MATRIX_3X2_F textureScale = D2D1::Matrix3x2F::Scale(D2D1::SizeF(1.f / 1.6f, 1.f / 1.6f));
-
-        for (const Geo& geo : m_gameState.geo)
+        const TileChunk& chunk = tilemap.chunks[chunkX];
+        int cacheIndex = chunkX % NUM_CHUNK_CACHES;
+        if (m_chunkCacheX[cacheIndex] != chunkX
+            || m_chunkCacheVersion[cacheIndex] != chunk.version)
         {
-            if (geo.active)
+            if (!SUCCEEDED(RenderTileChunk(chunkX, cacheIndex, textureScale)))
             {
-                D2D1_RECT_F geoRect = geo.GetRenderRectF();
-                m_pTextureBrushes[geo.textureId]->SetTransform(textureScale * D2D1::Matrix3x2F::Translation(D2D1::SizeF(geoRect.left - geo.spriteOffset, geoRect.top)));
-                m_pRenderTarget->FillRectangle(geoRect, m_pTextureBrushes[geo.textureId]);
+                continue;
             }
         }
 
-        for (const Enemy& enemy : m_gameState.enemies)
+        float chunkLeft = static_cast<float>(chunkX * TILE_CHUNK_PIXEL_WIDTH);
+        ID2D1Bitmap* pBitmap = NULL;
+        if (SUCCEEDED(m_pChunkTargets[cacheIndex]->GetBitmap(&pBitmap)))
         {
-            if (enemy.active)
-            {
-                const Actor& actor = enemy.actor;
-                D2D1_RECT_F enemyRect = actor.GetRectF();
-                D2D1_MATRIX_3X2_F flip = actor.spriteFlip
-                    ? D2D1::Matrix3x2F::Scale(D2D1::SizeF(-1.f, 1.f))
-                    : D2D1::Matrix3x2F::Identity();
-                D2D1_MATRIX_3X2_F translation = D2D1::Matrix3x2F::Translation(D2D1::SizeF(enemyRect.left - actor.spriteOffset, enemyRect.top));
-                m_pTextureBrushes[enemy.textureId]->SetTransform(textureScale * flip * translation);
-                m_pRenderTarget->FillRectangle(enemyRect, m_pTextureBrushes[enemy.textureId]);
-            }
+            pTarget->DrawBitmap(
+                pBitmap,
+                D2D1::RectF(chunkLeft, 0.f, chunkLeft + TILE_CHUNK_PIXEL_WIDTH, TILE_CHUNK_PIXEL_HEIGHT),
+                1.f,
+                D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+            SafeRelease(&pBitmap);
         }
 
-        // draw player
+        if (chunk.liveCount == 0)
         {
-            const Actor& actor = m_gameState.player.actor;
-            D2D1_RECT_F playerRect = actor.GetRectF();
-            D2D1_MATRIX_3X2_F flip = actor.spriteFlip
-                ? D2D1::Matrix3x2F::Scale(D2D1::SizeF(-1.f, 1.f))
-                : D2D1::Matrix3x2F::Identity();
-            D2D1_MATRIX_3X2_F translation = D2D1::Matrix3x2F::Translation(D2D1::SizeF(playerRect.left - actor.spriteOffset, playerRect.top));
-            m_pTextureBrushes[0]->SetTransform(textureScale * flip * translation);
-            m_pRenderTarget->FillRectangle(playerRect, m_pTextureBrushes[0]);
+            continue;
         }
-        
-        m_pRenderTarget->SetTransform(D2D1::Matrix3x2F::Identity());
-        static int frame = 1;
-        std::wstring frameString = std::to_wstring((int)(m_gameState.frameRate));
-        m_pRenderTarget->DrawTextW(
-            frameString.c_str(),
-            static_cast<UINT32>(frameString.length()),
-            m_pDebugTextFormat,
-            D2D1::RectF(0, 0, 200, 20),
-            m_pLightSlateGrayBrush);
 
-        hr = m_pRenderTarget->EndDraw();
-    }
+        // animated and bumped tiles are not part of the cache
+        for (int y = 0; y < TILE_CHUNK_HEIGHT; y++)
+        {
+            for (int x = 0; x < TILE_CHUNK_WIDTH; x++)
+            {
+                const Tile& tile = chunk.tiles[y][x];
+                ID2D1BitmapBrush* pBrush = tile.IsLive() ? GetTextureBrush(tile.textureId) : NULL;
+                if (!pBrush)
+                {
+                    continue;
+                }
 
-    if (hr == D2DERR_RECREATE_TARGET)
-    {
-        hr = S_OK;
-        DiscardDeviceResources();
-    }
+                int tileX = chunkX * TILE_CHUNK_WIDTH + x;
+                unsigned char frame = (tile.flags & Tile::ANIMATED)
+                    ? tilemap.GetQuestionFrame()
+                    : tile.frame;
+                float animYOffset = tilemap.GetBumpOffset(tileX, y);
+
+                D2D1_RECT_F tileRect = Tilemap::GetTileRectF(tileX, y);
+                tileRect.top += animYOffset;
+                tileRect.bottom += animYOffset;
+                if (tileRect.right < rect.left || tileRect.left > rect.right
+                    || tileRect.bottom < rect.top || tileRect.top > rect.bottom)
+                {
+                    continue;
+                }
 
-    return hr;
+                pBrush->SetTransform(textureScale * D2D1::Matrix3x2F::Translation(D2D1::SizeF(tileRect.left - GetSpriteOffset(tile.textureId, frame, false), tileRect.top)));
+                pTarget->FillRectangle(tileRect, pBrush);
+            }
+        }
+    }
 }
 
 void Platformer::OnResize(UINT width, UINT height)
@@ -530,6 +1708,9 @@ void Platformer::OnResize(UINT width, UINT height)
     {
         m_pRenderTarget->Resize(D2D1::SizeU(width, height));
     }
+
+    // recreated at the new size, and redrawn whole
+    SafeRelease(&m_pFrameTarget);
 }
 
 LRESULT CALLBACK Platformer::WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -631,6 +1812,40 @@ bool Platformer::ProcessInput(UINT message, WPARAM wParam, LPARAM lParam)
 
     Input::Type input = Input::NONE;
     WORD vkCode = LOWORD(wParam);
+
+    if (vkCode == VK_F8)
+    {
+        if (down)
+        {
+            m_forceDeviceLoss = true;
+        }
+
+        return true;
+    }
+
+    // a viewer has no game of its own to save or load
+    if ((vkCode == VK_F5 || vkCode == VK_F6) && !m_pViewerLink)
+    {
+        if (down && !(vkCode == VK_F5 ? QuickSave() : QuickLoad()))
+        {
+            OutputDebugStringA(vkCode == VK_F5 ? "Quick save failed\n" : "Quick load failed\n");
+        }
+
+        return true;
+    }
+
+#if USE_PROFILER
+    if (vkCode == VK_F9)
+    {
+        if (down)
+        {
+            Profiler::BeginCapture();
+        }
+
+        return true;
+    }
+#endif
+
     switch (vkCode)
     {
     case 0x41: // A
@@ -653,17 +1868,28 @@ bool Platformer::ProcessInput(UINT message, WPARAM wParam, LPARAM lParam)
         break;
     }
 
-    m_gameState.input = input;
+    if (input == Input::NONE)
+    {
+        return false;
+    }
 
-    return input != Input::NONE;
+    QueueInput(input);
+    return true;
 }
 
 HRESULT Platformer::Initialize()
 {
     HRESULT hr;
 
+    // Texture decodes run on the pool while the factories and the window come
+    // up, the device bitmaps are created from them on first draw.
+    m_assetLoader.Start();
+    QueueLevelTextures(m_startLevelId);
+    m_startupTimeline.Mark("assets queued");
+
     // Initialize device-independent resource, such as the Direct2D factory.
     hr = CreateDeviceIndependentResources();
+    m_startupTimeline.Mark("factories");
 
     if (SUCCEEDED(hr))
     {
@@ -716,297 +1942,640 @@ HRESULT Platformer::Initialize()
                 SWP_NOMOVE);
             ShowWindow(m_hwnd, SW_SHOWNORMAL);
             UpdateWindow(m_hwnd);
+            m_startupTimeline.Mark("window");
         }
     }
 
     return hr;
 }
 
-void Player::Reset()
+void Player::Reset(GameState& gameState)
 {
-    actor.Initialize(0, 0, PLAYER_WIDTH, PLAYER_HEIGHT, 75);
+    EntityWorld<NUM_ACTORS>& world = gameState.world;
+    world.Destroy(PLAYER_ENTITY);
+    world.CreatePlayer(PLAYER_ENTITY, 0, 0, PLAYER_WIDTH, PLAYER_HEIGHT, 75, 0);
     isDead = false;
 }
 
-inline void Player::HandleInput(Input::Type &input)
+inline void Player::HandleInput(GameState& gameState)
 {
+    Input::Type& input = gameState.input;
+    Velocity& velocity = *gameState.world.velocities.Get(PLAYER_ENTITY);
     if (input == Input::LEFT_DOWN)
     {
-        actor.action = static_cast<Action::Type>(actor.action | Action::MOVE_LEFT);
+        velocity.action = static_cast<Action::Type>(velocity.action | Action::MOVE_LEFT);
     }
 
     if (input == Input::LEFT_UP)
     {
-        actor.action = static_cast<Action::Type>(actor.action & ~Action::MOVE_LEFT);
+        velocity.action = static_cast<Action::Type>(velocity.action & ~Action::MOVE_LEFT);
     }
 
     if (input == Input::RIGHT_DOWN)
     {
-        actor.action = static_cast<Action::Type>(actor.action | Action::MOVE_RIGHT);
+        velocity.action = static_cast<Action::Type>(velocity.action | Action::MOVE_RIGHT);
     }
 
     if (input == Input::RIGHT_UP)
     {
-        actor.action = static_cast<Action::Type>(actor.action & ~Action::MOVE_RIGHT);
+        velocity.action = static_cast<Action::Type>(velocity.action & ~Action::MOVE_RIGHT);
     }
 
     if (input == Input::JUMP_DOWN)
     {
-        actor.action = static_cast<Action::Type>(actor.action | Action::JUMP);
+        velocity.action = static_cast<Action::Type>(velocity.action | Action::JUMP);
     }
 
     if (input == Input::JUMP_UP)
     {
-        actor.action = static_cast<Action::Type>(actor.action & ~Action::JUMP);
+        velocity.action = static_cast<Action::Type>(velocity.action & ~Action::JUMP);
     }
 
     input = Input::NONE;
 }
 
-bool Player::ResolveCollisions(GameState& gameState, MovementDirection::Type actorMovement)
+void Player::BeginTick(GameState& gameState, Scalar step, float delta)
+{
+    EntityWorld<NUM_ACTORS>& world = gameState.world;
+    Transform& transform = *world.transforms.Get(PLAYER_ENTITY);
+    Velocity& velocity = *world.velocities.Get(PLAYER_ENTITY);
+    velocity.movement = UpdateMovement(transform, velocity, step);
+    TickActorAnim(*world.sprites.Get(PLAYER_ENTITY), *world.animations.Get(PLAYER_ENTITY), velocity, delta);
+}
+
+void Player::EndTick(GameState& gameState)
+{
+    EntityWorld<NUM_ACTORS>& world = gameState.world;
+    const Transform& transform = *world.transforms.Get(PLAYER_ENTITY);
+    Velocity& velocity = *world.velocities.Get(PLAYER_ENTITY);
+    CheckFalling(gameState, transform, velocity, *world.colliders.Get(PLAYER_ENTITY));
+
+    // check jump
+    if (velocity.falling == false && velocity.action & Action::JUMP)
+    {
+        velocity.yVel = jumpPower;
+        velocity.falling = true;
+    }
+
+    // check dead zone
+    if (transform.y > SCREEN_HEIGHT)
+    {
+        isDead = true;
+    }
+
+    if (isDead)
+    {
+        gameState.anim.Activate(GlobalAnimation::Type::DEATH);
+    }
+}
+
+bool CollisionPipeline::Gather(const GameState& gameState, const CollisionBody& body)
 {
-    actor.ResolveGeoCollisions(gameState, actorMovement);
+    if (bodyCount == NUM_COLLISION_BODIES)
+    {
+        return false;
+    }
+
+    int bodyIndex = bodyCount;
+    int firstContact = contactCount;
+    SimRect bodyRect = GetRect(*body.transform, *body.collider);
+    MovementDirection::Type movement = body.velocity->movement;
 
-    D2D_RECT_F actorRect = actor.GetRectF();
-    bool gotKill = false;
-    for (Enemy &enemy : gameState.enemies)
+    for (int geoIndex = 0; geoIndex < NUM_GEO; geoIndex++)
     {
-        if (!enemy.active)
+        const Geo& geo = gameState.geo[geoIndex];
+        if (!geo.active || !geo.collides)
         {
             continue;
         }
 
-        float verticalAdjustment = 0;
-        float horizonalAdjustment = 0;
-        bool intersect = Intersect(
-            actorRect,
-            enemy.actor.GetRectF(),
-            actorMovement,
-            verticalAdjustment,
-            horizonalAdjustment);
+        Scalar verticalAdjustment = 0;
+        Scalar horizontalAdjustment = 0;
+        SimRect geoRect = geo.GetRect();
+        if (Intersect(bodyRect, geoRect, movement, verticalAdjustment, horizontalAdjustment)
+            && !AddContact(bodyIndex, ContactShape::GEO, geoIndex, 0, geoRect, movement, verticalAdjustment, horizontalAdjustment))
+        {
+            contactCount = firstContact;
+            return false;
+        }
+    }
 
-        if (intersect)
+    // only the tiles under the body are visited
+    const Tilemap& tilemap = gameState.tilemap;
+    int tileLeft, tileTop, tileRight, tileBottom;
+    Tilemap::GetTileRange(bodyRect, tileLeft, tileTop, tileRight, tileBottom);
+    for (int tileY = tileTop; tileY <= tileBottom; tileY++)
+    {
+        for (int tileX = tileLeft; tileX <= tileRight; tileX++)
         {
-            if (horizonalAdjustment != 0)
+            if (!tilemap.IsSolid(tileX, tileY))
             {
-                isDead = true;
+                continue;
             }
 
-            if (verticalAdjustment < 0)
+            // faces shared with a solid neighbour are internal and must not
+            // push the body out, otherwise bodies catch on tile seams
+            int tileMovement = movement;
+            if (tilemap.IsSolid(tileX - 1, tileY))
             {
-                enemy.isDead = true;
-                gotKill = true;
+                tileMovement &= ~MovementDirection::RIGHT;
             }
-            else
+            if (tilemap.IsSolid(tileX + 1, tileY))
+            {
+                tileMovement &= ~MovementDirection::LEFT;
+            }
+            if (tilemap.IsSolid(tileX, tileY - 1))
+            {
+                tileMovement &= ~MovementDirection::DOWN;
+            }
+            if (tilemap.IsSolid(tileX, tileY + 1))
+            {
+                tileMovement &= ~MovementDirection::UP;
+            }
+
+            Scalar verticalAdjustment = 0;
+            Scalar horizontalAdjustment = 0;
+            SimRect tileRect = Tilemap::GetTileRect(tileX, tileY);
+            if (Intersect(bodyRect, tileRect, static_cast<MovementDirection::Type>(tileMovement), verticalAdjustment, horizontalAdjustment)
+                && !AddContact(bodyIndex, ContactShape::TILE, tileX, tileY, tileRect, tileMovement, verticalAdjustment, horizontalAdjustment))
             {
-                isDead = true;
+                contactCount = firstContact;
+                return false;
             }
         }
     }
 
-    return gotKill;
+    bodies[bodyCount++] = body;
+    return true;
 }
 
-void Player::TickSimulation(GameState& gameState, float delta)
+// False when the buffer is full. Overlaps that push nothing are dropped, they
+// can neither move the body nor raise an event.
+bool CollisionPipeline::AddContact(int body, ContactShape::Type shape, int shapeX, int shapeY, const SimRect& rect, int movement, Scalar verticalAdjustment, Scalar horizontalAdjustment)
 {
-    static const float jumpPower = -150;
-    MovementDirection::Type movementDirection = actor.UpdateMovement(delta);
+    if (verticalAdjustment == 0 && horizontalAdjustment == 0 && shape != ContactShape::ACTOR)
+    {
+        return true;
+    }
 
-    TickAnim(delta);
+    if (contactCount == NUM_CONTACTS)
+    {
+        return false;
+    }
 
-    // resolve collisions
-    bool gotKill = ResolveCollisions(gameState, movementDirection);
+    Contact& contact = contacts[contactCount++];
+    contact.rect = rect;
+    contact.body = static_cast<short>(body);
+    contact.shapeX = static_cast<short>(shapeX);
+    contact.shapeY = static_cast<short>(shapeY);
+    contact.shape = shape;
+    contact.movement = static_cast<MovementDirection::Type>(movement);
+    contact.normalX = static_cast<signed char>(horizontalAdjustment < 0 ? -1 : horizontalAdjustment > 0 ? 1 : 0);
+    contact.normalY = static_cast<signed char>(verticalAdjustment < 0 ? -1 : verticalAdjustment > 0 ? 1 : 0);
+    contact.penetration = verticalAdjustment != 0 ? Abs(verticalAdjustment) : Abs(horizontalAdjustment);
+    return true;
+}
 
-    actor.CheckFalling(gameState);           
+void CollisionPipeline::AddEvent(CollisionEvent::Type type, int body, int shapeX, int shapeY, const SimRect& bodyRect)
+{
+    // one event per contact at most, so events never outnumber contacts
+    CollisionEvent& event = events[eventCount++];
+    event.type = type;
+    event.body = static_cast<short>(body);
+    event.shapeX = static_cast<short>(shapeX);
+    event.shapeY = static_cast<short>(shapeY);
+    event.bodyRect = bodyRect;
+}
 
-    // check jump
-    if ((actor.falling == false && actor.action & Action::JUMP)
-        || gotKill)
+// Body by body, deepest first. Ties go to the shape higher up, then further
+// left, so the order never depends on the geo pool.
+static bool ContactBefore(const Contact& a, const Contact& b)
+{
+    if (a.body != b.body)
     {
-        actor.yVel = jumpPower;
-        actor.falling = true;
+        return a.body < b.body;
     }
 
-    // check dead zone
-    if (actor.y > SCREEN_HEIGHT)
+    if (a.penetration != b.penetration)
     {
-        isDead = true;
+        return a.penetration > b.penetration;
     }
 
+    if (a.rect.top != b.rect.top)
+    {
+        return a.rect.top < b.rect.top;
+    }
 
-    if (gameState.player.isDead)
+    if (a.rect.left != b.rect.left)
     {
-        gameState.anim.Activate(GlobalAnimation::Type::DEATH);
+        return a.rect.left < b.rect.left;
+    }
+
+    if (a.shape != b.shape)
+    {
+        return a.shape < b.shape;
     }
+
+    return a.shapeX != b.shapeX ? a.shapeX < b.shapeX : a.shapeY < b.shapeY;
 }
 
-bool Actor::ResolveGeoCollisions(GameState& gameState, MovementDirection::Type actorMovement)
+void CollisionPipeline::Resolve()
 {
-    D2D_RECT_F actorRect = GetRectF();
-    bool hadHorizonalAdjustment = false;
-    for (Geo& geo : gameState.geo)
+    std::sort(contacts, contacts + contactCount, ContactBefore);
+
+    int wallBody = -1;
+    for (int index = 0; index < contactCount; index++)
     {
-        if (!geo.active)
+        const Contact& contact = contacts[index];
+        CollisionBody& body = bodies[contact.body];
+        Transform& transform = *body.transform;
+        Velocity& velocity = *body.velocity;
+
+        // earlier contacts may have pushed the body out of this one already
+        Scalar verticalAdjustment = 0;
+        Scalar horizontalAdjustment = 0;
+        if (!Intersect(GetRect(transform, *body.collider), contact.rect, contact.movement, verticalAdjustment, horizontalAdjustment))
         {
             continue;
         }
 
-        float verticalAdjustment = 0;
-        float horizonalAdjustment = 0;
-        bool intersect = Intersect(
-            actorRect,
-            geo.GetRectF(),
-            actorMovement,
-            verticalAdjustment,
-            horizonalAdjustment);
+        transform.x += horizontalAdjustment;
+        transform.y += verticalAdjustment;
 
-        if (intersect)
+        if (verticalAdjustment < 0)
+        {
+            velocity.falling = false;
+            velocity.yVel = 0;
+        }
+        else if (verticalAdjustment > 0)
+        {
+            velocity.yVel = 0;
+            AddEvent(contact.shape == ContactShape::GEO ? CollisionEvent::BUMP_GEO : CollisionEvent::BUMP_TILE,
+                contact.body, contact.shapeX, contact.shapeY, GetRect(transform, *body.collider));
+        }
+        else if (horizontalAdjustment != 0 && wallBody != contact.body)
         {
-            x += horizonalAdjustment;
-            y += verticalAdjustment;
-            actorRect = GetRectF();
+            // a body turns around once, however many walls it touched
+            wallBody = contact.body;
+            AddEvent(CollisionEvent::HIT_WALL, contact.body, contact.shapeX, contact.shapeY, GetRect(transform, *body.collider));
+        }
+    }
+}
 
-            if (verticalAdjustment < 0)
+void CollisionPipeline::DispatchLevelEvents(GameState& gameState)
+{
+    for (int index = 0; index < eventCount; index++)
+    {
+        const CollisionEvent& event = events[index];
+        switch (event.type)
+        {
+        case CollisionEvent::BUMP_GEO:
             {
-                falling = false;
-                yVel = 0;
+                Geo* pGeo = &gameState.geo[event.shapeX];
+                if (!pGeo->visible)
+                {
+                    pGeo = FindMergedBlock(gameState, event.shapeX, event.bodyRect);
+                }
+
+                if (pGeo && pGeo->Bump())
+                {
+                    gameState.bursts.Push(pGeo->type == Geo::BLOCK_BREAKABLE ? ParticleKind::DEBRIS : ParticleKind::COIN, pGeo->GetRectF());
+                }
             }
-            else if (verticalAdjustment > 0)
+            break;
+        case CollisionEvent::BUMP_TILE:
             {
-                yVel = 0;
-                geo.Bump();
+                unsigned char bumped = gameState.tilemap.Bump(event.shapeX, event.shapeY);
+                if (bumped != Tile::NONE)
+                {
+                    gameState.bursts.Push(bumped == Tile::BREAKABLE ? ParticleKind::DEBRIS : ParticleKind::COIN,
+                        Tilemap::GetTileRectF(event.shapeX, event.shapeY));
+                }
             }
-            else if (horizonalAdjustment != 0)
+            break;
+        case CollisionEvent::HIT_WALL:
             {
-                hadHorizonalAdjustment = true;
+                if (!bodies[event.body].turnsAtWalls)
+                {
+                    break;
+                }
+
+                Velocity& velocity = *bodies[event.body].velocity;
+
+                if (velocity.action & Action::MOVE_LEFT)
+                {
+                    velocity.action = Action::MOVE_RIGHT;
+                }
+                else if (velocity.action & Action::MOVE_RIGHT)
+                {
+                    velocity.action = Action::MOVE_LEFT;
+                }
             }
+            break;
+        default:
+            break;
         }
     }
-
-    return hadHorizonalAdjustment;
 }
 
-MovementDirection::Type Actor::UpdateMovement(float delta)
+// The block of a merged collider that the actor hit, i.e. the lowest one it
+// overlaps the most horizontally.
+Geo* FindMergedBlock(GameState& gameState, int colliderIndex, const SimRect& actorRect)
 {
-    // update movement
-    int movementDirection = MovementDirection::NONE;
-    if (action & Action::MOVE_LEFT)
+    Geo* bumped = NULL;
+    Scalar bestOverlap = 0;
+    for (Geo& geo : gameState.geo)
     {
-        if (!(action & Action::MOVE_RIGHT))
+        if (!geo.active || geo.collides || geo.colliderIndex != colliderIndex)
         {
-            x -= (runSpeed * delta);
-            movementDirection = movementDirection | MovementDirection::LEFT;
+            continue;
         }
-    }
-    else if (action & Action::MOVE_RIGHT)
-    {
-        x += (runSpeed * delta);
-        movementDirection = movementDirection | MovementDirection::RIGHT;
-    }
 
-    if (falling)
-    {
-        float actualGravity = gravity;
-        if (action & Action::JUMP)
+        Scalar overlap = Min(actorRect.right, geo.right) - Max(actorRect.left, geo.left);
+        if (overlap <= 0)
         {
-            actualGravity /= 2.5f;
+            continue;
         }
 
-        yVel += (actualGravity * delta);
+        if (overlap > bestOverlap
+            || (overlap == bestOverlap && geo.bottom > bumped->bottom))
+        {
+            bestOverlap = overlap;
+            bumped = &geo;
+        }
     }
 
-    if (yVel != 0)
+    return bumped;
+}
+
+void CheckFalling(GameState& gameState, const Transform& transform, Velocity& velocity, const Collider& collider)
+{
+    if (!velocity.falling)
     {
-        movementDirection = movementDirection | (yVel > 0 ? MovementDirection::DOWN : MovementDirection::UP);
+        LevelQuery query = GroundProbeQuery(GetRect(transform, collider), FALL_PROBE_DISTANCE);
+        LevelQueryResult result;
+        QueryLevel(gameState, &query, &result, 1);
+        if (!result.hit)
+        {
+            velocity.falling = true;
+        }
     }
+}
 
-    float yPrev = y;
-    y += (yVel * delta);
-
-    return (MovementDirection::Type)movementDirection;
+// Overlap with touching edges not counting, like Intersect.
+static bool Overlaps(const SimRect& a, const SimRect& b)
+{
+    return a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom;
 }
 
-void Actor::CheckFalling(const GameState& gameState)
+// Fraction of the segment before it enters rect.
+static bool RaycastRect(SimPoint from, SimPoint to, const SimRect& rect, Scalar& fraction)
 {
-    if (!falling)
+    Scalar enter = 0;
+    Scalar exit = 1;
+
+    const Scalar origins[2] = { from.x, from.y };
+    const Scalar deltas[2] = { to.x - from.x, to.y - from.y };
+    const Scalar lows[2] = { rect.left, rect.top };
+    const Scalar highs[2] = { rect.right, rect.bottom };
+    for (int axis = 0; axis < 2; axis++)
     {
-        D2D_RECT_F fallingRect = GetFallingRectF();
-        bool supported = false;
-        for (const Geo& geo : gameState.geo)
+        if (deltas[axis] == 0)
         {
-            float verticalAlignment = 0;
-            float horizontalAlignment = 0;
-            if (Intersect(fallingRect, geo.GetRectF(), MovementDirection::DOWN, verticalAlignment, horizontalAlignment))
+            if (origins[axis] <= lows[axis] || origins[axis] >= highs[axis])
             {
-                supported = true;
-                break;
+                return false;
             }
+
+            continue;
+        }
+
+        Scalar axisEnter = (lows[axis] - origins[axis]) / deltas[axis];
+        Scalar axisExit = (highs[axis] - origins[axis]) / deltas[axis];
+        if (axisEnter > axisExit)
+        {
+            Scalar swap = axisEnter;
+            axisEnter = axisExit;
+            axisExit = swap;
         }
-        if (!supported)
+
+        enter = axisEnter > enter ? axisEnter : enter;
+        exit = axisExit < exit ? axisExit : exit;
+        if (enter >= exit)
         {
-            falling = true;
+            return false;
         }
     }
+
+    fraction = enter;
+    return true;
+}
+
+// Bounds of everything a query could touch.
+static SimRect GetQueryBounds(const LevelQuery& query)
+{
+    switch (query.type)
+    {
+    case LevelQuery::RAYCAST:
+        return MakeSimRect(
+            Min(query.from.x, query.to.x),
+            Min(query.from.y, query.to.y),
+            Max(query.from.x, query.to.x),
+            Max(query.from.y, query.to.y));
+    case LevelQuery::GROUND_PROBE:
+        return MakeSimRect(query.rect.left, query.rect.top + query.distance, query.rect.right, query.rect.bottom + query.distance);
+    default:
+        return query.rect;
+    }
 }
 
-void Enemy::ResolveCollisions(GameState& gameState, MovementDirection::Type actorMovement)
+// Solid geo and tiles near a group of queries, packed so each query of the
+// group only walks rects. Tiles are left to each query when there are too
+// many to pack.
+struct LevelQueryCandidates
 {
-    bool hadHorizontalAdjustment = actor.ResolveGeoCollisions(gameState, actorMovement);
-    if (hadHorizontalAdjustment)
+    SimRect rects[NUM_LEVEL_QUERY_CANDIDATES];
+
+    // -1 for tiles
+    short geo[NUM_LEVEL_QUERY_CANDIDATES];
+    int count;
+    bool hasTiles;
+};
+
+// Test one solid rect, true once the query has its answer.
+static bool TestLevelRect(const LevelQuery& query, const SimRect& bounds, const SimRect& rect, int geoIndex, LevelQueryResult& result)
+{
+    if (query.type == LevelQuery::RAYCAST)
     {
-        if (actor.action & Action::MOVE_LEFT)
+        Scalar fraction;
+        if (RaycastRect(query.from, query.to, rect, fraction) && fraction < result.distance)
         {
-            actor.action = Action::MOVE_RIGHT;
+            result.hit = true;
+            result.geo = static_cast<short>(geoIndex);
+            result.distance = fraction;
         }
-        else if (actor.action & Action::MOVE_RIGHT)
+
+        return false;
+    }
+
+    if (!Overlaps(bounds, rect))
+    {
+        return false;
+    }
+
+    result.hit = true;
+    if (query.type == LevelQuery::OVERLAP)
+    {
+        result.geo = static_cast<short>(geoIndex);
+        return true;
+    }
+
+    Scalar gap = rect.top - query.rect.bottom;
+    if (gap < result.distance)
+    {
+        result.geo = static_cast<short>(geoIndex);
+        result.distance = gap;
+    }
+
+    return false;
+}
+
+static LevelQueryResult RunLevelQuery(const GameState& gameState, const LevelQuery& query, const SimRect& bounds, const LevelQueryCandidates& candidates)
+{
+    LevelQueryResult result = {};
+    result.geo = -1;
+    result.distance = query.type == LevelQuery::RAYCAST ? Scalar(1) : SCALAR_MAX;
+
+    for (int index = 0; index < candidates.count; index++)
+    {
+        if (TestLevelRect(query, bounds, candidates.rects[index], candidates.geo[index], result))
         {
-            actor.action = Action::MOVE_LEFT;
+            return result;
         }
     }
 
-    D2D_RECT_F actorRect = actor.GetRectF();
-
-    float verticalAdjustment = 0;
-    float horizonalAdjustment = 0;
-    bool intersect = Intersect(
-        actorRect,
-        gameState.player.actor.GetRectF(),
-        actorMovement,
-        verticalAdjustment,
-        horizonalAdjustment);
+    if (candidates.hasTiles)
+    {
+        return result;
+    }
 
-    if (intersect)
+    const Tilemap& tilemap = gameState.tilemap;
+    int tileLeft, tileTop, tileRight, tileBottom;
+    Tilemap::GetTileRange(bounds, tileLeft, tileTop, tileRight, tileBottom);
+    for (int tileY = tileTop; tileY <= tileBottom; tileY++)
     {
-        if (horizonalAdjustment != 0)
+        for (int tileX = tileLeft; tileX <= tileRight; tileX++)
         {
-            gameState.player.isDead = true;
+            if (tilemap.IsSolid(tileX, tileY)
+                && TestLevelRect(query, bounds, Tilemap::GetTileRect(tileX, tileY), -1, result))
+            {
+                return result;
+            }
         }
-        else if (verticalAdjustment < 0)
+    }
+
+    return result;
+}
+
+// Candidates for everything inside groupBounds.
+static void GatherLevelCandidates(GameState& gameState, const SimRect& groupBounds, LevelQueryCandidates& candidates)
+{
+    int handles[NUM_SPATIAL_ENTITIES];
+    int handleCount = gameState.spatial.Query(ToSpatialRect(groupBounds), handles, NUM_SPATIAL_ENTITIES);
+    candidates.count = 0;
+    for (int index = 0; index < handleCount; index++)
+    {
+        int geoIndex = handles[index];
+        if (geoIndex < NUM_GEO && gameState.geo[geoIndex].active && gameState.geo[geoIndex].collides)
         {
-            gameState.player.isDead = true;
+            candidates.rects[candidates.count] = gameState.geo[geoIndex].GetRect();
+            candidates.geo[candidates.count++] = static_cast<short>(geoIndex);
         }
-        else
+    }
+
+    int geoCount = candidates.count;
+    candidates.hasTiles = true;
+
+    const Tilemap& tilemap = gameState.tilemap;
+    int tileLeft, tileTop, tileRight, tileBottom;
+    Tilemap::GetTileRange(groupBounds, tileLeft, tileTop, tileRight, tileBottom);
+    for (int tileY = tileTop; tileY <= tileBottom && candidates.hasTiles; tileY++)
+    {
+        for (int tileX = tileLeft; tileX <= tileRight; tileX++)
         {
-            isDead = true;
+            if (!tilemap.IsSolid(tileX, tileY))
+            {
+                continue;
+            }
+
+            if (candidates.count == NUM_LEVEL_QUERY_CANDIDATES)
+            {
+                candidates.count = geoCount;
+                candidates.hasTiles = false;
+                break;
+            }
+
+            candidates.rects[candidates.count] = Tilemap::GetTileRect(tileX, tileY);
+            candidates.geo[candidates.count++] = -1;
         }
     }
 }
 
-void Enemy::TickSimulation(GameState& gameState, float delta)
+void QueryLevel(GameState& gameState, const LevelQuery* queries, LevelQueryResult* results, int count)
 {
-    MovementDirection::Type movementDirection = actor.UpdateMovement(delta);
+    LevelQueryCandidates candidates;
+    int order[NUM_LEVEL_QUERIES];
+    int cells[NUM_LEVEL_QUERIES];
+    SimRect bounds[NUM_LEVEL_QUERIES];
+    for (int first = 0; first < count; first += NUM_LEVEL_QUERIES)
+    {
+        int batchCount = count - first < NUM_LEVEL_QUERIES ? count - first : NUM_LEVEL_QUERIES;
+        for (int index = 0; index < batchCount; index++)
+        {
+            // queries are bucketed by the cell their top left corner is in,
+            // cells being as tall as the spatial index ones are wide
+            bounds[index] = GetQueryBounds(queries[first + index]);
+            int cellX = FloorDiv(bounds[index].left, SPATIAL_CELL_SIZE);
+            int cellY = FloorDiv(bounds[index].top, SPATIAL_CELL_SIZE);
+            cells[index] = cellX * 0x10000 + (cellY & 0xFFFF);
+
+            // insertion sort by cell, batches are small
+            int position = index;
+            while (position > 0 && cells[order[position - 1]] > cells[index])
+            {
+                order[position] = order[position - 1];
+                position--;
+            }
 
-    // resolve collisions
-    ResolveCollisions(gameState, movementDirection);
+            order[position] = index;
+        }
 
-    TickAnim(delta);
+        // queries in the same cell share the lookups over their combined
+        // bounds
+        int start = 0;
+        while (start < batchCount)
+        {
+            SimRect groupBounds = bounds[order[start]];
+            int end = start + 1;
+            while (end < batchCount && cells[order[end]] == cells[order[start]])
+            {
+                const SimRect& next = bounds[order[end]];
+                groupBounds.left = Min(groupBounds.left, next.left);
+                groupBounds.top = Min(groupBounds.top, next.top);
+                groupBounds.right = Max(groupBounds.right, next.right);
+                groupBounds.bottom = Max(groupBounds.bottom, next.bottom);
+                end++;
+            }
 
-    actor.CheckFalling(gameState);
+            GatherLevelCandidates(gameState, groupBounds, candidates);
+            for (int index = start; index < end; index++)
+            {
+                int query = first + order[index];
+                results[query] = RunLevelQuery(gameState, queries[query], bounds[order[index]], candidates);
+            }
 
-    // check dead zone
-    if (actor.y > SCREEN_HEIGHT)
-    {
-        isDead = true;
+            start = end;
+        }
     }
 }
 
@@ -1032,22 +2601,24 @@ void GlobalAnimation::Tick(GameState& gameState, float delta)
 
 void GlobalAnimation::TickDeath(GameState& gameState, float delta)
 {
+    Scalar step = static_cast<Scalar>(delta);
+    Velocity& velocity = *gameState.world.velocities.Get(PLAYER_ENTITY);
     if (elapsed < 0.5f)
     {
-        gameState.player.actor.yVel = 0;
+        velocity.yVel = 0;
     }
     else if (elapsed < 1.f)
     {
-        gameState.player.actor.yVel -= (gravity / 2.f * delta);
+        velocity.yVel -= (gravity / 2 * step);
     }
     else if (elapsed < 3.f)
     {
-        gameState.player.actor.yVel += (gravity / 2.f * delta);
+        velocity.yVel += (gravity / 2 * step);
     }
     else
     {
         gameState.needsReset = true;
     }
 
-    gameState.player.actor.y += gameState.player.actor.yVel * delta;
+    gameState.world.transforms.Get(PLAYER_ENTITY)->y += velocity.yVel * step;
 }
@@ -1,7 +1,10 @@
 #pragma once
+// before windows.h, which would bring in the old winsock.h
+#include <winsock2.h>
 #include <windows.h>
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <malloc.h>
 #include <memory.h>
 #include <wchar.h>
@@ -11,9 +14,12 @@
 #include <d2d1_3.h>
 #include <d2d1helper.h>
 #include <dwrite.h>
-#include <wincodec.h>
 
 #include "resource.h"
+#include "Fixed.h"
+#include "Tilemap.h"
+#include "SpatialIndex.h"
+#include "SweepAndPrune.h"
 
 template<class Interface>
 inline void SafeRelease(Interface** ppInterfaceToRelease)
@@ -38,6 +44,20 @@ EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #define HINST_THISCOMPONENT ((HINSTANCE)&__ImageBase)
 #endif
 
+#include "Level.h"
+#include "Image.h"
+#include "LevelStreamer.h"
+#include "AssetLoader.h"
+#include "StartupTimeline.h"
+#include "FrameArena.h"
+#include "Profiler.h"
+#include "Ecs.h"
+#include "Particles.h"
+#include "DamageTracker.h"
+#include "TextureCache.h"
+#include "SimStream.h"
+#include "BitStream.h"
+
 #define SCREEN_WIDTH 200
 #define SCREEN_HEIGHT 150
 
@@ -47,17 +67,110 @@ EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #define ENEMY_WIDTH 10
 #define ENEMY_HEIGHT 10
 
+// Largest enemy an archetype can make, so it spans at most two spatial index
+// cells each way.
+#define ENEMY_MAX_SIZE SPATIAL_CELL_SIZE
+
 #define NUM_GEO 20
-#define NUM_ENEMIES 5
+#define NUM_ENTITIES 5
 #define NUM_TEXTURES 20
 
-const float gravity = 550.f;
+// Slots of the enemy archetype table, one per Enemy::Type.
+#define NUM_ENEMY_ARCHETYPES 8
+static_assert(NUM_ENEMY_ARCHETYPES <= (1 << ENEMY_PALETTE_SHIFT), "enemy types do not fit the ENEMY record");
+
+// Entities of the world: up to NUM_ENTITIES enemies, then the player at a
+// fixed index past them, so enemies keep indices below NUM_ENTITIES.
+#define NUM_ACTORS (1 + NUM_ENTITIES)
+#define PLAYER_ENTITY NUM_ENTITIES
+
+static_assert((ENEMY_PALETTE_SWAP_RED_BLUE >> ENEMY_PALETTE_SHIFT) == Palette::SWAP_RED_BLUE
+    && (ENEMY_PALETTE_SWAP_RED_GREEN >> ENEMY_PALETTE_SHIFT) == Palette::SWAP_RED_GREEN
+    && (ENEMY_PALETTE_GRAY >> ENEMY_PALETTE_SHIFT) == Palette::GRAY, "enemy palettes out of sync");
+
+// Texture texels per level unit, tiles are 16 texels and 10 units wide.
+#define TEXELS_PER_UNIT 1.6f
+
+// Play levels compiled into the executable (Levels.cpp) instead of parsing
+// the LEVEL resources at runtime. Levels that are not embedded, the palette
+// test level among them, still load from their resource through the level
+// streamer.
+#ifndef USE_EMBEDDED_LEVELS
+#define USE_EMBEDDED_LEVELS 1
+#endif
+
+#define FIRST_LEVEL_ID 1
+
+// Every enemy palette side by side, for checking recolors without changing
+// the levels that are played. Start it with -level. Never embedded, so the
+// resource and streamer path is played in every build.
+#define PALETTE_TEST_LEVEL_ID 2
+
+// Entity arrays start on their own cache line and an entity never straddles
+// two of them.
+#define CACHE_LINE_SIZE 64
+
+// Height and length of the bump when a block is hit from below.
+#define GEO_BUMP_TIME 0.2f
+#define GEO_BUMP_SIZE -5.f
+
+static_assert(NUM_GEO + NUM_ENTITIES <= NUM_SPATIAL_ENTITIES, "spatial index too small");
+
+// Extra room around the camera rect when culling, covers bump offsets and
+// sprites hanging outside their bounds.
+#define CULL_MARGIN 20
+
+// Pre-composited chunk bitmaps kept by the renderer. A screen never spans more
+// than three chunks.
+#define NUM_CHUNK_CACHES 3
+#define CHUNK_CACHE_SCALE 4
+
+// Damage tracker slots, see DamageTracker: every geo, every entity, the
+// particles, the chunks a screen spans and every tile of the tile columns it
+// spans, those numbered from the first one on screen.
+#define DAMAGE_VIEW_CHUNKS NUM_CHUNK_CACHES
+#define DAMAGE_VIEW_TILE_COLUMNS (SCREEN_WIDTH / TILE_SIZE + 1)
+#define DAMAGE_SLOT_ENTITIES NUM_GEO
+#define DAMAGE_SLOT_PARTICLES (DAMAGE_SLOT_ENTITIES + NUM_ACTORS)
+#define DAMAGE_SLOT_CHUNKS (DAMAGE_SLOT_PARTICLES + 1)
+#define DAMAGE_SLOT_TILES (DAMAGE_SLOT_CHUNKS + DAMAGE_VIEW_CHUNKS)
+#define NUM_DAMAGE_SLOTS (DAMAGE_SLOT_TILES + DAMAGE_VIEW_TILE_COLUMNS * TILE_CHUNK_HEIGHT)
+
+// Sprite slots of a streamed snapshot, in drawing order: every geo, then
+// every entity, which puts the player last.
+#define SNAPSHOT_SPRITE_ENTITIES NUM_GEO
+
+static_assert(SNAPSHOT_SPRITE_ENTITIES + NUM_ACTORS <= SNAPSHOT_SPRITES, "snapshot sprites too few");
+static_assert(NUM_TEXTURES <= SNAPSHOT_TEXTURES, "snapshot textures too few");
+static_assert(NUM_CHUNK_CACHES <= SNAPSHOT_CHUNKS, "snapshot chunks too few");
+
+// Frames between the device losses -device-loss forces when given no count.
+#define DEFAULT_DEVICE_LOSS_INTERVAL 300
+
+// Written by F5 and read back by F6, in the working directory.
+#define QUICKSAVE_PATH "quicksave.sav"
+
+// Units per second squared, and the upward speed a jump starts at.
+#define GRAVITY 550.f
+#define JUMP_POWER -150.f
+
+const Scalar gravity = static_cast<Scalar>(GRAVITY);
+const Scalar jumpPower = static_cast<Scalar>(JUMP_POWER);
+
+// With fixed point physics the sim always steps by FIXED_SIM_STEP, a frame
+// running several steps to catch up, at most FIXED_SIM_MAX_STEPS of them.
+// The step is part of the replay as much as the input is.
+#define FIXED_SIM_STEP (1.f / 60.f)
+#define FIXED_SIM_MAX_STEPS 4
+
+// Key events waiting for a sim step, see Platformer::QueueInput.
+#define INPUT_QUEUE_SIZE 16
 
 struct GameState;
 
 struct Input
 {
-    enum Type
+    enum Type : unsigned char
     {
         NONE,
         LEFT_DOWN,
@@ -78,7 +191,7 @@ struct Input
 
 struct MovementDirection
 {
-    enum Type
+    enum Type : unsigned char
     {
         NONE = 0x0,
         LEFT = 0x1,
@@ -91,7 +204,7 @@ struct MovementDirection
 
 struct Action
 {
-    enum Type
+    enum Type : unsigned char
     {
         NONE       = 0x0,
         MOVE_LEFT  = 0x1,
@@ -103,7 +216,7 @@ struct Action
 class Geo
 {
 public:
-    enum BlockType
+    enum BlockType : unsigned char
     {
         BLOCK_NONE       = 0x0,
         BLOCK_BREAKABLE  = 0x1,
@@ -111,38 +224,70 @@ public:
         BLOCK_TYPE_COUNT = 0x3,
     };
 
-    enum GameplayState
+    enum GameplayState : unsigned char
     {
         GAMEPLAY_NONE,
         HAS_COIN,
         EMPTY,
+        BROKEN,
     };
 
-    enum AnimState
+    enum AnimState : unsigned char
     {
         ANIM_NONE,
         CYCLE_QUESTION,
         BUMPED,
     };
 
+    SimRect GetRect() const
+    {
+        return MakeSimRect(left, top, right, bottom);
+    }
+
     D2D1_RECT_F GetRectF() const
     {
-        return D2D1::RectF(left, top, right, bottom);
+        return ToRectF(GetRect());
     }
 
     D2D1_RECT_F GetRenderRectF() const
     {
-        return D2D1::RectF(left, top + animYOffset, right, bottom + animYOffset);
+        float animYOffset = GetAnimYOffset();
+        return D2D1::RectF(ToFloat(left), ToFloat(top) + animYOffset, ToFloat(right), ToFloat(bottom) + animYOffset);
+    }
+
+    float GetAnimYOffset() const
+    {
+        if (animState != BUMPED)
+        {
+            return 0.f;
+        }
+
+        if (animTime < GEO_BUMP_TIME / 2.f)
+        {
+            return animTime * (GEO_BUMP_SIZE / (GEO_BUMP_TIME / 2.f));
+        }
+
+        return (GEO_BUMP_TIME - animTime) * (GEO_BUMP_SIZE / (GEO_BUMP_TIME / 2.f));
+    }
+
+    bool IsInteractive() const
+    {
+        return type != BLOCK_NONE;
     }
 
-    void Initialize(float left, float top, float right, float bottom, int textureId, int type)
+    void Initialize(Scalar left, Scalar top, Scalar right, Scalar bottom, int textureId, int type)
     {
         active = true;
+        collides = true;
+        visible = true;
+        changed = false;
+        colliderIndex = -1;
+        blockCount = 1;
         this->left = left;
         this->top = top;
         this->right = right;
         this->bottom = bottom;
-        this->textureId = textureId;
+        this->textureId = static_cast<unsigned char>(textureId);
 
         this->type = type >= BLOCK_TYPE_COUNT
             ? BlockType::BLOCK_NONE
@@ -150,31 +295,49 @@ public:
 
         gameplayState = GAMEPLAY_NONE;
         animState = ANIM_NONE;
-        animYOffset = 0.f;
-        spriteOffset = 0.f;
+        animTime = 0.f;
+        spriteFrame = SpriteFrame::IDLE;
 
         if (type == BLOCK_COIN)
         {
             gameplayState = HAS_COIN;
             animState = CYCLE_QUESTION;
+            spriteFrame = SpriteFrame::CYCLE_1;
         }
     }
 
-    void Bump()
+    // Hit from below. Coin blocks give their coin and breakable blocks break,
+    // to be removed once the tick is over. Returns whether anything happened.
+    bool Bump()
     {
         if (type == BLOCK_COIN && gameplayState == HAS_COIN)
         {
             gameplayState = EMPTY;
             animState = BUMPED;
             animTime = 0.f;
-            spriteOffset = 30.f;
+            spriteFrame = SpriteFrame::SPENT;
+            changed = true;
+            return true;
+        }
+
+        if (type == BLOCK_BREAKABLE && gameplayState != BROKEN)
+        {
+            gameplayState = BROKEN;
+            changed = true;
+            return true;
         }
+
+        return false;
     }
 
     void TickAnim(float delta)
     {
-        const static float bumpTime = 0.2f;
-        const static float bumpSize = -5.f;
+        TickAnim(animState, animTime, spriteFrame, delta);
+    }
+
+    // Block animation on its own, shared with block entities.
+    static void TickAnim(AnimState& animState, float& animTime, SpriteFrame::Type& spriteFrame, float delta)
+    {
         const static float questionCycleRate = 2.5f;
 
         animTime += delta;
@@ -182,469 +345,1823 @@ public:
         switch (animState)
         {
         case BUMPED:
-            if (animTime < bumpTime / 2.f)
-            {
-                animYOffset = animTime * (bumpSize / (bumpTime / 2.f));
-            }
-            else if (animTime < bumpTime)
-            {
-                animYOffset = (bumpTime - animTime) * (bumpSize / (bumpTime / 2.f));
-            }
-            else
+            if (animTime >= GEO_BUMP_TIME)
             {
                 animState = ANIM_NONE;
-                animYOffset = 0.f;
             }
             break;
         case CYCLE_QUESTION:
-            switch (static_cast<int>(animTime * questionCycleRate) % 3)
-            {
-            case 1:
-                spriteOffset = 10.f;
-                break;
-            case 2:
-                spriteOffset = 20.f;
-                break;
-            case 0:
-                spriteOffset = 0.f;
-            default:
-                break;
-            }
+            spriteFrame = static_cast<SpriteFrame::Type>(
+                SpriteFrame::CYCLE_1 + static_cast<int>(animTime * questionCycleRate) % 3);
         default:
             break;
         }
     }
 
-    bool active;
-    float left;
-    float top;
-    float right;
-    float bottom;
-    int textureId;
+    // Hot: read by collision, culling and the spatial index every tick.
+    Scalar left;
+    Scalar top;
+    Scalar right;
+    Scalar bottom;
+
+    // Merged geo: a block that is part of a merged collider has collides
+    // cleared and points at the collider, which in turn is not visible.
+    short colliderIndex;
+    bool active : 1;
+    bool collides : 1;
+    bool visible : 1;
+    bool changed : 1;
     BlockType type;
     GameplayState gameplayState;
+
+    // Cold: only read when drawing or animating.
     AnimState animState;
+    unsigned char textureId;
+    SpriteFrame::Type spriteFrame;
+
+    // number of level blocks drawn by this geo
+    short blockCount;
     float animTime;
-    float animYOffset;
-    float spriteOffset;
 };
 
-class Actor
-{
-public:
+static_assert(sizeof(Geo) == 32, "two geo per cache line");
+static_assert(NUM_GEO <= 0x7FFF && NUM_TEXTURES <= 0xFF, "geo indices do not fit");
 
-    void Initialize(float x, float y, float width, float height, float runSpeed)
+// Slot of an enemy in the archetype table, see EnemyArchetype. Levels may set
+// any slot with an ARCHETYPE record; CAT comes with a stock archetype.
+struct Enemy
+{
+    enum Type : unsigned char
     {
-        this->x = x;
-        this->y = y;
-        this->width = width;
-        this->height = height;
-        yVel = 0;
-        falling = false;
-        action = Action::NONE;
-        this->runSpeed = runSpeed;
-        animTime = 0.f;
-        spriteOffset = 0.f;
-        spriteFlip = false;
-    }
+        CAT = 0x1,
+    };
+};
 
-    D2D1_RECT_F GetRectF() const
-    {
-        return D2D1::RectF(x, y, x + width, y + height);
-    }
+// Components of the entity world, see EntityWorld. The player and the
+// enemies are made of the same ones, so both go through the same movement,
+// collision and animation code.
+//
+// Positions, speeds and sizes are in the simulation's number type, see
+// Scalar. The templates take either type so both can be measured side by
+// side.
+template<class T>
+struct TransformT
+{
+    T x;
+    T y;
+};
 
-    D2D1_RECT_F GetFallingRectF() const
-    {
-        return D2D1::RectF(x, y + 0.1f, x + width, y + height + 0.1f);
-    }
+template<class T>
+struct VelocityT
+{
+    T yVel;
+    T runSpeed;
+    Action::Type action;
 
-    bool ResolveGeoCollisions(GameState &gameState, MovementDirection::Type actorMovement);
+    // direction of the last UpdateMovement, for collision
+    MovementDirection::Type movement;
+    bool falling;
+};
 
-    MovementDirection::Type UpdateMovement(float delta);
+template<class T>
+struct ColliderT
+{
+    T width;
+    T height;
+};
 
-    void CheckFalling(const GameState &gameState);
+typedef TransformT<Scalar> Transform;
+typedef VelocityT<Scalar> Velocity;
+typedef ColliderT<Scalar> Collider;
 
-    void TickAnim(float delta, float nominalOffset, float runOffset1, float runOffset2, float fallingOffset)
-    {
-        animTime += delta;
-        while (animTime > 100.f)
-        {
-            animTime -= 100.f;
-        }
-        const static float runAnimRate = 6.f;
+struct Sprite
+{
+    unsigned char textureId;
+    Palette::Type palette;
+    SpriteFrame::Type frame;
+    bool flip;
+};
 
-        if (falling)
-        {
-            spriteOffset = fallingOffset;
-        }
-        else if ((action & Action::MOVE_LEFT) && (action & Action::MOVE_RIGHT))
-        {
-            spriteOffset = nominalOffset;
-        }
-        else if (action & (Action::MOVE_LEFT | Action::MOVE_RIGHT))
-        {
-            if (static_cast<int>(animTime * runAnimRate) % 2)
-            {
-                spriteOffset = runOffset1;
-            }
-            else
-            {
-                spriteOffset = runOffset2;
-            }
-        }
-        else
-        {
-            spriteOffset = nominalOffset;
-        }
+struct Animation
+{
+    float time;
+};
 
-        if (action & (Action::MOVE_LEFT | Action::MOVE_RIGHT))
-        {
-            spriteFlip = static_cast<bool>(action & Action::MOVE_LEFT);
-        }
+struct BlockBehavior
+{
+    Geo::BlockType type;
+    Geo::GameplayState gameplayState;
+    Geo::AnimState animState;
+};
 
-        if (spriteFlip)
-        {
-            spriteOffset = -spriteOffset - 10.f;
-        }
-    }
+struct EnemyBrain
+{
+    Enemy::Type type;
+    bool isDead;
+};
 
-    float x;
-    float y;
-    float width;
-    float height;
-    float yVel;
-    bool falling;
-    Action::Type action;
-    float runSpeed;
-    float animTime;
-    float spriteOffset;
-    bool spriteFlip;
+// What an enemy type is spawned and ticked with. The systems run each type
+// as its own group and read the archetype once per group, never per enemy.
+struct EnemyArchetype
+{
+    // spawn: speed and size
+    Scalar runSpeed;
+    Scalar width;
+    Scalar height;
+
+    // tick: movement, ledges, stomps and sprite frames
+    Scalar gravityScale;
+    bool turnsAtLedges;
+    bool stompable;
+    SpriteFrame::Type idleFrame;
+    SpriteFrame::Type runFrame1;
+    SpriteFrame::Type runFrame2;
+    SpriteFrame::Type fallFrame;
 };
 
-class Player
+// Frames of actors that use the sprite sheet as drawn, like the player.
+struct StockFrames
 {
-public:
-    void Reset();
+    static constexpr SpriteFrame::Type idleFrame = SpriteFrame::IDLE;
+    static constexpr SpriteFrame::Type runFrame1 = SpriteFrame::RUN_1;
+    static constexpr SpriteFrame::Type runFrame2 = SpriteFrame::RUN_2;
+    static constexpr SpriteFrame::Type fallFrame = SpriteFrame::FALL;
+};
 
-    void HandleInput(Input::Type &input);
+// The stock cat as constants. Groups of cats that still have it run through
+// systems specialized on it, with every field folded in at compile time.
+struct CatArchetype : StockFrames
+{
+    static constexpr Scalar runSpeed = static_cast<Scalar>(45.f);
+    static constexpr Scalar width = static_cast<Scalar>(ENEMY_WIDTH);
+    static constexpr Scalar height = static_cast<Scalar>(ENEMY_HEIGHT);
+    static constexpr Scalar gravityScale = static_cast<Scalar>(1.f);
+    static constexpr bool turnsAtLedges = false;
+    static constexpr bool stompable = true;
+};
 
-    bool ResolveCollisions(GameState &gameState, MovementDirection::Type actorMovement);
+constexpr bool IsSpriteFrame(int frame)
+{
+    return frame >= 0 && frame < SpriteFrame::COUNT;
+}
 
-    void TickSimulation(GameState &gameState, float delta);
+// Types levels may use without setting an archetype first.
+constexpr bool IsStockEnemyType(int type)
+{
+    return type == Enemy::CAT;
+}
 
-    void TickAnim(float delta)
+// Zero, and so unable to spawn, for types with no stock archetype.
+inline EnemyArchetype StockEnemyArchetype(int type)
+{
+    EnemyArchetype archetype = {};
+    if (type == Enemy::CAT)
     {
-        actor.TickAnim(delta, 0.f, 10.f, 20.f, 30.f);
+        archetype.runSpeed = CatArchetype::runSpeed;
+        archetype.width = CatArchetype::width;
+        archetype.height = CatArchetype::height;
+        archetype.gravityScale = CatArchetype::gravityScale;
+        archetype.turnsAtLedges = CatArchetype::turnsAtLedges;
+        archetype.stompable = CatArchetype::stompable;
+        archetype.idleFrame = CatArchetype::idleFrame;
+        archetype.runFrame1 = CatArchetype::runFrame1;
+        archetype.runFrame2 = CatArchetype::runFrame2;
+        archetype.fallFrame = CatArchetype::fallFrame;
     }
 
-    bool isDead;
-    Actor actor;
-};
+    return archetype;
+}
 
-struct LevelEntity
+// Archetype of a validated ARCHETYPE record.
+inline EnemyArchetype MakeEnemyArchetype(const LevelArchetype& level)
 {
-    enum Type
-    {
-        END = 0x0,
-        GEO = 0x1,
-        ENEMY = 0x2,
-        TEXTURE = 0x3,
-    };
-};
+    EnemyArchetype archetype = {};
+    archetype.runSpeed = static_cast<Scalar>(level.runSpeed);
+    archetype.width = static_cast<Scalar>(level.width);
+    archetype.height = static_cast<Scalar>(level.height);
+    archetype.gravityScale = static_cast<Scalar>(level.gravityPercent) / static_cast<Scalar>(100);
+    archetype.turnsAtLedges = (level.flags & ENEMY_TURNS_AT_LEDGES) != 0;
+    archetype.stompable = (level.flags & ENEMY_STOMPABLE) != 0;
+    archetype.idleFrame = static_cast<SpriteFrame::Type>(level.idleFrame);
+    archetype.runFrame1 = static_cast<SpriteFrame::Type>(level.runFrame1);
+    archetype.runFrame2 = static_cast<SpriteFrame::Type>(level.runFrame2);
+    archetype.fallFrame = static_cast<SpriteFrame::Type>(level.fallFrame);
+    return archetype;
+}
 
-struct LevelCursor
+inline bool SameEnemyArchetype(const EnemyArchetype& a, const EnemyArchetype& b)
 {
-    short* next;
-};
+    return a.runSpeed == b.runSpeed
+        && a.width == b.width
+        && a.height == b.height
+        && a.gravityScale == b.gravityScale
+        && a.turnsAtLedges == b.turnsAtLedges
+        && a.stompable == b.stompable
+        && a.idleFrame == b.idleFrame
+        && a.runFrame1 == b.runFrame1
+        && a.runFrame2 == b.runFrame2
+        && a.fallFrame == b.fallFrame;
+}
 
-class Enemy
+inline SimRect GetRect(const Transform& transform, const Collider& collider)
 {
-public:
-    enum Type
-    {
-        CAT = 0x1,
-    };
+    return MakeSimRect(transform.x, transform.y, transform.x + collider.width, transform.y + collider.height);
+}
 
-    void Initialize(float x, float y, Type type, int textureId)
+// For drawing and particles, which only need to be close. Nothing the game
+// decides on goes through it.
+inline D2D1_RECT_F GetRectF(const Transform& transform, const Collider& collider)
+{
+    return ToRectF(GetRect(transform, collider));
+}
+
+// Run and fall for delta, returns the direction moved.
+template<class T>
+MovementDirection::Type UpdateMovement(TransformT<T>& transform, VelocityT<T>& velocity, T delta)
+{
+    // update movement
+    int movementDirection = MovementDirection::NONE;
+    Action::Type action = velocity.action;
+    if (action & Action::MOVE_LEFT)
     {
-        active = true;
-        isDead = false;
-        this->type = type;
-        actor.Initialize(x, y, ENEMY_WIDTH, ENEMY_HEIGHT, 45);
-        actor.action = Action::MOVE_LEFT;
-        this->textureId = textureId;
+        if (!(action & Action::MOVE_RIGHT))
+        {
+            transform.x -= (velocity.runSpeed * delta);
+            movementDirection = movementDirection | MovementDirection::LEFT;
+        }
+    }
+    else if (action & Action::MOVE_RIGHT)
+    {
+        transform.x += (velocity.runSpeed * delta);
+        movementDirection = movementDirection | MovementDirection::RIGHT;
     }
 
-    void ResolveCollisions(GameState& gameState, MovementDirection::Type actorMovement);
-    void TickSimulation(GameState& gameState, float delta);
+    if (velocity.falling)
+    {
+        T actualGravity = static_cast<T>(GRAVITY);
+        if (action & Action::JUMP)
+        {
+            actualGravity /= static_cast<T>(2.5f);
+        }
+
+        velocity.yVel += (actualGravity * delta);
+    }
 
-    void TickAnim(float delta)
+    if (velocity.yVel != 0)
     {
-        actor.TickAnim(delta, 0.f, 0.f, 10.f, 0.f);
+        movementDirection = movementDirection | (velocity.yVel > 0 ? MovementDirection::DOWN : MovementDirection::UP);
     }
 
-    bool active;
-    bool isDead;
-    Type type;
-    Actor actor;
-    int textureId;
-};
+    transform.y += (velocity.yVel * delta);
 
-class GlobalAnimation
+    return (MovementDirection::Type)movementDirection;
+}
+
+// The block of a merged collider that actorRect hit, NULL if none.
+Geo* FindMergedBlock(GameState& gameState, int colliderIndex, const SimRect& actorRect);
+
+// Queries against the solid level, geo and tiles, answered in batches by
+// QueryLevel.
+#define NUM_LEVEL_QUERIES 64
+
+// Geo and tiles a group of neighbouring queries is tested against at once.
+#define NUM_LEVEL_QUERY_CANDIDATES 256
+
+// How far under its feet an actor standing on something looks for it.
+#define FALL_PROBE_DISTANCE static_cast<Scalar>(0.1f)
+
+struct LevelQuery
 {
-public:
-    enum Type
+    enum Type : unsigned char
     {
-        NONE,
-        DEATH,
+        // anything solid overlapping rect
+        OVERLAP,
+
+        // the first solid thing on the segment from to to
+        RAYCAST,
+
+        // anything solid overlapping rect moved down by distance; under an
+        // actor for standing, a step ahead of it for ledges
+        GROUND_PROBE,
     };
 
-    bool active;
     Type type;
-    float elapsed;
+    SimRect rect;
+    SimPoint from;
+    SimPoint to;
+    Scalar distance;
+};
 
-    void Activate(Type type);
+struct LevelQueryResult
+{
+    bool hit;
 
-    void Tick(GameState& gameState, float delta);
+    // geo hit, -1 for a tile or when nothing was hit
+    short geo;
 
-private:
-    void TickDeath(GameState& gameState, float delta);
+    // RAYCAST: fraction of the segment before the hit. GROUND_PROBE: gap from
+    // the bottom of rect to the highest ground hit.
+    Scalar distance;
 };
 
-struct GameState
+inline LevelQuery OverlapQuery(const SimRect& rect)
 {
-    bool needsReset;
-    int levelId;
-    LevelCursor level;
-    Input::Type input;
-    Player player;
-    Geo geo[NUM_GEO];
-    Enemy enemies[NUM_ENEMIES];
-    GlobalAnimation anim;
-    float cameraScroll;
-    float frameRate;
-    float simTime;
-};
+    LevelQuery query = {};
+    query.type = LevelQuery::OVERLAP;
+    query.rect = rect;
+    return query;
+}
 
-class Platformer
+inline LevelQuery RaycastQuery(SimPoint from, SimPoint to)
 {
-public:
-    Platformer();
-    ~Platformer();
+    LevelQuery query = {};
+    query.type = LevelQuery::RAYCAST;
+    query.from = from;
+    query.to = to;
+    return query;
+}
 
-    // Register the windows class and call methods for instantiating drawing resources.
-    HRESULT Initialize();
+inline LevelQuery GroundProbeQuery(const SimRect& rect, Scalar distance)
+{
+    LevelQuery query = {};
+    query.type = LevelQuery::GROUND_PROBE;
+    query.rect = rect;
+    query.distance = distance;
+    return query;
+}
 
-    // Process and dispatch messages;
-    void RunMessageLoop();
+// Answer count queries into results, in the same order. Queries run sorted by
+// x, and those starting in the same spatial index cell share one lookup, so
+// issuing a tick's queries together beats asking one at a time.
+void QueryLevel(GameState& gameState, const LevelQuery* queries, LevelQueryResult* results, int count);
 
-    bool ProcessInput(UINT message, WPARAM wParam, LPARAM lParam);
+// Start falling when nothing is underneath.
+void CheckFalling(GameState& gameState, const Transform& transform, Velocity& velocity, const Collider& collider);
 
-private:
-    // Initialize device-independent resources.
-    HRESULT CreateDeviceIndependentResources();
+// Frames are the idleFrame, runFrame1, runFrame2 and fallFrame of an
+// archetype or of StockFrames.
+template<class Frames>
+inline void TickActorAnim(Sprite& sprite, Animation& animation, const Velocity& velocity, float delta, const Frames& frames)
+{
+    animation.time += delta;
+    while (animation.time > 100.f)
+    {
+        animation.time -= 100.f;
+    }
+    const static float runAnimRate = 6.f;
+
+    // selects rather than branches, enemy groups run this for every enemy
+    bool left = (velocity.action & Action::MOVE_LEFT) != 0;
+    bool right = (velocity.action & Action::MOVE_RIGHT) != 0;
+    SpriteFrame::Type runFrame = static_cast<int>(animation.time * runAnimRate) % 2 ? frames.runFrame1 : frames.runFrame2;
+    SpriteFrame::Type groundFrame = left != right ? runFrame : frames.idleFrame;
+    sprite.frame = velocity.falling ? frames.fallFrame : groundFrame;
+    sprite.flip = left || right ? left : sprite.flip;
+}
 
-    // Initialize device-dependent resources.
-    HRESULT CreateDeviceResources();
+inline void TickActorAnim(Sprite& sprite, Animation& animation, const Velocity& velocity, float delta)
+{
+    TickActorAnim(sprite, animation, velocity, delta, StockFrames());
+}
 
-    // Release device-dependent resources.
-    void DiscardDeviceResources();
+// The player's Transform, Velocity, Collider, Sprite and Animation live in
+// the world at PLAYER_ENTITY, see EntityWorld. What is left here is the
+// player's own state and the code that drives those components.
+class Player
+{
+public:
+    // Back at the start, standing still.
+    void Reset(GameState& gameState);
 
-    void ResetGame();
+    // Apply gameState.input to the player's actions and consume it.
+    void HandleInput(GameState& gameState);
 
-    bool LoadLevelGeo(short*& next)
-    {
-        float peekLeft = static_cast<float>(*(next + 1));
-        if (peekLeft > m_gameState.cameraScroll + SCREEN_WIDTH)
-        {
-            return true;
-        }
+    // Before collisions: move and pick the sprite frame.
+    void BeginTick(GameState& gameState, Scalar step, float delta);
 
-        next++; // type
-        float left = static_cast<float>(*next++);
-        float top = static_cast<float>(*next++);
-        float right = left + static_cast<float>(*next++);
-        float bottom = top + static_cast<float>(*next++);
-        int textureId = static_cast<int>(*next++);
-        int type = static_cast<int>(*next++);
-        AllocateGeo(left, top, right, bottom, textureId, type);
+    // After collisions: start falling, jump, and die out of the level.
+    void EndTick(GameState& gameState);
 
-        return false;
+    // Jump off an enemy the player landed on.
+    static void Bounce(Velocity& velocity)
+    {
+        velocity.yVel = jumpPower;
+        velocity.falling = true;
     }
 
-    bool LoadLevelEnemy(short*& next)
-    {
-        float peekLeft = static_cast<float>(*(next + 1));
-        if (peekLeft > m_gameState.cameraScroll + SCREEN_WIDTH)
-        {
-            return true;
-        }
+    bool isDead;
+};
 
-        next++; // type
-        float left = static_cast<float>(*next++);
-        float top = static_cast<float>(*next++);
-        float type = static_cast<float>(*next++);
-        int textureId = static_cast<int>(*next++);
-        AllocateEnemy(left, top, (Enemy::Type)type, textureId);
+// Dense component pools over Capacity entities. Enemies are entities with a
+// Transform, Velocity, Collider, Sprite, Animation and EnemyBrain; the player
+// has the same but for the brain; blocks have a Transform, Collider, Sprite,
+// Animation and BlockBehavior. Systems below each walk the pool that defines
+// what they update.
+//
+// Group sorts every pool by enemy type and then by entity, the player after
+// the enemies and blocks last. Afterwards each archetype owns one dense
+// range, an actor sits at the same dense index in every pool, and block i of
+// the blocks pool at BlockBase() + i in the others, so systems read all of an
+// entity's components in order without going through the sparse arrays.
+template<int Capacity>
+class EntityWorld
+{
+public:
+    static_assert((NUM_ENEMY_ARCHETYPES + 2) * static_cast<long long>(Capacity) <= 0x7FFFFFFF, "group keys do not fit");
 
-        return false;
+    EntityWorld()
+    {
+        ResetArchetypes();
+        Clear();
     }
 
-    bool LoadResourceImage(int resourceId, ID2D1Bitmap** pBitmap)
+    void Clear()
     {
-        HRSRC hRes = FindResource(
-            HINST_THISCOMPONENT,
-            MAKEINTRESOURCE(resourceId),
-            L"Image");
-        if (hRes == NULL)
+        grouped = false;
+        playerEntity = -1;
+        ids.Clear();
+        transforms.Clear();
+        velocities.Clear();
+        colliders.Clear();
+        sprites.Clear();
+        animations.Clear();
+        blocks.Clear();
+        brains.Clear();
+    }
+
+    // Stock archetypes only, as before a level sets any.
+    void ResetArchetypes()
+    {
+        for (int type = 0; type < NUM_ENEMY_ARCHETYPES; type++)
         {
-            return false;
+            archetypes[type] = StockEnemyArchetype(type);
+            stockArchetypes[type] = IsStockEnemyType(type);
         }
+    }
 
-        HGLOBAL hResLoad = LoadResource(HINST_THISCOMPONENT, hRes);
-        if (hResLoad == NULL)
+    void DefineArchetype(int type, const EnemyArchetype& archetype)
+    {
+        if (type < 0 || type >= NUM_ENEMY_ARCHETYPES)
         {
-            return false;
+            return;
         }
 
-        void* pImageData = LockResource(hResLoad);
-        if (pImageData == NULL)
+        archetypes[type] = archetype;
+        stockArchetypes[type] = IsStockEnemyType(type) && SameEnemyArchetype(archetype, StockEnemyArchetype(type));
+    }
+
+    // -1 when the world is full or type has no archetype.
+    int CreateEnemy(Scalar x, Scalar y, Enemy::Type type, int textureId, Palette::Type palette)
+    {
+        if (type >= NUM_ENEMY_ARCHETYPES || archetypes[type].width <= 0)
         {
-            return false;
+            return -1;
         }
 
-        DWORD imageDataSize = SizeofResource(HINST_THISCOMPONENT, hRes);
-        if (imageDataSize == 0)
+        EntityId id = ids.Create();
+        if (id == INVALID_ENTITY)
         {
-            return false;
+            return -1;
         }
 
-        IWICStream* pStream = NULL;
-        HRESULT hr = m_pIWICFactory->CreateStream(&pStream);
+        int entity = EntityIndex(id);
+        Transform& transform = transforms.Add(entity);
+        transform.x = x;
+        transform.y = y;
 
-        if (SUCCEEDED(hr))
-        {
-            hr = pStream->InitializeFromMemory(reinterpret_cast<BYTE*>(pImageData), imageDataSize);
-        }
-        
-        IWICBitmapDecoder* pDecoder = NULL;
-        if (SUCCEEDED(hr))
+        const EnemyArchetype& archetype = archetypes[type];
+        Velocity& velocity = velocities.Add(entity);
+        velocity.runSpeed = archetype.runSpeed;
+        velocity.action = Action::MOVE_LEFT;
+
+        Collider& collider = colliders.Add(entity);
+        collider.width = archetype.width;
+        collider.height = archetype.height;
+
+        Sprite& sprite = sprites.Add(entity);
+        sprite.textureId = static_cast<unsigned char>(textureId);
+        sprite.palette = palette;
+        sprite.frame = archetype.idleFrame;
+
+        animations.Add(entity);
+
+        EnemyBrain& brain = brains.Add(entity);
+        brain.type = type;
+        grouped = false;
+        return entity;
+    }
+
+    // The player, at index entity. -1 when the index is taken or there is a
+    // player already.
+    int CreatePlayer(int entity, Scalar x, Scalar y, Scalar width, Scalar height, Scalar runSpeed, int textureId)
+    {
+        if (playerEntity >= 0 || ids.CreateAt(entity) == INVALID_ENTITY)
+        {
+            return -1;
+        }
+
+        Transform& transform = transforms.Add(entity);
+        transform.x = x;
+        transform.y = y;
+
+        Velocity& velocity = velocities.Add(entity);
+        velocity.runSpeed = runSpeed;
+
+        Collider& collider = colliders.Add(entity);
+        collider.width = width;
+        collider.height = height;
+
+        Sprite& sprite = sprites.Add(entity);
+        sprite.textureId = static_cast<unsigned char>(textureId);
+
+        animations.Add(entity);
+        playerEntity = entity;
+        grouped = false;
+        return entity;
+    }
+
+    // -1 when the world is full.
+    int CreateBlock(Scalar left, Scalar top, Scalar right, Scalar bottom, int textureId, int type)
+    {
+        EntityId id = ids.Create();
+        if (id == INVALID_ENTITY)
+        {
+            return -1;
+        }
+
+        int entity = EntityIndex(id);
+        Transform& transform = transforms.Add(entity);
+        transform.x = left;
+        transform.y = top;
+
+        Collider& collider = colliders.Add(entity);
+        collider.width = right - left;
+        collider.height = bottom - top;
+
+        Sprite& sprite = sprites.Add(entity);
+        sprite.textureId = static_cast<unsigned char>(textureId);
+
+        animations.Add(entity);
+
+        BlockBehavior& block = blocks.Add(entity);
+        block.type = type >= Geo::BLOCK_TYPE_COUNT ? Geo::BLOCK_NONE : static_cast<Geo::BlockType>(type);
+        if (block.type == Geo::BLOCK_COIN)
+        {
+            block.gameplayState = Geo::HAS_COIN;
+            block.animState = Geo::CYCLE_QUESTION;
+            sprite.frame = SpriteFrame::CYCLE_1;
+        }
+
+        grouped = false;
+        return entity;
+    }
+
+    void Destroy(int entity)
+    {
+        if (!ids.IsAliveIndex(entity))
+        {
+            return;
+        }
+
+        grouped = false;
+        playerEntity = entity == playerEntity ? -1 : playerEntity;
+        transforms.Remove(entity);
+        velocities.Remove(entity);
+        colliders.Remove(entity);
+        sprites.Remove(entity);
+        animations.Remove(entity);
+        blocks.Remove(entity);
+        brains.Remove(entity);
+        ids.Destroy(entity);
+    }
+
+    // Sort the pools by group, if any entity came or went since the last
+    // time. Nearly sorted pools cost about a pass each.
+    void Group()
+    {
+        if (grouped)
+        {
+            return;
+        }
+
+        transforms.SortBy([this](const Transform&, int entity) { return GroupKey(entity); });
+        velocities.SortBy([this](const Velocity&, int entity) { return GroupKey(entity); });
+        colliders.SortBy([this](const Collider&, int entity) { return GroupKey(entity); });
+        sprites.SortBy([this](const Sprite&, int entity) { return GroupKey(entity); });
+        animations.SortBy([this](const Animation&, int entity) { return GroupKey(entity); });
+        blocks.SortBy([](const BlockBehavior&, int entity) { return entity; });
+
+        // last, the others look types up in it
+        brains.SortBy([](const EnemyBrain& brain, int entity) { return brain.type * Capacity + entity; });
+
+        int dense = 0;
+        for (int type = 0; type <= NUM_ENEMY_ARCHETYPES; type++)
+        {
+            while (dense < brains.Count() && brains.At(dense).type < type)
+            {
+                dense++;
+            }
+
+            enemyGroups[type] = dense;
+        }
+
+        grouped = true;
+    }
+
+    // Order of an entity in every pool once grouped: enemies by type, then
+    // the player, then blocks.
+    int GroupKey(int entity) const
+    {
+        const EnemyBrain* pBrain = brains.Get(entity);
+        int group = pBrain ? pBrain->type : NUM_ENEMY_ARCHETYPES + (blocks.Has(entity) ? 1 : 0);
+        return group * Capacity + entity;
+    }
+
+    // Dense index of the first block in the pools blocks share with actors,
+    // once grouped: every actor has a Velocity and comes first.
+    int BlockBase() const
+    {
+        return velocities.Count();
+    }
+
+    EntityPool<Capacity> ids;
+    ComponentPool<Transform, Capacity> transforms;
+    ComponentPool<Velocity, Capacity> velocities;
+    ComponentPool<Collider, Capacity> colliders;
+    ComponentPool<Sprite, Capacity> sprites;
+    ComponentPool<Animation, Capacity> animations;
+    ComponentPool<BlockBehavior, Capacity> blocks;
+    ComponentPool<EnemyBrain, Capacity> brains;
+
+    // The level's archetypes by Enemy::Type, and which of them are still the
+    // stock ones the systems have compile-time versions of.
+    EnemyArchetype archetypes[NUM_ENEMY_ARCHETYPES];
+    bool stockArchetypes[NUM_ENEMY_ARCHETYPES];
+
+    // Dense range [enemyGroups[type], enemyGroups[type + 1]) of each type in
+    // every pool but blocks, once grouped. The player follows the last one.
+    int enemyGroups[NUM_ENEMY_ARCHETYPES + 1];
+    bool grouped;
+
+    // -1 while there is no player.
+    int playerEntity;
+};
+
+class GlobalAnimation
+{
+public:
+    enum Type
+    {
+        NONE,
+        DEATH,
+    };
+
+    bool active;
+    Type type;
+    float elapsed;
+
+    void Activate(Type type);
+
+    void Tick(GameState& gameState, float delta);
+
+private:
+    void TickDeath(GameState& gameState, float delta);
+};
+
+// Overlap of rect1, moving in movement, with rect2. The adjustments move
+// rect1 back out along the axis that needs the smaller push.
+template<class Rect, class T>
+bool Intersect(
+    const Rect& rect1,
+    const Rect& rect2,
+    const MovementDirection::Type& movement,
+    T& verticalAdjustment,
+    T& horizontalAdjustment)
+{
+    if (rect1.right <= rect2.left
+        || rect1.left >= rect2.right
+        || rect1.bottom <= rect2.top
+        || rect1.top >= rect2.bottom)
+    {
+        return false;
+    }
+
+    bool hasVertical = false;
+    bool hasHorizontal = false;
+
+    if (movement & MovementDirection::DOWN)
+    {
+        verticalAdjustment = rect2.top - rect1.bottom;
+        hasVertical = true;
+    }
+    else if (movement & MovementDirection::UP)
+    {
+        verticalAdjustment = rect2.bottom - rect1.top;
+        hasVertical = true;
+    }
+
+    if (movement & MovementDirection::LEFT)
+    {
+        horizontalAdjustment = rect2.right - rect1.left;
+        hasHorizontal = true;
+    }
+    else if (movement & MovementDirection::RIGHT)
+    {
+        horizontalAdjustment = rect2.left - rect1.right;
+        hasHorizontal = true;
+    }
+
+    if (hasVertical && hasHorizontal)
+    {
+        if (Abs(horizontalAdjustment) > Abs(verticalAdjustment))
+        {
+            horizontalAdjustment = 0;
+        }
+        else
+        {
+            verticalAdjustment = 0;
+        }
+    }
+
+    return true;
+}
+
+// Geo and entities share the spatial index, entities are offset past the
+// geo.
+inline int GeoHandle(int index)
+{
+    return index;
+}
+
+inline int EntityHandle(int entity)
+{
+    return NUM_GEO + entity;
+}
+
+// The broadphase over moving actors knows them by entity.
+inline int ActorHandle(int entity)
+{
+    return entity;
+}
+
+struct TextureMemoryStats
+{
+    // pixels kept on the CPU as cooked, and what they would take at 32bpp
+    int storedBytes;
+    int expandedBytes;
+
+    // device bitmaps, always 32bpp and one per texture slot and palette
+    // drawn, so indexing saves nothing here and every palette costs a
+    // bitmap of its own
+    int deviceBytes;
+    int deviceBitmaps;
+};
+
+struct RenderStats
+{
+    int visibleGeo;
+    int totalGeo;
+    int visibleEnemies;
+    int totalEnemies;
+};
+
+// Device losses, real and forced, and how long the pass that brought every
+// device resource back took.
+struct DeviceStats
+{
+    int losses;
+    int forcedLosses;
+    float lastRecoveryTime;
+    float worstRecoveryTime;
+};
+
+// Bytes per entity and the cache lines a sim tick reads to visit the live
+// ones.
+struct StateLayoutStats
+{
+    int geoBytes;
+    int actorBytes;
+    int enemyBytes;
+    int liveGeo;
+    int liveEnemies;
+    int geoLines;
+    int enemyLines;
+    int playerLines;
+};
+
+struct GameState
+{
+    // Hot: the geo and entity pools the sim walks every tick, each starting
+    // on its own cache line.
+    alignas(CACHE_LINE_SIZE) Geo geo[NUM_GEO];
+    alignas(CACHE_LINE_SIZE) EntityWorld<NUM_ACTORS> world;
+    alignas(CACHE_LINE_SIZE) Player player;
+    Input::Type input;
+    bool needsReset;
+    Scalar cameraScroll;
+    float frameRate;
+    float simTime;
+
+    // Cold: touched on level load, by queries, or rarely.
+    alignas(CACHE_LINE_SIZE) int levelId;
+    GlobalAnimation anim;
+    LevelCursor level;
+    SpatialIndex spatial;
+    SweepAndPrune<NUM_ACTORS> actors;
+    Tilemap tilemap;
+
+    // cosmetic, drained into the particle system after every tick
+    ParticleBurstQueue bursts;
+};
+
+// Distinct cache lines spanned by the live entries of an entity array.
+template<class T, class IsLive>
+int CountCacheLines(const T* entities, int count, IsLive isLive)
+{
+    int lines = 0;
+    uintptr_t lastLine = ~static_cast<uintptr_t>(0);
+    for (int index = 0; index < count; index++)
+    {
+        if (!isLive(entities[index]))
+        {
+            continue;
+        }
+
+        uintptr_t first = reinterpret_cast<uintptr_t>(&entities[index]) / CACHE_LINE_SIZE;
+        uintptr_t last = (reinterpret_cast<uintptr_t>(&entities[index] + 1) - 1) / CACHE_LINE_SIZE;
+        lines += static_cast<int>(last - first) + (first != lastLine ? 1 : 0);
+        lastLine = last;
+    }
+
+    return lines;
+}
+
+// Cache lines spanned by the dense components of a pool.
+template<class T, int Capacity>
+int CountPoolLines(const ComponentPool<T, Capacity>& pool)
+{
+    return CountCacheLines(pool.Data(), pool.Count(), [](const T&) { return true; });
+}
+
+inline StateLayoutStats GetStateLayoutStats(const GameState& gameState)
+{
+    StateLayoutStats stats = {};
+    stats.geoBytes = sizeof(Geo);
+    stats.actorBytes = sizeof(Transform) + sizeof(Velocity) + sizeof(Collider)
+        + sizeof(Sprite) + sizeof(Animation);
+    stats.enemyBytes = sizeof(Transform) + sizeof(Velocity) + sizeof(Collider)
+        + sizeof(Sprite) + sizeof(Animation) + sizeof(EnemyBrain);
+
+    for (const Geo& geo : gameState.geo)
+    {
+        stats.liveGeo += geo.active ? 1 : 0;
+    }
+
+    const EntityWorld<NUM_ACTORS>& world = gameState.world;
+    stats.liveEnemies = world.brains.Count();
+
+    stats.geoLines = CountCacheLines(gameState.geo, NUM_GEO, [](const Geo& geo) { return geo.active; });
+    stats.enemyLines = CountPoolLines(world.transforms)
+        + CountPoolLines(world.velocities)
+        + CountPoolLines(world.colliders)
+        + CountPoolLines(world.sprites)
+        + CountPoolLines(world.animations)
+        + CountPoolLines(world.brains);
+    stats.playerLines = CountCacheLines(&gameState.player, 1, [](const Player&) { return true; });
+    return stats;
+}
+
+// Systems over an EntityWorld. MovementSystem runs before the collision
+// pipeline, TickEntitySystems runs the rest after it. Each groups the world
+// first and then walks dense ranges, reading every pool at the same index.
+
+// Call kernel(first, end, archetype) for the dense range of every enemy type
+// in the world, grouping it first. Stock cats get CatArchetype, every other group its entry of
+// the table, so kernels are compiled once for each.
+template<int Capacity, class GroupKernel>
+void ForEachEnemyGroup(EntityWorld<Capacity>& world, GroupKernel kernel)
+{
+    world.Group();
+    for (int type = 0; type < NUM_ENEMY_ARCHETYPES; type++)
+    {
+        int first = world.enemyGroups[type];
+        int end = world.enemyGroups[type + 1];
+        if (first == end)
+        {
+            continue;
+        }
+
+        if (type == Enemy::CAT && world.stockArchetypes[type])
+        {
+            kernel(first, end, CatArchetype());
+        }
+        else
+        {
+            kernel(first, end, world.archetypes[type]);
+        }
+    }
+}
+
+// UpdateMovement for one group of enemies, without its branches: enemies
+// never jump, and running and falling are folded into arithmetic.
+template<class Archetype, int Capacity>
+void MoveEnemies(EntityWorld<Capacity>& world, int first, int end, const Archetype& archetype, Scalar delta)
+{
+    Scalar fallSpeed = gravity * archetype.gravityScale * delta;
+    for (int dense = first; dense < end; dense++)
+    {
+        Velocity& velocity = world.velocities.At(dense);
+        Transform& transform = world.transforms.At(dense);
+        int left = (velocity.action & Action::MOVE_LEFT) ? 1 : 0;
+        int right = (velocity.action & Action::MOVE_RIGHT) ? 1 : 0;
+        transform.x += static_cast<Scalar>(right - left) * (velocity.runSpeed * delta);
+        velocity.yVel += fallSpeed * static_cast<Scalar>(static_cast<int>(velocity.falling));
+        transform.y += velocity.yVel * delta;
+        velocity.movement = static_cast<MovementDirection::Type>(
+            (left & ~right) * MovementDirection::LEFT
+            | (right & ~left) * MovementDirection::RIGHT
+            | (velocity.yVel < 0) * MovementDirection::UP
+            | (velocity.yVel > 0) * MovementDirection::DOWN);
+    }
+}
+
+template<int Capacity>
+void MovementSystem(EntityWorld<Capacity>& world, Scalar delta)
+{
+    ForEachEnemyGroup(world, [&](int first, int end, const auto& archetype)
+    {
+        MoveEnemies(world, first, end, archetype, delta);
+    });
+}
+
+template<int Capacity>
+void ActorAnimationSystem(EntityWorld<Capacity>& world, float delta)
+{
+    ForEachEnemyGroup(world, [&](int first, int end, const auto& archetype)
+    {
+        // a copy the sprite writes cannot alias, so the frames stay in
+        // registers and the selects stay selects
+        auto frames = archetype;
+        for (int dense = first; dense < end; dense++)
+        {
+            TickActorAnim(world.sprites.At(dense), world.animations.At(dense), world.velocities.At(dense), delta, frames);
+        }
+    });
+}
+
+template<int Capacity>
+void BlockAnimationSystem(EntityWorld<Capacity>& world, float delta)
+{
+    world.Group();
+    int base = world.BlockBase();
+    for (int dense = 0; dense < world.blocks.Count(); dense++)
+    {
+        Geo::TickAnim(world.blocks.At(dense).animState, world.animations.At(base + dense).time, world.sprites.At(base + dense).frame, delta);
+    }
+}
+
+// Level queries for the dense range [first, end), NUM_LEVEL_QUERIES at a
+// time. probe(dense, query) fills in the query of an entity and returns
+// false to skip it, hit(dense, result) gets the answer.
+template<class Probe, class Hit>
+void QueryEach(GameState& gameState, int first, int end, Probe probe, Hit hit)
+{
+    LevelQuery queries[NUM_LEVEL_QUERIES];
+    LevelQueryResult results[NUM_LEVEL_QUERIES];
+    int denses[NUM_LEVEL_QUERIES];
+    int count = 0;
+    for (int dense = first; dense <= end; dense++)
+    {
+        if (count == NUM_LEVEL_QUERIES || (dense == end && count > 0))
+        {
+            QueryLevel(gameState, queries, results, count);
+            for (int index = 0; index < count; index++)
+            {
+                hit(denses[index], results[index]);
+            }
+
+            count = 0;
+        }
+
+        if (dense < end && probe(dense, queries[count]))
+        {
+            denses[count++] = dense;
+        }
+    }
+}
+
+// Ground probes for every standing enemy, the player checks its own after
+// the jump, see Player::EndTick.
+template<int Capacity>
+void FallingSystem(EntityWorld<Capacity>& world, GameState& gameState)
+{
+    world.Group();
+    QueryEach(gameState, 0, world.brains.Count(),
+        [&](int dense, LevelQuery& query)
+        {
+            if (world.velocities.At(dense).falling)
+            {
+                return false;
+            }
+
+            query = GroundProbeQuery(GetRect(world.transforms.At(dense), world.colliders.At(dense)), FALL_PROBE_DISTANCE);
+            return true;
+        },
+        [&](int dense, const LevelQueryResult& result)
+        {
+            if (!result.hit)
+            {
+                world.velocities.At(dense).falling = true;
+            }
+        });
+}
+
+// Standing enemies whose archetype turns at ledges probe a one unit column
+// past their leading edge and turn around when there is no ground under it.
+template<int Capacity>
+void LedgeSystem(EntityWorld<Capacity>& world, GameState& gameState)
+{
+    ForEachEnemyGroup(world, [&](int first, int end, const auto& archetype)
+    {
+        if (!archetype.turnsAtLedges)
+        {
+            return;
+        }
+
+        QueryEach(gameState, first, end,
+            [&](int dense, LevelQuery& query)
+            {
+                const Velocity& velocity = world.velocities.At(dense);
+                int moving = velocity.action & (Action::MOVE_LEFT | Action::MOVE_RIGHT);
+                if (velocity.falling || (moving != Action::MOVE_LEFT && moving != Action::MOVE_RIGHT))
+                {
+                    return false;
+                }
+
+                SimRect rect = GetRect(world.transforms.At(dense), world.colliders.At(dense));
+                Scalar edge = moving == Action::MOVE_LEFT ? rect.left - 1 : rect.right;
+                query = GroundProbeQuery(MakeSimRect(edge, rect.top, edge + 1, rect.bottom), FALL_PROBE_DISTANCE);
+                return true;
+            },
+            [&](int dense, const LevelQueryResult& result)
+            {
+                if (!result.hit)
+                {
+                    Velocity& velocity = world.velocities.At(dense);
+                    velocity.action = static_cast<Action::Type>(velocity.action ^ (Action::MOVE_LEFT | Action::MOVE_RIGHT));
+                }
+            });
+    });
+}
+
+// Enemies that fell out of the level die.
+template<int Capacity>
+void EnemyBrainSystem(EntityWorld<Capacity>& world)
+{
+    world.Group();
+    for (int dense = 0; dense < world.brains.Count(); dense++)
+    {
+        if (world.transforms.At(dense).y > SCREEN_HEIGHT)
+        {
+            world.brains.At(dense).isDead = true;
+        }
+    }
+}
+
+template<int Capacity>
+void TickEntitySystems(EntityWorld<Capacity>& world, GameState& gameState, float delta)
+{
+    ActorAnimationSystem(world, delta);
+    BlockAnimationSystem(world, delta);
+    FallingSystem(world, gameState);
+    LedgeSystem(world, gameState);
+    EnemyBrainSystem(world);
+}
+
+// Contacts gathered per batch of bodies, see CollisionPipeline. A body never
+// overlaps more than NUM_GEO geo and a handful of tiles, so a batch always
+// holds a few bodies.
+#define NUM_COLLISION_BODIES 16
+#define NUM_CONTACTS 128
+
+struct ContactShape
+{
+    enum Type : unsigned char
+    {
+        GEO,
+        TILE,
+        ACTOR,
+    };
+};
+
+// A body the pipeline moves. Pointers stay valid for a Run, nothing is
+// allocated or freed while collisions are resolved.
+struct CollisionBody
+{
+    Transform* transform;
+    Velocity* velocity;
+    const Collider* collider;
+
+    // walks back and forth and turns around at walls, like enemies
+    bool turnsAtWalls;
+};
+
+// Overlap of a body with a shape, as found before anything is pushed. The
+// normal points out of the shape, penetration is how far along it the body
+// has to go to get out.
+struct Contact
+{
+    SimRect rect;
+    Scalar penetration;
+    short body;
+
+    // geo index, tile column and row, or the entities of an actor pair with
+    // -1 for the player
+    short shapeX;
+    short shapeY;
+    ContactShape::Type shape;
+
+    // directions the shape may push the body back along, internal tile faces
+    // removed
+    MovementDirection::Type movement;
+    signed char normalX;
+    signed char normalY;
+};
+
+struct CollisionEvent
+{
+    enum Type : unsigned char
+    {
+        // a geo or tile hit from below
+        BUMP_GEO,
+        BUMP_TILE,
+
+        // a body pushed back sideways
+        HIT_WALL,
+
+        // the player landed on an enemy, or an enemy got the player
+        STOMP,
+        KILL_PLAYER,
+
+        // two enemies ran into each other
+        TURN_AWAY,
+    };
+
+    Type type;
+    short body;
+    short shapeX;
+    short shapeY;
+
+    // body bounds once pushed out, picks the block of a merged collider
+    SimRect bodyRect;
+};
+
+// Collision in three phases. Gather records every overlap of a body with the
+// level in a flat contact buffer and only reads the state, so bodies could be
+// gathered in parallel. Resolve sorts the contacts and pushes bodies out in
+// that order, so results do not depend on where geo sits in its pool. Dispatch
+// then applies the gameplay events: bumps, walls, stomps and kills.
+//
+// Actors are paired by a sweep-and-prune broadphase once everything was
+// pushed out of the level, so each pair is tested once. Actor contacts never
+// move anyone, they only turn into events.
+class CollisionPipeline
+{
+public:
+    CollisionPipeline() :
+        bodies(),
+        contacts(),
+        events(),
+        bodyCount(0),
+        contactCount(0),
+        eventCount(0),
+        overflows(0)
+    {
+    }
+
+    // The player and every enemy of world against the level, then against
+    // each other. actors holds them from tick to tick, under ActorHandle.
+    template<int Capacity, int ActorCapacity>
+    void Run(GameState& gameState, EntityWorld<Capacity>& world, SweepAndPrune<ActorCapacity>& actors)
+    {
+        CollideWithLevel(gameState, world);
+        CollideActors(gameState, world, actors);
+    }
+
+    // The two halves of Run.
+    template<int Capacity>
+    void CollideWithLevel(GameState& gameState, EntityWorld<Capacity>& world);
+
+    template<int Capacity, int ActorCapacity>
+    void CollideActors(GameState& gameState, EntityWorld<Capacity>& world, SweepAndPrune<ActorCapacity>& actors);
+
+    void Clear()
+    {
+        bodyCount = 0;
+        contactCount = 0;
+        eventCount = 0;
+    }
+
+    // Phase 1: contacts of body with the geo and tiles it overlaps. False,
+    // with nothing recorded, when the buffers are too full for it; resolve
+    // and dispatch what is there first.
+    bool Gather(const GameState& gameState, const CollisionBody& body);
+
+    // Phase 2: push bodies out of the level, deepest contact first, and
+    // record bumps and walls.
+    void Resolve();
+
+    // Phase 3 for what Resolve recorded.
+    void DispatchLevelEvents(GameState& gameState);
+
+    CollisionBody bodies[NUM_COLLISION_BODIES];
+    Contact contacts[NUM_CONTACTS];
+    CollisionEvent events[NUM_CONTACTS];
+    int bodyCount;
+    int contactCount;
+    int eventCount;
+
+    // bodies dropped because they had more contacts than a batch holds
+    int overflows;
+
+private:
+    void Flush(GameState& gameState)
+    {
+        Resolve();
+        DispatchLevelEvents(gameState);
+        Clear();
+    }
+
+    void AddBody(GameState& gameState, const CollisionBody& body)
+    {
+        if (!Gather(gameState, body))
+        {
+            Flush(gameState);
+            if (!Gather(gameState, body))
+            {
+                overflows++;
+            }
+        }
+    }
+
+    template<int Capacity>
+    void DispatchActorEvents(GameState& gameState, EntityWorld<Capacity>& world);
+
+    // Walk towards direction, unless standing still.
+    static void TurnAway(Velocity& velocity, Action::Type direction)
+    {
+        int moving = velocity.action & (Action::MOVE_LEFT | Action::MOVE_RIGHT);
+        if (moving == Action::MOVE_LEFT || moving == Action::MOVE_RIGHT)
+        {
+            velocity.action = static_cast<Action::Type>((velocity.action & ~moving) | direction);
+        }
+    }
+
+    bool AddContact(int body, ContactShape::Type shape, int shapeX, int shapeY, const SimRect& rect, int movement, Scalar verticalAdjustment, Scalar horizontalAdjustment);
+    void AddEvent(CollisionEvent::Type type, int body, int shapeX, int shapeY, const SimRect& bodyRect);
+};
+
+template<int Capacity>
+void CollisionPipeline::CollideWithLevel(GameState& gameState, EntityWorld<Capacity>& world)
+{
+    Clear();
+    world.Group();
+
+    // the player first, its bumps go before anything an enemy does
+    int player = world.brains.Count();
+    if (world.playerEntity >= 0)
+    {
+        CollisionBody playerBody = { &world.transforms.At(player), &world.velocities.At(player), &world.colliders.At(player), false };
+        AddBody(gameState, playerBody);
+    }
+
+    for (int dense = 0; dense < world.brains.Count(); dense++)
+    {
+        CollisionBody body = { &world.transforms.At(dense), &world.velocities.At(dense), &world.colliders.At(dense), true };
+        AddBody(gameState, body);
+    }
+
+    Flush(gameState);
+}
+
+template<int Capacity, int ActorCapacity>
+void CollisionPipeline::CollideActors(GameState& gameState, EntityWorld<Capacity>& world, SweepAndPrune<ActorCapacity>& actors)
+{
+    static_assert(ActorCapacity >= Capacity, "broadphase too small for the world");
+
+    Clear();
+    world.Group();
+
+    // pair actors where they ended up
+    for (int dense = 0; dense < world.velocities.Count(); dense++)
+    {
+        actors.Update(ActorHandle(world.velocities.EntityAt(dense)), GetRect(world.transforms.At(dense), world.colliders.At(dense)));
+    }
+
+    int player = world.playerEntity;
+    SimRect playerRect = {};
+    MovementDirection::Type playerMovement = MovementDirection::NONE;
+    if (player >= 0)
+    {
+        playerRect = GetRect(*world.transforms.Get(player), *world.colliders.Get(player));
+        playerMovement = world.velocities.Get(player)->movement;
+    }
+
+    actors.Sort();
+    actors.ForEachPair([&](int handleA, int handleB)
+    {
+        if (contactCount == NUM_CONTACTS)
         {
-            hr = m_pIWICFactory->CreateDecoderFromStream(pStream, NULL, WICDecodeMetadataCacheOnDemand, &pDecoder);
+            DispatchActorEvents(gameState, world);
         }
 
-        IWICBitmapFrameDecode* pSource = NULL;
-        if (SUCCEEDED(hr))
+        int entityA = handleA;
+        int entityB = handleB;
+        if (entityA == player || entityB == player)
         {
-            hr = pDecoder->GetFrame(0, &pSource);
-            if (SUCCEEDED(hr))
+            int enemy = entityA == player ? entityB : entityA;
+            if (!world.brains.Has(enemy))
             {
-                UINT blah;
-                pSource->GetSize(&blah, &blah);
+                return;
             }
-        }
 
-        IWICFormatConverter* pConverter = NULL;
-        if (SUCCEEDED(hr))
+            Scalar verticalAdjustment = 0;
+            Scalar horizontalAdjustment = 0;
+            SimRect enemyRect = GetRect(*world.transforms.Get(enemy), *world.colliders.Get(enemy));
+            if (Intersect(playerRect, enemyRect, playerMovement, verticalAdjustment, horizontalAdjustment))
+            {
+                AddContact(-1, ContactShape::ACTOR, -1, enemy, enemyRect, playerMovement, verticalAdjustment, horizontalAdjustment);
+            }
+        }
+        else if (world.brains.Has(entityA) && world.brains.Has(entityB))
         {
-            hr = m_pIWICFactory->CreateFormatConverter(&pConverter);
+            // the normal points from b towards a, a is the one on the left
+            // when they are level
+            SimRect rectA = GetRect(*world.transforms.Get(entityA), *world.colliders.Get(entityA));
+            SimRect rectB = GetRect(*world.transforms.Get(entityB), *world.colliders.Get(entityB));
+            Scalar overlap = Min(rectA.right, rectB.right) - Max(rectA.left, rectB.left);
+            bool aOnRight = rectA.left + rectA.right > rectB.left + rectB.right;
+            AddContact(-1, ContactShape::ACTOR, entityA, entityB, rectB, MovementDirection::NONE, 0, aOnRight ? overlap : -overlap);
         }
+    });
+
+    DispatchActorEvents(gameState, world);
+}
 
-        if (SUCCEEDED(hr))
+// Landing on an enemy kills it if its archetype is stompable, any other touch
+// kills the player. Enemies that run into each other both turn away.
+template<int Capacity>
+void CollisionPipeline::DispatchActorEvents(GameState& gameState, EntityWorld<Capacity>& world)
+{
+    for (int index = 0; index < contactCount; index++)
+    {
+        const Contact& contact = contacts[index];
+        if (contact.shapeX >= 0)
+        {
+            // the enemy on the left first
+            bool swap = contact.normalX > 0;
+            AddEvent(CollisionEvent::TURN_AWAY, contact.body, swap ? contact.shapeY : contact.shapeX, swap ? contact.shapeX : contact.shapeY, contact.rect);
+        }
+        else
         {
-            hr = pConverter->Initialize(
-                pSource,
-                GUID_WICPixelFormat32bppPBGRA,
-                WICBitmapDitherTypeNone,
-                NULL,
-                0.f,
-                WICBitmapPaletteTypeMedianCut);
+            bool stompable = world.archetypes[world.brains.Get(contact.shapeY)->type].stompable;
+            AddEvent(contact.normalY < 0 && stompable ? CollisionEvent::STOMP : CollisionEvent::KILL_PLAYER,
+                contact.body, contact.shapeX, contact.shapeY, GetRect(*world.transforms.Get(world.playerEntity), *world.colliders.Get(world.playerEntity)));
         }
+    }
 
-        if (SUCCEEDED(hr))
+    for (int index = 0; index < eventCount; index++)
+    {
+        const CollisionEvent& event = events[index];
+        if (event.type == CollisionEvent::STOMP)
+        {
+            world.brains.Get(event.shapeY)->isDead = true;
+            Player::Bounce(*world.velocities.Get(world.playerEntity));
+            gameState.bursts.Push(ParticleKind::DUST, GetRectF(*world.transforms.Get(event.shapeY), *world.colliders.Get(event.shapeY)));
+        }
+        else if (event.type == CollisionEvent::KILL_PLAYER)
         {
-            hr = m_pRenderTarget->CreateBitmapFromWicBitmap(pConverter, NULL, pBitmap);
+            gameState.player.isDead = true;
         }
+        else if (event.type == CollisionEvent::TURN_AWAY)
+        {
+            TurnAway(*world.velocities.Get(event.shapeX), Action::MOVE_LEFT);
+            TurnAway(*world.velocities.Get(event.shapeY), Action::MOVE_RIGHT);
+        }
+    }
+
+    Clear();
+}
+
+class Platformer
+{
+    // Drive the sim without a window, see Benchmark/.
+    friend class SimBenchmark;
+    friend class ScenarioRunner;
+    friend class SimServer;
+    friend class SaveStateBenchmark;
+
+public:
+    Platformer();
+    ~Platformer();
 
-        SafeRelease(&pStream);
-        SafeRelease(&pDecoder);
-        SafeRelease(&pSource);
-        SafeRelease(&pConverter);
+    // Register the windows class and call methods for instantiating drawing resources.
+    HRESULT Initialize();
+
+    // Draw with the software rasterizer instead of the GPU. Call before
+    // Initialize.
+    void SetSoftwareRendering(bool software)
+    {
+        m_softwareRendering = software;
+    }
+
+    // Start on levelId instead of FIRST_LEVEL_ID. Call before Initialize.
+    void SetStartLevel(int levelId)
+    {
+        m_startLevelId = levelId;
+    }
+
+    // Lose the device every frames frames, 0 for never, to test recovering
+    // from it. F8 loses it once.
+    void SetDeviceLossInterval(int frames)
+    {
+        m_deviceLossInterval = frames;
+    }
+
+    // Draw what a sim server on this machine streams instead of playing,
+    // see SimStream.h. Call before Initialize.
+    bool ConnectViewer(unsigned short port);
+
+    // Process and dispatch messages;
+    void RunMessageLoop();
+
+    bool ProcessInput(UINT message, WPARAM wParam, LPARAM lParam);
+
+    // Key events wait here until a sim step takes them, one a step, so none
+    // is overwritten on a frame that runs no step and a press and release
+    // between two steps are both seen. Full only if steps stop entirely,
+    // then the newest are dropped.
+    void QueueInput(Input::Type input)
+    {
+        if (m_inputCount < INPUT_QUEUE_SIZE)
+        {
+            m_inputQueue[(m_inputHead + m_inputCount) % INPUT_QUEUE_SIZE] = input;
+            m_inputCount++;
+        }
+    }
 
-        return SUCCEEDED(hr);
+    // Hand the next queued event to the step about to run, unless it still
+    // has one of its own.
+    void TakeQueuedInput()
+    {
+        if (m_inputCount > 0 && m_gameState.input == Input::NONE)
+        {
+            m_gameState.input = m_inputQueue[m_inputHead];
+            m_inputHead = (m_inputHead + 1) % INPUT_QUEUE_SIZE;
+            m_inputCount--;
+        }
     }
 
-    void LoadLevelTexture(short*& next)
+    // Write the game, see SaveState.h, as a delta against pKeyframe when
+    // given. pLevelStream is the stream a stream level plays from, its LEVEL
+    // resource when NULL.
+    bool SaveState(BitWriter& out, const GameState* pKeyframe = NULL, unsigned int keyframeId = 0, short* pLevelStream = NULL);
+
+    // Carry on from a state SaveState wrote, with the same keyframe and
+    // level stream. Rebinds the level textures and restarts streaming from
+    // the loaded cursor. False when the state does not load, at any point,
+    // and then the running game is left exactly as it was; there is nothing
+    // to reload.
+    bool LoadState(BitReader& in, const GameState* pKeyframe = NULL, unsigned int keyframeId = 0, short* pLevelStream = NULL);
+
+    // The game to QUICKSAVE_PATH and back.
+    bool QuickSave();
+    bool QuickLoad();
+
+private:
+    // Initialize device-independent resources.
+    HRESULT CreateDeviceIndependentResources();
+
+    // Initialize device-dependent resources, all of them in one pass after
+    // the device was lost.
+    HRESULT CreateDeviceResources();
+
+    // Release device-dependent resources when the device is lost.
+    void DiscardDeviceResources();
+
+    void ResetGame();
+
+    // Spawn the entity described by a level record.
+    void SpawnLevelRecord(const LevelRecord& record)
     {
-        next++; // type
-        int levelTextureId = static_cast<int>(*next++);
-        int resourceTextureId = static_cast<int>(*next++);
+        switch (record.type)
+        {
+        case LevelEntity::GEO:
+            {
+                int index = AllocateGeo(
+                    static_cast<Scalar>(record.left),
+                    static_cast<Scalar>(record.top),
+                    static_cast<Scalar>(record.right),
+                    static_cast<Scalar>(record.bottom),
+                    record.textureId,
+                    record.kind);
+                if (index >= 0)
+                {
+                    MergeGeo(index);
+                }
+            }
+            break;
+        case LevelEntity::ENEMY:
+            AllocateEnemy(
+                static_cast<Scalar>(record.left),
+                static_cast<Scalar>(record.top),
+                (Enemy::Type)(record.kind & ((1 << ENEMY_PALETTE_SHIFT) - 1)),
+                record.textureId,
+                (Palette::Type)(record.kind >> ENEMY_PALETTE_SHIFT));
+            break;
+        case LevelEntity::TEXTURE:
+            LoadLevelTexture(record.textureId, record.kind);
+            break;
+        case LevelEntity::ARCHETYPE:
+            m_gameState.world.DefineArchetype(record.kind, MakeEnemyArchetype(record.archetype));
+            break;
+        case LevelEntity::TILES:
+            m_gameState.tilemap.Fill(record.left, record.top, record.right, record.bottom, record.textureId, record.kind);
+            break;
+        default:
+            break;
+        }
+    }
 
+    // Bind a texture resource to a level slot. Only the decode is queued here,
+    // the device bitmap is created by GetTextureBrush when the slot is drawn.
+    void LoadLevelTexture(int levelTextureId, int resourceTextureId)
+    {
         if (levelTextureId < 0 || levelTextureId >= NUM_TEXTURES)
         {
             return;
         }
 
-        SafeRelease(&m_pTextureBitmaps[levelTextureId]);
-        LoadResourceImage(resourceTextureId, &m_pTextureBitmaps[levelTextureId]);
+        m_textures.Bind(levelTextureId, resourceTextureId);
+        ReadSpriteSheet(resourceTextureId, &m_spriteSheets[levelTextureId]);
+        m_assetLoader.Queue(resourceTextureId);
+
+        // whatever used the slot looks different now
+        m_damage.Invalidate();
+    }
+
+    // Bind a texture decoded by the level streamer, the loader takes the
+    // pixels.
+    void UploadLevelTexture(int levelTextureId, int resourceTextureId, DecodedImage& image)
+    {
+        m_assetLoader.Store(resourceTextureId, image);
+        LoadLevelTexture(levelTextureId, resourceTextureId);
+    }
+
+    TextureMemoryStats GetTextureMemoryStats();
+
+    // Write the memory used by every loaded texture to the debugger output.
+    void ReportTextureMemory();
+
+    // Write the entity layout and the cache lines a tick touches to the
+    // debugger output.
+    void ReportStateLayout();
+
+    // Offset of a sprite frame within its texture in level units, as used by
+    // the brush transforms. Mirrored sprites start from the right edge of
+    // their frame.
+    float GetSpriteOffset(int levelTextureId, int frame, bool flip) const
+    {
+        const SpriteSheet& sheet = m_spriteSheets[levelTextureId];
+        float offset = sheet.GetFrameLeft(frame) / TEXELS_PER_UNIT;
+
+        return flip ? -offset - sheet.frameWidth / TEXELS_PER_UNIT : offset;
+    }
+
+    // Brush for a level texture slot drawn with a palette, NULL when nothing
+    // usable is bound. Every palette of a slot gets its own bitmap.
+    ID2D1BitmapBrush* GetTextureBrush(int levelTextureId, Palette::Type palette = Palette::BASE)
+    {
+        return m_textures.GetBrush(m_pRenderTarget, m_assetLoader, levelTextureId, palette);
+    }
+
+    // Records up to here are loaded. Records sit on whole units, so comparing
+    // them with the floor of the scroll is exact and no float rounding decides
+    // what spawns on which tick.
+    int GetLoadRight() const
+    {
+        return FloorDiv(m_gameState.cameraScroll, 1) + SCREEN_WIDTH;
     }
 
+    // Synchronous loading, used when the streamer is not running.
     void LoadLevelEntities()
     {
         short* &next = m_gameState.level.next;
-        bool done = false;
-        while (!done)
+        int loadRight = GetLoadRight();
+        while (PeekLevelRecordLeft(next) <= loadRight)
+        {
+            LevelRecord record;
+            ReadLevelRecord(next, record);
+            SpawnLevelRecord(record);
+        }
+    }
+
+    void CommitStreamedEntities();
+
+    // Embedded levels are already validated and sorted, loading is a walk
+    // over their records.
+    void LoadEmbeddedEntities()
+    {
+        const EmbeddedLevel& level = *m_gameState.level.embedded;
+        int& nextRecord = m_gameState.level.nextRecord;
+        int loadRight = GetLoadRight();
+        while (nextRecord < level.recordCount && level.records[nextRecord].left <= loadRight)
+        {
+            SpawnLevelRecord(level.records[nextRecord++]);
+        }
+    }
+
+    void LoadEmbeddedLevel(const EmbeddedLevel* pLevel)
+    {
+        m_levelStreamer.Stop();
+
+        m_gameState.level.next = NULL;
+        m_gameState.level.embedded = pLevel;
+        m_gameState.level.nextRecord = pLevel->FirstRecordAt(0.f);
+
+        for (int index = 0; index < pLevel->textureCount; index++)
+        {
+            const LevelRecord& texture = pLevel->textures[index];
+            LoadLevelTexture(texture.textureId, texture.kind);
+        }
+
+        for (int index = 0; index < pLevel->archetypeCount; index++)
+        {
+            SpawnLevelRecord(pLevel->archetypes[index]);
+        }
+
+        LoadEmbeddedEntities();
+    }
+
+    // Whether a loaded cursor is on a record of the stream it was saved
+    // against; the save only holds its offset.
+    static bool IsLoadedLevelCursor(const LevelCursor& level, const short* pLevelStream)
+    {
+        if (level.embedded || level.next == NULL)
+        {
+            return true;
+        }
+
+        const short* next = pLevelStream;
+        while (next < level.next && *next != LevelEntity::END && LevelRecordSize(*next) > 0)
+        {
+            next += LevelRecordSize(*next);
+        }
+
+        return next == level.next;
+    }
+
+    // Bind the textures of a loaded state's level: all of an embedded
+    // level's, or the ones of a stream up to the cursor, which must be on a
+    // record, see IsLoadedLevelCursor.
+    void BindLoadedLevelTextures(const short* pLevelStream)
+    {
+        const LevelCursor& level = m_gameState.level;
+        if (level.embedded)
+        {
+            for (int index = 0; index < level.embedded->textureCount; index++)
+            {
+                const LevelRecord& texture = level.embedded->textures[index];
+                BindLoadedLevelTexture(texture.textureId, texture.kind);
+            }
+
+            return;
+        }
+
+        const short* next = pLevelStream;
+        while (next != NULL && next < level.next)
         {
-            int peek = *next;
-            
-            switch (peek)
+            if (*next == LevelEntity::TEXTURE)
             {
-            case LevelEntity::GEO:
-                done = LoadLevelGeo(next);
-                break;
-            case LevelEntity::ENEMY:
-                done = LoadLevelEnemy(next);
-                break;
-            case LevelEntity::TEXTURE:
-                LoadLevelTexture(next);
-                break;
-            case LevelEntity::END:
-            default:
-                done = true;
-                break;
+                LevelRecord record;
+                ReadLevelRecord(next, record);
+                BindLoadedLevelTexture(record.textureId, record.kind);
+                continue;
             }
+
+            next += LevelRecordSize(*next);
         }
     }
 
-    bool LoadLevel()
+    // Slots already bound to the resource keep their bitmaps.
+    void BindLoadedLevelTexture(int levelTextureId, int resourceTextureId)
+    {
+        if (m_textures.GetResource(levelTextureId) != resourceTextureId)
+        {
+            LoadLevelTexture(levelTextureId, resourceTextureId);
+        }
+    }
+
+    // Record stream of a LEVEL resource, NULL when the level does not exist.
+    static short* FindLevelResource(int levelId)
     {
         HRSRC hRes = FindResource(
             HINST_THISCOMPONENT,
-            MAKEINTRESOURCE(TO_LEVEL_RES(m_gameState.levelId)),
+            MAKEINTRESOURCE(TO_LEVEL_RES(levelId)),
             LEVEL_RES_NAME);
         if (hRes == NULL)
         {
-            return false;
+            return NULL;
         }
 
         HGLOBAL hResLoad = LoadResource(HINST_THISCOMPONENT, hRes);
         if (hResLoad == NULL)
         {
-            return false;
+            return NULL;
+        }
+
+        return static_cast<short*>(LockResource(hResLoad));
+    }
+
+    // Start decoding every texture a level uses, ahead of loading it.
+    void QueueLevelTextures(int levelId)
+    {
+#if USE_EMBEDDED_LEVELS
+        const EmbeddedLevel* pEmbedded = FindEmbeddedLevel(levelId);
+        if (pEmbedded)
+        {
+            for (int index = 0; index < pEmbedded->textureCount; index++)
+            {
+                m_assetLoader.Queue(pEmbedded->textures[index].kind);
+            }
+
+            return;
+        }
+#endif
+
+        const short* next = FindLevelResource(levelId);
+        if (next == NULL)
+        {
+            return;
+        }
+
+        while (*next != LevelEntity::END && LevelRecordSize(*next) > 0)
+        {
+            if (*next == LevelEntity::TEXTURE)
+            {
+                LevelRecord record;
+                ReadLevelRecord(next, record);
+                m_assetLoader.Queue(record.kind);
+                continue;
+            }
+
+            next += LevelRecordSize(*next);
+        }
+    }
+
+    bool LoadLevel()
+    {
+        m_gameState.level.embedded = NULL;
+
+        // archetypes come with the level
+        m_gameState.world.ResetArchetypes();
+
+#if USE_EMBEDDED_LEVELS
+        const EmbeddedLevel* pEmbedded = FindEmbeddedLevel(m_gameState.levelId);
+        if (pEmbedded)
+        {
+            LoadEmbeddedLevel(pEmbedded);
+            return true;
         }
+#endif
 
-        LPVOID hResLock = LockResource(hResLoad);
-        if (hResLock == NULL)
+        m_gameState.level.next = FindLevelResource(m_gameState.levelId);
+        if (m_gameState.level.next == NULL)
         {
             return false;
         }
 
-        m_gameState.level.next = static_cast<short*>(hResLock);
-        LoadLevelEntities();
+        StartLevelStream();
         return true;
     }
 
-    int AllocateGeo(float left, float top, float right, float bottom, int textureId, int type)
+    // Load a stream level from the cursor on, through the streamer when its
+    // worker starts and synchronously when it does not.
+    void StartLevelStream()
+    {
+        if (m_levelStreamer.Start(m_gameState.level.next, ToFloat(m_gameState.cameraScroll), SCREEN_WIDTH))
+        {
+            // the first screen is needed right away, waiting for it is not a stall
+            CommitStreamedEntities();
+            m_levelStreamer.stats = StreamStats();
+        }
+        else
+        {
+            LoadLevelEntities();
+        }
+    }
+
+    int AllocateGeo(Scalar left, Scalar top, Scalar right, Scalar bottom, int textureId, int type)
     {
         for (int index = 0; index < NUM_GEO; index++)
         {
@@ -655,6 +2172,7 @@ private:
             }
 
             geo.Initialize(left, top, right, bottom, textureId, type);
+            m_gameState.spatial.Insert(GeoHandle(index), ToSpatialRect(geo.GetRect()));
 
             return index;
         }
@@ -665,66 +2183,202 @@ private:
     void DeallocateGeo(int index)
     {
         m_gameState.geo[index].active = false;
+        m_gameState.spatial.Remove(GeoHandle(index));
     }
 
-    void DeallocateAllGeo()
+    // Greedy load-time merge of a newly loaded geo into a collider that shares
+    // a full edge with it. Non-interactive blocks with the same texture as a
+    // plain neighbour are folded into it entirely; anything else only shares
+    // the collision rect and keeps its own render and behavior data.
+    void MergeGeo(int index)
     {
-        for (int index = 0; index < NUM_GEO; index++)
+        Geo& block = m_gameState.geo[index];
+        for (int otherIndex = 0; otherIndex < NUM_GEO; otherIndex++)
         {
-            DeallocateGeo(index);
+            Geo& other = m_gameState.geo[otherIndex];
+            if (otherIndex == index || !other.active || !other.collides)
+            {
+                continue;
+            }
+
+            bool horizontal = other.top == block.top
+                && other.bottom == block.bottom
+                && (other.right == block.left || other.left == block.right);
+            bool vertical = other.left == block.left
+                && other.right == block.right
+                && (other.bottom == block.top || other.top == block.bottom);
+            if (!horizontal && !vertical)
+            {
+                continue;
+            }
+
+            if (other.visible
+                && !other.IsInteractive()
+                && !block.IsInteractive()
+                && other.textureId == block.textureId)
+            {
+                GrowGeo(other, block);
+                other.blockCount += block.blockCount;
+                m_gameState.spatial.Update(GeoHandle(otherIndex), ToSpatialRect(other.GetRect()));
+                DeallocateGeo(index);
+                return;
+            }
+
+            int colliderIndex = otherIndex;
+            if (other.visible)
+            {
+                colliderIndex = AllocateGeo(other.left, other.top, other.right, other.bottom, 0, Geo::BLOCK_NONE);
+                if (colliderIndex < 0)
+                {
+                    return;
+                }
+
+                Geo& collider = m_gameState.geo[colliderIndex];
+                collider.visible = false;
+                collider.blockCount = 0;
+                other.collides = false;
+                other.colliderIndex = static_cast<short>(colliderIndex);
+            }
+
+            GrowGeo(m_gameState.geo[colliderIndex], block);
+            m_gameState.spatial.Update(GeoHandle(colliderIndex), ToSpatialRect(m_gameState.geo[colliderIndex].GetRect()));
+            block.collides = false;
+            block.colliderIndex = static_cast<short>(colliderIndex);
+            return;
         }
     }
 
-    int AllocateEnemy(float x, float y, Enemy::Type type, int textureId)
+    static void GrowGeo(Geo& geo, const Geo& other)
+    {
+        geo.left = Min(geo.left, other.left);
+        geo.top = Min(geo.top, other.top);
+        geo.right = Max(geo.right, other.right);
+        geo.bottom = Max(geo.bottom, other.bottom);
+    }
+
+    // Split a merged collider back into standalone blocks.
+    void SplitGeoCollider(int colliderIndex)
     {
-        for (int index = 0; index < NUM_ENEMIES; index++)
+        for (Geo& geo : m_gameState.geo)
         {
-            Enemy& enemy = m_gameState.enemies[index];
+            if (geo.active && !geo.collides && geo.colliderIndex == colliderIndex)
+            {
+                geo.collides = true;
+                geo.colliderIndex = -1;
+            }
+        }
+
+        DeallocateGeo(colliderIndex);
+    }
 
-            if (enemy.active)
+    void CountGeo(int& blocks, int& colliders, int& draws) const
+    {
+        blocks = 0;
+        colliders = 0;
+        draws = 0;
+        for (const Geo& geo : m_gameState.geo)
+        {
+            if (!geo.active)
             {
                 continue;
             }
 
-            enemy.Initialize(x, y, type, textureId);
+            blocks += geo.blockCount;
+            colliders += geo.collides ? 1 : 0;
+            draws += geo.visible ? 1 : 0;
+        }
+    }
+
+    void DeallocateAllGeo()
+    {
+        for (int index = 0; index < NUM_GEO; index++)
+        {
+            DeallocateGeo(index);
+        }
+    }
+
+    int AllocateEnemy(Scalar x, Scalar y, Enemy::Type type, int textureId, Palette::Type palette)
+    {
+        int entity = m_gameState.world.CreateEnemy(x, y, type, textureId, palette);
+        if (entity < 0)
+        {
+            return -1;
+        }
 
-            HRESULT hr = m_pDirect2dFactory->CreateRectangleGeometry(
-                D2D1::RectF(0, 0, enemy.actor.width, enemy.actor.height),
-                &(m_pEnemyRects[index]));
+        const Collider& collider = *m_gameState.world.colliders.Get(entity);
+        m_gameState.spatial.Insert(EntityHandle(entity), ToSpatialRect(GetRect(*m_gameState.world.transforms.Get(entity), collider)));
 
-            if (!SUCCEEDED(hr))
-            {
-                return -1;
-            }
+        HRESULT hr = m_pDirect2dFactory
+            ? m_pDirect2dFactory->CreateRectangleGeometry(
+                D2D1::RectF(0, 0, ToFloat(collider.width), ToFloat(collider.height)),
+                &(m_pEnemyRects[entity]))
+            : E_POINTER;
 
-            return index;
+        // an enemy is the entity and its shape or nothing
+        if (!SUCCEEDED(hr))
+        {
+            DeallocateEnemy(entity);
+            return -1;
         }
 
-        return -1;
+        return entity;
     }
 
-    void DeallocateEnemy(int index)
+    void DeallocateEnemy(int entity)
     {
-        m_gameState.enemies[index].active = false;
-        SafeRelease(&(m_pEnemyRects[index]));
+        m_gameState.world.Destroy(entity);
+        m_gameState.spatial.Remove(EntityHandle(entity));
+        m_gameState.actors.Remove(ActorHandle(entity));
+        SafeRelease(&(m_pEnemyRects[entity]));
     }
 
     void DeallocateAllEnemies()
     {
-        for (int index = 0; index < NUM_ENEMIES; index++)
+        for (int entity = 0; entity < NUM_ENTITIES; entity++)
         {
-            DeallocateEnemy(index);
+            DeallocateEnemy(entity);
         }
     }
 
     float GetTimeDelta();
     bool PumpMessages();
     void TickSimulation(float delta);
+
+    // Apply the pending input and advance the game by delta, without
+    // drawing. Resets are left to the caller.
+    void StepSimulation(float delta);
+
     bool TickGame();
 
     // Draw content.
     HRESULT RenderGame();
 
+    // Report everything on screen to the damage tracker and count what is
+    // visible. pixelsPerUnit is the scale of the target the frame is kept in.
+    void TrackDamage(float pixelsPerUnitX, float pixelsPerUnitY);
+
+    // Draw the part of the level under rect, clipped to it by the caller.
+    void RenderScene(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& rect, const D2D1_MATRIX_3X2_F& textureScale);
+
+    // Grid lines of the screen at scroll under rect.
+    void RenderGrid(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& rect, float scroll);
+
+    // The state of this tick as a streamed snapshot.
+    void CaptureSnapshot(SimSnapshot& snapshot, unsigned int tick);
+
+    // Bind the textures of the latest streamed snapshot that changed.
+    void ApplySnapshotTextures();
+
+    // Draw the latest streamed snapshot, all of the screen.
+    void RenderSnapshot(ID2D1RenderTarget* pTarget, const D2D1_MATRIX_3X2_F& textureScale);
+
+    // Re-composite a chunk into its cache bitmap.
+    HRESULT RenderTileChunk(int chunkX, int cacheIndex, const D2D1_MATRIX_3X2_F& textureScale);
+
+    // Draw the tilemap chunks under rect from their caches, then any live
+    // tiles.
+    void RenderTilemap(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& rect, const D2D1_MATRIX_3X2_F& textureScale);
+
     // Resize the render target;
     void OnResize(UINT width, UINT height);
 
@@ -740,28 +2394,68 @@ private:
     HWND m_hwnd;
     LARGE_INTEGER m_lastFrameTime;
     LARGE_INTEGER m_performanceFrequency;
+    float m_stepAccumulator;
+    Input::Type m_inputQueue[INPUT_QUEUE_SIZE];
+    int m_inputHead;
+    int m_inputCount;
+    int m_startLevelId;
     GameState m_gameState;
+    CollisionPipeline m_collision;
 
-    // WIC
-    IWICImagingFactory* m_pIWICFactory;
-    
     // Base
     ID2D1Factory* m_pDirect2dFactory;
     ID2D1HwndRenderTarget* m_pRenderTarget;
+    bool m_softwareRendering;
+
+    // Device loss, set until CreateDeviceResources has brought everything back
+    DeviceStats m_deviceStats;
+    bool m_deviceLost;
+    bool m_forceDeviceLoss;
+    int m_deviceLossInterval;
+    int m_framesSinceDeviceLoss;
+
+    // Damage, the frame is kept so only its damaged parts are redrawn
+    ID2D1BitmapRenderTarget* m_pFrameTarget;
+    DamageTracker<NUM_DAMAGE_SLOTS> m_damage;
 
     // Text
     IDWriteFactory* m_pWriteFactory;
     IDWriteTextFormat* m_pDebugTextFormat;
 
     // Geometry
-    ID2D1RectangleGeometry* m_pEnemyRects[NUM_ENEMIES];
+    ID2D1RectangleGeometry* m_pEnemyRects[NUM_ENTITIES];
     
     // Brushes
     ID2D1SolidColorBrush* m_pLightSlateGrayBrush;
     ID2D1SolidColorBrush* m_pCornflowerBlueBrush;
     ID2D1SolidColorBrush* m_pInnerSquareBrush;
     
-    // Textures
-    ID2D1Bitmap* m_pTextureBitmaps[NUM_TEXTURES];
-    ID2D1BitmapBrush* m_pTextureBrushes[NUM_TEXTURES];
+    // Textures, device copies of the level texture slots
+    TextureCache<NUM_TEXTURES> m_textures;
+    SpriteSheet m_spriteSheets[NUM_TEXTURES];
+
+    // Assets
+    AssetLoader m_assetLoader;
+    StartupTimeline m_startupTimeline;
+
+    // Frame
+    FrameArena m_frameArena;
+
+    // Tilemap
+    ID2D1BitmapRenderTarget* m_pChunkTargets[NUM_CHUNK_CACHES];
+    int m_chunkCacheX[NUM_CHUNK_CACHES];
+    int m_chunkCacheVersion[NUM_CHUNK_CACHES];
+
+    // Culling
+    RenderStats m_renderStats;
+
+    // Streaming
+    LevelStreamer m_levelStreamer;
+
+    // Particles, drawn through one bitmap the size of the screen
+    ParticleSystem m_particles;
+    ID2D1Bitmap* m_pParticleBitmap;
+
+    // Viewer, only connected when drawing a server's stream
+    SimStreamClient* m_pViewerLink;
 };
\ No newline at end of file
@@ -0,0 +1,193 @@
+#include "Profiler.h"
+
+#if USE_PROFILER
+
+#include <stdio.h>
+#include <new>
+
+// Events kept clear of the exported range, zones that were already open when
+// the capture stopped may still land in these slots while the trace is
+// written.
+#define PROFILE_EXPORT_SLACK 256
+
+std::atomic<bool> Profiler::s_capturing(false);
+std::atomic<int> Profiler::s_threadCount(0);
+std::atomic<ProfileThreadBuffer*> Profiler::s_threads[NUM_PROFILE_THREADS];
+
+int Profiler::s_captureFrames = PROFILE_DEFAULT_FRAMES;
+int Profiler::s_framesLeft = 0;
+int Profiler::s_captureIndex = 0;
+LONGLONG Profiler::s_captureStart = 0;
+unsigned int Profiler::s_captureFirst[NUM_PROFILE_THREADS];
+
+ProfileThreadBuffer* Profiler::GetThreadBuffer()
+{
+    thread_local ProfileThreadBuffer* t_pBuffer = NULL;
+    thread_local bool t_registered = false;
+    if (t_registered)
+    {
+        return t_pBuffer;
+    }
+
+    t_registered = true;
+
+    int index = s_threadCount.fetch_add(1, std::memory_order_relaxed);
+    if (index >= NUM_PROFILE_THREADS)
+    {
+        OutputDebugStringA("Profiler: too many threads, zones of this one are dropped\n");
+        return NULL;
+    }
+
+    t_pBuffer = new (std::nothrow) ProfileThreadBuffer();
+    if (t_pBuffer == NULL)
+    {
+        return NULL;
+    }
+
+    t_pBuffer->name = NULL;
+    t_pBuffer->threadId = GetCurrentThreadId();
+    s_threads[index].store(t_pBuffer, std::memory_order_release);
+    return t_pBuffer;
+}
+
+void Profiler::SetThreadName(const char* name)
+{
+    ProfileThreadBuffer* pBuffer = GetThreadBuffer();
+    if (pBuffer)
+    {
+        pBuffer->name = name;
+    }
+}
+
+void Profiler::SetCaptureFrames(int frameCount)
+{
+    s_captureFrames = frameCount > 0 ? frameCount : PROFILE_DEFAULT_FRAMES;
+}
+
+void Profiler::BeginCapture()
+{
+    if (IsCapturing())
+    {
+        return;
+    }
+
+    // threads that register later start at their first event
+    for (int index = 0; index < NUM_PROFILE_THREADS; index++)
+    {
+        ProfileThreadBuffer* pBuffer = s_threads[index].load(std::memory_order_acquire);
+        s_captureFirst[index] = pBuffer ? pBuffer->written.load(std::memory_order_acquire) : 0;
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    s_captureStart = now.QuadPart;
+    s_framesLeft = s_captureFrames;
+
+    s_capturing.store(true, std::memory_order_release);
+}
+
+void Profiler::EndFrame()
+{
+    if (!IsCapturing() || --s_framesLeft > 0)
+    {
+        return;
+    }
+
+    s_capturing.store(false, std::memory_order_release);
+    WriteTrace();
+}
+
+void Profiler::Record(const char* name, LONGLONG begin, LONGLONG end)
+{
+    ProfileThreadBuffer* pBuffer = GetThreadBuffer();
+    if (pBuffer == NULL)
+    {
+        return;
+    }
+
+    unsigned int written = pBuffer->written.load(std::memory_order_relaxed);
+    ProfileEvent& event = pBuffer->events[written % PROFILE_EVENTS_PER_THREAD];
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    pBuffer->written.store(written + 1, std::memory_order_release);
+}
+
+void Profiler::WriteTrace()
+{
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "trace_%d.json", s_captureIndex++);
+
+    FILE* pFile = NULL;
+    if (fopen_s(&pFile, fileName, "w") != 0 || pFile == NULL)
+    {
+        OutputDebugStringA("Profiler: could not open the trace file\n");
+        return;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    double microsecondsPerTick = 1000000.0 / static_cast<double>(frequency.QuadPart);
+
+    fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(pFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Platformer\"}}");
+
+    int eventCount = 0;
+    unsigned int dropped = 0;
+    int threadCount = s_threadCount.load(std::memory_order_relaxed);
+    for (int index = 0; index < threadCount && index < NUM_PROFILE_THREADS; index++)
+    {
+        ProfileThreadBuffer* pBuffer = s_threads[index].load(std::memory_order_acquire);
+        if (pBuffer == NULL)
+        {
+            continue;
+        }
+
+        fprintf(pFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+            static_cast<unsigned long>(pBuffer->threadId),
+            pBuffer->name ? pBuffer->name : "worker");
+
+        unsigned int written = pBuffer->written.load(std::memory_order_acquire);
+        unsigned int first = s_captureFirst[index];
+        if (written - first > PROFILE_EVENTS_PER_THREAD - PROFILE_EXPORT_SLACK)
+        {
+            dropped += written - first - (PROFILE_EVENTS_PER_THREAD - PROFILE_EXPORT_SLACK);
+            first = written - (PROFILE_EVENTS_PER_THREAD - PROFILE_EXPORT_SLACK);
+        }
+
+        for (unsigned int position = first; position != written; position++)
+        {
+            const ProfileEvent& event = pBuffer->events[position % PROFILE_EVENTS_PER_THREAD];
+            if (event.begin < s_captureStart)
+            {
+                // opened before the capture
+                continue;
+            }
+
+            fprintf(pFile, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name,
+                static_cast<unsigned long>(pBuffer->threadId),
+                static_cast<double>(event.begin - s_captureStart) * microsecondsPerTick,
+                static_cast<double>(event.end - event.begin) * microsecondsPerTick);
+            eventCount++;
+        }
+    }
+
+    fprintf(pFile, "\n]}\n");
+    fclose(pFile);
+
+    char line[128];
+    snprintf(line, sizeof(line), "Profiler: wrote %d events to %s, %u dropped\n", eventCount, fileName, dropped);
+    OutputDebugStringA(line);
+}
+
+void Profiler::Shutdown()
+{
+    s_capturing.store(false, std::memory_order_release);
+    for (int index = 0; index < NUM_PROFILE_THREADS; index++)
+    {
+        delete s_threads[index].exchange(NULL, std::memory_order_acq_rel);
+    }
+}
+
+#endif
@@ -0,0 +1,128 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+
+// Scoped zones recorded by every thread and written out as Chrome trace event
+// JSON, which chrome://tracing and ui.perfetto.dev both open. Zones cost a
+// flag check unless a capture is running, and nothing at all with the
+// profiler compiled out.
+#ifndef USE_PROFILER
+#define USE_PROFILER 1
+#endif
+
+#define NUM_PROFILE_THREADS 16
+#define PROFILE_EVENTS_PER_THREAD 16384
+
+// Frames captured by the F9 hotkey and by -trace without a count.
+#define PROFILE_DEFAULT_FRAMES 120
+
+#if USE_PROFILER
+
+struct ProfileEvent
+{
+    const char* name;
+    LONGLONG begin;
+    LONGLONG end;
+};
+
+// Ring of completed zones of one thread. Only the owning thread writes it;
+// written is published after each event so the exporter reads whole ones.
+struct ProfileThreadBuffer
+{
+    const char* name;
+    DWORD threadId;
+    std::atomic<unsigned int> written;
+    ProfileEvent events[PROFILE_EVENTS_PER_THREAD];
+};
+
+class Profiler
+{
+public:
+    // Name the calling thread in the trace.
+    static void SetThreadName(const char* name);
+
+    // Frames recorded by BeginCapture.
+    static void SetCaptureFrames(int frameCount);
+
+    // Record the next frames and write them to trace_<n>.json in the
+    // working directory. Ignored while a capture is running.
+    static void BeginCapture();
+
+    static bool IsCapturing()
+    {
+        return s_capturing.load(std::memory_order_relaxed);
+    }
+
+    // Count a frame of the main thread, writing the trace once the capture
+    // window is done.
+    static void EndFrame();
+
+    static void Record(const char* name, LONGLONG begin, LONGLONG end);
+
+    // Free the thread buffers, no zone may run afterwards.
+    static void Shutdown();
+
+private:
+    static ProfileThreadBuffer* GetThreadBuffer();
+    static void WriteTrace();
+
+    static std::atomic<bool> s_capturing;
+    static std::atomic<int> s_threadCount;
+    static std::atomic<ProfileThreadBuffer*> s_threads[NUM_PROFILE_THREADS];
+
+    // main thread only
+    static int s_captureFrames;
+    static int s_framesLeft;
+    static int s_captureIndex;
+    static LONGLONG s_captureStart;
+    static unsigned int s_captureFirst[NUM_PROFILE_THREADS];
+};
+
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char* name) :
+        m_name(name),
+        m_begin(0)
+    {
+        if (Profiler::IsCapturing())
+        {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            m_begin = now.QuadPart;
+        }
+    }
+
+    ~ProfileZone()
+    {
+        if (m_begin != 0)
+        {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            Profiler::Record(m_name, m_begin, now.QuadPart);
+        }
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* m_name;
+    LONGLONG m_begin;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// Time the rest of the enclosing scope. name must be a string literal.
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) Profiler::SetThreadName(name)
+#define PROFILE_FRAME() Profiler::EndFrame()
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_THREAD(name)
+#define PROFILE_FRAME()
+
+#endif
@@ -0,0 +1,1209 @@
+#pragma once
+#include <math.h>
+#include <string.h>
+
+#include "Platformer.h"
+#include "BitStream.h"
+
+// Versioned, bit-packed save format of the simulation state, for save files
+// and replay keyframes. A state is written whole, or as a delta against a
+// keyframe the reader already has: every field, entity and tile chunk then
+// starts with one bit telling whether it differs from the keyframe.
+//
+// Sim values are exact, so a loaded state plays out the same as the saved
+// one; whole numbers, which most level geometry is, take a few bits instead
+// of 32. Animation timers only pick sprite frames and bump offsets and are
+// rounded to 1/SAVE_TIMER_STEPS seconds. The level cursor is stored as an
+// offset into the level stream, or a record index into an embedded level.
+//
+// Nothing derived is stored: the spatial index, the broadphase, tile chunk
+// versions and live counts are rebuilt on load. Neither are the frame rate,
+// the sim time or the particle bursts, which are drained every tick.
+
+// "PSAV", first in every state.
+#define SAVE_STATE_MAGIC 0x56415350u
+
+// Bump on any change to the layout below. Other versions are rejected.
+#define SAVE_STATE_VERSION 2
+
+// Steps per second of the stored animation timers.
+#define SAVE_TIMER_STEPS 1024.0
+
+// Variable-length numbers are stored in groups of this many bits, each
+// followed by a bit telling whether another comes.
+#define SAVE_NUMBER_GROUP_BITS 7
+#define SAVE_NUMBER_MAX_GROUPS 5
+
+// Sim values with a whole part up to this are stored as whole numbers.
+#define SAVE_WHOLE_LIMIT 0x100000
+
+struct SaveStateFlags
+{
+    enum Type : unsigned char
+    {
+        NONE        = 0x0,
+        DELTA       = 0x1,
+        FIXED_POINT = 0x2,
+    };
+};
+
+// Capacities the layout depends on, a state only loads into a build that
+// has the same.
+#define SAVE_STATE_LAYOUT (NUM_GEO | (NUM_ENTITIES << 8) | (NUM_TILE_CHUNKS << 16) | (NUM_ENEMY_ARCHETYPES << 24))
+static_assert(NUM_GEO <= 0xFF && NUM_ENTITIES <= 0xFF && NUM_TILE_CHUNKS <= 0xFF && NUM_ENEMY_ARCHETYPES <= 0x7F, "capacities do not fit the layout word");
+
+struct SaveStateHeader
+{
+    unsigned int version;
+    unsigned int flags;
+
+    // the keyframe a delta was written against, 0 for whole states
+    unsigned int keyframeId;
+
+    // level played, so the reader can find its stream before the body
+    int levelId;
+};
+
+// Bits holding every value below count.
+constexpr int SaveBitsFor(unsigned int count)
+{
+    return count <= 1 ? 0 : 1 + SaveBitsFor((count + 1) / 2);
+}
+
+inline uint32_t SaveFloatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline float SaveBitsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline uint32_t SaveScalarBits(Scalar value)
+{
+#if USE_FIXED_POINT_PHYSICS
+    return static_cast<uint32_t>(value.Raw());
+#else
+    return SaveFloatBits(value);
+#endif
+}
+
+inline Scalar SaveBitsScalar(uint32_t bits)
+{
+#if USE_FIXED_POINT_PHYSICS
+    return Fixed::FromRaw(static_cast<int32_t>(bits));
+#else
+    return SaveBitsFloat(bits);
+#endif
+}
+
+// Whole number of a sim value, false when it has a fraction, is too large,
+// or is a negative zero.
+inline bool GetSaveWhole(Scalar value, int& whole)
+{
+#if USE_FIXED_POINT_PHYSICS
+    whole = value.Raw() / FIXED_ONE;
+#else
+    if (!(fabsf(value) < SAVE_WHOLE_LIMIT))
+    {
+        return false;
+    }
+
+    whole = static_cast<int>(value);
+#endif
+    return whole > -SAVE_WHOLE_LIMIT && whole < SAVE_WHOLE_LIMIT
+        && SaveScalarBits(static_cast<Scalar>(whole)) == SaveScalarBits(value);
+}
+
+// Animation timer in steps, clamped to what a stored number holds.
+inline uint32_t QuantizeSaveTimer(float time)
+{
+    if (!(time > 0.f))
+    {
+        return 0;
+    }
+
+    double steps = static_cast<double>(time) * SAVE_TIMER_STEPS + 0.5;
+    return steps >= 4294967295.0 ? 0xFFFFFFFFu : static_cast<uint32_t>(steps);
+}
+
+inline float DequantizeSaveTimer(uint32_t steps)
+{
+    return static_cast<float>(steps / SAVE_TIMER_STEPS);
+}
+
+// The three archives below walk a state with the same TransferState calls.
+// Each takes the value and the keyframe's value for it; with no keyframe
+// the second is ignored. The writer never changes what it is given.
+
+// Tells whether anything transferred differs from the keyframe, so the
+// writer can mark a whole entity unchanged with a single bit.
+class StateDiff
+{
+public:
+    StateDiff() :
+        changed(false)
+    {
+    }
+
+    bool Changed(bool differs)
+    {
+        changed = changed || differs;
+        return differs;
+    }
+
+    template<class T>
+    void Bounded(T& value, T base, uint32_t)
+    {
+        changed = changed || value != base;
+    }
+
+    void Bool(bool& value, bool base)
+    {
+        changed = changed || value != base;
+    }
+
+    void Number(uint32_t& value, uint32_t base)
+    {
+        changed = changed || value != base;
+    }
+
+    void SimValue(Scalar& value, Scalar base)
+    {
+        changed = changed || SaveScalarBits(value) != SaveScalarBits(base);
+    }
+
+    void Float(float& value, float base)
+    {
+        changed = changed || SaveFloatBits(value) != SaveFloatBits(base);
+    }
+
+    void Timer(float& value, float base)
+    {
+        changed = changed || QuantizeSaveTimer(value) != QuantizeSaveTimer(base);
+    }
+
+    template<class T>
+    void Group(T& value, const T& base)
+    {
+        TransferState(*this, value, base);
+    }
+
+    bool changed;
+};
+
+class StateWriter
+{
+public:
+    StateWriter(BitWriter& out, bool delta) :
+        m_out(out),
+        m_delta(delta),
+        m_failed(false)
+    {
+    }
+
+    // In a delta, one bit for whether what follows is there. Returns whether
+    // to write it.
+    bool Changed(bool differs)
+    {
+        if (!m_delta)
+        {
+            return true;
+        }
+
+        m_out.Write(differs ? 1 : 0, 1);
+        return differs;
+    }
+
+    // Value below count.
+    template<class T>
+    void Bounded(T& value, T base, uint32_t count)
+    {
+        if (Changed(value != base))
+        {
+            m_out.Write(static_cast<uint32_t>(value), SaveBitsFor(count));
+        }
+    }
+
+    void Bool(bool& value, bool base)
+    {
+        if (Changed(value != base))
+        {
+            m_out.Write(value ? 1 : 0, 1);
+        }
+    }
+
+    void Number(uint32_t& value, uint32_t base)
+    {
+        if (Changed(value != base))
+        {
+            WriteNumber(value);
+        }
+    }
+
+    // Exact. Whole numbers as a zigzag number, anything else as its bits.
+    void SimValue(Scalar& value, Scalar base)
+    {
+        uint32_t bits = SaveScalarBits(value);
+        if (!Changed(bits != SaveScalarBits(base)))
+        {
+            return;
+        }
+
+        int whole = 0;
+        if (GetSaveWhole(value, whole))
+        {
+            m_out.Write(1, 1);
+            WriteNumber((static_cast<uint32_t>(whole) << 1) ^ static_cast<uint32_t>(whole >> 31));
+        }
+        else
+        {
+            m_out.Write(0, 1);
+            m_out.Write(bits, 32);
+        }
+    }
+
+    void Float(float& value, float base)
+    {
+        uint32_t bits = SaveFloatBits(value);
+        if (Changed(bits != SaveFloatBits(base)))
+        {
+            m_out.Write(bits, 32);
+        }
+    }
+
+    void Timer(float& value, float base)
+    {
+        uint32_t steps = QuantizeSaveTimer(value);
+        if (Changed(steps != QuantizeSaveTimer(base)))
+        {
+            WriteNumber(steps);
+        }
+    }
+
+    // An entity or component: in a delta, one bit when none of it changed.
+    template<class T>
+    void Group(T& value, const T& base)
+    {
+        if (m_delta)
+        {
+            StateDiff diff;
+            TransferState(diff, value, base);
+            m_out.Write(diff.changed ? 1 : 0, 1);
+            if (!diff.changed)
+            {
+                return;
+            }
+        }
+
+        TransferState(*this, value, base);
+    }
+
+    // Unconditional, for layouts written whole.
+    void Write(uint32_t value, int count)
+    {
+        m_out.Write(value, count);
+    }
+
+    void WriteNumber(uint32_t value)
+    {
+        const uint32_t groupMask = (1u << SAVE_NUMBER_GROUP_BITS) - 1;
+        while (value > groupMask)
+        {
+            m_out.Write((value & groupMask) | (1u << SAVE_NUMBER_GROUP_BITS), SAVE_NUMBER_GROUP_BITS + 1);
+            value >>= SAVE_NUMBER_GROUP_BITS;
+        }
+
+        m_out.Write(value, SAVE_NUMBER_GROUP_BITS + 1);
+    }
+
+    bool IsDelta() const
+    {
+        return m_delta;
+    }
+
+    void Fail()
+    {
+        m_failed = true;
+    }
+
+    bool Failed() const
+    {
+        return m_failed || m_out.Failed();
+    }
+
+private:
+    BitWriter& m_out;
+    bool m_delta;
+    bool m_failed;
+};
+
+class StateReader
+{
+public:
+    StateReader(BitReader& in, bool delta) :
+        m_in(in),
+        m_delta(delta),
+        m_failed(false)
+    {
+    }
+
+    // The writer's Changed bit; always true when not reading a delta.
+    bool Changed(bool)
+    {
+        return !m_delta || m_in.Read(1) != 0;
+    }
+
+    // Fails on values not below count.
+    template<class T>
+    void Bounded(T& value, T base, uint32_t count)
+    {
+        if (!Changed(true))
+        {
+            value = base;
+            return;
+        }
+
+        uint32_t read = m_in.Read(SaveBitsFor(count));
+        if (read >= count)
+        {
+            m_failed = true;
+            read = 0;
+        }
+
+        value = static_cast<T>(read);
+    }
+
+    void Bool(bool& value, bool base)
+    {
+        value = Changed(true) ? m_in.Read(1) != 0 : base;
+    }
+
+    void Number(uint32_t& value, uint32_t base)
+    {
+        value = Changed(true) ? ReadNumber() : base;
+    }
+
+    void SimValue(Scalar& value, Scalar base)
+    {
+        if (!Changed(true))
+        {
+            value = base;
+            return;
+        }
+
+        if (m_in.Read(1) != 0)
+        {
+            uint32_t zigzag = ReadNumber();
+            int whole = static_cast<int>(zigzag >> 1) ^ -static_cast<int>(zigzag & 1);
+            if (whole <= -SAVE_WHOLE_LIMIT || whole >= SAVE_WHOLE_LIMIT)
+            {
+                m_failed = true;
+                whole = 0;
+            }
+
+            value = static_cast<Scalar>(whole);
+        }
+        else
+        {
+            value = SaveBitsScalar(m_in.Read(32));
+        }
+    }
+
+    void Float(float& value, float base)
+    {
+        value = Changed(true) ? SaveBitsFloat(m_in.Read(32)) : base;
+    }
+
+    void Timer(float& value, float base)
+    {
+        value = Changed(true) ? DequantizeSaveTimer(ReadNumber()) : base;
+    }
+
+    // An unchanged group is copied from the keyframe whole.
+    template<class T>
+    void Group(T& value, const T& base)
+    {
+        if (m_delta && m_in.Read(1) == 0)
+        {
+            value = base;
+            return;
+        }
+
+        TransferState(*this, value, base);
+    }
+
+    uint32_t Read(int count)
+    {
+        return m_in.Read(count);
+    }
+
+    uint32_t ReadNumber()
+    {
+        uint32_t value = 0;
+        for (int group = 0; group < SAVE_NUMBER_MAX_GROUPS; group++)
+        {
+            uint32_t bits = m_in.Read(SAVE_NUMBER_GROUP_BITS + 1);
+            value |= (bits & ((1u << SAVE_NUMBER_GROUP_BITS) - 1)) << (group * SAVE_NUMBER_GROUP_BITS);
+            if ((bits >> SAVE_NUMBER_GROUP_BITS) == 0)
+            {
+                return value;
+            }
+        }
+
+        m_failed = true;
+        return 0;
+    }
+
+    bool IsDelta() const
+    {
+        return m_delta;
+    }
+
+    void Fail()
+    {
+        m_failed = true;
+    }
+
+    bool Failed() const
+    {
+        return m_failed || m_in.Failed();
+    }
+
+private:
+    BitReader& m_in;
+    bool m_delta;
+    bool m_failed;
+};
+
+// Components and plain state, the same for every archive.
+
+template<class Archive>
+void TransferState(Archive& ar, Transform& transform, const Transform& base)
+{
+    ar.SimValue(transform.x, base.x);
+    ar.SimValue(transform.y, base.y);
+}
+
+template<class Archive>
+void TransferState(Archive& ar, Velocity& velocity, const Velocity& base)
+{
+    ar.SimValue(velocity.yVel, base.yVel);
+    ar.SimValue(velocity.runSpeed, base.runSpeed);
+    ar.Bounded(velocity.action, base.action, Action::JUMP << 1);
+    ar.Bounded(velocity.movement, base.movement, MovementDirection::DOWN << 1);
+    ar.Bool(velocity.falling, base.falling);
+}
+
+template<class Archive>
+void TransferState(Archive& ar, Collider& collider, const Collider& base)
+{
+    ar.SimValue(collider.width, base.width);
+    ar.SimValue(collider.height, base.height);
+}
+
+template<class Archive>
+void TransferState(Archive& ar, Sprite& sprite, const Sprite& base)
+{
+    ar.Bounded(sprite.textureId, base.textureId, 0x100);
+    ar.Bounded(sprite.palette, base.palette, Palette::COUNT);
+    ar.Bounded(sprite.frame, base.frame, SpriteFrame::COUNT);
+    ar.Bool(sprite.flip, base.flip);
+}
+
+template<class Archive>
+void TransferState(Archive& ar, Animation& animation, const Animation& base)
+{
+    ar.Timer(animation.time, base.time);
+}
+
+template<class Archive>
+void TransferState(Archive& ar, BlockBehavior& block, const BlockBehavior& base)
+{
+    ar.Bounded(block.type, base.type, Geo::BLOCK_TYPE_COUNT);
+    ar.Bounded(block.gameplayState, base.gameplayState, Geo::BROKEN + 1);
+    ar.Bounded(block.animState, base.animState, Geo::BUMPED + 1);
+}
+
+template<class Archive>
+void TransferState(Archive& ar, EnemyBrain& brain, const EnemyBrain& base)
+{
+    ar.Bounded(brain.type, base.type, NUM_ENEMY_ARCHETYPES);
+    ar.Bool(brain.isDead, base.isDead);
+}
+
+template<class Archive>
+void TransferState(Archive& ar, EnemyArchetype& archetype, const EnemyArchetype& base)
+{
+    ar.SimValue(archetype.runSpeed, base.runSpeed);
+    ar.SimValue(archetype.width, base.width);
+    ar.SimValue(archetype.height, base.height);
+    ar.SimValue(archetype.gravityScale, base.gravityScale);
+    ar.Bool(archetype.turnsAtLedges, base.turnsAtLedges);
+    ar.Bool(archetype.stompable, base.stompable);
+    ar.Bounded(archetype.idleFrame, base.idleFrame, SpriteFrame::COUNT);
+    ar.Bounded(archetype.runFrame1, base.runFrame1, SpriteFrame::COUNT);
+    ar.Bounded(archetype.runFrame2, base.runFrame2, SpriteFrame::COUNT);
+    ar.Bounded(archetype.fallFrame, base.fallFrame, SpriteFrame::COUNT);
+}
+
+// An inactive slot is one bit, whatever it held before is left alone.
+template<class Archive>
+void TransferState(Archive& ar, Geo& geo, const Geo& base)
+{
+    bool active = geo.active;
+    ar.Bool(active, base.active);
+    geo.active = active;
+    if (!active)
+    {
+        return;
+    }
+
+    // a slot the keyframe has inactive holds nothing to compare against
+    static const Geo s_emptyGeo = {};
+    const Geo& from = base.active ? base : s_emptyGeo;
+
+    ar.SimValue(geo.left, from.left);
+    ar.SimValue(geo.top, from.top);
+    ar.SimValue(geo.right, from.right);
+    ar.SimValue(geo.bottom, from.bottom);
+
+    short colliderIndex = geo.colliderIndex + 1;
+    ar.Bounded(colliderIndex, static_cast<short>(from.colliderIndex + 1), NUM_GEO + 1);
+    geo.colliderIndex = colliderIndex - 1;
+
+    bool collides = geo.collides;
+    bool visible = geo.visible;
+    bool changed = geo.changed;
+    ar.Bool(collides, from.collides);
+    ar.Bool(visible, from.visible);
+    ar.Bool(changed, from.changed);
+    geo.collides = collides;
+    geo.visible = visible;
+    geo.changed = changed;
+
+    ar.Bounded(geo.type, from.type, Geo::BLOCK_TYPE_COUNT);
+    ar.Bounded(geo.gameplayState, from.gameplayState, Geo::BROKEN + 1);
+    ar.Bounded(geo.animState, from.animState, Geo::BUMPED + 1);
+    ar.Bounded(geo.textureId, from.textureId, 0x100);
+    ar.Bounded(geo.spriteFrame, from.spriteFrame, SpriteFrame::COUNT);
+
+    uint32_t blockCount = static_cast<uint16_t>(geo.blockCount);
+    ar.Number(blockCount, static_cast<uint16_t>(from.blockCount));
+    geo.blockCount = static_cast<short>(blockCount);
+
+    ar.Timer(geo.animTime, from.animTime);
+}
+
+// The offset is recomputed from the time on load.
+template<class Archive>
+void TransferState(Archive& ar, TileBump& bump, const TileBump& base)
+{
+    ar.Bool(bump.active, base.active);
+    if (!bump.active)
+    {
+        return;
+    }
+
+    static const TileBump s_emptyBump = {};
+    const TileBump& from = base.active ? base : s_emptyBump;
+    ar.Bounded(bump.tileX, from.tileX, NUM_TILE_CHUNKS * TILE_CHUNK_WIDTH);
+    ar.Bounded(bump.tileY, from.tileY, TILE_CHUNK_HEIGHT);
+    ar.Timer(bump.animTime, from.animTime);
+}
+
+// An archetype still equal to its type's stock one is one bit.
+template<class Archive, int Capacity>
+void TransferArchetype(Archive& ar, EntityWorld<Capacity>& world, const EntityWorld<Capacity>& base, int type)
+{
+    ar.Bool(world.stockArchetypes[type], base.stockArchetypes[type]);
+
+    EnemyArchetype stock = StockEnemyArchetype(type);
+    bool stockValues = SameEnemyArchetype(world.archetypes[type], stock);
+    ar.Bool(stockValues, SameEnemyArchetype(base.archetypes[type], stock));
+    if (stockValues)
+    {
+        world.archetypes[type] = stock;
+    }
+    else
+    {
+        ar.Group(world.archetypes[type], base.archetypes[type]);
+    }
+}
+
+// Entity ids and dense pool order, written and read differently: both are
+// restored exactly so entities are created and walked in the same order as
+// before the save.
+
+template<int Capacity>
+void TransferState(StateWriter& ar, EntityPool<Capacity>& ids, const EntityPool<Capacity>& base)
+{
+    for (int index = 0; index < Capacity; index++)
+    {
+        uint32_t generation = ids.GetGeneration(index);
+        ar.Number(generation, base.GetGeneration(index));
+    }
+
+    int freeCount = Capacity - ids.Count();
+    bool same = freeCount == Capacity - base.Count();
+    for (int slot = 0; slot < freeCount && same; slot++)
+    {
+        same = ids.FreeAt(slot) == base.FreeAt(slot);
+    }
+
+    if (ar.Changed(!same))
+    {
+        ar.Write(freeCount, SaveBitsFor(Capacity + 1));
+        for (int slot = 0; slot < freeCount; slot++)
+        {
+            ar.Write(ids.FreeAt(slot), SaveBitsFor(Capacity));
+        }
+    }
+}
+
+template<int Capacity>
+void TransferState(StateReader& ar, EntityPool<Capacity>& ids, const EntityPool<Capacity>& base)
+{
+    unsigned short generations[Capacity];
+    for (int index = 0; index < Capacity; index++)
+    {
+        uint32_t generation = 0;
+        ar.Number(generation, base.GetGeneration(index));
+        if (generation > 0xFFFF)
+        {
+            ar.Fail();
+        }
+
+        generations[index] = static_cast<unsigned short>(generation);
+    }
+
+    int free[Capacity];
+    int freeCount = 0;
+    if (ar.Changed(true))
+    {
+        freeCount = static_cast<int>(ar.Read(SaveBitsFor(Capacity + 1)));
+        for (int slot = 0; slot < freeCount && slot < Capacity; slot++)
+        {
+            free[slot] = static_cast<int>(ar.Read(SaveBitsFor(Capacity)));
+        }
+    }
+    else
+    {
+        freeCount = Capacity - base.Count();
+        for (int slot = 0; slot < freeCount; slot++)
+        {
+            free[slot] = base.FreeAt(slot);
+        }
+    }
+
+    if (!ids.Restore(generations, free, freeCount))
+    {
+        ar.Fail();
+    }
+}
+
+// Entities in dense order, then their components. An entity the keyframe
+// has the component of compares against that.
+template<class T, int Capacity>
+void TransferState(StateWriter& ar, ComponentPool<T, Capacity>& pool, const ComponentPool<T, Capacity>& base)
+{
+    bool same = pool.Count() == base.Count();
+    for (int dense = 0; dense < pool.Count() && same; dense++)
+    {
+        same = pool.EntityAt(dense) == base.EntityAt(dense);
+    }
+
+    if (ar.Changed(!same))
+    {
+        ar.Write(pool.Count(), SaveBitsFor(Capacity + 1));
+        for (int dense = 0; dense < pool.Count(); dense++)
+        {
+            ar.Write(pool.EntityAt(dense), SaveBitsFor(Capacity));
+        }
+    }
+
+    for (int dense = 0; dense < pool.Count(); dense++)
+    {
+        const T* pBase = base.Get(pool.EntityAt(dense));
+        ar.Group(pool.At(dense), pBase ? *pBase : T());
+    }
+}
+
+template<class T, int Capacity>
+void TransferState(StateReader& ar, ComponentPool<T, Capacity>& pool, const ComponentPool<T, Capacity>& base)
+{
+    int entities[Capacity];
+    int count = 0;
+    if (ar.Changed(true))
+    {
+        count = static_cast<int>(ar.Read(SaveBitsFor(Capacity + 1)));
+        if (count > Capacity)
+        {
+            ar.Fail();
+            count = 0;
+        }
+
+        for (int dense = 0; dense < count; dense++)
+        {
+            entities[dense] = static_cast<int>(ar.Read(SaveBitsFor(Capacity)));
+        }
+    }
+    else
+    {
+        count = base.Count();
+        for (int dense = 0; dense < count; dense++)
+        {
+            entities[dense] = base.EntityAt(dense);
+        }
+    }
+
+    pool.Clear();
+    for (int dense = 0; dense < count; dense++)
+    {
+        int entity = entities[dense];
+        if (entity >= Capacity || pool.Has(entity))
+        {
+            ar.Fail();
+            pool.Clear();
+            return;
+        }
+
+        T& component = pool.Add(entity);
+        const T* pBase = base.Get(entity);
+        ar.Group(component, pBase ? *pBase : T());
+    }
+}
+
+// Keys of the dense components strictly rising, as a sort leaves them.
+template<class T, int Capacity, class Key>
+bool IsSortedPool(const ComponentPool<T, Capacity>& pool, Key key)
+{
+    for (int dense = 1; dense < pool.Count(); dense++)
+    {
+        if (!(key(pool.At(dense - 1), pool.EntityAt(dense - 1)) < key(pool.At(dense), pool.EntityAt(dense))))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Every live entity is an enemy, the player or a block with all of its
+// components, as the systems expect, and no dead one has any. A grouped
+// world has its pools in the order Group leaves them, which the systems
+// index by.
+template<int Capacity>
+bool IsValidSavedWorld(const EntityWorld<Capacity>& world)
+{
+    for (int entity = 0; entity < Capacity; entity++)
+    {
+        bool alive = world.ids.IsAliveIndex(entity);
+        bool enemy = world.brains.Has(entity);
+        bool block = world.blocks.Has(entity);
+        bool player = entity == world.playerEntity;
+        if (world.transforms.Has(entity) != alive
+            || world.colliders.Has(entity) != alive
+            || world.sprites.Has(entity) != alive
+            || world.animations.Has(entity) != alive
+            || world.velocities.Has(entity) != (enemy || player)
+            || (alive && enemy + block + player != 1)
+            || (!alive && (enemy || block || player)))
+        {
+            return false;
+        }
+    }
+
+    if (world.grouped)
+    {
+        auto key = [&](const auto&, int entity) { return world.GroupKey(entity); };
+        if (!IsSortedPool(world.transforms, key)
+            || !IsSortedPool(world.velocities, key)
+            || !IsSortedPool(world.colliders, key)
+            || !IsSortedPool(world.sprites, key)
+            || !IsSortedPool(world.animations, key)
+            || !IsSortedPool(world.blocks, [](const BlockBehavior&, int entity) { return entity; })
+            || !IsSortedPool(world.brains, [](const EnemyBrain& brain, int entity) { return brain.type * Capacity + entity; }))
+        {
+            return false;
+        }
+
+        for (int type = 0; type < NUM_ENEMY_ARCHETYPES; type++)
+        {
+            if (world.enemyGroups[type] > world.enemyGroups[type + 1])
+            {
+                return false;
+            }
+        }
+
+        return world.enemyGroups[0] == 0 && world.enemyGroups[NUM_ENEMY_ARCHETYPES] == world.brains.Count();
+    }
+
+    return true;
+}
+
+template<class Archive, int Capacity>
+void TransferState(Archive& ar, EntityWorld<Capacity>& world, const EntityWorld<Capacity>& base)
+{
+    TransferState(ar, world.ids, base.ids);
+    TransferState(ar, world.transforms, base.transforms);
+    TransferState(ar, world.velocities, base.velocities);
+    TransferState(ar, world.colliders, base.colliders);
+    TransferState(ar, world.sprites, base.sprites);
+    TransferState(ar, world.animations, base.animations);
+    TransferState(ar, world.blocks, base.blocks);
+    TransferState(ar, world.brains, base.brains);
+
+    for (int type = 0; type < NUM_ENEMY_ARCHETYPES; type++)
+    {
+        TransferArchetype(ar, world, base, type);
+    }
+
+    // the player, one up so none is 0
+    int player = world.playerEntity + 1;
+    ar.Bounded(player, base.playerEntity + 1, Capacity + 1);
+    world.playerEntity = player - 1;
+
+    // groups are only meaningful while grouped, pools are not re-sorted on
+    // load so they keep the order the saved game walked them in
+    ar.Bool(world.grouped, base.grouped);
+    if (world.grouped)
+    {
+        for (int type = 0; type <= NUM_ENEMY_ARCHETYPES; type++)
+        {
+            ar.Bounded(world.enemyGroups[type], base.grouped ? base.enemyGroups[type] : 0, Capacity + 1);
+        }
+    }
+}
+
+inline bool IsEmptyTile(const Tile& tile)
+{
+    return tile.textureId == TILE_NO_TEXTURE && tile.flags == Tile::NONE && tile.frame == SpriteFrame::IDLE;
+}
+
+inline bool SameTile(const Tile& a, const Tile& b)
+{
+    return a.textureId == b.textureId && a.flags == b.flags && a.frame == b.frame;
+}
+
+// One bit for an empty chunk. Otherwise each tile is one bit when it
+// repeats the one before it, rows of ground mostly do, or the tile.
+inline void WriteTileChunk(StateWriter& ar, const TileChunk& chunk)
+{
+    const Tile* pTiles = &chunk.tiles[0][0];
+    const int tileCount = TILE_CHUNK_WIDTH * TILE_CHUNK_HEIGHT;
+
+    bool empty = true;
+    for (int index = 0; index < tileCount && empty; index++)
+    {
+        empty = IsEmptyTile(pTiles[index]);
+    }
+
+    ar.Write(empty ? 1 : 0, 1);
+    if (empty)
+    {
+        return;
+    }
+
+    Tile previous = { TILE_NO_TEXTURE, Tile::NONE, SpriteFrame::IDLE };
+    for (int index = 0; index < tileCount; index++)
+    {
+        const Tile& tile = pTiles[index];
+        if (SameTile(tile, previous))
+        {
+            ar.Write(0, 1);
+            continue;
+        }
+
+        ar.Write(1, 1);
+        ar.Write(tile.textureId, 8);
+        ar.Write(tile.flags, SaveBitsFor(Tile::BUMPING << 1));
+        ar.Write(tile.frame, SaveBitsFor(SpriteFrame::COUNT));
+        previous = tile;
+    }
+}
+
+inline void ReadTileChunk(StateReader& ar, TileChunk& chunk)
+{
+    Tile* pTiles = &chunk.tiles[0][0];
+    const int tileCount = TILE_CHUNK_WIDTH * TILE_CHUNK_HEIGHT;
+    Tile previous = { TILE_NO_TEXTURE, Tile::NONE, SpriteFrame::IDLE };
+
+    chunk.liveCount = 0;
+    if (ar.Read(1) != 0)
+    {
+        for (int index = 0; index < tileCount; index++)
+        {
+            pTiles[index] = previous;
+        }
+
+        return;
+    }
+
+    for (int index = 0; index < tileCount; index++)
+    {
+        if (ar.Read(1) != 0)
+        {
+            previous.textureId = static_cast<unsigned char>(ar.Read(8));
+            previous.flags = static_cast<unsigned char>(ar.Read(SaveBitsFor(Tile::BUMPING << 1)));
+            previous.frame = static_cast<unsigned char>(ar.Read(SaveBitsFor(SpriteFrame::COUNT)));
+            if (previous.frame >= SpriteFrame::COUNT)
+            {
+                ar.Fail();
+            }
+        }
+
+        pTiles[index] = previous;
+        chunk.liveCount += previous.IsLive() ? 1 : 0;
+    }
+}
+
+// In a delta, one bit for each chunk whose tiles did not change.
+inline void TransferState(StateWriter& ar, Tilemap& tilemap, const Tilemap& base)
+{
+    for (int chunkX = 0; chunkX < NUM_TILE_CHUNKS; chunkX++)
+    {
+        const TileChunk& chunk = tilemap.chunks[chunkX];
+        const TileChunk& baseChunk = base.chunks[chunkX];
+        if (ar.Changed(memcmp(chunk.tiles, baseChunk.tiles, sizeof(chunk.tiles)) != 0))
+        {
+            WriteTileChunk(ar, chunk);
+        }
+    }
+
+    for (int index = 0; index < NUM_TILE_BUMPS; index++)
+    {
+        ar.Group(tilemap.bumps[index], base.bumps[index]);
+    }
+
+    ar.Timer(tilemap.animTime, base.animTime);
+}
+
+// Every chunk gets a new version, whatever was cached of it is stale.
+inline void TransferState(StateReader& ar, Tilemap& tilemap, const Tilemap& base)
+{
+    for (int chunkX = 0; chunkX < NUM_TILE_CHUNKS; chunkX++)
+    {
+        TileChunk& chunk = tilemap.chunks[chunkX];
+        const TileChunk& baseChunk = base.chunks[chunkX];
+        if (ar.Changed(true))
+        {
+            ReadTileChunk(ar, chunk);
+        }
+        else
+        {
+            memcpy(chunk.tiles, baseChunk.tiles, sizeof(chunk.tiles));
+            chunk.liveCount = baseChunk.liveCount;
+        }
+
+        chunk.version++;
+    }
+
+    for (int index = 0; index < NUM_TILE_BUMPS; index++)
+    {
+        TileBump& bump = tilemap.bumps[index];
+        ar.Group(bump, base.bumps[index]);
+        if (bump.active)
+        {
+            bump.animYOffset = Tilemap::GetBumpYOffset(bump.animTime);
+        }
+    }
+
+    ar.Timer(tilemap.animTime, base.animTime);
+}
+
+// Where loading got to: a record index into an embedded level, or one past
+// the offset of the next record in the level stream, 0 when there is none.
+// The keyframe's cursor only compares when it is on the same level.
+inline uint32_t GetSaveLevelOffset(const GameState& state, const short* pLevelStream, int levelId)
+{
+    const LevelCursor& level = state.level;
+    if (state.levelId != levelId)
+    {
+        return 0;
+    }
+
+    if (level.embedded)
+    {
+        return static_cast<uint32_t>(level.nextRecord);
+    }
+
+    return level.next && pLevelStream ? static_cast<uint32_t>(level.next - pLevelStream) + 1 : 0;
+}
+
+inline void TransferLevelCursor(StateWriter& ar, const GameState& state, const GameState& base, const short* pLevelStream)
+{
+    const LevelCursor& level = state.level;
+    bool embedded = level.embedded != NULL;
+    ar.Bool(embedded, base.level.embedded != NULL);
+
+    if (!embedded && level.next && (pLevelStream == NULL || level.next < pLevelStream))
+    {
+        ar.Fail();
+        return;
+    }
+
+    uint32_t offset = GetSaveLevelOffset(state, pLevelStream, state.levelId);
+    ar.Number(offset, ar.IsDelta() ? GetSaveLevelOffset(base, pLevelStream, state.levelId) : 0);
+}
+
+// The stream offset is trusted here; Platformer::LoadState walks the stream
+// up to it, which rejects one that is not on a record.
+inline void TransferLevelCursor(StateReader& ar, GameState& state, const GameState& base, short* pLevelStream)
+{
+    LevelCursor& level = state.level;
+    bool embedded = false;
+    ar.Bool(embedded, base.level.embedded != NULL);
+
+    uint32_t offset = 0;
+    ar.Number(offset, ar.IsDelta() ? GetSaveLevelOffset(base, pLevelStream, state.levelId) : 0);
+
+    level = LevelCursor();
+    if (embedded)
+    {
+        level.embedded = FindEmbeddedLevel(state.levelId);
+        if (level.embedded == NULL || offset > static_cast<uint32_t>(level.embedded->recordCount))
+        {
+            ar.Fail();
+            level.embedded = NULL;
+            return;
+        }
+
+        level.nextRecord = static_cast<int>(offset);
+    }
+    else if (offset > 0)
+    {
+        if (pLevelStream == NULL)
+        {
+            ar.Fail();
+            return;
+        }
+
+        level.next = pLevelStream + (offset - 1);
+    }
+}
+
+// Everything but the level cursor and the header, in the order stored.
+template<class Archive>
+void TransferState(Archive& ar, GameState& state, const GameState& base)
+{
+    ar.Bounded(state.input, base.input, Input::SPECIAL_UP + 1);
+    ar.Bool(state.needsReset, base.needsReset);
+    ar.SimValue(state.cameraScroll, base.cameraScroll);
+
+    ar.Bool(state.anim.active, base.anim.active);
+    ar.Bounded(state.anim.type, base.anim.type, GlobalAnimation::DEATH + 1);
+    ar.Float(state.anim.elapsed, base.anim.elapsed);
+
+    for (int index = 0; index < NUM_GEO; index++)
+    {
+        ar.Group(state.geo[index], base.geo[index]);
+    }
+
+    ar.Bool(state.player.isDead, base.player.isDead);
+
+    TransferState(ar, state.world, base.world);
+    TransferState(ar, state.tilemap, base.tilemap);
+}
+
+// Write state, as a delta against pKeyframe when one is given. keyframeId
+// is whatever the caller knows the keyframe by, a tick say, and a delta
+// only loads against the keyframe with the same id. pLevelStream is the
+// stream a stream level is loaded from. False when the writer failed.
+inline bool WriteGameState(BitWriter& out, const GameState& state, const short* pLevelStream, const GameState* pKeyframe, unsigned int keyframeId)
+{
+    unsigned int flags = pKeyframe ? SaveStateFlags::DELTA : SaveStateFlags::NONE;
+#if USE_FIXED_POINT_PHYSICS
+    flags |= SaveStateFlags::FIXED_POINT;
+#endif
+
+    out.Write(SAVE_STATE_MAGIC, 32);
+    out.Write(SAVE_STATE_VERSION, 8);
+    out.Write(flags, 8);
+    out.Write(SAVE_STATE_LAYOUT, 32);
+    out.Write(pKeyframe ? keyframeId : 0, 32);
+    out.Write(static_cast<uint32_t>(state.levelId), 32);
+
+    // the transfers are shared with the reader, the writer only reads
+    GameState& value = const_cast<GameState&>(state);
+    const GameState& base = pKeyframe ? *pKeyframe : state;
+    StateWriter ar(out, pKeyframe != NULL);
+    TransferLevelCursor(ar, state, base, pLevelStream);
+    TransferState(ar, value, base);
+    return !ar.Failed();
+}
+
+// The header, so the caller knows the level before the body. False when the
+// data is not a state of this version and build.
+inline bool ReadSaveStateHeader(BitReader& in, SaveStateHeader& header)
+{
+    uint32_t magic = in.Read(32);
+    header.version = in.Read(8);
+    header.flags = in.Read(8);
+    uint32_t layout = in.Read(32);
+    header.keyframeId = in.Read(32);
+    header.levelId = static_cast<int>(in.Read(32));
+
+#if USE_FIXED_POINT_PHYSICS
+    bool fixedPoint = true;
+#else
+    bool fixedPoint = false;
+#endif
+
+    return !in.Failed()
+        && magic == SAVE_STATE_MAGIC
+        && header.version == SAVE_STATE_VERSION
+        && layout == SAVE_STATE_LAYOUT
+        && ((header.flags & SaveStateFlags::FIXED_POINT) != 0) == fixedPoint;
+}
+
+// Read the body after its header into state, rebuilding the spatial index
+// and clearing the broadphase. A delta needs the keyframe it was written
+// against, which must not be state itself. False when the data is damaged or
+// the keyframe is not the right one; state is then partly overwritten, so
+// read into a copy and keep it only on success, as Platformer::LoadState does.
+inline bool ReadGameState(BitReader& in, const SaveStateHeader& header, GameState& state, short* pLevelStream, const GameState* pKeyframe, unsigned int keyframeId)
+{
+    bool delta = (header.flags & SaveStateFlags::DELTA) != 0;
+    if (delta && (pKeyframe == NULL || pKeyframe == &state || header.keyframeId != keyframeId))
+    {
+        return false;
+    }
+
+    // a whole state ignores the keyframe
+    const GameState& base = delta ? *pKeyframe : state;
+    StateReader ar(in, delta);
+    state.levelId = header.levelId;
+    TransferLevelCursor(ar, state, base, pLevelStream);
+    TransferState(ar, state, base);
+    if (ar.Failed() || !IsValidSavedWorld(state.world) || state.world.playerEntity != PLAYER_ENTITY)
+    {
+        return false;
+    }
+
+    state.bursts.count = 0;
+
+    state.spatial.Clear();
+    state.actors.Clear();
+    for (int index = 0; index < NUM_GEO; index++)
+    {
+        if (state.geo[index].active)
+        {
+            state.spatial.Insert(GeoHandle(index), ToSpatialRect(state.geo[index].GetRect()));
+        }
+    }
+
+    EntityWorld<NUM_ACTORS>& world = state.world;
+    for (int dense = 0; dense < world.brains.Count(); dense++)
+    {
+        int entity = world.brains.EntityAt(dense);
+        state.spatial.Insert(EntityHandle(entity), ToSpatialRect(GetRect(*world.transforms.Get(entity), *world.colliders.Get(entity))));
+    }
+
+    return true;
+}
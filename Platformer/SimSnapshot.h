@@ -0,0 +1,222 @@
+#pragma once
+#include <string.h>
+
+#include "Tilemap.h"
+
+// One tick of the game as a viewer needs it to draw: the camera, the texture
+// bound to every level slot, every sprite and the tiles of the chunks on
+// screen. The layout is fixed and plain bytes, so two snapshots can be
+// compared byte by byte; a snapshot is sent as the bytes that changed since
+// one the viewer already has, see EncodeSnapshotDelta.
+
+// Sprite slots, drawn in order. Pools keep their slots between ticks so an
+// entity that did not change sends nothing.
+#define SNAPSHOT_SPRITES 32
+#define SNAPSHOT_TEXTURES 32
+
+// Chunks from the one under the left edge of the screen, enough to cover it.
+#define SNAPSHOT_CHUNKS 3
+
+// Bump offsets are sent in steps of 1/SNAPSHOT_BUMP_SCALE units.
+#define SNAPSHOT_BUMP_SCALE 16.f
+
+// Snapshots kept to decode against, on both ends. An acknowledgement older
+// than this gets a full snapshot.
+#define SNAPSHOT_HISTORY 32
+
+// Unchanged bytes shorter than this inside a changed run are sent along,
+// a new run would cost more.
+#define SNAPSHOT_DELTA_MIN_GAP 3
+
+struct SnapshotSprite
+{
+    enum Flags : unsigned char
+    {
+        VISIBLE = 0x1,
+        FLIP    = 0x2,
+    };
+
+    // level units
+    float left;
+    float top;
+    float right;
+    float bottom;
+
+    unsigned char textureId;
+    unsigned char frame;
+    unsigned char palette;
+    unsigned char flags;
+};
+
+struct SnapshotTile
+{
+    // TILE_NO_TEXTURE when empty
+    unsigned char textureId;
+
+    // animated frames already resolved
+    unsigned char frame;
+    signed char bump;
+};
+
+struct SimSnapshot
+{
+    unsigned int tick;
+    float cameraScroll;
+    int firstChunk;
+
+    // resource bound to each level texture slot, 0 for none
+    unsigned short textures[SNAPSHOT_TEXTURES];
+
+    SnapshotSprite sprites[SNAPSHOT_SPRITES];
+    SnapshotTile tiles[SNAPSHOT_CHUNKS][TILE_CHUNK_HEIGHT][TILE_CHUNK_WIDTH];
+};
+
+// Longest delta of a snapshot, one run over all of it.
+#define SNAPSHOT_MAX_DELTA (sizeof(SimSnapshot) + 16)
+
+inline size_t WriteSnapshotVarint(unsigned char* pOut, size_t value)
+{
+    size_t written = 0;
+    while (value >= 0x80)
+    {
+        pOut[written++] = static_cast<unsigned char>(value | 0x80);
+        value >>= 7;
+    }
+
+    pOut[written++] = static_cast<unsigned char>(value);
+    return written;
+}
+
+inline bool ReadSnapshotVarint(const unsigned char* pIn, size_t size, size_t& offset, size_t& value)
+{
+    value = 0;
+    for (int shift = 0; offset < size && shift < 32; shift += 7)
+    {
+        unsigned char byte = pIn[offset++];
+        value |= static_cast<size_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Encode snapshot as the runs of bytes that differ from base: the count of
+// unchanged bytes to skip, the count of bytes that follow, then the bytes.
+// Identical snapshots encode to nothing. Returns the bytes written to pOut,
+// which holds at least SNAPSHOT_MAX_DELTA.
+inline size_t EncodeSnapshotDelta(const SimSnapshot& base, const SimSnapshot& snapshot, unsigned char* pOut)
+{
+    const unsigned char* pBase = reinterpret_cast<const unsigned char*>(&base);
+    const unsigned char* pBytes = reinterpret_cast<const unsigned char*>(&snapshot);
+    const size_t size = sizeof(SimSnapshot);
+
+    size_t written = 0;
+    size_t offset = 0;
+    for (;;)
+    {
+        size_t start = offset;
+        while (start < size && pBase[start] == pBytes[start])
+        {
+            start++;
+        }
+
+        if (start == size)
+        {
+            break;
+        }
+
+        // one past the last changed byte, through gaps too short for a run
+        size_t end = start + 1;
+        for (size_t index = end; index < size && index - end < SNAPSHOT_DELTA_MIN_GAP; index++)
+        {
+            if (pBase[index] != pBytes[index])
+            {
+                end = index + 1;
+            }
+        }
+
+        written += WriteSnapshotVarint(pOut + written, start - offset);
+        written += WriteSnapshotVarint(pOut + written, end - start);
+        memcpy(pOut + written, pBytes + start, end - start);
+        written += end - start;
+        offset = end;
+    }
+
+    return written;
+}
+
+// Rebuild a snapshot from base and a delta of EncodeSnapshotDelta. False
+// when the delta does not fit the layout.
+inline bool DecodeSnapshotDelta(const SimSnapshot& base, const unsigned char* pDelta, size_t deltaSize, SimSnapshot& snapshot)
+{
+    unsigned char* pBytes = reinterpret_cast<unsigned char*>(&snapshot);
+    const size_t size = sizeof(SimSnapshot);
+    memcpy(pBytes, &base, size);
+
+    size_t offset = 0;
+    size_t read = 0;
+    while (read < deltaSize)
+    {
+        size_t skip = 0;
+        size_t count = 0;
+        if (!ReadSnapshotVarint(pDelta, deltaSize, read, skip)
+            || !ReadSnapshotVarint(pDelta, deltaSize, read, count)
+            || skip > size - offset
+            || count > size - offset - skip
+            || count > deltaSize - read)
+        {
+            return false;
+        }
+
+        offset += skip;
+        memcpy(pBytes + offset, pDelta + read, count);
+        offset += count;
+        read += count;
+    }
+
+    return true;
+}
+
+// The last SNAPSHOT_HISTORY snapshots by tick. Tick 0 is never stored, it
+// stands for the empty snapshot every stream starts from.
+class SnapshotHistory
+{
+public:
+    SnapshotHistory()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        memset(m_snapshots, 0, sizeof(m_snapshots));
+        memset(&m_empty, 0, sizeof(m_empty));
+    }
+
+    void Store(const SimSnapshot& snapshot)
+    {
+        if (snapshot.tick != 0)
+        {
+            m_snapshots[snapshot.tick % SNAPSHOT_HISTORY] = snapshot;
+        }
+    }
+
+    // NULL when the tick is no longer kept.
+    const SimSnapshot* Find(unsigned int tick) const
+    {
+        if (tick == 0)
+        {
+            return &m_empty;
+        }
+
+        const SimSnapshot& snapshot = m_snapshots[tick % SNAPSHOT_HISTORY];
+        return snapshot.tick == tick ? &snapshot : NULL;
+    }
+
+private:
+    SimSnapshot m_snapshots[SNAPSHOT_HISTORY];
+    SimSnapshot m_empty;
+};
@@ -0,0 +1,577 @@
+#pragma once
+#include <winsock2.h>
+#include <windows.h>
+
+#include "SimSnapshot.h"
+
+// Per-tick state over loopback TCP, from a headless server running the sim
+// (benchmark -serve) to viewers drawing it (Platformer -connect). Every tick
+// the server sends each viewer the delta of the new snapshot against the
+// last one that viewer acknowledged, or against the empty snapshot when it
+// has none, and the viewer acknowledges every snapshot it decodes.
+//
+// Messages are a SimMessageHeader and its payload in native byte order; both
+// ends run on the same machine, and the capture time in every snapshot is a
+// QueryPerformanceCounter reading the viewer compares with its own to get
+// the latency.
+
+#define SIM_STREAM_DEFAULT_PORT 27960
+#define SIM_STREAM_MAX_VIEWERS 4
+#define SIM_STREAM_MAGIC 0x534D4953
+
+// Unread bytes a viewer buffers, room for several full snapshots.
+#define SIM_STREAM_RECEIVE_BUFFER (64 * 1024)
+
+struct SimMessage
+{
+    enum Type : unsigned int
+    {
+        // server to viewer, once on connect
+        HELLO,
+        // server to viewer, a SimSnapshotHeader and the delta
+        SNAPSHOT,
+        // viewer to server, a SimAck
+        ACK,
+    };
+};
+
+struct SimMessageHeader
+{
+    // payload bytes after the header
+    unsigned int size;
+    SimMessage::Type type;
+};
+
+struct SimHello
+{
+    unsigned int magic;
+    unsigned int snapshotSize;
+};
+
+struct SimSnapshotHeader
+{
+    unsigned int tick;
+
+    // snapshot the delta is against, 0 for the empty one
+    unsigned int baseTick;
+    LONGLONG captureTime;
+};
+
+struct SimAck
+{
+    unsigned int tick;
+};
+
+#define SIM_STREAM_MAX_MESSAGE (sizeof(SimMessageHeader) + sizeof(SimSnapshotHeader) + SNAPSHOT_MAX_DELTA)
+
+struct SimStreamStats
+{
+    // server: snapshots sent to all viewers, viewer: snapshots decoded
+    int snapshots;
+    int fullSnapshots;
+    long long bytes;
+    int lastBytes;
+
+    // viewer only, capture to decode
+    float lastLatency;
+    float worstLatency;
+};
+
+// Winsock is started once per process and never stopped, both ends may be
+// in one process.
+inline bool StartSimStreamSockets()
+{
+    static bool started = false;
+    if (!started)
+    {
+        WSADATA data;
+        started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }
+
+    return started;
+}
+
+inline void CloseSimStreamSocket(SOCKET& socket)
+{
+    if (socket != INVALID_SOCKET)
+    {
+        closesocket(socket);
+        socket = INVALID_SOCKET;
+    }
+}
+
+// Latency over blocking small sends: snapshots are written the moment they
+// are made.
+inline void ConfigureSimStreamSocket(SOCKET socket)
+{
+    int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+    u_long nonBlocking = 1;
+    ioctlsocket(socket, FIONBIO, &nonBlocking);
+}
+
+inline sockaddr_in GetSimStreamAddress(unsigned short port)
+{
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    return address;
+}
+
+// Send a whole message or nothing usable: a socket that can't take a message
+// at once is too far behind and is closed by the caller.
+inline bool SendSimMessage(SOCKET socket, SimMessage::Type type, const void* pPayload, unsigned int size, unsigned char* pScratch)
+{
+    SimMessageHeader header = { size, type };
+    memcpy(pScratch, &header, sizeof(header));
+    memcpy(pScratch + sizeof(header), pPayload, size);
+
+    int length = static_cast<int>(sizeof(header) + size);
+    return send(socket, reinterpret_cast<const char*>(pScratch), length, 0) == length;
+}
+
+class SimStreamServer
+{
+public:
+    SimStreamServer() :
+        stats(),
+        m_listen(INVALID_SOCKET),
+        m_viewers(),
+        m_history()
+    {
+        for (Viewer& viewer : m_viewers)
+        {
+            viewer.socket = INVALID_SOCKET;
+        }
+    }
+
+    ~SimStreamServer()
+    {
+        Stop();
+    }
+
+    SimStreamServer(const SimStreamServer&) = delete;
+    SimStreamServer& operator=(const SimStreamServer&) = delete;
+
+    // Listen on the loopback address only.
+    bool Listen(unsigned short port)
+    {
+        if (!StartSimStreamSockets())
+        {
+            return false;
+        }
+
+        m_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (m_listen == INVALID_SOCKET)
+        {
+            return false;
+        }
+
+        int reuse = 1;
+        setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+        sockaddr_in address = GetSimStreamAddress(port);
+        if (bind(m_listen, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+            || listen(m_listen, SIM_STREAM_MAX_VIEWERS) != 0)
+        {
+            CloseSimStreamSocket(m_listen);
+            return false;
+        }
+
+        u_long nonBlocking = 1;
+        ioctlsocket(m_listen, FIONBIO, &nonBlocking);
+        return true;
+    }
+
+    void Stop()
+    {
+        for (Viewer& viewer : m_viewers)
+        {
+            CloseSimStreamSocket(viewer.socket);
+        }
+
+        CloseSimStreamSocket(m_listen);
+    }
+
+    int GetViewerCount() const
+    {
+        int count = 0;
+        for (const Viewer& viewer : m_viewers)
+        {
+            count += viewer.socket != INVALID_SOCKET ? 1 : 0;
+        }
+
+        return count;
+    }
+
+    // Take new viewers, read acknowledgements and send every viewer the
+    // snapshot, delta compressed against what it has.
+    void Publish(const SimSnapshot& snapshot, LONGLONG captureTime)
+    {
+        Accept();
+        m_history.Store(snapshot);
+
+        for (Viewer& viewer : m_viewers)
+        {
+            if (viewer.socket == INVALID_SOCKET)
+            {
+                continue;
+            }
+
+            ReadAcks(viewer);
+            if (viewer.socket == INVALID_SOCKET)
+            {
+                continue;
+            }
+
+            const SimSnapshot* pBase = m_history.Find(viewer.ackedTick);
+            if (!pBase)
+            {
+                viewer.ackedTick = 0;
+                pBase = m_history.Find(0);
+            }
+
+            SimSnapshotHeader header = { snapshot.tick, viewer.ackedTick, captureTime };
+            memcpy(m_payload, &header, sizeof(header));
+            size_t size = sizeof(header) + EncodeSnapshotDelta(*pBase, snapshot, m_payload + sizeof(header));
+
+            if (!SendSimMessage(viewer.socket, SimMessage::SNAPSHOT, m_payload, static_cast<unsigned int>(size), m_message))
+            {
+                CloseSimStreamSocket(viewer.socket);
+                continue;
+            }
+
+            int bytes = static_cast<int>(sizeof(SimMessageHeader) + size);
+            stats.snapshots++;
+            stats.fullSnapshots += viewer.ackedTick == 0 ? 1 : 0;
+            stats.bytes += bytes;
+            stats.lastBytes = bytes;
+        }
+    }
+
+    SimStreamStats stats;
+
+private:
+    struct Viewer
+    {
+        SOCKET socket;
+        unsigned int ackedTick;
+
+        // a partly received SimAck
+        unsigned char pending[sizeof(SimMessageHeader) + sizeof(SimAck)];
+        int pendingBytes;
+    };
+
+    void Accept()
+    {
+        if (m_listen == INVALID_SOCKET)
+        {
+            return;
+        }
+
+        for (;;)
+        {
+            SOCKET socket = accept(m_listen, NULL, NULL);
+            if (socket == INVALID_SOCKET)
+            {
+                return;
+            }
+
+            Viewer* pViewer = NULL;
+            for (Viewer& viewer : m_viewers)
+            {
+                if (viewer.socket == INVALID_SOCKET)
+                {
+                    pViewer = &viewer;
+                    break;
+                }
+            }
+
+            ConfigureSimStreamSocket(socket);
+            SimHello hello = { SIM_STREAM_MAGIC, sizeof(SimSnapshot) };
+            if (!pViewer || !SendSimMessage(socket, SimMessage::HELLO, &hello, sizeof(hello), m_message))
+            {
+                closesocket(socket);
+                continue;
+            }
+
+            pViewer->socket = socket;
+            pViewer->ackedTick = 0;
+            pViewer->pendingBytes = 0;
+        }
+    }
+
+    // Viewers only ever send acknowledgements, newer ones replace older.
+    void ReadAcks(Viewer& viewer)
+    {
+        const int ackSize = static_cast<int>(sizeof(viewer.pending));
+        for (;;)
+        {
+            int received = recv(viewer.socket, reinterpret_cast<char*>(viewer.pending + viewer.pendingBytes), ackSize - viewer.pendingBytes, 0);
+            if (received == 0 || (received < 0 && WSAGetLastError() != WSAEWOULDBLOCK))
+            {
+                CloseSimStreamSocket(viewer.socket);
+                return;
+            }
+
+            if (received < 0)
+            {
+                return;
+            }
+
+            viewer.pendingBytes += received;
+            if (viewer.pendingBytes < ackSize)
+            {
+                continue;
+            }
+
+            SimMessageHeader header;
+            SimAck ack;
+            memcpy(&header, viewer.pending, sizeof(header));
+            memcpy(&ack, viewer.pending + sizeof(header), sizeof(ack));
+            viewer.pendingBytes = 0;
+
+            if (header.type != SimMessage::ACK || header.size != sizeof(SimAck))
+            {
+                CloseSimStreamSocket(viewer.socket);
+                return;
+            }
+
+            if (ack.tick > viewer.ackedTick)
+            {
+                viewer.ackedTick = ack.tick;
+            }
+        }
+    }
+
+    SOCKET m_listen;
+    Viewer m_viewers[SIM_STREAM_MAX_VIEWERS];
+    SnapshotHistory m_history;
+
+    unsigned char m_payload[sizeof(SimSnapshotHeader) + SNAPSHOT_MAX_DELTA];
+    unsigned char m_message[SIM_STREAM_MAX_MESSAGE];
+};
+
+class SimStreamClient
+{
+public:
+    SimStreamClient() :
+        stats(),
+        m_socket(INVALID_SOCKET),
+        m_helloReceived(false),
+        m_snapshot(),
+        m_history(),
+        m_received(0)
+    {
+        memset(&m_snapshot, 0, sizeof(m_snapshot));
+        QueryPerformanceFrequency(&m_frequency);
+    }
+
+    ~SimStreamClient()
+    {
+        Disconnect();
+    }
+
+    SimStreamClient(const SimStreamClient&) = delete;
+    SimStreamClient& operator=(const SimStreamClient&) = delete;
+
+    bool Connect(unsigned short port)
+    {
+        if (!StartSimStreamSockets())
+        {
+            return false;
+        }
+
+        m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (m_socket == INVALID_SOCKET)
+        {
+            return false;
+        }
+
+        sockaddr_in address = GetSimStreamAddress(port);
+        if (connect(m_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            CloseSimStreamSocket(m_socket);
+            return false;
+        }
+
+        ConfigureSimStreamSocket(m_socket);
+        m_helloReceived = false;
+        m_history.Clear();
+        m_received = 0;
+        return true;
+    }
+
+    void Disconnect()
+    {
+        CloseSimStreamSocket(m_socket);
+    }
+
+    bool IsConnected() const
+    {
+        return m_socket != INVALID_SOCKET;
+    }
+
+    // Decode the next snapshot, waiting up to timeout milliseconds for it to
+    // arrive. True when GetSnapshot has a new one.
+    bool Receive(int timeout)
+    {
+        for (;;)
+        {
+            int result = DecodeMessage();
+            if (result != 0)
+            {
+                return result > 0;
+            }
+
+            if (!IsConnected() || !Wait(timeout))
+            {
+                return false;
+            }
+
+            int received = recv(m_socket, reinterpret_cast<char*>(m_buffer + m_received), SIM_STREAM_RECEIVE_BUFFER - m_received, 0);
+            if (received == 0 || (received < 0 && WSAGetLastError() != WSAEWOULDBLOCK))
+            {
+                Disconnect();
+                return false;
+            }
+
+            if (received < 0)
+            {
+                return false;
+            }
+
+            m_received += received;
+        }
+    }
+
+    const SimSnapshot& GetSnapshot() const
+    {
+        return m_snapshot;
+    }
+
+    SimStreamStats stats;
+
+private:
+    bool Wait(int timeout)
+    {
+        if (timeout <= 0)
+        {
+            return true;
+        }
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(m_socket, &readable);
+        timeval wait = { timeout / 1000, (timeout % 1000) * 1000 };
+        return select(static_cast<int>(m_socket) + 1, &readable, NULL, NULL, &wait) > 0;
+    }
+
+    // 1 when a snapshot was decoded, -1 when the stream broke, 0 when the
+    // buffer holds no whole message.
+    int DecodeMessage()
+    {
+        for (;;)
+        {
+            SimMessageHeader header;
+            if (m_received < static_cast<int>(sizeof(header)))
+            {
+                return 0;
+            }
+
+            memcpy(&header, m_buffer, sizeof(header));
+            if (header.size > SIM_STREAM_MAX_MESSAGE)
+            {
+                Disconnect();
+                return -1;
+            }
+
+            int length = static_cast<int>(sizeof(header) + header.size);
+            if (m_received < length)
+            {
+                return 0;
+            }
+
+            int result = HandleMessage(header, m_buffer + sizeof(header));
+            memmove(m_buffer, m_buffer + length, m_received - length);
+            m_received -= length;
+
+            if (result != 0)
+            {
+                return result;
+            }
+        }
+    }
+
+    int HandleMessage(const SimMessageHeader& header, const unsigned char* pPayload)
+    {
+        if (header.type == SimMessage::HELLO)
+        {
+            SimHello hello = {};
+            memcpy(&hello, pPayload, header.size < sizeof(hello) ? header.size : sizeof(hello));
+            m_helloReceived = hello.magic == SIM_STREAM_MAGIC && hello.snapshotSize == sizeof(SimSnapshot);
+            if (!m_helloReceived)
+            {
+                // another build of the game, the layouts don't match
+                Disconnect();
+                return -1;
+            }
+
+            return 0;
+        }
+
+        if (header.type != SimMessage::SNAPSHOT || !m_helloReceived || header.size < sizeof(SimSnapshotHeader))
+        {
+            Disconnect();
+            return -1;
+        }
+
+        SimSnapshotHeader snapshotHeader;
+        memcpy(&snapshotHeader, pPayload, sizeof(snapshotHeader));
+
+        const SimSnapshot* pBase = m_history.Find(snapshotHeader.baseTick);
+        if (!pBase
+            || !DecodeSnapshotDelta(*pBase, pPayload + sizeof(snapshotHeader), header.size - sizeof(snapshotHeader), m_snapshot)
+            || m_snapshot.tick != snapshotHeader.tick)
+        {
+            Disconnect();
+            return -1;
+        }
+
+        m_history.Store(m_snapshot);
+
+        SimAck ack = { m_snapshot.tick };
+        unsigned char message[sizeof(SimMessageHeader) + sizeof(SimAck)];
+        if (!SendSimMessage(m_socket, SimMessage::ACK, &ack, sizeof(ack), message))
+        {
+            Disconnect();
+            return -1;
+        }
+
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        float latency = static_cast<float>(now.QuadPart - snapshotHeader.captureTime) / static_cast<float>(m_frequency.QuadPart);
+
+        int bytes = static_cast<int>(sizeof(header) + header.size);
+        stats.snapshots++;
+        stats.fullSnapshots += snapshotHeader.baseTick == 0 ? 1 : 0;
+        stats.bytes += bytes;
+        stats.lastBytes = bytes;
+        stats.lastLatency = latency;
+        stats.worstLatency = latency > stats.worstLatency ? latency : stats.worstLatency;
+        return 1;
+    }
+
+    SOCKET m_socket;
+    bool m_helloReceived;
+    LARGE_INTEGER m_frequency;
+
+    // latest decoded snapshot
+    SimSnapshot m_snapshot;
+    SnapshotHistory m_history;
+
+    unsigned char m_buffer[SIM_STREAM_RECEIVE_BUFFER];
+    int m_received;
+};
@@ -0,0 +1,272 @@
+#pragma once
+
+#include "Fixed.h"
+
+#define SPATIAL_CELL_SIZE 40
+#define NUM_SPATIAL_CELLS 64
+#define NUM_SPATIAL_NODES 256
+#define NUM_SPATIAL_ENTITIES 64
+
+// Uniform grid over x, hashed into a ring of cells. Side-scrolling levels
+// only ever have a screen or two of content loaded, so a 1D grid is enough.
+// Entities are identified by small integer handles chosen by the caller, and
+// are linked into every cell their bounds overlap.
+//
+// Bounds are whole units, rounded outwards from the caller's rects, so what a
+// query returns never depends on float rounding and is the same on any build.
+struct SpatialRect
+{
+    int left;
+    int top;
+    int right;
+    int bottom;
+};
+
+template<class Rect>
+inline SpatialRect ToSpatialRect(const Rect& rect)
+{
+    SpatialRect result = { FloorDiv(rect.left, 1), FloorDiv(rect.top, 1), CeilDiv(rect.right, 1), CeilDiv(rect.bottom, 1) };
+    return result;
+}
+
+class SpatialIndex
+{
+public:
+    struct Node
+    {
+        int handle;
+        int next;
+    };
+
+    struct Entry
+    {
+        bool inserted;
+
+        // Could not get enough nodes, returned by every query instead.
+        bool overflow;
+        int firstCell;
+        int lastCell;
+        int stamp;
+        SpatialRect bounds;
+    };
+
+    void Clear()
+    {
+        for (int cell = 0; cell < NUM_SPATIAL_CELLS; cell++)
+        {
+            cells[cell] = -1;
+        }
+
+        for (int node = 0; node < NUM_SPATIAL_NODES; node++)
+        {
+            nodes[node].handle = -1;
+            nodes[node].next = node + 1 < NUM_SPATIAL_NODES ? node + 1 : -1;
+        }
+
+        for (Entry& entry : entries)
+        {
+            entry.inserted = false;
+            entry.overflow = false;
+            entry.stamp = 0;
+        }
+
+        freeNode = 0;
+        freeCount = NUM_SPATIAL_NODES;
+        overflowCount = 0;
+        stamp = 0;
+    }
+
+    void Insert(int handle, const SpatialRect& bounds)
+    {
+        if (handle < 0 || handle >= NUM_SPATIAL_ENTITIES)
+        {
+            return;
+        }
+
+        Entry& entry = entries[handle];
+        if (entry.inserted)
+        {
+            Remove(handle);
+        }
+
+        entry.inserted = true;
+        entry.overflow = false;
+        entry.bounds = bounds;
+        GetCellSpan(bounds, entry.firstCell, entry.lastCell);
+
+        if (freeCount < entry.lastCell - entry.firstCell + 1)
+        {
+            entry.overflow = true;
+            overflowCount++;
+            return;
+        }
+
+        for (int cell = entry.firstCell; cell <= entry.lastCell; cell++)
+        {
+            int node = freeNode;
+            freeNode = nodes[node].next;
+            freeCount--;
+
+            int& head = cells[CellSlot(cell)];
+            nodes[node].handle = handle;
+            nodes[node].next = head;
+            head = node;
+        }
+    }
+
+    void Remove(int handle)
+    {
+        if (handle < 0 || handle >= NUM_SPATIAL_ENTITIES || !entries[handle].inserted)
+        {
+            return;
+        }
+
+        Entry& entry = entries[handle];
+        entry.inserted = false;
+
+        if (entry.overflow)
+        {
+            entry.overflow = false;
+            overflowCount--;
+            return;
+        }
+
+        for (int cell = entry.firstCell; cell <= entry.lastCell; cell++)
+        {
+            int* link = &cells[CellSlot(cell)];
+            while (*link >= 0)
+            {
+                int node = *link;
+                if (nodes[node].handle == handle)
+                {
+                    *link = nodes[node].next;
+                    nodes[node].handle = -1;
+                    nodes[node].next = freeNode;
+                    freeNode = node;
+                    freeCount++;
+                    break;
+                }
+
+                link = &nodes[node].next;
+            }
+        }
+    }
+
+    // Called when an entity moves; only relinks when its cell span changed.
+    void Update(int handle, const SpatialRect& bounds)
+    {
+        if (handle < 0 || handle >= NUM_SPATIAL_ENTITIES || !entries[handle].inserted)
+        {
+            return;
+        }
+
+        Entry& entry = entries[handle];
+        int firstCell, lastCell;
+        GetCellSpan(bounds, firstCell, lastCell);
+        if (entry.overflow || firstCell != entry.firstCell || lastCell != entry.lastCell)
+        {
+            Insert(handle, bounds);
+        }
+        else
+        {
+            entry.bounds = bounds;
+        }
+    }
+
+    // Handles of the entities whose bounds intersect rect, in ascending
+    // handle order. Returns the number of handles written.
+    int Query(const SpatialRect& rect, int* results, int maxResults)
+    {
+        stamp++;
+        int count = 0;
+
+        int firstCell, lastCell;
+        GetCellSpan(rect, firstCell, lastCell);
+        for (int cell = firstCell; cell <= lastCell; cell++)
+        {
+            for (int node = cells[CellSlot(cell)]; node >= 0; node = nodes[node].next)
+            {
+                Collect(nodes[node].handle, rect, results, maxResults, count);
+            }
+        }
+
+        if (overflowCount > 0)
+        {
+            for (int handle = 0; handle < NUM_SPATIAL_ENTITIES; handle++)
+            {
+                if (entries[handle].inserted && entries[handle].overflow)
+                {
+                    Collect(handle, rect, results, maxResults, count);
+                }
+            }
+        }
+
+        // results are tiny, keep them in a stable order for the caller
+        for (int i = 1; i < count; i++)
+        {
+            int handle = results[i];
+            int j = i - 1;
+            while (j >= 0 && results[j] > handle)
+            {
+                results[j + 1] = results[j];
+                j--;
+            }
+            results[j + 1] = handle;
+        }
+
+        return count;
+    }
+
+    int cells[NUM_SPATIAL_CELLS];
+    Node nodes[NUM_SPATIAL_NODES];
+    Entry entries[NUM_SPATIAL_ENTITIES];
+    int freeNode;
+    int freeCount;
+    int overflowCount;
+    int stamp;
+
+private:
+    static int CellX(int x)
+    {
+        return x >= 0 ? x / SPATIAL_CELL_SIZE : -((SPATIAL_CELL_SIZE - 1 - x) / SPATIAL_CELL_SIZE);
+    }
+
+    static int CellSlot(int cell)
+    {
+        return ((cell % NUM_SPATIAL_CELLS) + NUM_SPATIAL_CELLS) % NUM_SPATIAL_CELLS;
+    }
+
+    static void GetCellSpan(const SpatialRect& rect, int& firstCell, int& lastCell)
+    {
+        firstCell = CellX(rect.left);
+        lastCell = CellX(rect.right);
+
+        // wider than the ring, every cell already holds it once
+        if (lastCell - firstCell >= NUM_SPATIAL_CELLS)
+        {
+            lastCell = firstCell + NUM_SPATIAL_CELLS - 1;
+        }
+    }
+
+    void Collect(int handle, const SpatialRect& rect, int* results, int maxResults, int& count)
+    {
+        Entry& entry = entries[handle];
+        if (entry.stamp == stamp || count >= maxResults)
+        {
+            return;
+        }
+
+        entry.stamp = stamp;
+
+        const SpatialRect& bounds = entry.bounds;
+        if (bounds.right < rect.left
+            || bounds.left > rect.right
+            || bounds.bottom < rect.top
+            || bounds.top > rect.bottom)
+        {
+            return;
+        }
+
+        results[count++] = handle;
+    }
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <windows.h>
+#include <stdio.h>
+
+#define NUM_STARTUP_MARKS 16
+
+// Named timestamps taken while the game starts up, reported to the debugger
+// output once the first frame is on screen.
+class StartupTimeline
+{
+public:
+    StartupTimeline() :
+        m_count(0),
+        m_reported(false),
+        m_names(),
+        m_times()
+    {
+        QueryPerformanceFrequency(&m_frequency);
+        QueryPerformanceCounter(&m_start);
+    }
+
+    void Mark(const char* name)
+    {
+        if (m_count >= NUM_STARTUP_MARKS)
+        {
+            return;
+        }
+
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+
+        m_names[m_count] = name;
+        m_times[m_count] = static_cast<float>(now.QuadPart - m_start.QuadPart)
+            / static_cast<float>(m_frequency.QuadPart);
+        m_count++;
+    }
+
+    bool IsReported() const
+    {
+        return m_reported;
+    }
+
+    // Seconds from construction to the last mark.
+    float GetTotal() const
+    {
+        return m_count > 0 ? m_times[m_count - 1] : 0.f;
+    }
+
+    // One line per mark with the time since start and since the previous
+    // mark, then the total as the time to first frame.
+    void Report()
+    {
+        char line[128];
+        float previous = 0.f;
+        for (int index = 0; index < m_count; index++)
+        {
+            snprintf(line, sizeof(line), "startup: %-20s %8.2f ms (+%.2f ms)\n",
+                m_names[index],
+                m_times[index] * 1000.f,
+                (m_times[index] - previous) * 1000.f);
+            OutputDebugStringA(line);
+            previous = m_times[index];
+        }
+
+        snprintf(line, sizeof(line), "startup: time to first frame %.2f ms\n", GetTotal() * 1000.f);
+        OutputDebugStringA(line);
+
+        m_reported = true;
+    }
+
+private:
+    LARGE_INTEGER m_frequency;
+    LARGE_INTEGER m_start;
+    int m_count;
+    bool m_reported;
+    const char* m_names[NUM_STARTUP_MARKS];
+    float m_times[NUM_STARTUP_MARKS];
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "Fixed.h"
+
+// Sort-and-sweep broadphase on x for boxes that move every tick. Boxes are
+// kept sorted by their left edge across ticks; they only move a little per
+// tick, so re-sorting with insertion sort is close to a single pass. Pairs
+// are then found by sweeping the sorted boxes and stopping as soon as the
+// next left edge is past the right edge of the current box. Side-scrolling
+// levels are long and flat, so x alone separates almost everything.
+// Boxes are identified by small integer handles chosen by the caller. The
+// game keeps them in sim numbers, so which pairs it sees is the same on any
+// build.
+template<int Capacity, class Rect = SimRect>
+class SweepAndPrune
+{
+public:
+    typedef decltype(Rect::left) Number;
+
+    struct Entry
+    {
+        Number left;
+        Number right;
+        Number top;
+        Number bottom;
+        int handle;
+    };
+
+    SweepAndPrune()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        for (int handle = 0; handle < Capacity; handle++)
+        {
+            m_positions[handle] = -1;
+        }
+
+        m_count = 0;
+    }
+
+    // Add a box, or move one already there. New boxes go at the end and are
+    // put in place by the next Sort.
+    void Update(int handle, const Rect& bounds)
+    {
+        if (handle < 0 || handle >= Capacity)
+        {
+            return;
+        }
+
+        int position = m_positions[handle];
+        if (position < 0)
+        {
+            position = m_count++;
+            m_positions[handle] = position;
+        }
+
+        Entry& entry = m_entries[position];
+        entry.left = bounds.left;
+        entry.right = bounds.right;
+        entry.top = bounds.top;
+        entry.bottom = bounds.bottom;
+        entry.handle = handle;
+    }
+
+    void Remove(int handle)
+    {
+        if (handle < 0 || handle >= Capacity || m_positions[handle] < 0)
+        {
+            return;
+        }
+
+        // keep the rest sorted
+        m_count--;
+        for (int position = m_positions[handle]; position < m_count; position++)
+        {
+            m_entries[position] = m_entries[position + 1];
+            m_positions[m_entries[position].handle] = position;
+        }
+
+        m_positions[handle] = -1;
+    }
+
+    // Insertion sort by left edge, ties by handle so the order is the same
+    // however the boxes got there.
+    void Sort()
+    {
+        for (int position = 1; position < m_count; position++)
+        {
+            Entry entry = m_entries[position];
+            int target = position;
+            while (target > 0 && Before(entry, m_entries[target - 1]))
+            {
+                m_entries[target] = m_entries[target - 1];
+                m_positions[m_entries[target].handle] = target;
+                target--;
+            }
+
+            if (target != position)
+            {
+                m_entries[target] = entry;
+                m_positions[entry.handle] = target;
+            }
+        }
+    }
+
+    // Call pairCallback(handleA, handleB) for every pair of overlapping boxes,
+    // handleA being the one further left. Boxes only touching do not overlap.
+    // The boxes must be sorted.
+    template<class PairCallback>
+    void ForEachPair(PairCallback pairCallback) const
+    {
+        for (int first = 0; first < m_count; first++)
+        {
+            const Entry& a = m_entries[first];
+            for (int second = first + 1; second < m_count && m_entries[second].left < a.right; second++)
+            {
+                const Entry& b = m_entries[second];
+                if (a.top < b.bottom && b.top < a.bottom)
+                {
+                    pairCallback(a.handle, b.handle);
+                }
+            }
+        }
+    }
+
+    int Count() const
+    {
+        return m_count;
+    }
+
+private:
+    static bool Before(const Entry& a, const Entry& b)
+    {
+        return a.left < b.left || (a.left == b.left && a.handle < b.handle);
+    }
+
+    int m_count;
+    int m_positions[Capacity];
+    Entry m_entries[Capacity];
+};
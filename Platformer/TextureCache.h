@@ -0,0 +1,263 @@
+#pragma once
+#include <windows.h>
+#include <stdlib.h>
+
+#include <d2d1.h>
+
+#include "Image.h"
+#include "AssetLoader.h"
+
+// Device bitmaps and brushes of the level texture slots, one pair per palette
+// a slot is drawn with. They die with the render target, but the pixels they
+// were made from stay in the asset loader, so after a device loss Restore
+// rebuilds every pair that was in use in one pass, before anything is drawn,
+// instead of leaving brushes to be made from bitmaps of the old device.
+
+struct TextureCacheStats
+{
+    // what the last restore rebuilt, out of what was in use
+    int restoredBitmaps;
+    int usedBitmaps;
+};
+
+template<int SlotCount>
+class TextureCache
+{
+public:
+    TextureCache() :
+        stats(),
+        m_resources(),
+        m_missing(),
+        m_used(),
+        m_pBitmaps(),
+        m_pBrushes()
+    {
+    }
+
+    ~TextureCache()
+    {
+        for (int slot = 0; slot < SlotCount; slot++)
+        {
+            ReleaseSlot(slot);
+        }
+    }
+
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    // Bind a texture resource to a slot, 0 for none. Whatever the slot held
+    // is released and no longer restored.
+    void Bind(int slot, int resourceId)
+    {
+        if (slot < 0 || slot >= SlotCount)
+        {
+            return;
+        }
+
+        ReleaseSlot(slot);
+        for (bool& used : m_used[slot])
+        {
+            used = false;
+        }
+
+        m_resources[slot] = resourceId;
+        m_missing[slot] = false;
+    }
+
+    // Resource bound to a slot, 0 for none, whether or not it loaded.
+    int GetResource(int slot) const
+    {
+        return slot >= 0 && slot < SlotCount ? m_resources[slot] : 0;
+    }
+
+    // Brush for a slot drawn with a palette, its bitmap created from the
+    // loader's pixels on first use. NULL when nothing usable is bound.
+    ID2D1BitmapBrush* GetBrush(ID2D1RenderTarget* pTarget, AssetLoader& loader, int slot, Palette::Type palette)
+    {
+        if (slot < 0 || slot >= SlotCount
+            || palette >= Palette::COUNT
+            || !pTarget)
+        {
+            return NULL;
+        }
+
+        if (!m_pBrushes[slot][palette])
+        {
+            Create(pTarget, loader, slot, palette);
+        }
+
+        return m_pBrushes[slot][palette];
+    }
+
+    // The device is gone. Every bitmap and brush is released, the ones that
+    // were in use are remembered for Restore.
+    void OnDeviceLost()
+    {
+        for (int slot = 0; slot < SlotCount; slot++)
+        {
+            ReleaseSlot(slot);
+        }
+    }
+
+    // Rebuild everything that was in use on the new target. Returns the
+    // number of bitmaps rebuilt; ones that fail are tried again on first use.
+    int Restore(ID2D1RenderTarget* pTarget, AssetLoader& loader)
+    {
+        int restored = 0;
+        int used = 0;
+        for (int slot = 0; slot < SlotCount; slot++)
+        {
+            for (int palette = 0; palette < Palette::COUNT; palette++)
+            {
+                if (!m_used[slot][palette])
+                {
+                    continue;
+                }
+
+                used++;
+                if (m_pBrushes[slot][palette]
+                    || Create(pTarget, loader, slot, static_cast<Palette::Type>(palette)))
+                {
+                    restored++;
+                }
+            }
+        }
+
+        stats.restoredBitmaps = restored;
+        stats.usedBitmaps = used;
+        return restored;
+    }
+
+    // Bytes of every bitmap on the device, and how many there are.
+    int GetDeviceBytes(int* pBitmapCount = NULL) const
+    {
+        int bytes = 0;
+        int count = 0;
+        for (int slot = 0; slot < SlotCount; slot++)
+        {
+            for (ID2D1Bitmap* pBitmap : m_pBitmaps[slot])
+            {
+                if (pBitmap)
+                {
+                    D2D1_SIZE_U size = pBitmap->GetPixelSize();
+                    bytes += size.width * size.height * sizeof(UINT);
+                    count++;
+                }
+            }
+        }
+
+        if (pBitmapCount)
+        {
+            *pBitmapCount = count;
+        }
+
+        return bytes;
+    }
+
+    TextureCacheStats stats;
+
+private:
+    template<class Interface>
+    static void Release(Interface*& pInterface)
+    {
+        if (pInterface)
+        {
+            pInterface->Release();
+            pInterface = NULL;
+        }
+    }
+
+    void ReleaseSlot(int slot)
+    {
+        for (int palette = 0; palette < Palette::COUNT; palette++)
+        {
+            Release(m_pBrushes[slot][palette]);
+            Release(m_pBitmaps[slot][palette]);
+        }
+    }
+
+    bool Create(ID2D1RenderTarget* pTarget, AssetLoader& loader, int slot, Palette::Type palette)
+    {
+        if (m_resources[slot] == 0 || m_missing[slot])
+        {
+            return false;
+        }
+
+        ID2D1Bitmap*& pBitmap = m_pBitmaps[slot][palette];
+        if (!pBitmap)
+        {
+            const DecodedImage* pImage = loader.Acquire(m_resources[slot]);
+            if (!pImage)
+            {
+                // the load failed, don't wait on it again every frame
+                m_missing[slot] = true;
+                return false;
+            }
+
+            if (!CreateBitmap(pTarget, *pImage, palette, &pBitmap))
+            {
+                return false;
+            }
+        }
+
+        ID2D1BitmapBrush*& pBrush = m_pBrushes[slot][palette];
+        if (FAILED(pTarget->CreateBitmapBrush(pBitmap, &pBrush)))
+        {
+            return false;
+        }
+
+        pBrush->SetExtendModeX(D2D1_EXTEND_MODE_WRAP);
+        pBrush->SetExtendModeY(D2D1_EXTEND_MODE_WRAP);
+        m_used[slot][palette] = true;
+        return true;
+    }
+
+    // Device bitmaps are always BGRA, indexed and recolored images are
+    // expanded right before the upload.
+    static bool CreateBitmap(ID2D1RenderTarget* pTarget, const DecodedImage& image, Palette::Type palette, ID2D1Bitmap** pBitmap)
+    {
+        if (image.pixels == NULL)
+        {
+            return false;
+        }
+
+        const BYTE* pixels = image.pixels;
+        UINT stride = image.stride;
+        UINT* pExpanded = NULL;
+        if (image.palette || palette != Palette::BASE)
+        {
+            pExpanded = static_cast<UINT*>(malloc(image.width * image.height * sizeof(UINT)));
+            if (pExpanded == NULL)
+            {
+                return false;
+            }
+
+            ExpandImage(image, palette, pExpanded);
+            pixels = reinterpret_cast<const BYTE*>(pExpanded);
+            stride = image.width * sizeof(UINT);
+        }
+
+        HRESULT hr = pTarget->CreateBitmap(
+            D2D1::SizeU(image.width, image.height),
+            pixels,
+            stride,
+            D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)),
+            pBitmap);
+
+        free(pExpanded);
+
+        return SUCCEEDED(hr);
+    }
+
+    // resource bound to each slot, 0 when empty
+    int m_resources[SlotCount];
+
+    // slots whose resource failed to load
+    bool m_missing[SlotCount];
+
+    // pairs drawn since the slot was bound, rebuilt by Restore
+    bool m_used[SlotCount][Palette::COUNT];
+
+    ID2D1Bitmap* m_pBitmaps[SlotCount][Palette::COUNT];
+    ID2D1BitmapBrush* m_pBrushes[SlotCount][Palette::COUNT];
+};
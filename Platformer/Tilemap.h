@@ -0,0 +1,348 @@
+#pragma once
+#include <math.h>
+
+#include <d2d1.h>
+
+#include "resource.h"
+#include "CookedTexture.h"
+#include "Fixed.h"
+
+#define TILE_SIZE 10
+
+#define TILE_CHUNK_WIDTH 16
+#define TILE_CHUNK_HEIGHT 16
+#define TILE_CHUNK_PIXEL_WIDTH (TILE_CHUNK_WIDTH * TILE_SIZE)
+#define TILE_CHUNK_PIXEL_HEIGHT (TILE_CHUNK_HEIGHT * TILE_SIZE)
+
+// Chunks are indexed directly by their x position in the level, so this
+// bounds the level width (64 chunks = 10240 px).
+#define NUM_TILE_CHUNKS 64
+#define NUM_TILE_BUMPS 4
+#define TILE_BUMP_TIME 0.2f
+#define TILE_BUMP_SIZE -5.f
+
+#define TILE_NO_TEXTURE 0xFF
+
+struct Tile
+{
+    enum Flags
+    {
+        NONE      = 0x0,
+        SOLID     = 0x1,
+        BREAKABLE = 0x2,
+        COIN      = 0x4,
+        // drawn every frame instead of from the chunk cache
+        ANIMATED  = 0x8,
+        BUMPING   = 0x10,
+    };
+
+    bool IsEmpty() const
+    {
+        return textureId == TILE_NO_TEXTURE;
+    }
+
+    bool IsLive() const
+    {
+        return (flags & (ANIMATED | BUMPING)) != 0;
+    }
+
+    unsigned char textureId;
+    unsigned char flags;
+
+    // SpriteFrame::Type
+    unsigned char frame;
+};
+
+struct TileChunk
+{
+    Tile tiles[TILE_CHUNK_HEIGHT][TILE_CHUNK_WIDTH];
+
+    // incremented whenever the pre-composited bitmap of this chunk goes stale
+    int version;
+
+    // number of tiles that are drawn live rather than from the cache
+    int liveCount;
+};
+
+struct TileBump
+{
+    bool active;
+    int tileX;
+    int tileY;
+    float animTime;
+    float animYOffset;
+};
+
+class Tilemap
+{
+public:
+    void Clear()
+    {
+        for (TileChunk& chunk : chunks)
+        {
+            for (auto& row : chunk.tiles)
+            {
+                for (Tile& tile : row)
+                {
+                    tile.textureId = TILE_NO_TEXTURE;
+                    tile.flags = Tile::NONE;
+                    tile.frame = SpriteFrame::IDLE;
+                }
+            }
+
+            chunk.liveCount = 0;
+            chunk.version++;
+        }
+
+        for (TileBump& bump : bumps)
+        {
+            bump.active = false;
+        }
+
+        animTime = 0.f;
+    }
+
+    static bool InBounds(int tileX, int tileY)
+    {
+        return tileX >= 0
+            && tileX < NUM_TILE_CHUNKS * TILE_CHUNK_WIDTH
+            && tileY >= 0
+            && tileY < TILE_CHUNK_HEIGHT;
+    }
+
+    const Tile* GetTile(int tileX, int tileY) const
+    {
+        if (!InBounds(tileX, tileY))
+        {
+            return nullptr;
+        }
+
+        return &chunks[tileX / TILE_CHUNK_WIDTH].tiles[tileY][tileX % TILE_CHUNK_WIDTH];
+    }
+
+    Tile* GetTile(int tileX, int tileY)
+    {
+        return const_cast<Tile*>(static_cast<const Tilemap*>(this)->GetTile(tileX, tileY));
+    }
+
+    bool IsSolid(int tileX, int tileY) const
+    {
+        const Tile* tile = GetTile(tileX, tileY);
+        return tile && (tile->flags & Tile::SOLID);
+    }
+
+    static D2D1_RECT_F GetTileRectF(int tileX, int tileY)
+    {
+        return D2D1::RectF(
+            static_cast<float>(tileX * TILE_SIZE),
+            static_cast<float>(tileY * TILE_SIZE),
+            static_cast<float>((tileX + 1) * TILE_SIZE),
+            static_cast<float>((tileY + 1) * TILE_SIZE));
+    }
+
+    // The same in simulation units.
+    static SimRect GetTileRect(int tileX, int tileY)
+    {
+        return MakeSimRect(
+            static_cast<Scalar>(tileX * TILE_SIZE),
+            static_cast<Scalar>(tileY * TILE_SIZE),
+            static_cast<Scalar>((tileX + 1) * TILE_SIZE),
+            static_cast<Scalar>((tileY + 1) * TILE_SIZE));
+    }
+
+    // Inclusive range of tiles overlapped by rect. Touching edges do not count
+    // as overlap, matching Intersect.
+    template<class Rect>
+    static void GetTileRange(const Rect& rect, int& left, int& top, int& right, int& bottom)
+    {
+        left = FloorDiv(rect.left, TILE_SIZE);
+        top = FloorDiv(rect.top, TILE_SIZE);
+        right = CeilDiv(rect.right, TILE_SIZE) - 1;
+        bottom = CeilDiv(rect.bottom, TILE_SIZE) - 1;
+    }
+
+    template<class Rect>
+    bool AnySolid(const Rect& rect) const
+    {
+        int left, top, right, bottom;
+        GetTileRange(rect, left, top, right, bottom);
+        for (int tileY = top; tileY <= bottom; tileY++)
+        {
+            for (int tileX = left; tileX <= right; tileX++)
+            {
+                if (IsSolid(tileX, tileY))
+                {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    // Fill the tiles covered by a level rect. Coordinates are in pixels and
+    // snapped to the tile grid.
+    void Fill(float left, float top, float right, float bottom, int textureId, int type)
+    {
+        int tileLeft, tileTop, tileRight, tileBottom;
+        GetTileRange(D2D1::RectF(left, top, right, bottom), tileLeft, tileTop, tileRight, tileBottom);
+
+        unsigned char flags = Tile::SOLID;
+        if (type == BLOCK_TYPE_BREAKABLE)
+        {
+            flags |= Tile::BREAKABLE;
+        }
+        else if (type == BLOCK_TYPE_COIN)
+        {
+            flags |= Tile::COIN | Tile::ANIMATED;
+        }
+
+        for (int tileY = tileTop; tileY <= tileBottom; tileY++)
+        {
+            for (int tileX = tileLeft; tileX <= tileRight; tileX++)
+            {
+                Tile* tile = GetTile(tileX, tileY);
+                if (!tile)
+                {
+                    continue;
+                }
+
+                SetTile(tileX, tileY, static_cast<unsigned char>(textureId), flags, SpriteFrame::IDLE);
+            }
+        }
+    }
+
+    // Hit from below. A coin tile gives its coin and a breakable tile is
+    // cleared. Returns Tile::COIN or Tile::BREAKABLE for what happened, or
+    // Tile::NONE.
+    unsigned char Bump(int tileX, int tileY)
+    {
+        Tile* tile = GetTile(tileX, tileY);
+        if (tile && (tile->flags & Tile::BREAKABLE))
+        {
+            SetTile(tileX, tileY, TILE_NO_TEXTURE, Tile::NONE, SpriteFrame::IDLE);
+            return Tile::BREAKABLE;
+        }
+
+        if (!tile || !(tile->flags & Tile::COIN))
+        {
+            return Tile::NONE;
+        }
+
+        TileBump* freeBump = nullptr;
+        for (TileBump& bump : bumps)
+        {
+            if (!bump.active)
+            {
+                freeBump = &bump;
+                break;
+            }
+        }
+
+        unsigned char flags = tile->flags & ~(Tile::COIN | Tile::ANIMATED);
+        if (freeBump)
+        {
+            freeBump->active = true;
+            freeBump->tileX = tileX;
+            freeBump->tileY = tileY;
+            freeBump->animTime = 0.f;
+            freeBump->animYOffset = 0.f;
+            flags |= Tile::BUMPING;
+        }
+
+        SetTile(tileX, tileY, tile->textureId, flags, SpriteFrame::SPENT);
+        return Tile::COIN;
+    }
+
+    float GetBumpOffset(int tileX, int tileY) const
+    {
+        for (const TileBump& bump : bumps)
+        {
+            if (bump.active && bump.tileX == tileX && bump.tileY == tileY)
+            {
+                return bump.animYOffset;
+            }
+        }
+
+        return 0.f;
+    }
+
+    // Frame shared by every animated question tile.
+    unsigned char GetQuestionFrame() const
+    {
+        const static float questionCycleRate = 2.5f;
+        return static_cast<unsigned char>(SpriteFrame::CYCLE_1 + static_cast<int>(animTime * questionCycleRate) % 3);
+    }
+
+    // Offset of a bump animTime seconds in, up and back down over
+    // TILE_BUMP_TIME.
+    static float GetBumpYOffset(float animTime)
+    {
+        if (animTime < TILE_BUMP_TIME / 2.f)
+        {
+            return animTime * (TILE_BUMP_SIZE / (TILE_BUMP_TIME / 2.f));
+        }
+
+        return (TILE_BUMP_TIME - animTime) * (TILE_BUMP_SIZE / (TILE_BUMP_TIME / 2.f));
+    }
+
+    void TickAnim(float delta)
+    {
+        animTime += delta;
+        // keep the question cycle phase when wrapping
+        while (animTime > 120.f)
+        {
+            animTime -= 120.f;
+        }
+
+        for (TileBump& bump : bumps)
+        {
+            if (!bump.active)
+            {
+                continue;
+            }
+
+            bump.animTime += delta;
+            if (bump.animTime < TILE_BUMP_TIME)
+            {
+                bump.animYOffset = GetBumpYOffset(bump.animTime);
+            }
+            else
+            {
+                bump.active = false;
+                Tile* tile = GetTile(bump.tileX, bump.tileY);
+                if (tile)
+                {
+                    SetTile(bump.tileX, bump.tileY, tile->textureId, tile->flags & ~Tile::BUMPING, tile->frame);
+                }
+            }
+        }
+    }
+
+    TileChunk chunks[NUM_TILE_CHUNKS];
+    TileBump bumps[NUM_TILE_BUMPS];
+    float animTime;
+
+private:
+    void SetTile(int tileX, int tileY, unsigned char textureId, unsigned char flags, unsigned char frame)
+    {
+        TileChunk& chunk = chunks[tileX / TILE_CHUNK_WIDTH];
+        Tile& tile = chunk.tiles[tileY][tileX % TILE_CHUNK_WIDTH];
+
+        if (tile.IsLive())
+        {
+            chunk.liveCount--;
+        }
+
+        tile.textureId = textureId;
+        tile.flags = flags;
+        tile.frame = frame;
+
+        if (tile.IsLive())
+        {
+            chunk.liveCount++;
+        }
+
+        chunk.version++;
+    }
+};
@@ -7,6 +7,17 @@
 #define BLOCK_TYPE_BREAKABLE                 0x1
 #define BLOCK_TYPE_COIN                      0x2
 
+// Palette of an enemy, or'd into the type of its ENEMY level record
+#define ENEMY_PALETTE_SHIFT                  8
+#define ENEMY_PALETTE_BASE                   0x000
+#define ENEMY_PALETTE_SWAP_RED_BLUE          0x100
+#define ENEMY_PALETTE_SWAP_RED_GREEN         0x200
+#define ENEMY_PALETTE_GRAY                   0x300
+
+// Flags of an ARCHETYPE level record
+#define ENEMY_TURNS_AT_LEDGES                0x1
+#define ENEMY_STOMPABLE                      0x2
+
 #define LEVEL_OFFSET                    1000
 #define LEVEL_RES_NAME L"LEVEL"
 #define TO_LEVEL_RES(levelId) (levelId + LEVEL_OFFSET)
@@ -17,6 +28,7 @@
 #define TEXTURE_QUESTION                2003
 #define TEXTURE_PLAYER                  2004
 #define TEXTURE_CAT                     2005
+#define TEXTURE_LAST                    TEXTURE_CAT
 
 // Next default values for new objects
 // 